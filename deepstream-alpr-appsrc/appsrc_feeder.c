@@ -0,0 +1,387 @@
+/*
+ * Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <gst/app/gstappsrc.h>
+#include "appsrc_feeder.h"
+
+/* Decimation never goes below 1 / APPSRC_LIVE_MAX_STRIDE of the frames */
+#define APPSRC_LIVE_MAX_STRIDE 8
+
+struct _AppSrcFeeder
+{
+  GstElement *app_source;
+  AppSrcIo *io;
+  guint fps;
+
+  GstBuffer **ring;             /* Frames read ahead, oldest at head */
+  gint64 *captured;             /* Capture time of every ring frame, in us */
+  guint depth;
+  guint head;
+  guint count;
+  gboolean wanted;              /* appsrc asked for data */
+  gboolean eos;                 /* The reader is done, at EOF or on an error */
+  gboolean stop;
+  GMutex lock;
+  GCond cond;
+
+  GThread *reader;
+  GThread *pusher;
+  AppSrcFeederStats stats;
+
+  gboolean live;
+  AppSrcLiveConfig live_config;
+  gboolean pace;                /* Read at fps, like a camera delivers */
+  guint stride;                 /* Decimate: push every stride-th frame */
+  guint64 taken;                /* Frames taken from the ring */
+  GstClockTime push_age;        /* Capture to push, smoothed */
+  GstClockTime push_queue;      /* Wait behind the frames in appsrc at push, smoothed */
+  GstClockTime push_interval;   /* Between pushes, smoothed */
+  gsize frame_bytes;            /* Of the last frame pushed */
+  gint64 last_push;
+  gint64 last_log;
+  guint64 logged_drops;
+};
+
+static const gchar *live_policy_names[] = { "drop", "decimate", "latest" };
+
+gboolean
+appsrc_live_policy_from_string (const gchar * name, AppSrcLivePolicy * policy)
+{
+  for (guint i = 0; i < G_N_ELEMENTS (live_policy_names); i++) {
+    if (!g_strcmp0 (name, live_policy_names[i])) {
+      *policy = (AppSrcLivePolicy) i;
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+static GstClockTime
+smooth (GstClockTime average, GstClockTime sample)
+{
+  return average ? (7 * average + sample) / 8 : sample;
+}
+
+/* Drop the oldest frame of the ring, with the lock held */
+static void
+ring_drop_head (AppSrcFeeder * feeder)
+{
+  gst_buffer_unref (feeder->ring[feeder->head]);
+  feeder->head = (feeder->head + 1) % feeder->depth;
+  feeder->count--;
+}
+
+/* Running time of the pipeline at the capture time, NONE before PLAYING */
+static GstClockTime
+capture_running_time (AppSrcFeeder * feeder, gint64 captured)
+{
+  GstClock *clock = gst_element_get_clock (feeder->app_source);
+  GstClockTime running = GST_CLOCK_TIME_NONE;
+
+  if (clock) {
+    GstClockTime now = gst_clock_get_time (clock);
+    GstClockTime base = gst_element_get_base_time (feeder->app_source);
+    GstClockTime age = (g_get_monotonic_time () - captured) * GST_USECOND;
+    running = now > base + age ? now - base - age : 0;
+    gst_object_unref (clock);
+  }
+  return running;
+}
+
+/* Print the drops now and then, with the lock held */
+static void
+live_log (AppSrcFeeder * feeder, gint64 now)
+{
+  AppSrcFeederStats *stats = &feeder->stats;
+  guint64 drops = stats->dropped_late + stats->dropped_full +
+      stats->dropped_skipped;
+
+  if (drops == feeder->logged_drops || now - feeder->last_log < G_USEC_PER_SEC)
+    return;
+  g_print ("%s: dropped %lu late, %lu on a full ring, %lu skipped frames, "
+      "latency %.1f ms, pushing 1/%u\n", GST_ELEMENT_NAME (feeder->app_source),
+      (unsigned long) stats->dropped_late, (unsigned long) stats->dropped_full,
+      (unsigned long) stats->dropped_skipped, stats->latency / 1e6,
+      feeder->stride);
+  feeder->logged_drops = drops;
+  feeder->last_log = now;
+}
+
+/* Live: FALSE when the frame captured at captured should not be pushed.
+ * With the lock held. */
+static gboolean
+live_admit (AppSrcFeeder * feeder, gint64 captured)
+{
+  gint64 now = g_get_monotonic_time ();
+  GstClockTime age = (now - captured) * GST_USECOND;
+  GstClockTime budget = feeder->live_config.budget;
+  /* The frames already queued in appsrc enter the pipeline first, one per
+   * push interval: up to two frames more for a frame pushed behind a full
+   * queue, which matters to budgets of a few frames */
+  guint64 queued = feeder->frame_bytes ?
+      gst_app_src_get_current_level_bytes ((GstAppSrc *) feeder->app_source) /
+      feeder->frame_bytes : 0;
+  GstClockTime interval = feeder->push_interval ? feeder->push_interval :
+      feeder->fps ? GST_SECOND / feeder->fps : 0;
+  GstClockTime queue_wait = queued * interval;
+  /* The part of the latency after the appsrc queue, from the frames that
+   * made it */
+  GstClockTime spent = feeder->push_age + feeder->push_queue;
+  GstClockTime downstream = feeder->stats.latency > spent ?
+      feeder->stats.latency - spent : 0;
+  gboolean late = age + queue_wait + downstream > budget;
+  gboolean admit = TRUE;
+
+  if (feeder->live_config.policy == APPSRC_LIVE_DECIMATE) {
+    if (late)
+      feeder->stride = MIN (feeder->stride + 1, APPSRC_LIVE_MAX_STRIDE);
+    else if (age + queue_wait + downstream < budget / 2 && feeder->stride > 1)
+      feeder->stride--;
+    if (feeder->taken % feeder->stride) {
+      feeder->stats.dropped_skipped++;
+      admit = FALSE;
+    }
+  }
+  feeder->taken++;
+
+  /* One frame per budget gets through regardless, so the downstream
+   * latency keeps being measured while everything else is late */
+  if (admit && late && now - feeder->last_push < (gint64) (budget / GST_USECOND)) {
+    feeder->stats.dropped_late++;
+    admit = FALSE;
+  }
+  if (admit) {
+    feeder->push_age = smooth (feeder->push_age, age);
+    feeder->push_queue = smooth (feeder->push_queue, queue_wait);
+    if (feeder->last_push)
+      feeder->push_interval = smooth (feeder->push_interval,
+          (now - feeder->last_push) * GST_USECOND);
+    feeder->last_push = now;
+  }
+  live_log (feeder, now);
+  return admit;
+}
+
+static gpointer
+feeder_read (gpointer data)
+{
+  AppSrcFeeder *feeder = (AppSrcFeeder *) data;
+
+  gint64 next_capture = g_get_monotonic_time ();
+
+  for (;;) {
+    GstBuffer *buffer;
+    gboolean failed = FALSE;
+
+    /* A camera does not wait for the pipeline */
+    if (feeder->pace) {
+      gint64 now = g_get_monotonic_time ();
+      if (now < next_capture)
+        g_usleep (next_capture - now);
+      next_capture = MAX (next_capture, now - G_USEC_PER_SEC / feeder->fps) +
+          G_USEC_PER_SEC / feeder->fps;
+    }
+
+    g_mutex_lock (&feeder->lock);
+    while (!feeder->live && feeder->count == feeder->depth && !feeder->stop)
+      g_cond_wait (&feeder->cond, &feeder->lock);
+    if (feeder->stop) {
+      g_mutex_unlock (&feeder->lock);
+      break;
+    }
+    g_mutex_unlock (&feeder->lock);
+
+    /* May block on the disk or on the io pool, the ring keeps the pusher busy */
+    buffer = appsrc_io_next_frame (feeder->io, &failed);
+    if (failed)
+      g_printerr ("\n failed to read from file\n");
+
+    g_mutex_lock (&feeder->lock);
+    if (buffer) {
+      /* Live, the oldest frame makes room for the new one */
+      if (feeder->count == feeder->depth) {
+        ring_drop_head (feeder);
+        feeder->stats.dropped_full++;
+      }
+      feeder->ring[(feeder->head + feeder->count) % feeder->depth] = buffer;
+      feeder->captured[(feeder->head + feeder->count) % feeder->depth] =
+          g_get_monotonic_time ();
+      feeder->count++;
+    } else {
+      feeder->eos = TRUE;
+    }
+    g_cond_broadcast (&feeder->cond);
+    g_mutex_unlock (&feeder->lock);
+    if (!buffer)
+      break;
+  }
+  return NULL;
+}
+
+static gpointer
+feeder_push (gpointer data)
+{
+  AppSrcFeeder *feeder = (AppSrcFeeder *) data;
+  GstFlowReturn gstret;
+
+  for (;;) {
+    GstBuffer *buffer;
+    gboolean stalled = FALSE;
+
+    gint64 captured;
+
+    g_mutex_lock (&feeder->lock);
+    while (!feeder->stop &&
+        !(feeder->wanted && (feeder->count || feeder->eos))) {
+      if (feeder->wanted && !stalled) {
+        feeder->stats.underruns++;
+        stalled = TRUE;
+      }
+      g_cond_wait (&feeder->cond, &feeder->lock);
+    }
+    if (feeder->stop || !feeder->count) {
+      gboolean at_eos = !feeder->stop;
+      g_mutex_unlock (&feeder->lock);
+      if (at_eos) {
+        gstret = gst_app_src_end_of_stream ((GstAppSrc *) feeder->app_source);
+        if (gstret != GST_FLOW_OK)
+          g_print ("gst_app_src_end_of_stream returned %d. EoS not queued successfully.\n",
+              gstret);
+      }
+      break;
+    }
+    if (feeder->live && feeder->live_config.policy == APPSRC_LIVE_LATEST) {
+      while (feeder->count > 1) {
+        ring_drop_head (feeder);
+        feeder->stats.dropped_skipped++;
+      }
+    }
+    buffer = feeder->ring[feeder->head];
+    captured = feeder->captured[feeder->head];
+    feeder->head = (feeder->head + 1) % feeder->depth;
+    feeder->count--;
+    g_cond_broadcast (&feeder->cond);
+    if (feeder->live && !live_admit (feeder, captured)) {
+      g_mutex_unlock (&feeder->lock);
+      gst_buffer_unref (buffer);
+      continue;
+    }
+    g_mutex_unlock (&feeder->lock);
+
+    GST_BUFFER_PTS (buffer) = GST_CLOCK_TIME_NONE;
+    if (feeder->live)
+      GST_BUFFER_PTS (buffer) = capture_running_time (feeder, captured);
+    if (feeder->fps && !GST_CLOCK_TIME_IS_VALID (GST_BUFFER_PTS (buffer)))
+      GST_BUFFER_PTS (buffer) =
+          gst_util_uint64_scale (feeder->stats.pushed, GST_SECOND, feeder->fps);
+    gsize frame_bytes = gst_buffer_get_size (buffer);
+    gstret = gst_app_src_push_buffer ((GstAppSrc *) feeder->app_source, buffer);
+    if (gstret != GST_FLOW_OK) {
+      g_print ("gst_app_src_push_buffer returned %d \n", gstret);
+      break;
+    }
+    g_mutex_lock (&feeder->lock);
+    feeder->frame_bytes = frame_bytes;
+    feeder->stats.pushed++;
+    g_mutex_unlock (&feeder->lock);
+  }
+  return NULL;
+}
+
+AppSrcFeeder *
+appsrc_feeder_new (GstElement * app_source, AppSrcIo * io, guint depth,
+    guint fps, const AppSrcLiveConfig * live)
+{
+  AppSrcFeeder *feeder = g_new0 (AppSrcFeeder, 1);
+
+  /* The pipeline may be freed before the feeder, the threads keep using it */
+  feeder->app_source = gst_object_ref (app_source);
+  feeder->io = io;
+  feeder->fps = fps;
+  feeder->depth = MAX (depth, 1);
+  feeder->ring = g_new0 (GstBuffer *, feeder->depth);
+  feeder->captured = g_new0 (gint64, feeder->depth);
+  feeder->stride = 1;
+  if (live) {
+    feeder->live = TRUE;
+    feeder->live_config = *live;
+    /* A capture process paces itself, a file is read at the frame rate */
+    feeder->pace = fps > 0 && appsrc_io_get_type (io) != APPSRC_IO_SHM;
+  }
+  g_mutex_init (&feeder->lock);
+  g_cond_init (&feeder->cond);
+
+  feeder->reader = g_thread_new ("appsrc-reader", feeder_read, feeder);
+  feeder->pusher = g_thread_new ("appsrc-pusher", feeder_push, feeder);
+  return feeder;
+}
+
+void
+appsrc_feeder_set_wanted (AppSrcFeeder * feeder, gboolean wanted)
+{
+  g_mutex_lock (&feeder->lock);
+  feeder->wanted = wanted;
+  g_cond_broadcast (&feeder->cond);
+  g_mutex_unlock (&feeder->lock);
+}
+
+void
+appsrc_feeder_report_latency (AppSrcFeeder * feeder, GstClockTime pts,
+    GstClockTime now)
+{
+  if (!feeder->live || !GST_CLOCK_TIME_IS_VALID (pts) || now < pts)
+    return;
+  g_mutex_lock (&feeder->lock);
+  feeder->stats.latency = smooth (feeder->stats.latency, now - pts);
+  g_mutex_unlock (&feeder->lock);
+}
+
+void
+appsrc_feeder_get_stats (AppSrcFeeder * feeder, AppSrcFeederStats * stats)
+{
+  g_mutex_lock (&feeder->lock);
+  *stats = feeder->stats;
+  g_mutex_unlock (&feeder->lock);
+}
+
+void
+appsrc_feeder_free (AppSrcFeeder * feeder)
+{
+  g_mutex_lock (&feeder->lock);
+  feeder->stop = TRUE;
+  g_cond_broadcast (&feeder->cond);
+  g_mutex_unlock (&feeder->lock);
+
+  /* The reader may be waiting for an idle producer */
+  appsrc_io_stop (feeder->io);
+  g_thread_join (feeder->reader);
+  g_thread_join (feeder->pusher);
+
+  while (feeder->count)
+    ring_drop_head (feeder);
+  g_free (feeder->ring);
+  g_free (feeder->captured);
+  g_mutex_clear (&feeder->lock);
+  g_cond_clear (&feeder->cond);
+  gst_object_unref (feeder->app_source);
+  g_free (feeder);
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* Threaded appsrc feeding.
+ *
+ * A reader thread reads frames ahead from an AppSrcIo into a bounded ring, a
+ * pusher thread moves them into appsrc while appsrc wants data. The appsrc
+ * need-data / enough-data signals only toggle the wanted flag, so neither
+ * disk stalls nor pushing ever run on the GLib main loop.
+ *
+ * In live mode every frame is stamped with its capture time and gets the
+ * running time of that instant as PTS. Frames are read at the source rate
+ * like a camera delivers them (a shm producer sets its own pace), a full
+ * ring drops its oldest frame instead of holding up the capture, and frames
+ * that would reach the results later than the latency budget, judging from
+ * their age, the appsrc queue level and the measured downstream latency,
+ * are dropped before appsrc according to the policy.
+ */
+
+#ifndef __APPSRC_FEEDER_H__
+#define __APPSRC_FEEDER_H__
+
+#include <gst/gst.h>
+#include "appsrc_io.h"
+
+typedef enum
+{
+  APPSRC_LIVE_DROP,             /* Drop every frame that would be late */
+  APPSRC_LIVE_DECIMATE,         /* Also push only every n-th frame while late */
+  APPSRC_LIVE_LATEST            /* Skip to the newest frame read ahead */
+} AppSrcLivePolicy;
+
+typedef struct _AppSrcLiveConfig
+{
+  GstClockTime budget;          /* Capture to results latency */
+  AppSrcLivePolicy policy;
+} AppSrcLiveConfig;
+
+typedef struct _AppSrcFeederStats
+{
+  guint64 pushed;
+  guint64 underruns;            /* appsrc wanted data while the ring was empty */
+  guint64 dropped_late;         /* Live: would have exceeded the budget */
+  guint64 dropped_full;         /* Live: the ring was full */
+  guint64 dropped_skipped;      /* Live: decimated or skipped for a newer one */
+  GstClockTime latency;         /* Live: capture to results, smoothed */
+} AppSrcFeederStats;
+
+typedef struct _AppSrcFeeder AppSrcFeeder;
+
+/* Policy of a config name ("drop", "decimate", "latest") */
+gboolean appsrc_live_policy_from_string (const gchar * name,
+    AppSrcLivePolicy * policy);
+
+/* Feed app_source from io with up to depth frames read ahead. Buffers get
+ * PTS frame / fps, or none when fps is 0. live, when not NULL, enables live
+ * mode. app_source is referenced until the feeder is freed. The threads
+ * start right away, pushing waits for wanted. */
+AppSrcFeeder *appsrc_feeder_new (GstElement * app_source, AppSrcIo * io,
+    guint depth, guint fps, const AppSrcLiveConfig * live);
+
+/* need-data (TRUE) / enough-data (FALSE) */
+void appsrc_feeder_set_wanted (AppSrcFeeder * feeder, gboolean wanted);
+
+/* Live: a frame with this PTS reached the results at running time now */
+void appsrc_feeder_report_latency (AppSrcFeeder * feeder, GstClockTime pts,
+    GstClockTime now);
+
+void appsrc_feeder_get_stats (AppSrcFeeder * feeder, AppSrcFeederStats * stats);
+
+/* Stop and join the threads, dropping the frames still in the ring */
+void appsrc_feeder_free (AppSrcFeeder * feeder);
+
+#endif
@@ -0,0 +1,812 @@
+/*
+ * Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <linux/io_uring.h>
+#include "appsrc_io.h"
+#include "appsrc_shm.h"
+
+/* O_DIRECT offset, length and buffer alignment */
+#define APPSRC_IO_ALIGN 4096
+
+#define APPSRC_IO_MAX_DEPTH 64
+
+/* Largest frame ring accepted from a shm producer */
+#define APPSRC_IO_MAX_SHM_SLOTS 256
+
+/* Pool buffers besides the reads in flight, for the frames queued in appsrc
+ * and the one being uploaded by nvvideoconvert */
+#define APPSRC_IO_SPARE_SLOTS 4
+
+#define ROUND_UP(x, a) (((x) + (a) - 1) / (a) * (a))
+
+typedef enum
+{
+  SLOT_FREE,
+  SLOT_READING,
+  SLOT_READY,
+  SLOT_OUT
+} AppSrcIoSlotState;
+
+/* One pool buffer */
+typedef struct _AppSrcIoSlot
+{
+  AppSrcIo *io;
+  guint8 *mem;
+  guint64 frame;                /* Frame held or being read */
+  gsize data_offset;            /* Frame start inside mem */
+  gssize result;                /* Bytes read into mem, < 0 on error */
+  struct iovec iov;             /* uring read target */
+  AppSrcIoSlotState state;
+} AppSrcIoSlot;
+
+/* Minimal io_uring, the raw syscalls so no liburing is needed */
+typedef struct _AppSrcUring
+{
+  gint fd;
+  guint *sq_tail;
+  guint *sq_mask;
+  guint *sq_array;
+  guint *cq_head;
+  guint *cq_tail;
+  guint *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void *sq_ring;
+  gsize sq_ring_size;
+  void *cq_ring;
+  gsize cq_ring_size;
+  gsize sqes_size;
+  guint to_submit;              /* Queued, not yet entered */
+  guint in_flight;              /* Entered, not yet reaped */
+} AppSrcUring;
+
+struct _AppSrcIo
+{
+  AppSrcIoType type;
+  gint fd;
+  gboolean direct;              /* fd is opened with O_DIRECT */
+  gsize frame_size;
+  guint64 num_frames;
+  guint64 next_frame;           /* Next frame handed out */
+  guint64 next_read;            /* uring: next frame submitted */
+  gint refs;                    /* The reader plus every buffer downstream */
+  guint depth;
+
+  guint8 *map;
+  gsize map_size;
+
+  gint sock;                    /* shm: connection to the producer */
+
+  guint8 *pool;
+  gsize slot_size;
+  guint num_slots;
+  AppSrcIoSlot *slots;
+  GMutex lock;
+  GCond released;
+
+  AppSrcUring ring;
+};
+
+static const gchar *io_type_names[] = { "read", "mmap", "pread", "direct", "uring",
+  "shm"
+};
+
+gboolean
+appsrc_io_type_from_string (const gchar * name, AppSrcIoType * type)
+{
+  for (guint i = 0; i < G_N_ELEMENTS (io_type_names); i++) {
+    if (!g_strcmp0 (name, io_type_names[i])) {
+      *type = (AppSrcIoType) i;
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+const gchar *
+appsrc_io_type_name (AppSrcIoType type)
+{
+  return io_type_names[type];
+}
+
+AppSrcIoType
+appsrc_io_get_type (AppSrcIo * io)
+{
+  return io->type;
+}
+
+static gboolean
+uring_setup (AppSrcUring * ring, guint entries)
+{
+  struct io_uring_params p;
+
+  memset (&p, 0, sizeof (p));
+  ring->fd = syscall (__NR_io_uring_setup, entries, &p);
+  if (ring->fd < 0)
+    return FALSE;
+
+  ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof (guint);
+  ring->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof (struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    ring->sq_ring_size = ring->cq_ring_size =
+        MAX (ring->sq_ring_size, ring->cq_ring_size);
+
+  ring->sq_ring = mmap (NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (ring->sq_ring == MAP_FAILED)
+    goto fail;
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    ring->cq_ring = ring->sq_ring;
+  } else {
+    ring->cq_ring = mmap (NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cq_ring == MAP_FAILED)
+      goto fail;
+  }
+  ring->sqes_size = p.sq_entries * sizeof (struct io_uring_sqe);
+  ring->sqes = mmap (NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED)
+    goto fail;
+
+  ring->sq_tail = (guint *) ((guint8 *) ring->sq_ring + p.sq_off.tail);
+  ring->sq_mask = (guint *) ((guint8 *) ring->sq_ring + p.sq_off.ring_mask);
+  ring->sq_array = (guint *) ((guint8 *) ring->sq_ring + p.sq_off.array);
+  ring->cq_head = (guint *) ((guint8 *) ring->cq_ring + p.cq_off.head);
+  ring->cq_tail = (guint *) ((guint8 *) ring->cq_ring + p.cq_off.tail);
+  ring->cq_mask = (guint *) ((guint8 *) ring->cq_ring + p.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *) ((guint8 *) ring->cq_ring + p.cq_off.cqes);
+  return TRUE;
+
+fail:
+  if (ring->sq_ring && ring->sq_ring != MAP_FAILED)
+    munmap (ring->sq_ring, ring->sq_ring_size);
+  if (ring->cq_ring && ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring)
+    munmap (ring->cq_ring, ring->cq_ring_size);
+  close (ring->fd);
+  memset (ring, 0, sizeof (*ring));
+  ring->fd = -1;
+  return FALSE;
+}
+
+static void
+uring_teardown (AppSrcUring * ring)
+{
+  if (ring->fd < 0)
+    return;
+  munmap (ring->sqes, ring->sqes_size);
+  if (ring->cq_ring != ring->sq_ring)
+    munmap (ring->cq_ring, ring->cq_ring_size);
+  munmap (ring->sq_ring, ring->sq_ring_size);
+  close (ring->fd);
+  ring->fd = -1;
+}
+
+static void
+uring_queue_read (AppSrcUring * ring, gint fd, AppSrcIoSlot * slot,
+    guint64 offset, guint64 user_data)
+{
+  guint tail = *ring->sq_tail;
+  guint index = tail & *ring->sq_mask;
+  struct io_uring_sqe *sqe = &ring->sqes[index];
+
+  memset (sqe, 0, sizeof (*sqe));
+  sqe->opcode = IORING_OP_READV;
+  sqe->fd = fd;
+  sqe->addr = (guint64) (uintptr_t) & slot->iov;
+  sqe->len = 1;
+  sqe->off = offset;
+  sqe->user_data = user_data;
+  ring->sq_array[index] = index;
+  __atomic_store_n (ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  ring->to_submit++;
+}
+
+/* Submit the queued reads, and wait for at least min_complete completions */
+static gboolean
+uring_enter (AppSrcUring * ring, guint min_complete)
+{
+  guint flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+
+  while (ring->to_submit || min_complete) {
+    gint ret = syscall (__NR_io_uring_enter, ring->fd, ring->to_submit,
+        min_complete, flags, NULL, 0);
+    if (ret < 0) {
+      if (errno == EINTR)
+        continue;
+      return FALSE;
+    }
+    ring->to_submit -= ret;
+    ring->in_flight += ret;
+    if (min_complete)
+      break;
+  }
+  return TRUE;
+}
+
+static void
+io_unref (AppSrcIo * io)
+{
+  if (!g_atomic_int_dec_and_test (&io->refs))
+    return;
+
+  if (io->map)
+    munmap (io->map, io->map_size);
+  if (io->sock >= 0)
+    close (io->sock);
+  free (io->pool);
+  g_free (io->slots);
+  g_mutex_clear (&io->lock);
+  g_cond_clear (&io->released);
+  g_free (io);
+}
+
+static void
+map_release (gpointer data)
+{
+  io_unref ((AppSrcIo *) data);
+}
+
+static void
+slot_release (gpointer data)
+{
+  AppSrcIoSlot *slot = (AppSrcIoSlot *) data;
+  AppSrcIo *io = slot->io;
+
+  g_mutex_lock (&io->lock);
+  slot->state = SLOT_FREE;
+  g_cond_signal (&io->released);
+  g_mutex_unlock (&io->lock);
+  io_unref (io);
+}
+
+/* A free pool buffer, waiting for downstream to release one if block */
+static AppSrcIoSlot *
+slot_acquire (AppSrcIo * io, gboolean block)
+{
+  AppSrcIoSlot *slot = NULL;
+
+  g_mutex_lock (&io->lock);
+  while (!slot) {
+    for (guint i = 0; i < io->num_slots && !slot; i++) {
+      if (io->slots[i].state == SLOT_FREE)
+        slot = &io->slots[i];
+    }
+    if (slot)
+      slot->state = SLOT_READING;
+    else if (block)
+      g_cond_wait (&io->released, &io->lock);
+    else
+      break;
+  }
+  g_mutex_unlock (&io->lock);
+  return slot;
+}
+
+static void
+slot_set_state (AppSrcIoSlot * slot, AppSrcIoSlotState state)
+{
+  g_mutex_lock (&slot->io->lock);
+  slot->state = state;
+  g_mutex_unlock (&slot->io->lock);
+}
+
+/* File range to read for frame into slot. O_DIRECT needs the range widened
+ * to the alignment, the frame then starts at data_offset. */
+static void
+slot_prepare (AppSrcIo * io, AppSrcIoSlot * slot, guint64 frame,
+    guint64 * offset, gsize * length)
+{
+  guint64 start = frame * io->frame_size;
+
+  slot->frame = frame;
+  slot->result = 0;
+  if (io->direct) {
+    *offset = start / APPSRC_IO_ALIGN * APPSRC_IO_ALIGN;
+    *length = ROUND_UP (start + io->frame_size - *offset, APPSRC_IO_ALIGN);
+  } else {
+    *offset = start;
+    *length = io->frame_size;
+  }
+  slot->data_offset = start - *offset;
+}
+
+static gboolean
+slot_complete (AppSrcIo * io, AppSrcIoSlot * slot)
+{
+  return slot->result >= (gssize) (slot->data_offset + io->frame_size);
+}
+
+static GstBuffer *
+slot_wrap (AppSrcIo * io, AppSrcIoSlot * slot)
+{
+  slot_set_state (slot, SLOT_OUT);
+  g_atomic_int_inc (&io->refs);
+  return gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY, slot->mem,
+      io->slot_size, slot->data_offset, io->frame_size, slot, slot_release);
+}
+
+/* Start the kernel readahead depth frames ahead of the reader, the page
+ * cache does the rest for sequential reads */
+static void
+io_advise_ahead (AppSrcIo * io)
+{
+  if (!io->direct)
+    posix_fadvise (io->fd, (io->next_frame + io->depth) * io->frame_size,
+        io->frame_size, POSIX_FADV_WILLNEED);
+}
+
+static GstBuffer *
+read_next (AppSrcIo * io, gboolean * failed)
+{
+  GstBuffer *buffer = gst_buffer_new_allocate (NULL, io->frame_size, NULL);
+  GstMapInfo map;
+  gsize done = 0;
+
+  io_advise_ahead (io);
+  gst_buffer_map (buffer, &map, GST_MAP_WRITE);
+  while (done < io->frame_size) {
+    gssize ret = pread (io->fd, map.data + done, io->frame_size - done,
+        io->next_frame * io->frame_size + done);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    if (ret <= 0)
+      break;
+    done += ret;
+  }
+  gst_buffer_unmap (buffer, &map);
+
+  if (done < io->frame_size) {
+    gst_buffer_unref (buffer);
+    *failed = TRUE;
+    return NULL;
+  }
+  io->next_frame++;
+  return buffer;
+}
+
+static GstBuffer *
+mmap_next (AppSrcIo * io)
+{
+  guint64 offset = io->next_frame * io->frame_size;
+  guint64 ahead = offset / APPSRC_IO_ALIGN * APPSRC_IO_ALIGN;
+
+  /* Fault in the next frames before nvvideoconvert touches them */
+  if (ahead < io->map_size)
+    madvise (io->map + ahead, MIN ((guint64) io->depth * io->frame_size + APPSRC_IO_ALIGN,
+            io->map_size - ahead), MADV_WILLNEED);
+
+  io->next_frame++;
+  g_atomic_int_inc (&io->refs);
+  return gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY,
+      io->map + offset, io->frame_size, 0, io->frame_size, io, map_release);
+}
+
+static GstBuffer *
+pread_next (AppSrcIo * io, gboolean * failed)
+{
+  AppSrcIoSlot *slot = slot_acquire (io, TRUE);
+  guint64 offset;
+  gsize length;
+
+  io_advise_ahead (io);
+  slot_prepare (io, slot, io->next_frame, &offset, &length);
+  while (slot->result < (gssize) length) {
+    gssize ret = pread (io->fd, slot->mem + slot->result,
+        length - slot->result, offset + slot->result);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    if (ret <= 0)
+      break;
+    slot->result += ret;
+  }
+
+  if (!slot_complete (io, slot)) {
+    slot_set_state (slot, SLOT_FREE);
+    *failed = TRUE;
+    return NULL;
+  }
+  io->next_frame++;
+  return slot_wrap (io, slot);
+}
+
+/* Keep up to depth reads in flight on free pool buffers */
+static gboolean
+uring_fill (AppSrcIo * io)
+{
+  AppSrcUring *ring = &io->ring;
+
+  while (ring->in_flight + ring->to_submit < io->depth &&
+      io->next_read < io->num_frames) {
+    AppSrcIoSlot *slot = slot_acquire (io, FALSE);
+    guint64 offset;
+    gsize length;
+    if (!slot)
+      break;
+    slot_prepare (io, slot, io->next_read++, &offset, &length);
+    slot->iov.iov_base = slot->mem;
+    slot->iov.iov_len = length;
+    uring_queue_read (ring, io->fd, slot, offset, slot - io->slots);
+  }
+  return uring_enter (ring, 0);
+}
+
+static void
+uring_reap (AppSrcIo * io)
+{
+  AppSrcUring *ring = &io->ring;
+  guint head = *ring->cq_head;
+  guint tail = __atomic_load_n (ring->cq_tail, __ATOMIC_ACQUIRE);
+
+  for (; head != tail; head++) {
+    struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+    AppSrcIoSlot *slot = &io->slots[cqe->user_data];
+    slot->result = cqe->res;
+    slot_set_state (slot, SLOT_READY);
+    ring->in_flight--;
+  }
+  __atomic_store_n (ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static GstBuffer *
+uring_next (AppSrcIo * io, gboolean * failed)
+{
+  for (;;) {
+    AppSrcIoSlot *slot = NULL;
+    gboolean reading = FALSE;
+    gboolean free_slot = FALSE;
+
+    if (!uring_fill (io))
+      break;
+    uring_reap (io);
+
+    g_mutex_lock (&io->lock);
+    for (guint i = 0; i < io->num_slots; i++) {
+      free_slot |= io->slots[i].state == SLOT_FREE;
+      if (io->slots[i].frame != io->next_frame)
+        continue;
+      if (io->slots[i].state == SLOT_READY)
+        slot = &io->slots[i];
+      else if (io->slots[i].state == SLOT_READING)
+        reading = TRUE;
+    }
+    /* Nothing to read into until downstream releases a buffer */
+    if (!slot && !reading && !free_slot)
+      g_cond_wait (&io->released, &io->lock);
+    g_mutex_unlock (&io->lock);
+
+    if (slot) {
+      if (!slot_complete (io, slot)) {
+        slot_set_state (slot, SLOT_FREE);
+        break;
+      }
+      io->next_frame++;
+      return slot_wrap (io, slot);
+    }
+    if (reading && !uring_enter (&io->ring, 1))
+      break;
+  }
+
+  *failed = TRUE;
+  return NULL;
+}
+
+/* Hand the slot back to the producer once downstream is done with it */
+static void
+shm_release (gpointer data)
+{
+  AppSrcIoSlot *slot = (AppSrcIoSlot *) data;
+  AppSrcIo *io = slot->io;
+  AppSrcShmMsg msg = { APPSRC_SHM_RELEASE, slot - io->slots, slot->frame };
+
+  slot_set_state (slot, SLOT_FREE);
+  /* A producer that is gone does not need its slots anymore */
+  if (send (io->sock, &msg, sizeof (msg), MSG_NOSIGNAL) != sizeof (msg) &&
+      errno != EPIPE && errno != ECONNRESET)
+    g_printerr ("Failed to release a shm slot: %s\n", strerror (errno));
+  io_unref (io);
+}
+
+static GstBuffer *
+shm_next (AppSrcIo * io, gboolean * failed)
+{
+  AppSrcShmMsg msg;
+  AppSrcIoSlot *slot;
+  gssize ret;
+
+  do
+    ret = recv (io->sock, &msg, sizeof (msg), 0);
+  while (ret < 0 && errno == EINTR);
+
+  /* The producer ended the stream or went away */
+  if (ret == 0 || (ret == sizeof (msg) && msg.type == APPSRC_SHM_EOS))
+    return NULL;
+  if (ret != sizeof (msg) || msg.type != APPSRC_SHM_FRAME ||
+      msg.slot >= io->num_slots) {
+    *failed = TRUE;
+    return NULL;
+  }
+
+  slot = &io->slots[msg.slot];
+  slot->frame = msg.sequence;
+  slot_set_state (slot, SLOT_OUT);
+  io->next_frame++;
+  g_atomic_int_inc (&io->refs);
+  return gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY, slot->mem,
+      io->slot_size, 0, io->frame_size, slot, shm_release);
+}
+
+/* Connect to the producer at path and map the frame ring it sends */
+static gboolean
+shm_connect (AppSrcIo * io, const gchar * path)
+{
+  struct sockaddr_un addr = {.sun_family = AF_UNIX };
+  AppSrcShmHello hello;
+  gchar control[CMSG_SPACE (sizeof (gint))];
+  struct iovec iov = { &hello, sizeof (hello) };
+  struct msghdr msg = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = control,
+    .msg_controllen = sizeof (control),
+  };
+  struct cmsghdr *cmsg;
+  gint memfd = -1;
+
+  if (strlen (path) >= sizeof (addr.sun_path)) {
+    g_printerr ("Socket path %s is too long\n", path);
+    return FALSE;
+  }
+  strcpy (addr.sun_path, path);
+  io->sock = socket (AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (io->sock < 0 ||
+      connect (io->sock, (struct sockaddr *) &addr, sizeof (addr)) != 0) {
+    g_printerr ("Failed to connect to %s: %s\n", path, strerror (errno));
+    return FALSE;
+  }
+
+  if (recvmsg (io->sock, &msg, MSG_CMSG_CLOEXEC) != sizeof (hello)) {
+    g_printerr ("No frame ring received from %s\n", path);
+    return FALSE;
+  }
+  cmsg = CMSG_FIRSTHDR (&msg);
+  if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+    memcpy (&memfd, CMSG_DATA (cmsg), sizeof (gint));
+  if (memfd < 0 || hello.magic != APPSRC_SHM_MAGIC ||
+      hello.version != APPSRC_SHM_VERSION) {
+    g_printerr ("%s is not an appsrc shm producer\n", path);
+    if (memfd >= 0)
+      close (memfd);
+    return FALSE;
+  }
+  if (hello.frame_size != io->frame_size || hello.slot_size < hello.frame_size ||
+      hello.num_slots == 0 || hello.num_slots > APPSRC_IO_MAX_SHM_SLOTS) {
+    g_printerr ("%s sends %u slots of %lu byte frames, expected %lu bytes\n",
+        path, hello.num_slots, (unsigned long) hello.frame_size,
+        (unsigned long) io->frame_size);
+    close (memfd);
+    return FALSE;
+  }
+
+  io->map_size = hello.slot_size * hello.num_slots;
+  io->map = mmap (NULL, io->map_size, PROT_READ, MAP_SHARED, memfd, 0);
+  close (memfd);
+  if (io->map == MAP_FAILED) {
+    g_printerr ("Failed to map the frame ring of %s: %s\n", path,
+        strerror (errno));
+    io->map = NULL;
+    return FALSE;
+  }
+
+  io->slot_size = hello.slot_size;
+  io->num_slots = hello.num_slots;
+  io->slots = g_new0 (AppSrcIoSlot, io->num_slots);
+  for (guint i = 0; i < io->num_slots; i++) {
+    io->slots[i].io = io;
+    io->slots[i].mem = io->map + i * io->slot_size;
+    io->slots[i].state = SLOT_FREE;
+  }
+  /* A live stream, it ends when the producer says so */
+  io->num_frames = G_MAXUINT64;
+  return TRUE;
+}
+
+GstBuffer *
+appsrc_io_next_frame (AppSrcIo * io, gboolean * failed)
+{
+  *failed = FALSE;
+  if (io->next_frame >= io->num_frames)
+    return NULL;
+
+  switch (io->type) {
+    case APPSRC_IO_READ:
+      return read_next (io, failed);
+    case APPSRC_IO_MMAP:
+      return mmap_next (io);
+    case APPSRC_IO_URING:
+      return uring_next (io, failed);
+    case APPSRC_IO_SHM:
+      return shm_next (io, failed);
+    default:
+      return pread_next (io, failed);
+  }
+}
+
+/* Wait for the reads in flight and drop the frames read ahead */
+static void
+uring_drain (AppSrcIo * io)
+{
+  while (io->ring.in_flight || io->ring.to_submit) {
+    if (!uring_enter (&io->ring, io->ring.in_flight ? 1 : 0))
+      break;
+    uring_reap (io);
+  }
+
+  g_mutex_lock (&io->lock);
+  for (guint i = 0; i < io->num_slots; i++) {
+    if (io->slots[i].state == SLOT_READY)
+      io->slots[i].state = SLOT_FREE;
+  }
+  g_mutex_unlock (&io->lock);
+}
+
+void
+appsrc_io_rewind (AppSrcIo * io)
+{
+  if (io->type == APPSRC_IO_SHM)
+    return;
+  if (io->type == APPSRC_IO_URING)
+    uring_drain (io);
+  io->next_frame = 0;
+  io->next_read = 0;
+}
+
+static gboolean
+pool_init (AppSrcIo * io, guint num_slots)
+{
+  io->slot_size = ROUND_UP (io->frame_size + (io->direct ? 2 * APPSRC_IO_ALIGN : 0),
+      APPSRC_IO_ALIGN);
+  if (posix_memalign ((void **) &io->pool, APPSRC_IO_ALIGN,
+          io->slot_size * num_slots) != 0)
+    return FALSE;
+
+  io->num_slots = num_slots;
+  io->slots = g_new0 (AppSrcIoSlot, num_slots);
+  for (guint i = 0; i < num_slots; i++) {
+    io->slots[i].io = io;
+    io->slots[i].mem = io->pool + i * io->slot_size;
+    io->slots[i].frame = G_MAXUINT64;
+    io->slots[i].state = SLOT_FREE;
+  }
+  return TRUE;
+}
+
+AppSrcIo *
+appsrc_io_open (const gchar * path, gsize frame_size, AppSrcIoType type,
+    guint depth)
+{
+  struct stat st;
+  AppSrcIo *io;
+
+  if (frame_size == 0)
+    return NULL;
+
+  io = g_new0 (AppSrcIo, 1);
+  io->type = type;
+  io->frame_size = frame_size;
+  io->depth = CLAMP (depth, 1, APPSRC_IO_MAX_DEPTH);
+  io->refs = 1;
+  io->ring.fd = -1;
+  io->sock = -1;
+  g_mutex_init (&io->lock);
+  g_cond_init (&io->released);
+
+  io->fd = -1;
+  if (type == APPSRC_IO_SHM) {
+    if (!shm_connect (io, path)) {
+      io_unref (io);
+      return NULL;
+    }
+    return io;
+  }
+  if (type == APPSRC_IO_DIRECT || type == APPSRC_IO_URING) {
+    io->fd = open (path, O_RDONLY | O_DIRECT);
+    io->direct = io->fd >= 0;
+    if (io->fd < 0 && errno == EINVAL)
+      g_printerr ("%s does not support O_DIRECT, reading through the page cache\n",
+          path);
+  }
+  if (io->fd < 0)
+    io->fd = open (path, O_RDONLY);
+  if (io->fd < 0 || fstat (io->fd, &st) != 0) {
+    g_printerr ("Failed to open %s: %s\n", path, strerror (errno));
+    if (io->fd >= 0)
+      close (io->fd);
+    io_unref (io);
+    return NULL;
+  }
+  io->num_frames = st.st_size / frame_size;
+  if (!io->direct)
+    posix_fadvise (io->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  if (type == APPSRC_IO_MMAP && io->num_frames > 0) {
+    io->map_size = st.st_size;
+    io->map = mmap (NULL, io->map_size, PROT_READ, MAP_SHARED, io->fd, 0);
+    if (io->map == MAP_FAILED) {
+      g_printerr ("mmap of %s failed: %s, using pread\n", path, strerror (errno));
+      io->map = NULL;
+      io->type = APPSRC_IO_PREAD;
+    } else {
+      madvise (io->map, io->map_size, MADV_SEQUENTIAL);
+    }
+  }
+
+  if (type == APPSRC_IO_URING && !uring_setup (&io->ring, io->depth)) {
+    g_printerr ("io_uring is not available: %s, using pread\n", strerror (errno));
+    io->type = io->direct ? APPSRC_IO_DIRECT : APPSRC_IO_PREAD;
+  }
+
+  if (io->type != APPSRC_IO_READ && io->type != APPSRC_IO_MMAP &&
+      !pool_init (io, io->depth + APPSRC_IO_SPARE_SLOTS)) {
+    g_printerr ("Failed to allocate the frame pool of %s\n", path);
+    appsrc_io_close (io);
+    return NULL;
+  }
+
+  return io;
+}
+
+void
+appsrc_io_stop (AppSrcIo * io)
+{
+  /* recv() returns 0 as if the producer had ended the stream, and slots
+   * released later are not sent back */
+  if (io->sock >= 0)
+    shutdown (io->sock, SHUT_RDWR);
+}
+
+void
+appsrc_io_close (AppSrcIo * io)
+{
+  if (io->ring.fd >= 0) {
+    uring_drain (io);
+    uring_teardown (&io->ring);
+  }
+  if (io->fd >= 0)
+    close (io->fd);
+  io->fd = -1;
+  io_unref (io);
+}
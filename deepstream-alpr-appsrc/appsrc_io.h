@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* Raw frame readers feeding appsrc.
+ *
+ * Every engine hands out one GstBuffer per frame of a raw video file:
+ *  - read:   a new buffer per frame filled with read(), the original behaviour.
+ *  - mmap:   the file is mapped once and each buffer wraps the frame pages,
+ *            nothing is copied or allocated besides the GstBuffer itself.
+ *  - pread:  frames are read into a fixed pool of page aligned buffers that
+ *            return to the pool when downstream releases them.
+ *  - direct: as pread, with O_DIRECT so the page cache is bypassed.
+ *  - uring:  as direct, with up to depth reads in flight through io_uring.
+ *  - shm:    path is the UNIX socket of a capture process sharing a memfd
+ *            frame ring (appsrc_shm.h). Buffers wrap the ring slots and hand
+ *            them back to the producer when downstream releases them.
+ * Only whole frames are delivered, a trailing partial frame ends the stream.
+ */
+
+#ifndef __APPSRC_IO_H__
+#define __APPSRC_IO_H__
+
+#include <gst/gst.h>
+
+typedef enum
+{
+  APPSRC_IO_READ,
+  APPSRC_IO_MMAP,
+  APPSRC_IO_PREAD,
+  APPSRC_IO_DIRECT,
+  APPSRC_IO_URING,
+  APPSRC_IO_SHM
+} AppSrcIoType;
+
+typedef struct _AppSrcIo AppSrcIo;
+
+/* Engine of a config name ("read", "mmap", "pread", "direct", "uring", "shm") */
+gboolean appsrc_io_type_from_string (const gchar * name, AppSrcIoType * type);
+
+const gchar *appsrc_io_type_name (AppSrcIoType type);
+
+/* Open path for frames of frame_size bytes. depth is the number of reads
+ * kept in flight by uring and sizes the buffer pool of the pooled engines.
+ * Engines that can not be set up on this file or kernel fall back to pread
+ * with a message. Returns NULL when the file can not be opened. */
+AppSrcIo *appsrc_io_open (const gchar * path, gsize frame_size,
+    AppSrcIoType type, guint depth);
+
+/* Engine actually in use after fallbacks */
+AppSrcIoType appsrc_io_get_type (AppSrcIo * io);
+
+/* Next frame, NULL at the end of the file or on a read error (failed is set
+ * to TRUE). Pooled engines block while all pool buffers are downstream. */
+GstBuffer *appsrc_io_next_frame (AppSrcIo * io, gboolean * failed);
+
+/* Rewind to the first frame, no effect on a shm stream */
+void appsrc_io_rewind (AppSrcIo * io);
+
+/* Make appsrc_io_next_frame return NULL from now on, also when it is
+ * blocked waiting for a shm producer, so the reader can be joined. May be
+ * called from another thread than the reader. */
+void appsrc_io_stop (AppSrcIo * io);
+
+/* Close the file. Buffers still downstream stay valid, the pool and the
+ * mapping are released with the last of them. */
+void appsrc_io_close (AppSrcIo * io);
+
+#endif
@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* Throughput of the appsrc I/O engines on one raw file.
+ *
+ * Every engine reads the whole file the way the app does, while a consumer
+ * copies each frame into a staging buffer like the nvvideoconvert upload and
+ * keeps the last few buffers outstanding like the appsrc queue. Reports
+ * frames/sec, MB/s and CPU time per frame (user + system).
+ *
+ *   $ make bench BENCH_ARGS="-s 3110400 -e read,mmap,pread,direct,uring -c test.nv12"
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "appsrc_io.h"
+
+#define BENCH_MAX_HOLD 16
+
+typedef struct _BenchConfig
+{
+  const gchar *path;
+  gsize frame_size;
+  guint depth;
+  guint hold;                   /* Buffers kept outstanding by the consumer */
+  guint passes;
+  gboolean cold;                /* Drop the file from the page cache first */
+  gboolean touch;               /* Copy every frame like the upload does */
+} BenchConfig;
+
+static gdouble
+cpu_seconds (void)
+{
+  struct rusage usage;
+
+  getrusage (RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+      usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+static gdouble
+wall_seconds (void)
+{
+  return g_get_monotonic_time () / 1e6;
+}
+
+static void
+drop_page_cache (const gchar * path)
+{
+  gint fd = open (path, O_RDONLY);
+
+  if (fd < 0)
+    return;
+  fdatasync (fd);
+  posix_fadvise (fd, 0, 0, POSIX_FADV_DONTNEED);
+  close (fd);
+}
+
+static gboolean
+run_engine (const BenchConfig * cfg, AppSrcIoType type, guint8 * staging)
+{
+  GstBuffer *held[BENCH_MAX_HOLD] = { NULL };
+  guint64 frames = 0;
+  guint slot = 0;
+  gboolean failed = FALSE;
+
+  if (cfg->cold)
+    drop_page_cache (cfg->path);
+
+  AppSrcIo *io = appsrc_io_open (cfg->path, cfg->frame_size, type, cfg->depth);
+  if (!io)
+    return FALSE;
+
+  gdouble wall = wall_seconds ();
+  gdouble cpu = cpu_seconds ();
+  for (guint pass = 0; pass < cfg->passes && !failed; pass++) {
+    GstBuffer *buffer;
+    appsrc_io_rewind (io);
+    while ((buffer = appsrc_io_next_frame (io, &failed))) {
+      if (cfg->touch) {
+        GstMapInfo map;
+        gst_buffer_map (buffer, &map, GST_MAP_READ);
+        memcpy (staging, map.data, map.size);
+        gst_buffer_unmap (buffer, &map);
+      }
+      if (held[slot])
+        gst_buffer_unref (held[slot]);
+      held[slot] = buffer;
+      slot = (slot + 1) % MAX (cfg->hold, 1);
+      frames++;
+    }
+  }
+  for (guint i = 0; i < BENCH_MAX_HOLD; i++) {
+    if (held[i])
+      gst_buffer_unref (held[i]);
+  }
+  wall = wall_seconds () - wall;
+  cpu = cpu_seconds () - cpu;
+
+  if (failed)
+    g_printerr ("%s: read error after %lu frames\n",
+        appsrc_io_type_name (type), (unsigned long) frames);
+  g_print ("%-7s (%-6s) frames %7lu  fps %9.1f  MB/s %8.1f  cpu us/frame %8.1f\n",
+      appsrc_io_type_name (type), appsrc_io_type_name (appsrc_io_get_type (io)),
+      (unsigned long) frames, frames / wall,
+      frames * (gdouble) cfg->frame_size / wall / 1e6,
+      frames ? cpu * 1e6 / frames : 0.0);
+  appsrc_io_close (io);
+  return !failed;
+}
+
+static void
+usage (const gchar * prog)
+{
+  g_printerr ("Usage: %s -s frame_size [-e read,mmap,pread,direct,uring] [-d depth]\n"
+      "          [-q held_buffers] [-n passes] [-c] [-t] raw_file\n"
+      "  -e  shm reads from the producer socket given as raw_file, one pass\n"
+      "  -c  drop the file from the page cache before each engine\n"
+      "  -t  do not copy the frames, measure the reads only\n", prog);
+}
+
+int
+main (int argc, char *argv[])
+{
+  BenchConfig cfg = { NULL, 0, 4, 2, 1, FALSE, TRUE };
+  const gchar *engines = "read,mmap,pread,direct,uring";
+  gint opt;
+  int ret = 0;
+
+  while ((opt = getopt (argc, argv, "s:e:d:q:n:cth")) != -1) {
+    switch (opt) {
+      case 's': cfg.frame_size = strtoul (optarg, NULL, 10); break;
+      case 'e': engines = optarg; break;
+      case 'd': cfg.depth = atoi (optarg); break;
+      case 'q': cfg.hold = atoi (optarg); break;
+      case 'n': cfg.passes = atoi (optarg); break;
+      case 'c': cfg.cold = TRUE; break;
+      case 't': cfg.touch = FALSE; break;
+      default: usage (argv[0]); return -1;
+    }
+  }
+  if (optind != argc - 1 || cfg.frame_size == 0 || cfg.hold > BENCH_MAX_HOLD) {
+    usage (argv[0]);
+    return -1;
+  }
+  cfg.path = argv[optind];
+
+  guint8 *staging = g_malloc (cfg.frame_size);
+  gchar **names = g_strsplit (engines, ",", -1);
+  g_print ("%s: frame %lu bytes, depth %u, held %u, passes %u%s\n", cfg.path,
+      (unsigned long) cfg.frame_size, cfg.depth, cfg.hold, cfg.passes,
+      cfg.cold ? ", cold cache" : "");
+  for (gchar ** name = names; *name; name++) {
+    AppSrcIoType type;
+    if (!appsrc_io_type_from_string (*name, &type)) {
+      g_printerr ("Unknown engine %s\n", *name);
+      ret = -1;
+      continue;
+    }
+    if (!run_engine (&cfg, type, staging))
+      ret = -1;
+  }
+  g_strfreev (names);
+  g_free (staging);
+  return ret;
+}
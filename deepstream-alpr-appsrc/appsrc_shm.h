@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* Frame ring shared between a capture process and the app.
+ *
+ * The producer creates a memfd holding num_slots frame slots of slot_size
+ * bytes and listens on a UNIX SOCK_SEQPACKET socket. On connect it sends an
+ * AppSrcShmHello with the memfd attached (SCM_RIGHTS). It then writes a frame
+ * into a free slot and sends APPSRC_SHM_FRAME with the slot index; the app
+ * wraps the slot into a GstBuffer and sends APPSRC_SHM_RELEASE back once
+ * the buffer is freed downstream, after which the producer may reuse the
+ * slot. APPSRC_SHM_EOS, or closing the socket, ends the stream.
+ */
+
+#ifndef __APPSRC_SHM_H__
+#define __APPSRC_SHM_H__
+
+#include <glib.h>
+
+#define APPSRC_SHM_MAGIC 0x4d485341     /* "ASHM" */
+#define APPSRC_SHM_VERSION 1
+
+typedef struct _AppSrcShmHello
+{
+  guint32 magic;
+  guint32 version;
+  guint64 frame_size;
+  guint64 slot_size;            /* Slot i starts at i * slot_size */
+  guint32 num_slots;
+  guint32 reserved;
+} AppSrcShmHello;
+
+typedef enum
+{
+  APPSRC_SHM_FRAME = 1,         /* producer -> app */
+  APPSRC_SHM_EOS = 2,           /* producer -> app */
+  APPSRC_SHM_RELEASE = 3        /* app -> producer */
+} AppSrcShmMsgType;
+
+typedef struct _AppSrcShmMsg
+{
+  guint32 type;
+  guint32 slot;
+  guint64 sequence;             /* Frame number given by the producer */
+} AppSrcShmMsg;
+
+#endif
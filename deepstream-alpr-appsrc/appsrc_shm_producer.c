@@ -0,0 +1,318 @@
+/*
+ * Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* Stand-in for a capture process feeding the app through the shm engine.
+ *
+ * Serves frames from a raw file, or a moving test pattern without one, over
+ * a memfd frame ring (appsrc_shm.h) to the first client of the socket. Each
+ * frame is written into a free slot, as a capture process would decode into
+ * it, and the slot is reused once the app releases it. At the end it prints
+ * frames/sec, MB/s and how long the app held a slot.
+ *
+ *   $ make producer PRODUCER_ARGS="-s 3110400 -f plates-drive.nv12 /tmp/alpr.sock"
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <glib.h>
+#include "appsrc_shm.h"
+
+#define PRODUCER_ALIGN 4096
+#define ROUND_UP(x, a) (((x) + (a) - 1) / (a) * (a))
+
+typedef struct _ProducerConfig
+{
+  const gchar *socket_path;
+  const gchar *raw_path;        /* NULL = test pattern */
+  gsize frame_size;
+  guint num_slots;
+  guint64 frames;               /* 0 = the raw file once, or forever */
+  guint fps;                    /* 0 = as fast as slots are released */
+} ProducerConfig;
+
+typedef struct _Producer
+{
+  ProducerConfig cfg;
+  gint sock;
+  guint8 *ring;
+  gsize slot_size;
+  gboolean *busy;               /* Slot is with the app */
+  gint64 *sent_at;
+  guint in_use;
+  guint8 *raw;
+  guint64 raw_frames;
+  guint64 released;
+  gint64 hold_us;               /* Summed send to release time */
+  gint64 max_hold_us;
+} Producer;
+
+static gboolean
+send_msg (Producer * p, guint32 type, guint32 slot, guint64 sequence)
+{
+  AppSrcShmMsg msg = { type, slot, sequence };
+
+  return send (p->sock, &msg, sizeof (msg), MSG_NOSIGNAL) == sizeof (msg);
+}
+
+/* Take the releases sent by the app, waiting up to timeout_ms for one */
+static gboolean
+take_releases (Producer * p, gint timeout_ms)
+{
+  struct pollfd fd = {.fd = p->sock,.events = POLLIN };
+  AppSrcShmMsg msg;
+
+  if (poll (&fd, 1, timeout_ms) <= 0)
+    return TRUE;
+  while (recv (p->sock, &msg, sizeof (msg), MSG_DONTWAIT) == sizeof (msg)) {
+    if (msg.type != APPSRC_SHM_RELEASE || msg.slot >= p->cfg.num_slots ||
+        !p->busy[msg.slot])
+      continue;
+    gint64 hold = g_get_monotonic_time () - p->sent_at[msg.slot];
+    p->busy[msg.slot] = FALSE;
+    p->in_use--;
+    p->released++;
+    p->hold_us += hold;
+    p->max_hold_us = MAX (p->max_hold_us, hold);
+  }
+  /* Readable without a message: the app closed the connection */
+  return !(fd.revents & (POLLHUP | POLLERR));
+}
+
+static void
+fill_slot (Producer * p, guint8 * slot, guint64 sequence)
+{
+  if (p->raw) {
+    memcpy (slot, p->raw + sequence % p->raw_frames * p->cfg.frame_size,
+        p->cfg.frame_size);
+  } else {
+    /* Gray frame with a bright band moving down */
+    gsize band = p->cfg.frame_size / 32;
+    gsize start = sequence * band / 4 % (p->cfg.frame_size - band);
+    memset (slot, 0x80, p->cfg.frame_size);
+    memset (slot + start, 0xeb, band);
+  }
+}
+
+static gint
+serve (Producer * p)
+{
+  AppSrcShmHello hello = {
+    APPSRC_SHM_MAGIC, APPSRC_SHM_VERSION, p->cfg.frame_size, p->slot_size,
+    p->cfg.num_slots, 0
+  };
+  gint memfd;
+  gchar control[CMSG_SPACE (sizeof (gint))];
+  struct iovec iov = { &hello, sizeof (hello) };
+  struct msghdr msg = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = control,
+    .msg_controllen = sizeof (control),
+  };
+  struct cmsghdr *cmsg;
+  guint64 total = p->cfg.frames ? p->cfg.frames :
+      p->raw ? p->raw_frames : G_MAXUINT64;
+  guint64 sequence = 0;
+  gint64 start, next_due;
+
+  memfd = memfd_create ("alpr-frame-ring", MFD_CLOEXEC);
+  if (memfd < 0 || ftruncate (memfd, p->slot_size * p->cfg.num_slots) != 0) {
+    g_printerr ("Failed to create the frame ring: %s\n", strerror (errno));
+    return -1;
+  }
+  p->ring = mmap (NULL, p->slot_size * p->cfg.num_slots, PROT_READ | PROT_WRITE,
+      MAP_SHARED, memfd, 0);
+  if (p->ring == MAP_FAILED) {
+    g_printerr ("Failed to map the frame ring: %s\n", strerror (errno));
+    close (memfd);
+    return -1;
+  }
+
+  memset (control, 0, sizeof (control));
+  cmsg = CMSG_FIRSTHDR (&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN (sizeof (gint));
+  memcpy (CMSG_DATA (cmsg), &memfd, sizeof (gint));
+  if (sendmsg (p->sock, &msg, MSG_NOSIGNAL) != sizeof (hello)) {
+    g_printerr ("Failed to send the frame ring: %s\n", strerror (errno));
+    close (memfd);
+    return -1;
+  }
+  close (memfd);
+
+  start = next_due = g_get_monotonic_time ();
+  while (sequence < total) {
+    guint slot;
+
+    /* Wait for a free slot */
+    while (p->in_use == p->cfg.num_slots) {
+      if (!take_releases (p, 1000)) {
+        g_printerr ("The app disconnected\n");
+        goto done;
+      }
+    }
+    if (!take_releases (p, 0))
+      break;
+    if (p->cfg.fps) {
+      gint64 now = g_get_monotonic_time ();
+      if (now < next_due)
+        g_usleep (next_due - now);
+      next_due += G_USEC_PER_SEC / p->cfg.fps;
+    }
+
+    for (slot = 0; p->busy[slot]; slot++);
+    fill_slot (p, p->ring + slot * p->slot_size, sequence);
+    p->busy[slot] = TRUE;
+    p->sent_at[slot] = g_get_monotonic_time ();
+    p->in_use++;
+    if (!send_msg (p, APPSRC_SHM_FRAME, slot, sequence)) {
+      g_printerr ("The app disconnected\n");
+      break;
+    }
+    sequence++;
+  }
+  send_msg (p, APPSRC_SHM_EOS, 0, sequence);
+
+  /* Slots still downstream come back as the app drains */
+  while (p->in_use) {
+    guint in_use = p->in_use;
+    if (!take_releases (p, 5000) || p->in_use == in_use)
+      break;
+  }
+
+done:;
+  gdouble wall = (g_get_monotonic_time () - start) / 1e6;
+  g_print ("frames %lu  fps %.1f  MB/s %.1f  slot hold mean %.2f ms  max %.2f ms\n",
+      (unsigned long) sequence, sequence / wall,
+      sequence * (gdouble) p->cfg.frame_size / wall / 1e6,
+      p->released ? p->hold_us / 1e3 / p->released : 0.0,
+      p->max_hold_us / 1e3);
+  munmap (p->ring, p->slot_size * p->cfg.num_slots);
+  return 0;
+}
+
+static gboolean
+map_raw (Producer * p)
+{
+  struct stat st;
+  gint fd = open (p->cfg.raw_path, O_RDONLY);
+
+  if (fd < 0 || fstat (fd, &st) != 0) {
+    g_printerr ("Failed to open %s: %s\n", p->cfg.raw_path, strerror (errno));
+    if (fd >= 0)
+      close (fd);
+    return FALSE;
+  }
+  p->raw_frames = st.st_size / p->cfg.frame_size;
+  if (p->raw_frames == 0) {
+    g_printerr ("%s holds no whole frame\n", p->cfg.raw_path);
+    close (fd);
+    return FALSE;
+  }
+  p->raw = mmap (NULL, p->raw_frames * p->cfg.frame_size, PROT_READ,
+      MAP_PRIVATE | MAP_POPULATE, fd, 0);
+  close (fd);
+  if (p->raw == MAP_FAILED) {
+    g_printerr ("Failed to map %s: %s\n", p->cfg.raw_path, strerror (errno));
+    p->raw = NULL;
+    return FALSE;
+  }
+  return TRUE;
+}
+
+static void
+usage (const gchar * prog)
+{
+  g_printerr ("Usage: %s -s frame_size [-f raw_file] [-n slots] [-c frames]\n"
+      "          [-r fps] socket_path\n"
+      "  -f  frames to serve, a test pattern without it\n"
+      "  -n  frame slots in the ring, default 16\n"
+      "  -c  frames to send, default the raw file once or forever\n"
+      "  -r  frame rate, default as fast as the app releases slots\n", prog);
+}
+
+int
+main (int argc, char *argv[])
+{
+  Producer p = { {NULL, NULL, 0, 16, 0, 0} };
+  struct sockaddr_un addr = {.sun_family = AF_UNIX };
+  gint listener, opt, ret;
+
+  while ((opt = getopt (argc, argv, "s:f:n:c:r:h")) != -1) {
+    switch (opt) {
+      case 's': p.cfg.frame_size = strtoul (optarg, NULL, 10); break;
+      case 'f': p.cfg.raw_path = optarg; break;
+      case 'n': p.cfg.num_slots = atoi (optarg); break;
+      case 'c': p.cfg.frames = strtoull (optarg, NULL, 10); break;
+      case 'r': p.cfg.fps = atoi (optarg); break;
+      default: usage (argv[0]); return -1;
+    }
+  }
+  if (optind != argc - 1 || p.cfg.frame_size == 0 || p.cfg.num_slots == 0 ||
+      strlen (argv[optind]) >= sizeof (addr.sun_path)) {
+    usage (argv[0]);
+    return -1;
+  }
+  p.cfg.socket_path = argv[optind];
+  if (p.cfg.raw_path && !map_raw (&p))
+    return -1;
+  p.slot_size = ROUND_UP (p.cfg.frame_size, PRODUCER_ALIGN);
+  p.busy = g_new0 (gboolean, p.cfg.num_slots);
+  p.sent_at = g_new0 (gint64, p.cfg.num_slots);
+
+  strcpy (addr.sun_path, p.cfg.socket_path);
+  unlink (p.cfg.socket_path);
+  listener = socket (AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (listener < 0 || bind (listener, (struct sockaddr *) &addr, sizeof (addr)) != 0 ||
+      listen (listener, 1) != 0) {
+    g_printerr ("Failed to listen on %s: %s\n", p.cfg.socket_path,
+        strerror (errno));
+    return -1;
+  }
+  g_print ("Waiting for the app on %s, %u slots of %lu bytes\n",
+      p.cfg.socket_path, p.cfg.num_slots, (unsigned long) p.cfg.frame_size);
+  p.sock = accept4 (listener, NULL, NULL, SOCK_CLOEXEC);
+  if (p.sock < 0) {
+    g_printerr ("accept failed: %s\n", strerror (errno));
+    return -1;
+  }
+
+  ret = serve (&p);
+  close (p.sock);
+  close (listener);
+  unlink (p.cfg.socket_path);
+  g_free (p.busy);
+  g_free (p.sent_at);
+  return ret;
+}
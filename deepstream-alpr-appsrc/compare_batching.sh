@@ -0,0 +1,51 @@
+#!/bin/sh
+# Compare N single source processes with one N source batched process on the
+# same raw files. Run from this directory after make.
+#
+#   ./compare_batching.sh <fps> <format> <raw file> [<raw file> ...]
+
+APP=./deepstream-alpr-appsrc
+CONFIG=deepstream_alpr_appsrc_app_config.txt
+
+if [ $# -lt 3 ]; then
+  echo "Usage: $0 <fps> <format(I420, NV12, RGBA)> <raw file> [<raw file> ...]" >&2
+  exit 1
+fi
+FPS=$1
+FORMAT=$2
+shift 2
+N=$#
+
+LOG=$(mktemp -d)
+cp $CONFIG $LOG/config.orig
+trap 'cp $LOG/config.orig $CONFIG; rm -rf $LOG' EXIT INT TERM
+
+# throughput: <n> sources, <frames> frames in <sec> s, <fps> fps
+frames() { awk '/^throughput:/ { print $4 }' "$@"; }
+
+echo "== $N processes, batch 1"
+START=$(date +%s.%N)
+I=0
+for RAW in "$@"; do
+  $APP $RAW $FPS $FORMAT > $LOG/single$I.log 2>&1 &
+  I=$((I + 1))
+done
+wait
+END=$(date +%s.%N)
+TOTAL=$(frames $LOG/single*.log | awk '{ s += $1 } END { print s + 0 }')
+awk -v f=$TOTAL -v s=$START -v e=$END \
+    'BEGIN { printf "%d frames in %.2f s, %.1f fps\n", f, e - s, f / (e - s) }'
+
+echo "== 1 process, batch $N"
+grep -v '^source[0-9]' $LOG/config.orig > $CONFIG
+I=0
+for RAW in "$@"; do
+  echo "source$I = $RAW,$FPS,$FORMAT" >> $CONFIG
+  I=$((I + 1))
+done
+START=$(date +%s.%N)
+$APP > $LOG/batched.log 2>&1
+END=$(date +%s.%N)
+TOTAL=$(frames $LOG/batched.log)
+awk -v f=${TOTAL:-0} -v s=$START -v e=$END \
+    'BEGIN { printf "%d frames in %.2f s, %.1f fps\n", f, e - s, f / (e - s) }'
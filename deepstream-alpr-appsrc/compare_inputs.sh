@@ -0,0 +1,52 @@
+#!/bin/sh
+# Compare disk bytes per frame and end-to-end fps of the same footage read
+# as raw frames and as an encoded file, decoded by the hardware and the
+# software decoder. Runs in benchmark mode. Run from this directory after make.
+#
+#   ./compare_inputs.sh <fps> <raw file> <raw format> <encoded file> <encoded format>
+
+APP=./deepstream-alpr-appsrc
+CONFIG=deepstream_alpr_appsrc_app_config.txt
+
+if [ $# -ne 5 ]; then
+  echo "Usage: $0 <fps> <raw file> <format(I420, NV12, RGBA)>" \
+      "<encoded file> <format(H264, H265, MP4, MKV)>" >&2
+  exit 1
+fi
+
+LOG=$(mktemp -d)
+cp $CONFIG $LOG/config.orig
+trap 'cp $LOG/config.orig $CONFIG; rm -rf $LOG' EXIT INT TERM
+
+# throughput: ..., <fps> fps
+# input: <bytes> bytes read, <bytes per frame> bytes per frame
+run() {
+  NAME=$1
+  FILE=$2
+  FORMAT=$3
+  DECODER=$4
+  grep -v '^benchmark\|^source_decoder' $LOG/config.orig > $CONFIG
+  echo "benchmark = 1" >> $CONFIG
+  echo "benchmark_summary = $LOG/$NAME.json" >> $CONFIG
+  echo "source_decoder = $DECODER" >> $CONFIG
+  $APP $FILE $FPS $FORMAT > $LOG/$NAME.log 2>&1
+  awk -v n=$NAME '
+    /^throughput:/ { fps = $(NF - 1) }
+    /^input:/ { bytes = $(NF - 3) }
+    END { print n, bytes, fps }' $LOG/$NAME.log
+}
+
+FPS=$1
+{
+  run raw $2 $3 hw
+  run encoded-hw $4 $5 hw
+  run encoded-sw $4 $5 sw
+} | awk '
+  { name[NR] = $1; bytes[NR] = $2; fps[NR] = $3 }
+  END {
+    printf "%-12s %16s %10s %10s\n", "input", "disk bytes/frame", "fps",
+        "vs raw"
+    for (i = 1; i <= NR; i++)
+      printf "%-12s %16.0f %10.1f %9.2fx\n", name[i], bytes[i], fps[i],
+          (fps[1] > 0 ? fps[i] / fps[1] : 0)
+  }'
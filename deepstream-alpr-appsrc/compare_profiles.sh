@@ -0,0 +1,49 @@
+#!/bin/sh
+# Measure what each optional branch of the pipeline costs per frame by running
+# the same raw file with the branch removed. Run from this directory after make.
+#
+#   ./compare_profiles.sh <raw file> <fps> <format>
+
+APP=./deepstream-alpr-appsrc
+CONFIG=deepstream_alpr_appsrc_app_config.txt
+
+if [ $# -ne 3 ]; then
+  echo "Usage: $0 <raw file> <fps> <format(I420, NV12, RGBA)>" >&2
+  exit 1
+fi
+
+LOG=$(mktemp -d)
+cp $CONFIG $LOG/config.orig
+trap 'cp $LOG/config.orig $CONFIG; rm -rf $LOG' EXIT INT TERM
+
+# frame time: ..., <wall> ms wall, <cpu> ms cpu per frame
+run() {
+  NAME=$1
+  shift
+  grep -v '^pipeline_\|^sgie[0-9]_enable' $LOG/config.orig > $CONFIG
+  for KEY in "$@"; do
+    echo "$KEY" >> $CONFIG
+  done
+  $APP $RAW $FPS $FORMAT > $LOG/$NAME.log 2>&1
+  awk -v n=$NAME '/^frame time:/ { print n, $(NF - 7), $(NF - 4) }' $LOG/$NAME.log
+}
+
+RAW=$1
+FPS=$2
+FORMAT=$3
+{
+  run full "pipeline_profile = display"
+  run no-appsink "pipeline_profile = display" "pipeline_appsink = 0"
+  run no-osd "pipeline_profile = display" "pipeline_osd = 0"
+  run headless "pipeline_profile = headless"
+  run headless-no-make-type "pipeline_profile = headless" "sgie3_enable = 0" \
+      "sgie4_enable = 0"
+} | awk '
+  { name[NR] = $1; wall[NR] = $2; cpu[NR] = $3 }
+  END {
+    printf "%-22s %10s %10s %12s %12s\n", "profile", "wall ms", "cpu ms",
+        "wall saved", "cpu saved"
+    for (i = 1; i <= NR; i++)
+      printf "%-22s %10.3f %10.3f %12.3f %12.3f\n", name[i], wall[i], cpu[i],
+          wall[1] - wall[i], cpu[1] - cpu[i]
+  }'
@@ -26,9 +26,24 @@
 #include <glib.h>
 #include <stdio.h>
 #include <string.h>
+#include <math.h>
+#include <sys/resource.h>
 #include <cuda_runtime_api.h>
 #include "gstnvdsmeta.h"
 #include "gstnvdsinfer.h"
+#include "nvbufsurface.h"
+#include "appsrc_io.h"
+#include "appsrc_feeder.h"
+#include "result_writer.h"
+#include "plate_store.h"
+#include "track_consensus.h"
+#include "lpr_gate.h"
+#include "vehicle_join.h"
+#include "runtime_config.h"
+#include "stage_trace.h"
+#include "evidence_export.h"
+#include "hotlist.h"
+#include "nvinfer_custom_lpr_parser/lpr_char_meta.h"
 
 #define CONFIG_PATH "deepstream_alpr_appsrc_app_config.txt"
 
@@ -74,55 +89,270 @@ gint muxer_live_source = 0;
 gint muxer_batch_size = 0;
 gint muxer_batched_push_timeout = 0;
 gint muxer_nvbuf_memory_type = 0;
-gint open_everyobject_output = 0;
-gint open_everycar_classification = 0;
-gint lpr_word_limit = 0;
-gint lpr_word_count = 0;
+gchar appsrc_io_engine[SIZE] = "read";
+gint appsrc_io_depth = 4;
+gint appsrc_prefetch_depth = 8;
+gchar source_decoder[SIZE] = "hw";
+gint live_latency_ms = 0;
+gchar live_policy[SIZE] = "drop";
+gchar result_output[SIZE] = "-";
+gchar result_format[SIZE] = "csv";
+gint result_queue_size = 4096;
+gchar result_overflow[SIZE] = "block";
+gchar result_fsync[SIZE] = "none";
+guint64 result_rotate_bytes = 0;
+gint result_rotate_keep = 5;
+gchar result_store_dir[SIZE] = "";
+guint64 result_store_segment_bytes = 64 << 20;
+gchar result_store_socket[SIZE] = "";
+gchar hotlist_path[SIZE] = "";
+gint hotlist_near_miss = 1;
+gchar hotlist_alert_output[SIZE] = "hotlist_alerts.jsonl";
+gint hotlist_alert_queue_size = 1024;
+gint consensus_enable = 0;
+gint consensus_timeout = 30;
+gint consensus_dwell = 0;
+gint lpr_gate_enable = 0;
+gint lpr_gate_sharpness = 0;
+gchar lpr_gate_trace[SIZE] = "";
+gint latency_report = 0;
+gint stage_trace_enable = 0;
+gchar evidence_dir[SIZE] = "";
+gint evidence_workers = 2;
+gint evidence_queue_size = 16;
+gint evidence_jpeg_quality = 90;
+gint stage_trace_interval = 10;
+gchar stage_trace_chrome[SIZE] = "";
+gint config_reload = 1;
+gint benchmark = 0;
+gchar benchmark_summary[SIZE] = "benchmark.json";
+gchar benchmark_label[SIZE] = "";
+gchar pipeline_profile[SIZE] = "display";
+gint pipeline_osd = 1;
+gint pipeline_appsink = 1;
+
+/* Compiled-in live settings, the starting point of every config file read */
+static const RuntimeConfig live_config_defaults = {
+  .open_everyobject_output = 0,
+  .open_everycar_classification = 0,
+  .lpr_word_limit = 0,
+  .lpr_word_count = 0,
+  .lpr_gate_min_readings = 3,
+  .lpr_gate_strong_confidence = 0.8,
+  .lpr_gate = {
+    .min_score = 0.15,
+    .better_margin = 0.1,
+    .ideal_width = 100,
+    .aspect_min = 1.5,
+    .aspect_max = 5.0,
+    .sharpness_ref = 300,
+    .track_timeout = 30,
+  },
+};
+
+/* Settings read by the probes, published as a new snapshot on every change
+ * of the config file */
+RuntimeConfig live_config;
+
+/* Last value of every other setting, to report the ones that need a restart */
+static GHashTable *config_values;
+static ConfigWatch *config_watch;
+
+#define NUM_SGIES 5
+
+/* sgie0 (plate detector) and sgie1 (LPR) always run, the vehicle
+ * classifiers sgie2..4 can be left out. batch-size 0 keeps the infer config. */
+gint sgie_enable[NUM_SGIES] = { 1, 1, 1, 1, 1 };
+gint sgie_batch_size[NUM_SGIES] = { 0 };
+
+#define MAX_SOURCES 16
+
+/* One raw or encoded input, from the command line or a source<N> config line */
+typedef struct _SourceConfig
+{
+  gchar path[SIZE];
+  glong fps;
+  gchar format[8];
+  gint width;                   /* 0 = muxer_width */
+  gint height;                  /* 0 = muxer_height */
+} SourceConfig;
+
+SourceConfig source_configs[MAX_SOURCES];
+guint num_sources = 0;
+
+/* User meta type of the per-character plate confidences */
+static NvDsMetaType lpr_char_meta_type;
+
+/* Results are written off the streaming thread */
+static ResultWriter *result_writer;
+
+/* Plate results searchable across restarts, appended by the result writer */
+static PlateStore *plate_store;
+
+/* Emitted plates are matched against the hotlist, swapped under the lock
+ * when the file changes */
+static Hotlist *hotlist;
+static GMutex hotlist_lock;
+static HotlistAlerts *hotlist_alerts;
+static ConfigWatch *hotlist_watch;
+
+/* Readings are voted into one result per vehicle when enabled */
+static TrackConsensus *track_consensus;
+
+/* Plate crops not worth an LPR inference are hidden from sgie1 */
+static LprGate *lpr_gate;
+static FILE *lpr_gate_trace_file;
+
+/* Time from streammux to the end of the last GIE and of the results probe,
+ * per batch.
+ * Batches are matched by PTS through a small ring of streammux times. */
+#define LATENCY_RING 64
 
-/* These are the strings of the labels for the respective models */
+typedef struct _LatencyReport
+{
+  GMutex lock;
+  GstClockTime pts[LATENCY_RING];
+  gint64 mux_time[LATENCY_RING];
+  guint next;
+  GArray *pipeline_us;          /* streammux src -> last GIE src */
+  GArray *probe_us;             /* results probe body */
+} LatencyReport;
+
+static LatencyReport *latency;
+
+/* Latency of every element of the pipeline and of the results probe */
+static StageTrace *stage_trace;
+static guint results_stage;
+
+/* JPEG crops of the best frame of every emitted vehicle */
+static EvidenceExport *evidence;
+
+/* Plates read by the LPR classifier, counted by the results probe */
+static guint64 plates_read;
+
+/* Low level tracker config, for the benchmark summary */
+static gchar *tracker_ll_config;
+
+/* Vehicles and plates of the frame in the results probe */
+static VehicleJoin *vehicle_join;
+
+/* These are the strings of the labels for the respective models, in the
+ * order of their labels.txt */
 gchar pgie_classes_str[4][32] = { "Vehicle", "TwoWheeler", "Person", "RoadSign" };
 
 gchar sgie2_classes_str[12][32] = { "black", "blue", "brown", "gold", "green",
   "grey", "maroon", "orange", "red", "silver", "white", "yellow"
 };
 
-gchar sgie3_classes_str[20][32] = { "Acura", "Audi", "BMW", "Chevrolet", "Chrysler",
-  "Dodge", "Ford", "GMC", "Honda", "Hyundai", "Infiniti", "Jeep", "Kia",
-      "Lexus", "Mazda", "Mercedes", "Nissan",
-  "Subaru", "Toyota", "Volkswagen"
+gchar sgie3_classes_str[20][32] = { "acura", "audi", "bmw", "chevrolet", "chrysler",
+  "dodge", "ford", "gmc", "honda", "hyundai", "infiniti", "jeep", "kia",
+      "lexus", "mazda", "mercedes", "nissan",
+  "subaru", "toyota", "volkswagen"
 };
 
 gchar sgie4_classes_str[6][32] = { "coupe", "largevehicle", "sedan", "suv",
   "truck", "van"
 };
 
-/* Structure to contain all our information for appsrc,
+/* Structure to contain all our information for one source,
  * so we can pass it to callbacks */
 typedef struct _AppSrcData
 {
+  guint source_id;              /* streammux sink pad index */
   GstElement *app_source;
   long frame_size;
-  FILE *file;                   /* Pointer to the raw video file */
-  gint appsrc_frame_num;
+  AppSrcIo *io;                 /* Reader of the raw video file */
+  AppSrcFeeder *feeder;         /* Threads reading ahead and pushing frames */
   guint fps;                    /* To set the FPS value */
-  guint sourceid;               /* To control the GSource */
+
+  /* Encoded sources: filesrc -> [demuxer] -> parser -> decoder -> converter */
+  GstElement *pipeline;
+  GstElement *converter;
+  gboolean decoding;            /* Decoder added for the video stream */
+  guint64 frames;               /* Frames decoded */
+  guint64 bytes_read;           /* Bytes read from the file */
 } AppSrcData;
 
+/* Feeders by streammux pad in live mode, told the end-to-end latency by the
+ * results probe */
+static AppSrcFeeder *live_feeders[MAX_SOURCES];
+
+/* H.264 and H.265 elementary streams, and MP4 and MKV files holding them */
+static gboolean
+source_format_is_encoded (const gchar * format)
+{
+  return !g_strcmp0 (format, "H264") || !g_strcmp0 (format, "H265") ||
+      !g_strcmp0 (format, "MP4") || !g_strcmp0 (format, "MKV");
+}
+
+static gboolean
+source_format_is_valid (const gchar * format)
+{
+  return !g_strcmp0 (format, "I420") || !g_strcmp0 (format, "RGBA") ||
+      !g_strcmp0 (format, "NV12") || source_format_is_encoded (format);
+}
+
+/* Fill config from "<raw file>,<fps>,<format>[,<width>x<height>]" */
+static gboolean
+parse_source_config (const gchar * value, SourceConfig * config)
+{
+  gchar **fields = g_strsplit (value, ",", -1);
+  gboolean ok = FALSE;
+  gchar *endptr = NULL;
+
+  memset (config, 0, sizeof (*config));
+  if (g_strv_length (fields) < 3 || g_strv_length (fields) > 4)
+    goto done;
+
+  g_strlcpy (config->path, fields[0], sizeof (config->path));
+  config->fps = g_ascii_strtoll (fields[1], &endptr, 10);
+  if (config->fps <= 0 || endptr == fields[1])
+    goto done;
+  g_strlcpy (config->format, fields[2], sizeof (config->format));
+  if (!source_format_is_valid (config->format))
+    goto done;
+  if (fields[3] && sscanf (fields[3], "%dx%d", &config->width, &config->height) != 2)
+    goto done;
+  ok = config->path[0] != '\0' && config->width >= 0 && config->height >= 0;
+
+done:
+  g_strfreev (fields);
+  return ok;
+}
+
+/* Next "name = value" line of fp, skipping comments and blank lines */
+static gboolean
+read_config_line(FILE *fp, char *name, char *value){
+  char line[SIZE * 2];
+
+  while(fgets(line, sizeof(line), fp)){
+    memset(name,0,SIZE);
+    memset(value,0,SIZE);
+    if(sscanf(line, " %255[^#= \t\n] = %255s", name, value) == 2)
+      return TRUE;
+  }
+  return FALSE;
+}
+
 static void
 readConfig(){ 
   char name[SIZE];
   char value[SIZE];
   
+  config_values = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  live_config = live_config_defaults;
   FILE *fp = fopen(CONFIG_PATH, "r");
   if (fp == NULL){
     return;
   }else{
-    while(!feof(fp)){
-      memset(name,0,SIZE);
-      memset(value,0,SIZE);
-
-      /*Read Data*/
-      fscanf(fp,"%s = %s\n", name, value);
+    /*Read Data*/
+    while(read_config_line(fp, name, value)){
+      if(runtime_config_parse(&live_config, name, value))
+      {
+        /* Live settings, also read by reload_config */
+        continue;
+      }
+      g_hash_table_replace(config_values, g_strdup(name), g_strdup(value));
 
       if(!strcmp(name, "muxer_width"))
       {
@@ -148,17 +378,144 @@ readConfig(){
       {
         muxer_nvbuf_memory_type = atoi(value);
       }
-      else if(!strcmp(name, "open_everyobject_output")){
-        open_everyobject_output = atoi(value);
+      else if(!strcmp(name, "appsrc_io_engine")){
+        g_strlcpy(appsrc_io_engine, value, SIZE);
+      }
+      else if(!strcmp(name, "appsrc_io_depth")){
+        appsrc_io_depth = atoi(value);
+      }
+      else if(!strcmp(name, "appsrc_prefetch_depth")){
+        appsrc_prefetch_depth = atoi(value);
+      }
+      else if(!strcmp(name, "source_decoder")){
+        g_strlcpy(source_decoder, value, SIZE);
+      }
+      else if(!strcmp(name, "live_latency_ms")){
+        live_latency_ms = atoi(value);
+      }
+      else if(!strcmp(name, "live_policy")){
+        g_strlcpy(live_policy, value, SIZE);
+      }
+      else if(!strcmp(name, "result_output")){
+        g_strlcpy(result_output, value, SIZE);
+      }
+      else if(!strcmp(name, "result_format")){
+        g_strlcpy(result_format, value, SIZE);
+      }
+      else if(!strcmp(name, "result_queue_size")){
+        result_queue_size = atoi(value);
+      }
+      else if(!strcmp(name, "result_overflow")){
+        g_strlcpy(result_overflow, value, SIZE);
+      }
+      else if(!strcmp(name, "result_fsync")){
+        g_strlcpy(result_fsync, value, SIZE);
+      }
+      else if(!strcmp(name, "result_rotate_bytes")){
+        result_rotate_bytes = g_ascii_strtoull(value, NULL, 10);
+      }
+      else if(!strcmp(name, "result_rotate_keep")){
+        result_rotate_keep = atoi(value);
+      }
+      else if(!strcmp(name, "result_store_dir")){
+        g_strlcpy(result_store_dir, value, SIZE);
+      }
+      else if(!strcmp(name, "result_store_segment_bytes")){
+        result_store_segment_bytes = g_ascii_strtoull(value, NULL, 10);
+      }
+      else if(!strcmp(name, "result_store_socket")){
+        g_strlcpy(result_store_socket, value, SIZE);
+      }
+      else if(!strcmp(name, "hotlist")){
+        g_strlcpy(hotlist_path, value, SIZE);
       }
-      else if(!strcmp(name, "open_everycar_classification")){
-        open_everycar_classification = atoi(value);
+      else if(!strcmp(name, "hotlist_near_miss")){
+        hotlist_near_miss = atoi(value);
       }
-      else if(!strcmp(name, "lpr_word_limit")){
-        lpr_word_limit = atoi(value);
+      else if(!strcmp(name, "hotlist_alert_output")){
+        g_strlcpy(hotlist_alert_output, value, SIZE);
       }
-      else if(!strcmp(name, "lpr_word_count")){
-        lpr_word_count = atoi(value);
+      else if(!strcmp(name, "hotlist_alert_queue_size")){
+        hotlist_alert_queue_size = atoi(value);
+      }
+      else if(!strcmp(name, "latency_report")){
+        latency_report = atoi(value);
+      }
+      else if(!strcmp(name, "evidence_dir")){
+        g_strlcpy(evidence_dir, value, SIZE);
+      }
+      else if(!strcmp(name, "evidence_workers")){
+        evidence_workers = atoi(value);
+      }
+      else if(!strcmp(name, "evidence_queue_size")){
+        evidence_queue_size = atoi(value);
+      }
+      else if(!strcmp(name, "evidence_jpeg_quality")){
+        evidence_jpeg_quality = atoi(value);
+      }
+      else if(!strcmp(name, "stage_trace")){
+        stage_trace_enable = atoi(value);
+      }
+      else if(!strcmp(name, "stage_trace_interval")){
+        stage_trace_interval = atoi(value);
+      }
+      else if(!strcmp(name, "stage_trace_chrome")){
+        g_strlcpy(stage_trace_chrome, value, SIZE);
+      }
+      else if(!strcmp(name, "consensus_enable")){
+        consensus_enable = atoi(value);
+      }
+      else if(!strcmp(name, "consensus_timeout")){
+        consensus_timeout = atoi(value);
+      }
+      else if(!strcmp(name, "consensus_dwell")){
+        consensus_dwell = atoi(value);
+      }
+      else if(!strcmp(name, "lpr_gate_enable")){
+        lpr_gate_enable = atoi(value);
+      }
+      else if(!strcmp(name, "lpr_gate_sharpness")){
+        lpr_gate_sharpness = atoi(value);
+      }
+      else if(!strcmp(name, "lpr_gate_trace")){
+        g_strlcpy(lpr_gate_trace, value, SIZE);
+      }
+      else if(!strcmp(name, "config_reload")){
+        config_reload = atoi(value);
+      }
+      else if(!strcmp(name, "benchmark")){
+        benchmark = atoi(value);
+      }
+      else if(!strcmp(name, "benchmark_summary")){
+        g_strlcpy(benchmark_summary, value, SIZE);
+      }
+      else if(!strcmp(name, "benchmark_label")){
+        g_strlcpy(benchmark_label, value, SIZE);
+      }
+      else if(!strcmp(name, "pipeline_profile")){
+        g_strlcpy(pipeline_profile, value, SIZE);
+      }
+      else if(!strcmp(name, "pipeline_osd")){
+        pipeline_osd = atoi(value);
+      }
+      else if(!strcmp(name, "pipeline_appsink")){
+        pipeline_appsink = atoi(value);
+      }
+      else if(!strncmp(name, "sgie", 4) && g_ascii_isdigit(name[4]) && name[4] - '0' < NUM_SGIES){
+        guint id = name[4] - '0';
+        if(!strcmp(name + 5, "_enable") && id >= 2)
+          sgie_enable[id] = atoi(value);
+        else if(!strcmp(name + 5, "_batch_size"))
+          sgie_batch_size[id] = atoi(value);
+        else
+          g_printerr("Invalid sgie config %s = %s\n", name, value);
+      }
+      else if(!strncmp(name, "source", 6) && g_ascii_isdigit(name[6])){
+        guint id = atoi(name + 6);
+        if(id < MAX_SOURCES && parse_source_config(value, &source_configs[id]))
+          num_sources = MAX(num_sources, id + 1);
+        else
+          g_printerr("Invalid source config %s = %s\n", name, value);
       }
     }
   }
@@ -167,6 +524,54 @@ readConfig(){
   return;
 }
 
+/* Called by the config watch thread whenever the config file was written:
+ * publishes the live settings as a new snapshot and reports changes to the
+ * others, which only take effect after a restart */
+static void
+reload_config(gpointer user_data){
+  char name[SIZE];
+  char value[SIZE];
+  const RuntimeConfig *current = runtime_config_get();
+  RuntimeConfig config = live_config_defaults;
+  GHashTable *seen = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  GHashTableIter iter;
+  gpointer key;
+
+  FILE *fp = fopen(CONFIG_PATH, "r");
+  if (fp == NULL){
+    g_printerr("Cannot reload %s\n", CONFIG_PATH);
+    g_hash_table_destroy(seen);
+    return;
+  }
+  while(read_config_line(fp, name, value)){
+    if(runtime_config_parse(&config, name, value))
+      continue;
+    if(g_strcmp0(g_hash_table_lookup(config_values, name), value) != 0){
+      g_print("config: %s changed to %s, takes effect after a restart\n", name, value);
+      g_hash_table_replace(config_values, g_strdup(name), g_strdup(value));
+    }
+    g_hash_table_add(seen, g_strdup(name));
+  }
+  fclose(fp);
+  /* Keys missing from the file fall back to their defaults, the track
+   * timeout follows consensus_timeout which needs a restart */
+  config.version = current->version;
+  config.lpr_gate.track_timeout = current->lpr_gate.track_timeout;
+
+  g_hash_table_iter_init(&iter, config_values);
+  while(g_hash_table_iter_next(&iter, &key, NULL)){
+    if(!g_hash_table_contains(seen, key)){
+      g_print("config: %s removed, takes effect after a restart\n", (gchar *) key);
+      g_hash_table_iter_remove(&iter);
+    }
+  }
+  g_hash_table_destroy(seen);
+
+  config.version++;
+  runtime_config_publish(&config);
+  g_print("config: reloaded %s, version %u\n", CONFIG_PATH, config.version);
+}
+
 /* new_sample is an appsink callback that will extract metadata received
  * tee sink pad and update params for drawing rectangle,
  *object information etc. */
@@ -222,326 +627,695 @@ new_sample (GstElement * sink, gpointer * data)
   return GST_FLOW_ERROR;
 }
 
-/* This method is called by the idle GSource in the mainloop, 
- * to feed one raw video frame into appsrc.
- * The idle handler is added to the mainloop when appsrc requests us
- * to start sending data (need-data signal)
- * and is removed when appsrc has enough data (enough-data signal).
- */
-static gboolean
-read_data (AppSrcData * data)
+/* This signal callback triggers when appsrc needs data. The feeder threads
+ * read ahead all the time, here we only let them push into appsrc */
+static void
+start_feed (GstElement * source, guint size, AppSrcData * data)
 {
-  GstBuffer *buffer;
-  GstFlowReturn gstret;
-
-  size_t ret = 0;
-  GstMapInfo map;
-  buffer = gst_buffer_new_allocate (NULL, data->frame_size, NULL);
+  appsrc_feeder_set_wanted (data->feeder, TRUE);
+}
 
-  gst_buffer_map (buffer, &map, GST_MAP_WRITE);
-  ret = fread (map.data, 1, data->frame_size, data->file);
-  map.size = ret;
+/* This callback triggers when appsrc has enough data and we can stop sending.
+ * Frames keep being read ahead until the ring is full */
+static void
+stop_feed (GstElement * source, AppSrcData * data)
+{
+  appsrc_feeder_set_wanted (data->feeder, FALSE);
+}
 
-  gst_buffer_unmap (buffer, &map);
-  if (ret > 0) {
-#if CUSTOM_PTS
-    GST_BUFFER_PTS (buffer) =
-        gst_util_uint64_scale (data->appsrc_frame_num, GST_SECOND, data->fps);
-#endif
-    gstret = gst_app_src_push_buffer ((GstAppSrc *) data->app_source, buffer);
-    if (gstret != GST_FLOW_OK) {
-      g_print ("gst_app_src_push_buffer returned %d \n", gstret);
-      return FALSE;
-    }
-  } else if (ret == 0) {
-    gstret = gst_app_src_end_of_stream ((GstAppSrc *) data->app_source);
-    if (gstret != GST_FLOW_OK) {
-      g_print
-          ("gst_app_src_end_of_stream returned %d. EoS not queued successfully.\n",
-          gstret);
-      return FALSE;
-    }
-  } else {
-    g_print ("\n failed to read from file\n");
-    return FALSE;
-  }
-  data->appsrc_frame_num++;
+static gpointer
+lpr_char_meta_copy (gpointer data, gpointer user_data)
+{
+  NvDsUserMeta *user_meta = (NvDsUserMeta *) data;
+  LprCharMeta *char_meta = g_new (LprCharMeta, 1);
 
-  return TRUE;
+  memcpy (char_meta, user_meta->user_meta_data, sizeof (LprCharMeta));
+  return char_meta;
 }
 
-/* This signal callback triggers when appsrc needs data. Here,
- * we add an idle handler to the mainloop to start pushing
- * data into the appsrc */
 static void
-start_feed (GstElement * source, guint size, AppSrcData * data)
+lpr_char_meta_release (gpointer data, gpointer user_data)
 {
-  if (data->sourceid == 0) {
-    data->sourceid = g_idle_add ((GSourceFunc) read_data, data);
-  }
+  NvDsUserMeta *user_meta = (NvDsUserMeta *) data;
+
+  g_free (user_meta->user_meta_data);
+  user_meta->user_meta_data = NULL;
 }
 
-/* This callback triggers when appsrc has enough data and we can stop sending.
- * We remove the idle handler from the mainloop */
-static void
-stop_feed (GstElement * source, AppSrcData * data)
+/* Laplacian variance of the luma under rect in frame batch_id of a mapped
+ * surface, -1 when the format has no usable luma */
+static gfloat
+plate_sharpness (NvBufSurface * surface, guint batch_id,
+    NvOSD_RectParams * rect)
 {
-  if (data->sourceid != 0) {
-    g_source_remove (data->sourceid);
-    data->sourceid = 0;
+  NvBufSurfaceParams *params = &surface->surfaceList[batch_id];
+  guint8 *pixels = (guint8 *) params->mappedAddr.addr[0];
+  guint pitch = params->planeParams.pitch[0];
+  guint pixel_step;
+  gint left = MAX ((gint) rect->left, 0);
+  gint top = MAX ((gint) rect->top, 0);
+  gint right = MIN ((gint) (rect->left + rect->width), (gint) params->width);
+  gint bottom = MIN ((gint) (rect->top + rect->height), (gint) params->height);
+
+  switch (params->colorFormat) {
+    case NVBUF_COLOR_FORMAT_NV12:
+    case NVBUF_COLOR_FORMAT_NV12_ER:
+    case NVBUF_COLOR_FORMAT_YUV420:
+    case NVBUF_COLOR_FORMAT_GRAY8:
+      pixel_step = 1;
+      break;
+    case NVBUF_COLOR_FORMAT_RGBA:
+    case NVBUF_COLOR_FORMAT_BGRA:
+    case NVBUF_COLOR_FORMAT_RGBx:
+    case NVBUF_COLOR_FORMAT_BGRx:
+      /* The G byte stands in for luma */
+      pixel_step = 4;
+      pixels += 1;
+      break;
+    default:
+      return -1;
   }
+  if (!pixels || right - left < 3 || bottom - top < 3)
+    return -1;
+
+  return lpr_laplacian_variance (pixels + (gsize) top * pitch + left * pixel_step,
+      pitch, pixel_step, right - left, bottom - top);
 }
 
-/* sgie4_src_pad_buffer_probe  will extract metadata received from sgie
- * and update params for drawing rectangle, object information etc. */
+/* sgie1_sink_pad_buffer_probe scores every plate crop before the LPR GIE.
+ * Crops that are neither better than the best crop of their vehicle nor
+ * needed by a weak consensus get LPR_GATE_SKIPPED_ID, so sgie1 passes over
+ * them. The sharpness and score ride along in misc_obj_info for the trace. */
 static GstPadProbeReturn
-sgie4_src_pad_buffer_probe (GstPad * pad, GstPadProbeInfo * info,
+sgie1_sink_pad_buffer_probe (GstPad * pad, GstPadProbeInfo * info,
     gpointer u_data)
 {
-  guint64 track_id = 0;
-  guint64 vehicle_track_id = 0;
-  gchar license_plate[SIZE] = {0};
-  float lpr_confidence = 0;
-  gchar vehicle_color[SIZE] = {0};
-  gchar vehicle_make[SIZE] = {0};
-  gchar vehicle_type[SIZE] = {0};
-  static guint use_device_mem = 0;
-
+  static const RuntimeConfig *gate_config;
+  const RuntimeConfig *config = runtime_config_get ();
   GstBuffer *buf = (GstBuffer *)info->data;
   NvDsBatchMeta *batch_meta = gst_buffer_get_nvds_batch_meta(buf);
+  NvBufSurface *surface = NULL;
+  GstMapInfo map_info;
 
-  for (NvDsMetaList *l_frame = batch_meta->frame_meta_list; l_frame != NULL; l_frame = l_frame->next) 
+  /* The gate takes reloaded thresholds from the thread that runs it */
+  if (lpr_gate && config != gate_config)
+    lpr_gate_set_config (lpr_gate, &config->lpr_gate);
+  gate_config = config;
+
+  /* The frames are only readable by the CPU in unified / surface array memory */
+  if (lpr_gate_sharpness && gst_buffer_map (buf, &map_info, GST_MAP_READ))
+    surface = (NvBufSurface *) map_info.data;
+
+  for (NvDsMetaList *l_frame = batch_meta->frame_meta_list; l_frame != NULL; l_frame = l_frame->next)
   {
     NvDsFrameMeta *frame_meta = (NvDsFrameMeta *) (l_frame->data);
-    if(frame_meta->obj_meta_list == NULL)
+    gboolean mapped = FALSE;
+    gboolean map_failed = FALSE;
+
+    for (NvDsMetaList *l_obj = frame_meta->obj_meta_list; l_obj != NULL; l_obj = l_obj->next)
     {
-      continue;
+      NvDsObjectMeta *obj_meta = (NvDsObjectMeta *) (l_obj->data);
+      gfloat sharpness = -1;
+      if(obj_meta->unique_component_id != 2)
+      {
+        continue;
+      }
+
+      if (surface && !mapped && !map_failed)
+      {
+        mapped = NvBufSurfaceMap (surface, frame_meta->batch_id, 0, NVBUF_MAP_READ) == 0;
+        map_failed = !mapped;
+        if (mapped)
+          NvBufSurfaceSyncForCpu (surface, frame_meta->batch_id, 0);
+      }
+      if (mapped)
+        sharpness = plate_sharpness (surface, frame_meta->batch_id, &obj_meta->rect_params);
+
+      gfloat score = lpr_gate_score (&config->lpr_gate, obj_meta->rect_params.width,
+          obj_meta->rect_params.height, sharpness);
+      obj_meta->misc_obj_info[0] = sharpness < 0 ? -1 : (gint64) (sharpness * 1000);
+      obj_meta->misc_obj_info[1] = (gint64) (score * 1000000);
+      if (!lpr_gate)
+      {
+        continue;
+      }
+
+      gint64 vehicle_id = obj_meta->parent ? (gint64) obj_meta->parent->object_id : -1;
+      gboolean weak = FALSE;
+      if (track_consensus)
+      {
+        /* Weak by the OCR confidence of the vote: a well detected plate can
+         * still be misread */
+        guint readings = 0;
+        gfloat ocr_confidence = 0;
+        weak = !track_consensus_query (track_consensus, vehicle_id, &readings, &ocr_confidence) ||
+            readings < (guint) config->lpr_gate_min_readings ||
+            ocr_confidence < config->lpr_gate_strong_confidence;
+      }
+      if (!lpr_gate_decide (lpr_gate, vehicle_id, score, weak))
+      {
+        obj_meta->unique_component_id = LPR_GATE_SKIPPED_ID;
+      }
     }
 
-    float obj_lpr_box_left = 0;
-    float obj_lpr_box_top = 0;
-    float obj_lpr_box_height = 0;
-    float obj_lpr_box_width = 0;
-    float obj_car_box_left = 0;
-    float obj_car_box_top = 0;
-    float obj_car_box_height = 0;
-    float obj_car_box_width = 0;
+    if (mapped)
+      NvBufSurfaceUnMap (surface, frame_meta->batch_id, 0);
+  }
+
+  if (surface)
+    gst_buffer_unmap (buf, &map_info);
+  if (lpr_gate)
+    lpr_gate_tick (lpr_gate);
+  return GST_PAD_PROBE_OK;
+}
 
-    for (NvDsMetaList *l_obj = frame_meta->obj_meta_list; l_obj != NULL; l_obj = l_obj->next) 
+/* One trace line per plate crop, see lpr_gate_eval.c:
+ * batch,source,vehicle,width,height,sharpness,confidence,plate,conf;conf;... */
+static void
+write_gate_trace (guint64 batch, NvDsFrameMeta * frame_meta,
+    NvDsObjectMeta * obj_meta, NvDsLabelInfo * plate_label,
+    const LprCharMeta * char_meta)
+{
+  gint64 vehicle_id = obj_meta->parent ? (gint64) obj_meta->parent->object_id : -1;
+
+  fprintf (lpr_gate_trace_file, "%lu,%u,%ld,%.1f,%.1f,%.3f,%f,%s,",
+      (unsigned long) batch, frame_meta->source_id, (long) vehicle_id,
+      obj_meta->rect_params.width, obj_meta->rect_params.height,
+      obj_meta->misc_obj_info[0] / 1000.0,
+      plate_label ? plate_label->result_prob : 0.0f,
+      plate_label ? plate_label->result_label : "");
+  for (guint i = 0; char_meta && i < char_meta->length; i++)
+    fprintf (lpr_gate_trace_file, i ? ";%.3f" : "%.3f", char_meta->confs[i]);
+  fputc ('\n', lpr_gate_trace_file);
+}
+
+/* sgie1_src_pad_buffer_probe unpacks the per-character attribute of the LPR
+ * parser into an LprCharMeta user meta on each plate object, so later stages
+ * can vote per character. */
+static GstPadProbeReturn
+sgie1_src_pad_buffer_probe (GstPad * pad, GstPadProbeInfo * info,
+    gpointer u_data)
+{
+  GstBuffer *buf = (GstBuffer *)info->data;
+  NvDsBatchMeta *batch_meta = gst_buffer_get_nvds_batch_meta(buf);
+  static guint64 batch = 0;
+
+  for (NvDsMetaList *l_frame = batch_meta->frame_meta_list; l_frame != NULL; l_frame = l_frame->next)
+  {
+    NvDsFrameMeta *frame_meta = (NvDsFrameMeta *) (l_frame->data);
+
+    for (NvDsMetaList *l_obj = frame_meta->obj_meta_list; l_obj != NULL; l_obj = l_obj->next)
     {
       NvDsObjectMeta *obj_meta = (NvDsObjectMeta *) (l_obj->data);
-      if(obj_meta->classifier_meta_list == NULL)
+      gboolean traced = FALSE;
+
+      /* Plates hidden from the LPR GIE are plates again for the app */
+      if(obj_meta->unique_component_id == LPR_GATE_SKIPPED_ID)
       {
-        continue;
+        obj_meta->unique_component_id = 2;
       }
 
-      vehicle_track_id = 0;
-      memset(vehicle_color,0,SIZE);
-      memset(vehicle_make,0,SIZE);
-      memset(vehicle_type,0,SIZE);
-
-      for (NvDsMetaList * l_class = obj_meta->classifier_meta_list; l_class != NULL; l_class = l_class->next) 
+      for (NvDsMetaList * l_class = obj_meta->classifier_meta_list; l_class != NULL; l_class = l_class->next)
       {
         NvDsClassifierMeta *class_meta = (NvDsClassifierMeta *)(l_class->data);
-        if(class_meta->label_info_list == NULL)
+        NvDsLabelInfo *plate_label = NULL;
+        NvDsLabelInfo *char_label = NULL;
+        if(class_meta->unique_component_id != 3)
         {
           continue;
         }
 
-        for (NvDsMetaList * l_label = class_meta->label_info_list; l_label != NULL; l_label = l_label->next) 
+        for (NvDsMetaList * l_label = class_meta->label_info_list; l_label != NULL; l_label = l_label->next)
         {
           NvDsLabelInfo *label_info = (NvDsLabelInfo *)l_label->data;
-
-          if(class_meta->unique_component_id == 3)
-          {
-            if(lpr_word_limit)
-            {
-              if(strlen(label_info->result_label) == lpr_word_count)
-              {
-                track_id = obj_meta->parent->object_id;
-                strcpy(license_plate, label_info->result_label);
-                lpr_confidence = obj_meta->confidence;
-                obj_lpr_box_left = obj_meta->detector_bbox_info.org_bbox_coords.left;
-                obj_lpr_box_top = obj_meta->detector_bbox_info.org_bbox_coords.top;
-                obj_lpr_box_width = obj_meta->detector_bbox_info.org_bbox_coords.width;
-                obj_lpr_box_height = obj_meta->detector_bbox_info.org_bbox_coords.height;
-              }
-            }
-            else
-            {
-              track_id = obj_meta->parent->object_id;
-              strcpy(license_plate, label_info->result_label);
-              lpr_confidence = obj_meta->confidence;
-              obj_lpr_box_left = obj_meta->detector_bbox_info.org_bbox_coords.left;
-              obj_lpr_box_top = obj_meta->detector_bbox_info.org_bbox_coords.top;
-              obj_lpr_box_width = obj_meta->detector_bbox_info.org_bbox_coords.width;
-              obj_lpr_box_height = obj_meta->detector_bbox_info.org_bbox_coords.height;
-            }
-          }
-          else
-          {
-            vehicle_track_id = obj_meta->object_id;
-            if(class_meta->unique_component_id == 4)
-            {
-              strcpy(vehicle_color, label_info->result_label);
-            }
-            else if(class_meta->unique_component_id == 5)
-            {
-              strcpy(vehicle_make, label_info->result_label);
-            }
-            else if(class_meta->unique_component_id == 6)
-            {
-              strcpy(vehicle_type, label_info->result_label);
-            }
-            obj_car_box_left = obj_meta->detector_bbox_info.org_bbox_coords.left;
-            obj_car_box_top = obj_meta->detector_bbox_info.org_bbox_coords.top;
-            obj_car_box_width = obj_meta->detector_bbox_info.org_bbox_coords.width;
-            obj_car_box_height = obj_meta->detector_bbox_info.org_bbox_coords.height;
-          }
+          if(label_info->label_id == LPR_PLATE_ATTR_INDEX)
+            plate_label = label_info;
+          else if(label_info->label_id == LPR_CHAR_ATTR_INDEX)
+            char_label = label_info;
         }
-      }
-
-      float vehicle_color_maxProbability = 0;
-      float vehicle_make_maxProbability = 0;
-      float vehicle_type_maxProbability = 0;
-      bool classification_display_check = false;
-
-      /* Iterate user metadata in object to search SGIE's tensor data */
-      for (NvDsMetaList * l_user = obj_meta->obj_user_meta_list; l_user != NULL;  l_user = l_user->next)
-      {
-        // g_print("Raw meta output of obj_id = %d \n", obj_meta->class_id);
-        NvDsUserMeta *user_meta = (NvDsUserMeta *) l_user->data;
-        if (user_meta->base_meta.meta_type != NVDSINFER_TENSOR_OUTPUT_META)
+        if(plate_label == NULL)
+        {
           continue;
-
-        /* convert to tensor metadata */
-        NvDsInferTensorMeta *meta = (NvDsInferTensorMeta *) user_meta->user_meta_data;
-        for (unsigned int i = 0; i < meta->num_output_layers; i++)
+        }
+        if(char_label == NULL)
         {
-          NvDsInferLayerInfo *info = &meta->output_layers_info[i];
-          info->buffer = meta->out_buf_ptrs_host[i];
-          if (use_device_mem && meta->out_buf_ptrs_dev[i])
+          /* LPR_CHAR_ATTR is off, the plate is voted as a whole */
+          if (lpr_gate_trace_file)
           {
-            cudaMemcpy (meta->out_buf_ptrs_host[i], meta->out_buf_ptrs_dev[i], 
-            info->inferDims.numElements * 4, cudaMemcpyDeviceToHost);
+            write_gate_trace (batch, frame_meta, obj_meta, plate_label, NULL);
+            traced = TRUE;
           }
+          continue;
         }
 
-        NvDsInferDimsCHW dims;
-        getDimsCHWFromDims (dims, meta->output_layers_info[0].inferDims);
-        unsigned int numClasses = dims.c;
-        float *outputCoverageBuffer = (float *) meta->output_layers_info[0].buffer;
+        const gchar *packed = char_label->result_label;
+        const gchar *glyph = plate_label->result_label;
+        guint length = MIN (char_label->result_class_id, strlen (packed) / 2);
+        LprCharMeta *char_meta = g_new0 (LprCharMeta, 1);
 
-        for (unsigned int c = 0; c < numClasses; c++)
+        char_meta->length = length;
+        char_meta->log_conf = char_label->result_prob;
+        for (guint i = 0; i < length; i++)
         {
-          float probability = outputCoverageBuffer[c];
-          if(meta->unique_id == 4)
-          {
-            classification_display_check = true;
-            if (probability > vehicle_color_maxProbability)
-            {
-              vehicle_color_maxProbability = probability;
-              if(strcmp(vehicle_color, "") == 0)
-              {
-                vehicle_color_maxProbability = 0;
-              }
-            }
-          }
-          else if(meta->unique_id == 5)
-          {
-            if (probability > vehicle_make_maxProbability)
-            {
-              vehicle_make_maxProbability = probability;
-              if(strcmp(vehicle_make, "") == 0)
-              {
-                vehicle_make_maxProbability = 0;
-              }
-            }
-          }
-          else if(meta->unique_id == 6)
-          {
-            if (probability > vehicle_type_maxProbability)
-            {
-              vehicle_type_maxProbability = probability;
-              if(strcmp(vehicle_type, "") == 0)
-              {
-                vehicle_type_maxProbability = 0;
-              }
-            }
-          }
+          char_meta->confs[i] = LPR_CHAR_CONF_UNPACK (packed[i * 2]);
+          char_meta->steps[i] = LPR_CHAR_STEP_UNPACK (packed[i * 2 + 1]);
+          char_meta->offsets[i] = MIN (glyph - plate_label->result_label, 255);
+          if (*glyph)
+            glyph = g_utf8_next_char (glyph);
         }
 
-        if(!open_everyobject_output)
+        NvDsUserMeta *user_meta = nvds_acquire_user_meta_from_pool (batch_meta);
+        user_meta->user_meta_data = char_meta;
+        user_meta->base_meta.meta_type = lpr_char_meta_type;
+        user_meta->base_meta.copy_func = (NvDsMetaCopyFunc) lpr_char_meta_copy;
+        user_meta->base_meta.release_func = (NvDsMetaReleaseFunc) lpr_char_meta_release;
+        nvds_add_user_meta_to_obj (obj_meta, user_meta);
+
+        if (lpr_gate_trace_file)
         {
-          if(strcmp(license_plate, "") != 0 && classification_display_check)
-          {
-            if(track_id == vehicle_track_id)
-            {
-              g_print("%ld,%s,%f,%s,%f,%s,%f,%s,%f\n", vehicle_track_id, license_plate, lpr_confidence, vehicle_color, vehicle_color_maxProbability, vehicle_make, vehicle_make_maxProbability, vehicle_type, vehicle_type_maxProbability);
-              classification_display_check = false;
-            }
-          }
-          // // although not classification, still output car plate
-          // else if(strcmp(license_plate, "") != 0 && !classification_display_check)
-          // {
-          //   g_print("%ld,%s,%f,%s,%d,%s,%d,%s,%d\n", track_id, license_plate, lpr_confidence, "", 0, "", 0, "", 0);
-          // }
-          else if(strcmp(license_plate, "") == 0 && classification_display_check && open_everycar_classification)
-          {
-            g_print("%ld,%s,%f,%s,%f,%s,%f,%s,%f\n", vehicle_track_id, license_plate, lpr_confidence, vehicle_color, vehicle_color_maxProbability, vehicle_make, vehicle_make_maxProbability, vehicle_type, vehicle_type_maxProbability);
-            classification_display_check = false;
-          }
+          write_gate_trace (batch, frame_meta, obj_meta, plate_label, char_meta);
+          traced = TRUE;
         }
       }
 
-      if(open_everyobject_output)
+      if (lpr_gate_trace_file && !traced && obj_meta->unique_component_id == 2)
       {
-        vehicle_color_maxProbability = 0;
-        vehicle_make_maxProbability = 0;
-        vehicle_type_maxProbability = 0;
-
-        if(strcmp(license_plate, "") != 0)
-        {
-          if(track_id == vehicle_track_id)
-          {
-            g_print("%ld,%s,%f,%s,%f,%s,%f,%s,%f\n", vehicle_track_id, license_plate, lpr_confidence, vehicle_color, vehicle_color_maxProbability, vehicle_make, vehicle_make_maxProbability, vehicle_type, vehicle_type_maxProbability);
-          }
-        }
-        else if(strcmp(license_plate, "") == 0 && open_everycar_classification)
-        {
-          g_print("%ld,%s,%f,%s,%f,%s,%f,%s,%f\n", vehicle_track_id, license_plate, lpr_confidence, vehicle_color, vehicle_color_maxProbability, vehicle_make, vehicle_make_maxProbability, vehicle_type, vehicle_type_maxProbability);
-        }
+        write_gate_trace (batch, frame_meta, obj_meta, NULL, NULL);
       }
-
     }
   }
 
-  use_device_mem = 1 - use_device_mem;
+  batch++;
   return GST_PAD_PROBE_OK;
 }
 
-static gboolean
-bus_call (GstBus * bus, GstMessage * msg, gpointer data)
+/* LprCharMeta attached to a plate object by sgie1_src_pad_buffer_probe */
+static const LprCharMeta *
+find_lpr_char_meta (NvDsObjectMeta * obj_meta)
 {
-  GMainLoop *loop = (GMainLoop *) data;
-  switch (GST_MESSAGE_TYPE (msg)) {
-    case GST_MESSAGE_EOS:
-      g_print ("End of stream\n");
-      g_main_loop_quit (loop);
-      break;
-    case GST_MESSAGE_ERROR:{
-      gchar *debug;
-      GError *error;
-      gst_message_parse_error (msg, &error, &debug);
-      g_printerr ("ERROR from element %s: %s\n",
-          GST_OBJECT_NAME (msg->src), error->message);
-      if (debug)
-        g_printerr ("Error details: %s\n", debug);
-      g_free (debug);
-      g_error_free (error);
-      g_main_loop_quit (loop);
-      break;
-    }
+  for (NvDsMetaList * l_user = obj_meta->obj_user_meta_list; l_user != NULL; l_user = l_user->next)
+  {
+    NvDsUserMeta *user_meta = (NvDsUserMeta *) l_user->data;
+    if (user_meta->base_meta.meta_type == lpr_char_meta_type)
+      return (const LprCharMeta *) user_meta->user_meta_data;
+  }
+  return NULL;
+}
+
+/* Called by the hotlist watch thread whenever the hotlist was written: the
+ * new list is indexed and swapped in, the old one is freed by its last user */
+static void
+reload_hotlist (gpointer user_data)
+{
+  gint64 start = g_get_monotonic_time ();
+  Hotlist *list = hotlist_load (hotlist_path);
+
+  if (!list) {
+    g_printerr ("hotlist: %s not reloaded, the current list stays\n", hotlist_path);
+    return;
+  }
+  g_mutex_lock (&hotlist_lock);
+  Hotlist *old = hotlist;
+  hotlist = list;
+  g_mutex_unlock (&hotlist_lock);
+  hotlist_unref (old);
+  g_print ("hotlist: reloaded %s, %lu entries in %.0f ms\n", hotlist_path,
+      (unsigned long) hotlist_size (list),
+      (g_get_monotonic_time () - start) / 1000.0);
+}
+
+/* Alert when the plate of an emitted record is on the hotlist */
+static void
+check_hotlist (const ResultRecord * record)
+{
+  HotlistMatch match;
+
+  if (!hotlist_alerts || !record->plate[0])
+    return;
+  g_mutex_lock (&hotlist_lock);
+  Hotlist *list = hotlist_ref (hotlist);
+  g_mutex_unlock (&hotlist_lock);
+  if (hotlist_match (list, record->plate, hotlist_near_miss, &match))
+    hotlist_alerts_push (hotlist_alerts, record, &match);
+  hotlist_unref (list);
+}
+
+/* Consensus records go to the writer. Every push, also the EOS flush from the
+ * main thread, runs under the consensus lock, so the writer still sees a
+ * single producer at a time. */
+static void
+consensus_emit (const ResultRecord * record, gpointer user_data)
+{
+  result_writer_push (result_writer, record);
+  check_hotlist (record);
+  if (evidence)
+    evidence_export_emit (evidence, record->track_id);
+}
+
+/* Queue the result of one vehicle of frame_meta for the writer thread, or add
+ * it to the track consensus. Without with_probs the probabilities are 0. */
+static void
+emit_vehicle (NvDsFrameMeta * frame_meta, const JoinedVehicle * vehicle,
+    gboolean with_probs)
+{
+  ResultRecord record;
+
+  record.pts = frame_meta->buf_pts;
+  record.track_id = vehicle->object_id;
+  record.source_id = frame_meta->source_id;
+  record.lpr_confidence = vehicle->plate_confidence;
+  record.ocr_confidence = vehicle->plate_ocr_confidence;
+  record.color_class = vehicle->attr_class[VEHICLE_JOIN_COLOR];
+  record.make_class = vehicle->attr_class[VEHICLE_JOIN_MAKE];
+  record.type_class = vehicle->attr_class[VEHICLE_JOIN_TYPE];
+  record.color_prob = with_probs ? vehicle->attr_prob[VEHICLE_JOIN_COLOR] : 0;
+  record.make_prob = with_probs ? vehicle->attr_prob[VEHICLE_JOIN_MAKE] : 0;
+  record.type_prob = with_probs ? vehicle->attr_prob[VEHICLE_JOIN_TYPE] : 0;
+  g_strlcpy (record.plate, vehicle->plate ? vehicle->plate : "",
+      sizeof (record.plate));
+  if (track_consensus)
+    track_consensus_observe (track_consensus, &record,
+        (const LprCharMeta *) vehicle->plate_chars);
+  else {
+    result_writer_push (result_writer, &record);
+    check_hotlist (&record);
+    if (evidence)
+      evidence_export_emit (evidence, record.track_id);
+  }
+}
+
+/* streammux_src_pad_buffer_probe records when a batch left the muxer */
+static GstPadProbeReturn
+streammux_src_pad_buffer_probe (GstPad * pad, GstPadProbeInfo * info,
+    gpointer u_data)
+{
+  GstBuffer *buf = (GstBuffer *) info->data;
+
+  g_mutex_lock (&latency->lock);
+  latency->pts[latency->next] = GST_BUFFER_PTS (buf);
+  latency->mux_time[latency->next] = g_get_monotonic_time ();
+  latency->next = (latency->next + 1) % LATENCY_RING;
+  g_mutex_unlock (&latency->lock);
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+latency_record (GstBuffer * buf, gint64 probe_start)
+{
+  gint64 now = g_get_monotonic_time ();
+  gint64 probe_us = now - probe_start;
+
+  g_mutex_lock (&latency->lock);
+  for (guint i = 0; i < LATENCY_RING; i++) {
+    guint slot = (latency->next + LATENCY_RING - 1 - i) % LATENCY_RING;
+    if (latency->mux_time[slot] && latency->pts[slot] == GST_BUFFER_PTS (buf)) {
+      gint64 pipeline_us = probe_start - latency->mux_time[slot];
+      g_array_append_val (latency->pipeline_us, pipeline_us);
+      latency->mux_time[slot] = 0;
+      break;
+    }
+  }
+  g_array_append_val (latency->probe_us, probe_us);
+  g_mutex_unlock (&latency->lock);
+}
+
+static gint
+compare_gint64 (gconstpointer a, gconstpointer b)
+{
+  gint64 x = *(const gint64 *) a, y = *(const gint64 *) b;
+  return x < y ? -1 : x > y;
+}
+
+static void
+latency_print (const gchar * name, GArray * samples)
+{
+  if (samples->len == 0) {
+    g_print ("latency %s: no batches\n", name);
+    return;
+  }
+  gint64 *us = (gint64 *) samples->data;
+  gdouble sum = 0;
+  g_array_sort (samples, compare_gint64);
+  for (guint i = 0; i < samples->len; i++)
+    sum += us[i];
+  g_print ("latency %s: %u batches, mean %.3f ms, p50 %.3f ms, p99 %.3f ms, "
+      "max %.3f ms\n", name, samples->len, sum / samples->len / 1000.0,
+      us[samples->len / 2] / 1000.0, us[samples->len * 99 / 100] / 1000.0,
+      us[samples->len - 1] / 1000.0);
+}
+
+/* Offer the plate and vehicle crops of vehicle in frame batch_id of a mapped
+ * surface to the evidence export */
+static void
+offer_evidence (NvBufSurface * surface, NvDsFrameMeta * frame_meta,
+    const JoinedVehicle * vehicle)
+{
+  NvBufSurfaceParams *params = &surface->surfaceList[frame_meta->batch_id];
+  const NvDsObjectMeta *objects[2] = { vehicle->plate_object,
+      vehicle->vehicle_object };
+  EvidenceBox boxes[2];
+  EvidenceFrame frame;
+
+  switch (params->colorFormat) {
+    case NVBUF_COLOR_FORMAT_NV12:
+    case NVBUF_COLOR_FORMAT_NV12_ER:
+      frame.format = EVIDENCE_FORMAT_NV12;
+      break;
+    case NVBUF_COLOR_FORMAT_RGBA:
+    case NVBUF_COLOR_FORMAT_RGBx:
+      frame.format = EVIDENCE_FORMAT_RGBA;
+      break;
+    default:
+      return;
+  }
+  frame.width = params->width;
+  frame.height = params->height;
+  for (guint i = 0; i < 2; i++) {
+    frame.planes[i] = (const guint8 *) params->mappedAddr.addr[i];
+    frame.pitch[i] = params->planeParams.pitch[i];
+  }
+  if (!frame.planes[0])
+    return;
+
+  for (guint i = 0; i < 2; i++) {
+    if (!objects[i])
+      continue;
+    boxes[i].left = objects[i]->rect_params.left;
+    boxes[i].top = objects[i]->rect_params.top;
+    boxes[i].width = objects[i]->rect_params.width;
+    boxes[i].height = objects[i]->rect_params.height;
+  }
+  evidence_export_offer (evidence, vehicle->object_id, frame_meta->buf_pts,
+      vehicle->plate_confidence, &frame, objects[0] ? &boxes[0] : NULL,
+      objects[1] ? &boxes[1] : NULL);
+}
+
+/* results_src_pad_buffer_probe  will extract metadata received from the
+ * secondary gies, attached to the src pad of the last one that runs */
+static GstPadProbeReturn
+results_src_pad_buffer_probe (GstPad * pad, GstPadProbeInfo * info,
+    gpointer u_data)
+{
+  gint64 probe_start = latency || stage_trace ? g_get_monotonic_time () : 0;
+  const RuntimeConfig *config = runtime_config_get ();
+  GstBuffer *buf = (GstBuffer *)info->data;
+  NvDsBatchMeta *batch_meta = gst_buffer_get_nvds_batch_meta(buf);
+  GstClockTime now = GST_CLOCK_TIME_NONE;
+  NvBufSurface *surface = NULL;
+  GstMapInfo map_info;
+
+  if (!vehicle_join)
+    vehicle_join = vehicle_join_new ();
+
+  /* Crops need CPU readable frames, like the sharpness of the LPR gate */
+  if (evidence && gst_buffer_map (buf, &map_info, GST_MAP_READ))
+    surface = (NvBufSurface *) map_info.data;
+
+  /* Running time of the pipeline, to compare with the capture time PTS */
+  if (live_latency_ms > 0) {
+    GstClock *clock = gst_element_get_clock (GST_ELEMENT (u_data));
+    if (clock) {
+      now = gst_clock_get_time (clock) -
+          gst_element_get_base_time (GST_ELEMENT (u_data));
+      gst_object_unref (clock);
+    }
+  }
+
+  for (NvDsMetaList *l_frame = batch_meta->frame_meta_list; l_frame != NULL; l_frame = l_frame->next) 
+  {
+    NvDsFrameMeta *frame_meta = (NvDsFrameMeta *) (l_frame->data);
+    if (GST_CLOCK_TIME_IS_VALID (now) && frame_meta->source_id < MAX_SOURCES &&
+        live_feeders[frame_meta->source_id])
+      appsrc_feeder_report_latency (live_feeders[frame_meta->source_id],
+          frame_meta->buf_pts, now);
+    if(frame_meta->obj_meta_list == NULL)
+    {
+      continue;
+    }
+
+    /* Join the classifier results of every vehicle with the plate read from
+     * its child object, in one pass and whatever the object order */
+    vehicle_join_reset (vehicle_join, frame_meta->num_obj_meta);
+
+    for (NvDsMetaList *l_obj = frame_meta->obj_meta_list; l_obj != NULL; l_obj = l_obj->next) 
+    {
+      NvDsObjectMeta *obj_meta = (NvDsObjectMeta *) (l_obj->data);
+      if(obj_meta->classifier_meta_list == NULL)
+      {
+        continue;
+      }
+
+      for (NvDsMetaList * l_class = obj_meta->classifier_meta_list; l_class != NULL; l_class = l_class->next) 
+      {
+        NvDsClassifierMeta *class_meta = (NvDsClassifierMeta *)(l_class->data);
+        if(class_meta->label_info_list == NULL)
+        {
+          continue;
+        }
+
+        for (NvDsMetaList * l_label = class_meta->label_info_list; l_label != NULL; l_label = l_label->next) 
+        {
+          NvDsLabelInfo *label_info = (NvDsLabelInfo *)l_label->data;
+
+          if(class_meta->unique_component_id == 3)
+          {
+            /* The packed per-character attribute is not a plate */
+            if(label_info->label_id != LPR_PLATE_ATTR_INDEX || !obj_meta->parent)
+            {
+              continue;
+            }
+            if(config->lpr_word_limit && strlen(label_info->result_label) != config->lpr_word_count)
+            {
+              continue;
+            }
+            JoinedVehicle *vehicle = vehicle_join_get (vehicle_join, obj_meta->parent->object_id);
+            vehicle->plate = label_info->result_label;
+            vehicle->plate_chars = find_lpr_char_meta(obj_meta);
+            vehicle->plate_confidence = obj_meta->confidence;
+            vehicle->plate_ocr_confidence = label_info->result_prob;
+            vehicle->plate_object = obj_meta;
+            vehicle->vehicle_object = obj_meta->parent;
+          }
+          else if(class_meta->unique_component_id >= 4 && class_meta->unique_component_id <= 6)
+          {
+            /* Color, make and type of gie 4, 5 and 6 */
+            guint attr = class_meta->unique_component_id - 4;
+            JoinedVehicle *vehicle = vehicle_join_get (vehicle_join, obj_meta->object_id);
+            vehicle->vehicle_object = obj_meta;
+            vehicle->attr_class[attr] = label_info->result_class_id;
+            vehicle->attr_prob[attr] = label_info->result_prob;
+          }
+        }
+      }
+    }
+
+    gboolean mapped = FALSE;
+    gboolean map_failed = FALSE;
+    for (guint i = 0; i < vehicle_join_count (vehicle_join); i++)
+    {
+      const JoinedVehicle *vehicle = vehicle_join_nth (vehicle_join, i);
+      if(vehicle->plate)
+      {
+        plates_read++;
+      }
+      /* Only a reading better than the best of the track is copied out */
+      if(surface && vehicle->plate &&
+          evidence_export_wants (evidence, vehicle->object_id, vehicle->plate_confidence))
+      {
+        if (!mapped && !map_failed)
+        {
+          mapped = NvBufSurfaceMap (surface, frame_meta->batch_id, 0, NVBUF_MAP_READ) == 0;
+          map_failed = !mapped;
+          if (mapped)
+            NvBufSurfaceSyncForCpu (surface, frame_meta->batch_id, 0);
+        }
+        if (mapped)
+          offer_evidence (surface, frame_meta, vehicle);
+      }
+      /* A vehicle is classified once it has a color, or the first attribute
+       * whose classifier runs; with open_everyobject_output any attribute
+       * will do and no probabilities are reported. Without any vehicle
+       * classifier only the plate counts. */
+      gboolean classified = TRUE;
+      for (guint attr = 0; attr < VEHICLE_JOIN_ATTRS; attr++)
+      {
+        if(!sgie_enable[2 + attr])
+        {
+          continue;
+        }
+        classified = vehicle->attr_class[attr] >= 0;
+        if(classified || !config->open_everyobject_output)
+        {
+          break;
+        }
+      }
+      if(!classified)
+      {
+        continue;
+      }
+      // although not detect car plate, still output classification
+      if(vehicle->plate || config->open_everycar_classification)
+      {
+        emit_vehicle (frame_meta, vehicle, !config->open_everyobject_output);
+      }
+    }
+
+    if (mapped)
+      NvBufSurfaceUnMap (surface, frame_meta->batch_id, 0);
+  }
+
+  if (surface)
+    gst_buffer_unmap (buf, &map_info);
+
+  /* One tick per batch ends the tracks not seen for consensus_timeout batches */
+  if (track_consensus)
+    track_consensus_tick (track_consensus);
+  if (evidence)
+    evidence_export_tick (evidence);
+
+  if (latency)
+    latency_record (buf, probe_start);
+  if (stage_trace)
+    stage_trace_record (stage_trace, results_stage, GST_BUFFER_PTS (buf),
+        probe_start, g_get_monotonic_time ());
+
+  return GST_PAD_PROBE_OK;
+}
+
+static gboolean
+stage_trace_report (gpointer user_data)
+{
+  stage_trace_print (stage_trace, TRUE);
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+bus_call (GstBus * bus, GstMessage * msg, gpointer data)
+{
+  GMainLoop *loop = (GMainLoop *) data;
+  switch (GST_MESSAGE_TYPE (msg)) {
+    case GST_MESSAGE_EOS:
+      g_print ("End of stream\n");
+      /* Tracks still visible in the last frames end with the stream */
+      if (track_consensus)
+        track_consensus_flush (track_consensus);
+      if (stage_trace)
+        stage_trace_print (stage_trace, FALSE);
+      g_main_loop_quit (loop);
+      break;
+    case GST_MESSAGE_ERROR:{
+      gchar *debug;
+      GError *error;
+      gst_message_parse_error (msg, &error, &debug);
+      g_printerr ("ERROR from element %s: %s\n",
+          GST_OBJECT_NAME (msg->src), error->message);
+      if (debug)
+        g_printerr ("Error details: %s\n", debug);
+      g_free (debug);
+      g_error_free (error);
+      g_main_loop_quit (loop);
+      break;
+    }
     default:
       break;
   }
@@ -623,6 +1397,7 @@ set_tracker_properties (GstElement *nvtracker)
                     CONFIG_GROUP_TRACKER_LL_CONFIG_FILE, &error));
       CHECK_ERROR (error);
       g_object_set (G_OBJECT (nvtracker), "ll-config-file", ll_config_file, NULL);
+      tracker_ll_config = ll_config_file;
     } else if (!g_strcmp0 (*key, CONFIG_GROUP_TRACKER_LL_LIB_FILE)) {
       char* ll_lib_file = get_absolute_file_path (TRACKER_CONFIG_FILE,
                 g_key_file_get_string (key_file,
@@ -664,67 +1439,581 @@ done:
   return ret;
 }
 
+/* Link the last element of source id to sink_<id> of streammux */
+static gboolean
+link_to_streammux (GstElement * streammux, GstElement * caps_filter, guint id)
+{
+  GstPad *sinkpad, *srcpad;
+  gchar pad_name_sink[16];
+
+  g_snprintf (pad_name_sink, sizeof (pad_name_sink), "sink_%u", id);
+  sinkpad = gst_element_get_request_pad (streammux, pad_name_sink);
+  if (!sinkpad) {
+    g_printerr ("Streammux request sink pad failed. Exiting.\n");
+    return FALSE;
+  }
+
+  srcpad = gst_element_get_static_pad (caps_filter, "src");
+  if (!srcpad) {
+    g_printerr ("Caps filter request src pad failed. Exiting.\n");
+    return FALSE;
+  }
+
+  if (gst_pad_link (srcpad, sinkpad) != GST_PAD_LINK_OK) {
+    g_printerr ("Failed to link caps filter to stream muxer. Exiting.\n");
+    return FALSE;
+  }
+
+  gst_object_unref (sinkpad);
+  gst_object_unref (srcpad);
+  return TRUE;
+}
+
+/* Add parser -> decoder for codec ("h264" or "h265") in front of the
+ * converter of data and feed it from srcpad */
+static gboolean
+add_decoder (AppSrcData * data, const gchar * codec, GstPad * srcpad)
+{
+  GstElement *parser, *decoder;
+  GstPad *sinkpad;
+  gchar factory[32], name[32];
+  gboolean linked;
+
+  g_snprintf (factory, sizeof (factory), "%sparse", codec);
+  g_snprintf (name, sizeof (name), "parser-%u", data->source_id);
+  parser = gst_element_factory_make (factory, name);
+
+  /* nvv4l2decoder decodes into device memory, avdec on the CPU for testing */
+  if (!g_strcmp0 (source_decoder, "sw"))
+    g_snprintf (factory, sizeof (factory), "avdec_%s", codec);
+  else
+    g_strlcpy (factory, "nvv4l2decoder", sizeof (factory));
+  g_snprintf (name, sizeof (name), "decoder-%u", data->source_id);
+  decoder = gst_element_factory_make (factory, name);
+  if (!parser || !decoder) {
+    g_printerr ("%sparse or %s could not be created. Exiting.\n", codec,
+        factory);
+    return FALSE;
+  }
+
+  gst_bin_add_many (GST_BIN (data->pipeline), parser, decoder, NULL);
+  sinkpad = gst_element_get_static_pad (parser, "sink");
+  linked = gst_pad_link (srcpad, sinkpad) == GST_PAD_LINK_OK &&
+      gst_element_link_many (parser, decoder, data->converter, NULL);
+  gst_object_unref (sinkpad);
+  if (!linked) {
+    g_printerr ("Source %u decoder could not be linked.\n", data->source_id);
+    return FALSE;
+  }
+
+  /* Added by a demuxer while the pipeline is running */
+  gst_element_sync_state_with_parent (parser);
+  gst_element_sync_state_with_parent (decoder);
+  data->decoding = TRUE;
+  return TRUE;
+}
+
+/* The demuxer found a stream, the first H.264 or H.265 video is decoded */
+static void
+demux_pad_added (GstElement * demux, GstPad * pad, AppSrcData * data)
+{
+  GstCaps *caps = gst_pad_get_current_caps (pad);
+  const gchar *media = caps ?
+      gst_structure_get_name (gst_caps_get_structure (caps, 0)) : "";
+
+  if (data->decoding || !g_str_has_prefix (media, "video/"))
+    ;
+  else if (!g_strcmp0 (media, "video/x-h264"))
+    add_decoder (data, "h264", pad);
+  else if (!g_strcmp0 (media, "video/x-h265"))
+    add_decoder (data, "h265", pad);
+  else
+    g_printerr ("Source %u: %s is not supported, only H.264 and H.265\n",
+        data->source_id, media);
+  if (caps)
+    gst_caps_unref (caps);
+}
+
+static void
+demux_no_more_pads (GstElement * demux, AppSrcData * data)
+{
+  if (!data->decoding)
+    GST_ELEMENT_ERROR (demux, STREAM, CODEC_NOT_FOUND,
+        ("Source %u has no H.264 or H.265 video", data->source_id), (NULL));
+}
+
+static GstPadProbeReturn
+file_read_probe (GstPad * pad, GstPadProbeInfo * info, gpointer u_data)
+{
+  AppSrcData *data = u_data;
+
+  data->bytes_read += gst_buffer_get_size (GST_PAD_PROBE_INFO_BUFFER (info));
+  return GST_PAD_PROBE_OK;
+}
+
+/* Decoded frame n gets PTS n / fps, like the feeder stamps raw frame n, so
+ * results carry the same frame numbers and PTS with either input */
+static GstPadProbeReturn
+decoded_frame_probe (GstPad * pad, GstPadProbeInfo * info, gpointer u_data)
+{
+  AppSrcData *data = u_data;
+  GstBuffer *buf = gst_buffer_make_writable (GST_PAD_PROBE_INFO_BUFFER (info));
+
+  GST_BUFFER_PTS (buf) =
+      gst_util_uint64_scale (data->frames, GST_SECOND, data->fps);
+  GST_BUFFER_DTS (buf) = GST_CLOCK_TIME_NONE;
+  GST_BUFFER_DURATION (buf) = gst_util_uint64_scale (1, GST_SECOND, data->fps);
+  GST_PAD_PROBE_INFO_DATA (info) = buf;
+  data->frames++;
+  return GST_PAD_PROBE_OK;
+}
+
+/* Create filesrc -> [demuxer] -> parser -> decoder -> nvvideoconvert ->
+ * capsfilter for one encoded source and link it to sink_<id> of streammux.
+ * With a demuxer, the parser and decoder are added once the codec is known. */
+static gboolean
+create_encoded_source (GstElement * pipeline, GstElement * streammux,
+    const SourceConfig * config, guint id, AppSrcData * data)
+{
+  GstElement *file_source, *demux = NULL, *caps_filter;
+  GstCaps *caps;
+  GstPad *pad;
+  gchar name[32];
+  gint width = config->width ? config->width : muxer_width;
+  gint height = config->height ? config->height : muxer_height;
+  gboolean container = !g_strcmp0 (config->format, "MP4") ||
+      !g_strcmp0 (config->format, "MKV");
+
+  memset (data, 0, sizeof (*data));
+  data->source_id = id;
+  data->fps = config->fps;
+  data->frame_size = width * height * 1.5;
+  data->pipeline = pipeline;
+
+  if (!g_file_test (config->path, G_FILE_TEST_IS_REGULAR)) {
+    g_printerr ("Encoded file %s could not be opened. Exiting.\n",
+        config->path);
+    return FALSE;
+  }
+
+  g_snprintf (name, sizeof (name), "file-source-%u", id);
+  file_source = gst_element_factory_make ("filesrc", name);
+  if (container) {
+    g_snprintf (name, sizeof (name), "demuxer-%u", id);
+    demux = gst_element_factory_make (!g_strcmp0 (config->format, "MP4") ?
+        "qtdemux" : "matroskademux", name);
+  }
+  g_snprintf (name, sizeof (name), "nvvideo-converter1-%u", id);
+  data->converter = gst_element_factory_make ("nvvideoconvert", name);
+  g_snprintf (name, sizeof (name), "capsfilter-%u", id);
+  caps_filter = gst_element_factory_make ("capsfilter", name);
+  if (!file_source || !data->converter || !caps_filter || (container && !demux)) {
+    g_printerr ("Source %u elements could not be created. Exiting.\n", id);
+    return FALSE;
+  }
+
+  g_object_set (G_OBJECT (file_source), "location", config->path, NULL);
+  caps = gst_caps_from_string ("video/x-raw(memory:NVMM), format=NV12");
+  g_object_set (G_OBJECT (caps_filter), "caps", caps, NULL);
+  gst_caps_unref (caps);
+
+  gst_bin_add_many (GST_BIN (pipeline), file_source, data->converter,
+      caps_filter, NULL);
+  if (!gst_element_link (data->converter, caps_filter)) {
+    g_printerr ("Source %u elements could not be linked: Exiting.\n", id);
+    return FALSE;
+  }
+
+  pad = gst_element_get_static_pad (file_source, "src");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, file_read_probe, data,
+      NULL);
+  if (demux) {
+    gst_bin_add (GST_BIN (pipeline), demux);
+    if (!gst_element_link (file_source, demux)) {
+      g_printerr ("Source %u demuxer could not be linked: Exiting.\n", id);
+      return FALSE;
+    }
+    g_signal_connect (demux, "pad-added", G_CALLBACK (demux_pad_added), data);
+    g_signal_connect (demux, "no-more-pads", G_CALLBACK (demux_no_more_pads),
+        data);
+  } else if (!add_decoder (data, !g_strcmp0 (config->format, "H264") ?
+          "h264" : "h265", pad)) {
+    return FALSE;
+  }
+  gst_object_unref (pad);
+
+  pad = gst_element_get_static_pad (data->converter, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, decoded_frame_probe, data,
+      NULL);
+  gst_object_unref (pad);
+
+  return link_to_streammux (streammux, caps_filter, id);
+}
+
+/* Create appsrc -> nvvideoconvert -> capsfilter for one raw source, start
+ * its reader and link it to sink_<id> of streammux */
+static gboolean
+create_source (GstElement * pipeline, GstElement * streammux,
+    const SourceConfig * config, guint id, AppSrcIoType io_type,
+    const AppSrcLiveConfig * live, AppSrcData * data)
+{
+  GstElement *nvvidconv1 = NULL, *caps_filter = NULL;
+  GstCaps *caps = NULL;
+  GstCapsFeatures *feature = NULL;
+  const gchar *vidconv_format = NULL;
+  gchar name[32];
+  gint width = config->width ? config->width : muxer_width;
+  gint height = config->height ? config->height : muxer_height;
+
+  memset (data, 0, sizeof (*data));
+  data->source_id = id;
+  data->fps = config->fps;
+  if (!g_strcmp0 (config->format, "RGBA")) {
+    data->frame_size = width * height * 4;
+    vidconv_format = "RGBA";
+  } else {
+    data->frame_size = width * height * 1.5;
+    vidconv_format = "NV12";
+  }
+
+  /* The pool of the reader holds the frames read ahead */
+  data->io = appsrc_io_open (config->path, data->frame_size, io_type,
+      MAX (appsrc_io_depth, appsrc_prefetch_depth));
+  if (!data->io) {
+    g_printerr ("Raw file %s could not be opened. Exiting.\n", config->path);
+    return FALSE;
+  }
+
+  /* App Source element for reading from raw video file */
+  g_snprintf (name, sizeof (name), "app-source-%u", id);
+  data->app_source = gst_element_factory_make ("appsrc", name);
+  if (!data->app_source) {
+    g_printerr ("Appsrc element could not be created. Exiting.\n");
+    return FALSE;
+  }
+
+  /* Use convertor to convert from software buffer to GPU buffer */
+  g_snprintf (name, sizeof (name), "nvvideo-converter1-%u", id);
+  nvvidconv1 = gst_element_factory_make ("nvvideoconvert", name);
+  if (!nvvidconv1) {
+    g_printerr ("nvvideoconvert1 could not be created. Exiting.\n");
+    return FALSE;
+  }
+  g_snprintf (name, sizeof (name), "capsfilter-%u", id);
+  caps_filter = gst_element_factory_make ("capsfilter", name);
+  if (!caps_filter) {
+    g_printerr ("Caps_filter could not be created. Exiting.\n");
+    return FALSE;
+  }
+
+  /* Configure appsrc */
+  g_object_set (data->app_source, "caps",
+      gst_caps_new_simple ("video/x-raw",
+          "format", G_TYPE_STRING, config->format,
+          "width", G_TYPE_INT, width,
+          "height", G_TYPE_INT, height,
+          "framerate", GST_TYPE_FRACTION, data->fps, 1, NULL), NULL);
+#if !CUSTOM_PTS
+  if (!live)
+    g_object_set (G_OBJECT (data->app_source), "do-timestamp", TRUE, NULL);
+#endif
+  /* Live, appsrc holds about two frames so that the feeder, not its queue,
+   * decides which frames are late */
+  if (live)
+    g_object_set (G_OBJECT (data->app_source), "is-live", TRUE,
+        "format", GST_FORMAT_TIME, "max-bytes", (guint64) data->frame_size * 2,
+        NULL);
+  g_signal_connect (data->app_source, "need-data", G_CALLBACK (start_feed),
+      data);
+  g_signal_connect (data->app_source, "enough-data", G_CALLBACK (stop_feed),
+      data);
+
+  caps =
+      gst_caps_new_simple ("video/x-raw", "format", G_TYPE_STRING,
+      vidconv_format, NULL);
+  feature = gst_caps_features_new ("memory:NVMM", NULL);
+  gst_caps_set_features (caps, 0, feature);
+  g_object_set (G_OBJECT (caps_filter), "caps", caps, NULL);
+  gst_caps_unref (caps);
+
+  gst_bin_add_many (GST_BIN (pipeline), data->app_source, nvvidconv1,
+      caps_filter, NULL);
+  if (!gst_element_link_many (data->app_source, nvvidconv1, caps_filter, NULL)) {
+    g_printerr ("Source %u elements could not be linked: Exiting.\n", id);
+    return FALSE;
+  }
+
+  if (!link_to_streammux (streammux, caps_filter, id))
+    return FALSE;
+
+  /* Start reading ahead before appsrc asks for the first frame */
+  data->feeder = appsrc_feeder_new (data->app_source, data->io,
+      appsrc_prefetch_depth, CUSTOM_PTS || live ? data->fps : 0, live);
+  if (live)
+    live_feeders[id] = data->feeder;
+  return TRUE;
+}
+
+static void
+print_json_string (FILE * out, const gchar * str)
+{
+  fputc ('"', out);
+  for (; str && *str; str++) {
+    guchar c = *str;
+    if (c == '"' || c == '\\')
+      fprintf (out, "\\%c", c);
+    else if (c < 0x20)
+      fprintf (out, "\\u%04x", c);
+    else
+      fputc (c, out);
+  }
+  fputc ('"', out);
+}
+
+/* Machine readable summary of a benchmark run, one JSON object, so runs of
+ * different builds, configs and machines can be compared by a script */
+static void
+write_benchmark_summary (guint num_sources, const guint * sgie_batch,
+    guint64 frames, gdouble elapsed, gdouble cpu, glong peak_rss_kb,
+    guint64 disk_bytes, guint64 h2d_bytes)
+{
+  FILE *out = fopen (benchmark_summary, "w");
+  if (!out) {
+    g_printerr ("benchmark: cannot write %s\n", benchmark_summary);
+    return;
+  }
+  fprintf (out, "{\n  \"label\": ");
+  print_json_string (out, benchmark_label);
+  fprintf (out, ",\n  \"sources\": %u,\n  \"muxer_batch_size\": %u,\n"
+      "  \"pgie_batch_size\": %u,\n  \"sgie_batch_size\": [%u, %u, %u, %u, %u],\n"
+      "  \"tracker_config\": ", num_sources, num_sources, num_sources,
+      sgie_batch[0], sgie_batch[1], sgie_batch[2], sgie_batch[3], sgie_batch[4]);
+  print_json_string (out, tracker_ll_config);
+  fprintf (out, ",\n  \"frames\": %lu,\n  \"seconds\": %.3f,\n  \"fps\": %.2f,\n"
+      "  \"plates\": %lu,\n  \"plates_per_sec\": %.2f,\n"
+      "  \"cpu_percent\": %.1f,\n  \"peak_rss_kb\": %ld,\n"
+      "  \"disk_bytes\": %lu,\n  \"h2d_bytes\": %lu,\n  \"stages\": [",
+      (unsigned long) frames, elapsed, elapsed > 0 ? frames / elapsed : 0.0,
+      (unsigned long) plates_read, elapsed > 0 ? plates_read / elapsed : 0.0,
+      elapsed > 0 ? cpu * 100 / elapsed : 0.0, peak_rss_kb,
+      (unsigned long) disk_bytes, (unsigned long) h2d_bytes);
+  for (guint i = 0; stage_trace && i < stage_trace_num_stages (stage_trace); i++) {
+    StageTraceStats stats;
+    stage_trace_get_stats (stage_trace, i, &stats);
+    fprintf (out, "%s\n    {\"name\": ", i ? "," : "");
+    print_json_string (out, stats.name);
+    fprintf (out, ", \"count\": %lu, \"mean_ms\": %.3f, \"p50_ms\": %.3f, "
+        "\"p99_ms\": %.3f, \"max_ms\": %.3f}", (unsigned long) stats.count,
+        stats.mean_us / 1e3, stats.p50_us / 1e3, stats.p99_us / 1e3,
+        stats.max_us / 1e3);
+  }
+  fprintf (out, "\n  ]\n}\n");
+  fclose (out);
+  g_print ("benchmark: summary written to %s\n", benchmark_summary);
+}
+
 int
 main (int argc, char *argv[])
 {
   GMainLoop *loop = NULL;
-  GstElement *pipeline = NULL, *nvvidconv1 = NULL, *caps_filter = NULL,
+  GstElement *pipeline = NULL,
       *streammux = NULL, *sink = NULL, *pgie = NULL, *nvtracker = NULL, 
       *sgie0 = NULL, *sgie1 = NULL, *sgie2 = NULL, *sgie3 = NULL, *sgie4 = NULL, *nvvidconv2 = NULL,
       *nvosd = NULL, *tee = NULL, *appsink = NULL;
-  GstElement *transform = NULL;
+  GstElement *transform = NULL, *tiler = NULL;
   GstBus *bus = NULL;
   guint bus_watch_id;
-  AppSrcData data;
-  GstCaps *caps = NULL;
-  GstCapsFeatures *feature = NULL;
-  gchar *endptr1 = NULL, *vidconv_format = NULL;
+  AppSrcData sources[MAX_SOURCES];
+  AppSrcIoType io_type;
+  AppSrcLiveConfig live_config_appsrc;
+  guint pgie_batch_size;
+  gchar *endptr1 = NULL;
   GstPad *tee_source_pad1, *tee_source_pad2;
   GstPad *osd_sink_pad, *appsink_sink_pad;
 
   readConfig();
 
+  /* The LPR parser only packs the per-character confidences into a second
+   * label when asked, before nvinfer loads it */
+  if (consensus_enable || lpr_gate_trace[0] != '\0')
+    g_setenv (LPR_CHAR_ATTR_ENV, "1", FALSE);
+
   int current_device = -1;
   cudaGetDevice(&current_device);
   struct cudaDeviceProp prop;
   cudaGetDeviceProperties(&prop, current_device);
-  /* Check input arguments */
-  if (argc != 4) {
+  /* Check input arguments. A raw file on the command line replaces the
+   * source<N> list of the config file */
+  if (argc == 4) {
+    long fps = g_ascii_strtoll (argv[2], &endptr1, 10);
+    gchar *format = argv[3];
+    if (fps == 0 && endptr1 == argv[2]) {
+      g_printerr ("Incorrect FPS\n");
+      return -1;
+    }
+
+    if (fps == 0) {
+      g_printerr ("FPS cannot be 0\n");
+      return -1;
+    }
+
+    if (!source_format_is_valid (format)) {
+      g_printerr ("Only I420, RGBA, NV12, H264, H265, MP4 and MKV are supported\n");
+      return -1;
+    }
+
+    memset (&source_configs[0], 0, sizeof (SourceConfig));
+    g_strlcpy (source_configs[0].path, argv[1], SIZE);
+    g_strlcpy (source_configs[0].format, format, sizeof (source_configs[0].format));
+    source_configs[0].fps = fps;
+    num_sources = 1;
+  } else if (argc != 1 || num_sources == 0) {
     g_printerr
-        ("Usage: %s <Raw filename> <fps> <format(I420, NV12, RGBA)>\n",
-        argv[0]);
+        ("Usage: %s <Raw or encoded filename> <fps> <format(I420, NV12, RGBA, H264, H265, MP4, MKV)>\n"
+        "       %s (sources from source<N> in %s)\n",
+        argv[0], argv[0], CONFIG_PATH);
     return -1;
   }
 
-  long fps = g_ascii_strtoll (argv[2], &endptr1, 10);
-  gchar *format = argv[3];
-  if (fps == 0 && endptr1 == argv[2]) {
-    g_printerr ("Incorrect FPS\n");
+  for (guint i = 0; i < num_sources; i++) {
+    if (source_configs[i].path[0] == '\0') {
+      g_printerr ("source%u is missing in %s\n", i, CONFIG_PATH);
+      return -1;
+    }
+  }
+
+  /* A benchmark reads and infers as fast as it can: no display or appsink,
+   * no pacing of live sources, no reloads, and every stage timed */
+  if (benchmark) {
+    g_strlcpy (pipeline_profile, "headless", SIZE);
+    muxer_live_source = 0;
+    live_latency_ms = 0;
+    config_reload = 0;
+    stage_trace_enable = 1;
+  }
+
+  if (!g_strcmp0 (pipeline_profile, "headless")) {
+    pipeline_osd = 0;
+    pipeline_appsink = 0;
+  } else if (g_strcmp0 (pipeline_profile, "display") != 0) {
+    g_printerr ("Unknown pipeline_profile %s\n", pipeline_profile);
     return -1;
   }
 
-  if (fps == 0) {
-    g_printerr ("FPS cannot be 0\n");
+  if (!appsrc_io_type_from_string (appsrc_io_engine, &io_type)) {
+    g_printerr ("Unknown appsrc_io_engine %s\n", appsrc_io_engine);
     return -1;
   }
 
-  if (g_strcmp0 (format, "I420") != 0 && g_strcmp0 (format, "RGBA") != 0
-      && g_strcmp0 (format, "NV12") != 0) {
-    g_printerr ("Only I420, RGBA and NV12 are supported\n");
+  if (g_strcmp0 (source_decoder, "hw") && g_strcmp0 (source_decoder, "sw")) {
+    g_printerr ("Unknown source_decoder %s\n", source_decoder);
     return -1;
   }
 
-  /* Initialize custom data structure */
-  memset (&data, 0, sizeof (data));
-  if (!g_strcmp0 (format, "RGBA")) {
-    data.frame_size = muxer_width * muxer_height * 4;
-    vidconv_format = "RGBA";
-  } else {
-    data.frame_size = muxer_width * muxer_height * 1.5;
-    vidconv_format = "NV12";
+  live_config_appsrc.budget = live_latency_ms * GST_MSECOND;
+  if (!appsrc_live_policy_from_string (live_policy, &live_config_appsrc.policy)) {
+    g_printerr ("Unknown live_policy %s\n", live_policy);
+    return -1;
   }
-  data.file = fopen (argv[1], "r");
-  data.fps = fps;
+
+  ResultWriterConfig writer_config = {
+    .path = result_output,
+    .queue_size = result_queue_size,
+    .rotate_bytes = result_rotate_bytes,
+    .rotate_keep = result_rotate_keep,
+    .color_labels = { sgie2_classes_str, G_N_ELEMENTS (sgie2_classes_str) },
+    .make_labels = { sgie3_classes_str, G_N_ELEMENTS (sgie3_classes_str) },
+    .type_labels = { sgie4_classes_str, G_N_ELEMENTS (sgie4_classes_str) },
+  };
+  if (!result_format_from_string (result_format, &writer_config.format)) {
+    g_printerr ("Unknown result_format %s\n", result_format);
+    return -1;
+  }
+  if (!result_overflow_from_string (result_overflow, &writer_config.overflow)) {
+    g_printerr ("Unknown result_overflow %s\n", result_overflow);
+    return -1;
+  }
+  if (!result_fsync_from_string (result_fsync, &writer_config.fsync)) {
+    g_printerr ("Unknown result_fsync %s\n", result_fsync);
+    return -1;
+  }
+  if (result_store_dir[0] != '\0') {
+    PlateStoreConfig store_config = {
+      .dir = result_store_dir,
+      .segment_bytes = result_store_segment_bytes,
+    };
+    plate_store = plate_store_open (&store_config);
+    if (!plate_store) {
+      return -1;
+    }
+    PlateStoreStats store_stats;
+    plate_store_get_stats (plate_store, &store_stats);
+    g_print ("Plate store %s: %lu results, %u plates, %lu corrupt records\n",
+        result_store_dir, (unsigned long) store_stats.records,
+        store_stats.plates, (unsigned long) store_stats.corrupt);
+    if (result_store_socket[0] != '\0' &&
+        !plate_store_serve (plate_store, result_store_socket)) {
+      return -1;
+    }
+    writer_config.store = plate_store;
+  }
+  result_writer = result_writer_new (&writer_config);
+  if (!result_writer) {
+    return -1;
+  }
+  if (consensus_enable) {
+    TrackConsensusConfig consensus_config = {
+      .timeout = consensus_timeout,
+      .dwell = consensus_dwell,
+    };
+    track_consensus = track_consensus_new (&consensus_config, consensus_emit,
+        NULL);
+  }
+  if (hotlist_path[0] != '\0') {
+    hotlist = hotlist_load (hotlist_path);
+    if (!hotlist) {
+      return -1;
+    }
+    hotlist_alerts = hotlist_alerts_new (hotlist_alert_output,
+        hotlist_alert_queue_size);
+    if (!hotlist_alerts) {
+      return -1;
+    }
+    g_print ("Hotlist %s: %lu entries, %lu skipped\n", hotlist_path,
+        (unsigned long) hotlist_size (hotlist),
+        (unsigned long) hotlist_skipped (hotlist));
+  }
+  if (evidence_dir[0] != '\0') {
+    /* A track is emitted at the latest a timeout after its last reading */
+    EvidenceConfig evidence_config = {
+      .dir = evidence_dir,
+      .workers = evidence_workers,
+      .queue_size = evidence_queue_size,
+      .quality = evidence_jpeg_quality,
+      .timeout = 2 * consensus_timeout + consensus_dwell,
+    };
+    evidence = evidence_export_new (&evidence_config);
+    if (!evidence) {
+      return -1;
+    }
+  }
+  /* The probes read the live settings from a snapshot, replaced whenever the
+   * config file is written */
+  live_config.lpr_gate.track_timeout = consensus_timeout;
+  runtime_config_publish (&live_config);
+  if (lpr_gate_enable) {
+    lpr_gate = lpr_gate_new (&live_config.lpr_gate);
+  }
+  if (lpr_gate_trace[0] != '\0') {
+    lpr_gate_trace_file = fopen (lpr_gate_trace, "w");
+    if (!lpr_gate_trace_file) {
+      g_printerr ("LPR gate trace %s could not be opened\n", lpr_gate_trace);
+      return -1;
+    }
+  }
+
+  /* One frame of every source per batch */
+  muxer_batch_size = num_sources;
 
   /* Standard GStreamer initialization */
   gst_init (&argc, &argv);
@@ -738,26 +2027,6 @@ main (int argc, char *argv[])
     return -1;
   }
 
-  /* App Source element for reading from raw video file */
-  data.app_source = gst_element_factory_make ("appsrc", "app-source");
-  if (!data.app_source) {
-    g_printerr ("Appsrc element could not be created. Exiting.\n");
-    return -1;
-  }
-
-  /* Use convertor to convert from software buffer to GPU buffer */
-  nvvidconv1 =
-      gst_element_factory_make ("nvvideoconvert", "nvvideo-converter1");
-  if (!nvvidconv1) {
-    g_printerr ("nvvideoconvert1 could not be created. Exiting.\n");
-    return -1;
-  }
-  caps_filter = gst_element_factory_make ("capsfilter", "capsfilter");
-  if (!caps_filter) {
-    g_printerr ("Caps_filter could not be created. Exiting.\n");
-    return -1;
-  }
-
   /* Create nvstreammux instance to form batches from one or more sources. */
   streammux = gst_element_factory_make ("nvstreammux", "stream-muxer");
   if (!streammux) {
@@ -793,89 +2062,101 @@ main (int argc, char *argv[])
     return -1;
   }
 
-  /* We need three secondary gies so lets create 3 more instances of
-     nvinfer */
-  sgie2 = gst_element_factory_make ("nvinfer", "secondary2-nvinference-engine");
-  if (!sgie2) {
-    g_printerr ("Secondary2 nvinfer could not be created. Exiting.\n");
-    return -1;
+  /* Up to three vehicle classifiers, color, make and type */
+  if (sgie_enable[2]) {
+    sgie2 = gst_element_factory_make ("nvinfer", "secondary2-nvinference-engine");
+    if (!sgie2) {
+      g_printerr ("Secondary2 nvinfer could not be created. Exiting.\n");
+      return -1;
+    }
   }
 
-  sgie3 = gst_element_factory_make ("nvinfer", "secondary3-nvinference-engine");
-  if (!sgie3) {
-    g_printerr ("Secondary3 nvinfer could not be created. Exiting.\n");
-    return -1;
+  if (sgie_enable[3]) {
+    sgie3 = gst_element_factory_make ("nvinfer", "secondary3-nvinference-engine");
+    if (!sgie3) {
+      g_printerr ("Secondary3 nvinfer could not be created. Exiting.\n");
+      return -1;
+    }
   }
 
-  sgie4 = gst_element_factory_make ("nvinfer", "secondary4-nvinference-engine");
-  if (!sgie4) {
-    g_printerr ("Secondary4 nvinfer could not be created. Exiting.\n");
-    return -1;
+  if (sgie_enable[4]) {
+    sgie4 = gst_element_factory_make ("nvinfer", "secondary4-nvinference-engine");
+    if (!sgie4) {
+      g_printerr ("Secondary4 nvinfer could not be created. Exiting.\n");
+      return -1;
+    }
   }
 
-  /* Use convertor to convert from NV12 to RGBA as required by nvdsosd */
-  nvvidconv2 =
-      gst_element_factory_make ("nvvideoconvert", "nvvideo-converter2");
-  if (!nvvidconv2) {
-    g_printerr ("nvvideoconvert2 could not be created. Exiting.\n");
-    return -1;
-  }
+  if (pipeline_osd) {
+    /* Use convertor to convert from NV12 to RGBA as required by nvdsosd */
+    nvvidconv2 =
+        gst_element_factory_make ("nvvideoconvert", "nvvideo-converter2");
+    if (!nvvidconv2) {
+      g_printerr ("nvvideoconvert2 could not be created. Exiting.\n");
+      return -1;
+    }
 
-  /* Create OSD to draw on the converted RGBA buffer */
-  nvosd = gst_element_factory_make ("nvdsosd", "nv-onscreendisplay");
-  if (!nvosd) {
-    g_printerr ("nvdsosd could not be created. Exiting.\n");
-    return -1;
-  }
+    /* Create OSD to draw on the converted RGBA buffer */
+    nvosd = gst_element_factory_make ("nvdsosd", "nv-onscreendisplay");
+    if (!nvosd) {
+      g_printerr ("nvdsosd could not be created. Exiting.\n");
+      return -1;
+    }
 
-  /* Finally render the osd output. We will use a tee to render video
-   * playback on nveglglessink, and we use appsink to extract metadata
-   * from buffer and print object, person and vehicle count. */
-  tee = gst_element_factory_make ("tee", "tee");
-  if (!tee) {
-    g_printerr ("Tee could not be created. Exiting.\n");
-    return -1;
-  }
-  if(prop.integrated) {
-    transform = gst_element_factory_make ("nvegltransform", "nvegl-transform");
-    if (!transform) {
-      g_printerr ("Tegra transform element could not be created. Exiting.\n");
+    if(prop.integrated) {
+      transform = gst_element_factory_make ("nvegltransform", "nvegl-transform");
+      if (!transform) {
+        g_printerr ("Tegra transform element could not be created. Exiting.\n");
+        return -1;
+      }
+    }
+    sink = gst_element_factory_make ("nveglglessink", "nvvideo-renderer");
+    if (!sink) {
+      g_printerr ("Display sink could not be created. Exiting.\n");
       return -1;
     }
   }
-  sink = gst_element_factory_make ("nveglglessink", "nvvideo-renderer");
-  if (!sink) {
-    g_printerr ("Display sink could not be created. Exiting.\n");
-    return -1;
+
+  /* The appsink extracts metadata from the buffer and prints object, person
+   * and vehicle count */
+  if (pipeline_appsink) {
+    appsink = gst_element_factory_make ("appsink", "app-sink");
+    if (!appsink) {
+      g_printerr ("Appsink element could not be created. Exiting.\n");
+      return -1;
+    }
   }
 
-  appsink = gst_element_factory_make ("appsink", "app-sink");
-  if (!appsink) {
-    g_printerr ("Appsink element could not be created. Exiting.\n");
-    return -1;
+  /* With both the video rendering and the appsink, a tee feeds both */
+  if (pipeline_osd && pipeline_appsink) {
+    tee = gst_element_factory_make ("tee", "tee");
+    if (!tee) {
+      g_printerr ("Tee could not be created. Exiting.\n");
+      return -1;
+    }
   }
 
-  /* Configure appsrc */
-  g_object_set (data.app_source, "caps",
-      gst_caps_new_simple ("video/x-raw",
-          "format", G_TYPE_STRING, format,
-          "width", G_TYPE_INT, muxer_width,
-          "height", G_TYPE_INT, muxer_height,
-          "framerate", GST_TYPE_FRACTION, data.fps, 1, NULL), NULL);
-#if !CUSTOM_PTS
-  g_object_set (G_OBJECT (data.app_source), "do-timestamp", TRUE, NULL);
-#endif
-  g_signal_connect (data.app_source, "need-data", G_CALLBACK (start_feed),
-      &data);
-  g_signal_connect (data.app_source, "enough-data", G_CALLBACK (stop_feed),
-      &data);
+  /* Headless, the results are all that is left of a batch */
+  if (!pipeline_osd && !pipeline_appsink) {
+    sink = gst_element_factory_make ("fakesink", "fake-sink");
+    if (!sink) {
+      g_printerr ("Fakesink could not be created. Exiting.\n");
+      return -1;
+    }
+  }
 
-  caps =
-      gst_caps_new_simple ("video/x-raw", "format", G_TYPE_STRING,
-      vidconv_format, NULL);
-  feature = gst_caps_features_new ("memory:NVMM", NULL);
-  gst_caps_set_features (caps, 0, feature);
-  g_object_set (G_OBJECT (caps_filter), "caps", caps, NULL);
+  /* Several sources are shown side by side */
+  if (pipeline_osd && num_sources > 1) {
+    tiler = gst_element_factory_make ("nvmultistreamtiler", "nvtiler");
+    if (!tiler) {
+      g_printerr ("Tiler could not be created. Exiting.\n");
+      return -1;
+    }
+    guint tiler_columns = (guint) ceil (sqrt (num_sources));
+    guint tiler_rows = (num_sources + tiler_columns - 1) / tiler_columns;
+    g_object_set (G_OBJECT (tiler), "rows", tiler_rows, "columns", tiler_columns,
+        "width", muxer_width, "height", muxer_height, NULL);
+  }
 
   /* Set streammux properties */
   g_object_set (G_OBJECT (streammux), "width", muxer_width, "height",
@@ -887,9 +2168,31 @@ main (int argc, char *argv[])
   g_object_set (G_OBJECT (pgie), "config-file-path", PGIE_CONFIG_FILE, NULL);
   g_object_set (G_OBJECT (sgie0), "config-file-path", SGIE0_CONFIG_FILE, NULL);
   g_object_set (G_OBJECT (sgie1), "config-file-path", SGIE1_CONFIG_FILE, NULL);
-  g_object_set (G_OBJECT (sgie2), "config-file-path", SGIE2_CONFIG_FILE, NULL);
-  g_object_set (G_OBJECT (sgie3), "config-file-path", SGIE3_CONFIG_FILE, NULL);
-  g_object_set (G_OBJECT (sgie4), "config-file-path", SGIE4_CONFIG_FILE, NULL);
+  if (sgie2)
+    g_object_set (G_OBJECT (sgie2), "config-file-path", SGIE2_CONFIG_FILE, NULL);
+  if (sgie3)
+    g_object_set (G_OBJECT (sgie3), "config-file-path", SGIE3_CONFIG_FILE, NULL);
+  if (sgie4)
+    g_object_set (G_OBJECT (sgie4), "config-file-path", SGIE4_CONFIG_FILE, NULL);
+
+  /* Secondary batch sizes given in the app config replace the infer configs */
+  GstElement *sgies[NUM_SGIES] = { sgie0, sgie1, sgie2, sgie3, sgie4 };
+  guint sgie_batch[NUM_SGIES] = { 0 };
+  for (guint i = 0; i < NUM_SGIES; i++) {
+    if (sgies[i] && sgie_batch_size[i] > 0)
+      g_object_set (G_OBJECT (sgies[i]), "batch-size", sgie_batch_size[i], NULL);
+    if (sgies[i])
+      g_object_get (G_OBJECT (sgies[i]), "batch-size", &sgie_batch[i], NULL);
+  }
+
+  /* The primary detector sees one frame per source */
+  g_object_get (G_OBJECT (pgie), "batch-size", &pgie_batch_size, NULL);
+  if (pgie_batch_size != num_sources) {
+    g_printerr
+        ("WARNING: Overriding infer-config batch-size (%d) with number of sources (%d)\n",
+        pgie_batch_size, num_sources);
+    g_object_set (G_OBJECT (pgie), "batch-size", num_sources, NULL);
+  }
 
   /* Set necessary properties of the tracker element. */
   if (!set_tracker_properties(nvtracker)) {
@@ -905,104 +2208,191 @@ main (int argc, char *argv[])
   /* Set up the pipeline */
   /* we add all elements into the pipeline */
   gst_bin_add_many (GST_BIN (pipeline),
-      data.app_source, nvvidconv1, caps_filter, streammux, pgie, nvtracker, sgie0, sgie1, sgie2, sgie3, sgie4,
-      nvvidconv2, nvosd, tee, sink, appsink, NULL);
-  if(prop.integrated) {
-    gst_bin_add (GST_BIN (pipeline), transform);
+      streammux, pgie, nvtracker, sgie0, sgie1, NULL);
+  GstElement *optional[] = { sgie2, sgie3, sgie4, nvvidconv2, nvosd, tee,
+    transform, tiler, sink, appsink };
+  for (guint i = 0; i < G_N_ELEMENTS (optional); i++) {
+    if (optional[i])
+      gst_bin_add (GST_BIN (pipeline), optional[i]);
+  }
+
+  /* The results are read after the last GIE that runs */
+  GstElement *last_gie = sgie4 ? sgie4 : sgie3 ? sgie3 : sgie2 ? sgie2 : sgie1;
+
+  lpr_char_meta_type = nvds_get_user_meta_type (LPR_CHAR_META_TYPE);
+
+  if (lpr_gate_enable || lpr_gate_sharpness || lpr_gate_trace[0] != '\0')
+  {
+    GstPad *sink_pad3 = gst_element_get_static_pad (sgie1, "sink");
+    if (!sink_pad3)
+      g_print ("Unable to get secondary_gie1 sink pad\n");
+    else
+    {
+      gst_pad_add_probe(sink_pad3, GST_PAD_PROBE_TYPE_BUFFER, sgie1_sink_pad_buffer_probe, NULL, NULL);
+      gst_object_unref (sink_pad3);
+    }
+  }
+
+  GstPad *src_pad3;
+  src_pad3 = gst_element_get_static_pad (sgie1, "src");
+  if (!src_pad3)
+    g_print ("Unable to get secondary_gie1 src pad\n");
+  else
+  {
+    gst_pad_add_probe(src_pad3, GST_PAD_PROBE_TYPE_BUFFER, sgie1_src_pad_buffer_probe, NULL, NULL);
+    gst_object_unref (src_pad3);
   }
 
   GstPad *src_pad6;
-  src_pad6 = gst_element_get_static_pad (sgie4, "src");
+  src_pad6 = gst_element_get_static_pad (last_gie, "src");
   if (!src_pad6)
-    g_print ("Unable to get secondary_gie4 src pad\n");
+    g_print ("Unable to get %s src pad\n", GST_ELEMENT_NAME (last_gie));
   else
   {
-    gst_pad_add_probe(src_pad6, GST_PAD_PROBE_TYPE_BUFFER, sgie4_src_pad_buffer_probe, NULL, NULL);
+    gst_pad_add_probe(src_pad6, GST_PAD_PROBE_TYPE_BUFFER, results_src_pad_buffer_probe, pipeline, NULL);
     gst_object_unref (src_pad6);
   }
 
-  GstPad *sinkpad, *srcpad;
-  gchar pad_name_sink[16] = "sink_0";
-  gchar pad_name_src[16] = "src";
-
-  sinkpad = gst_element_get_request_pad (streammux, pad_name_sink);
-  if (!sinkpad) {
-    g_printerr ("Streammux request sink pad failed. Exiting.\n");
-    return -1;
+  if (latency_report)
+  {
+    latency = g_new0 (LatencyReport, 1);
+    g_mutex_init (&latency->lock);
+    latency->pipeline_us = g_array_new (FALSE, FALSE, sizeof (gint64));
+    latency->probe_us = g_array_new (FALSE, FALSE, sizeof (gint64));
+    GstPad *mux_src_pad = gst_element_get_static_pad (streammux, "src");
+    if (!mux_src_pad)
+      g_print ("Unable to get streammux src pad\n");
+    else
+    {
+      gst_pad_add_probe(mux_src_pad, GST_PAD_PROBE_TYPE_BUFFER, streammux_src_pad_buffer_probe, NULL, NULL);
+      gst_object_unref (mux_src_pad);
+    }
   }
 
-  srcpad = gst_element_get_static_pad (caps_filter, pad_name_src);
-  if (!srcpad) {
-    g_printerr ("Caps filter request src pad failed. Exiting.\n");
-    return -1;
+  for (guint i = 0; i < num_sources; i++) {
+    if (source_format_is_encoded (source_configs[i].format)) {
+      if (!create_encoded_source (pipeline, streammux, &source_configs[i], i,
+              &sources[i]))
+        return -1;
+    } else if (!create_source (pipeline, streammux, &source_configs[i], i,
+            io_type, live_latency_ms > 0 ? &live_config_appsrc : NULL,
+            &sources[i])) {
+      return -1;
+    }
   }
 
-  if (gst_pad_link (srcpad, sinkpad) != GST_PAD_LINK_OK) {
-    g_printerr ("Failed to link caps filter to stream muxer. Exiting.\n");
+  /* we link the elements together */
+  /* app-source -> nvvidconv -> caps filter -> streammux (one per source) ->
+   * nvinfer -> tracker -> nvinfer x 2 -> [nvinfer x 3] -> branches */
+  if (!gst_element_link_many (streammux, pgie, nvtracker, sgie0, sgie1, NULL) ||
+      (sgie2 && !gst_element_link (sgie1, sgie2)) ||
+      (sgie3 && !gst_element_link (sgie2 ? sgie2 : sgie1, sgie3)) ||
+      (sgie4 && !gst_element_link (sgie3 ? sgie3 : sgie2 ? sgie2 : sgie1, sgie4))) {
+    g_printerr ("Elements could not be linked: Exiting.\n");
     return -1;
   }
 
-  gst_object_unref (sinkpad);
-  gst_object_unref (srcpad);
-
-  /* we link the elements together */
-  /* app-source -> nvvidconv -> caps filter ->
-   * nvinfer -> nvvidconv -> nvosd -> video-renderer */
-  if(prop.integrated) {
-    if (!gst_element_link_many (data.app_source, nvvidconv1, caps_filter, NULL) ||
-        !gst_element_link_many (nvosd, transform, sink, NULL) ||
-        !gst_element_link_many (streammux, pgie, nvtracker, sgie0, sgie1, sgie2, sgie3, sgie4, nvvidconv2, tee, NULL)) {
+  /* Video rendering: nvvidconv -> [tiler] -> nvosd -> video-renderer */
+  if (pipeline_osd) {
+    if (tiler && !gst_element_link (tiler, nvosd)) {
+      g_printerr ("Tiler could not be linked: Exiting.\n");
+      return -1;
+    }
+    if (!gst_element_link (last_gie, nvvidconv2) ||
+        (!tee && !gst_element_link (nvvidconv2, tiler ? tiler : nvosd)) ||
+        (transform && !gst_element_link_many (nvosd, transform, sink, NULL)) ||
+        (!transform && !gst_element_link (nvosd, sink))) {
       g_printerr ("Elements could not be linked: Exiting.\n");
       return -1;
     }
   }
-  else {
-    if (!gst_element_link_many (data.app_source, nvvidconv1, caps_filter, NULL) ||
-        !gst_element_link_many (nvosd, sink, NULL) ||
-        !gst_element_link_many (streammux, pgie, nvtracker, sgie0, sgie1, sgie2, sgie3, sgie4, nvvidconv2, tee, NULL)) {
+
+  if (tee) {
+    /* Manually link the Tee, which has "Request" pads.
+     * This tee, in case of multistream usecase, will come before tiler element. */
+    if (!gst_element_link (nvvidconv2, tee)) {
       g_printerr ("Elements could not be linked: Exiting.\n");
       return -1;
     }
+    tee_source_pad1 = gst_element_get_request_pad (tee, "src_0");
+    osd_sink_pad = gst_element_get_static_pad (tiler ? tiler : nvosd, "sink");
+    tee_source_pad2 = gst_element_get_request_pad (tee, "src_1");
+    appsink_sink_pad = gst_element_get_static_pad (appsink, "sink");
+    if (gst_pad_link (tee_source_pad1, osd_sink_pad) != GST_PAD_LINK_OK) {
+      g_printerr ("Tee could not be linked to display sink.\n");
+      gst_object_unref (pipeline);
+      return -1;
+    }
+    if (gst_pad_link (tee_source_pad2, appsink_sink_pad) != GST_PAD_LINK_OK) {
+      g_printerr ("Tee could not be linked to appsink.\n");
+      gst_object_unref (pipeline);
+      return -1;
+    }
+    gst_object_unref (osd_sink_pad);
+    gst_object_unref (appsink_sink_pad);
+  } else if (appsink) {
+    if (!gst_element_link (last_gie, appsink)) {
+      g_printerr ("Appsink could not be linked: Exiting.\n");
+      return -1;
+    }
+  } else if (!pipeline_osd) {
+    if (!gst_element_link (last_gie, sink)) {
+      g_printerr ("Fakesink could not be linked: Exiting.\n");
+      return -1;
+    }
   }
 
-/* Manually link the Tee, which has "Request" pads.
- * This tee, in case of multistream usecase, will come before tiler element. */
-  tee_source_pad1 = gst_element_get_request_pad (tee, "src_0");
-  osd_sink_pad = gst_element_get_static_pad (nvosd, "sink");
-  tee_source_pad2 = gst_element_get_request_pad (tee, "src_1");
-  appsink_sink_pad = gst_element_get_static_pad (appsink, "sink");
-  if (gst_pad_link (tee_source_pad1, osd_sink_pad) != GST_PAD_LINK_OK) {
-    g_printerr ("Tee could not be linked to display sink.\n");
-    gst_object_unref (pipeline);
-    return -1;
-  }
-  if (gst_pad_link (tee_source_pad2, appsink_sink_pad) != GST_PAD_LINK_OK) {
-    g_printerr ("Tee could not be linked to appsink.\n");
-    gst_object_unref (pipeline);
-    return -1;
-  }
-  
-  /* Lets add probe to get informed of the meta data generated, we add probe to
-   * the sink pad of the osd element, since by that time, the buffer would have
-   * had got all the metadata. */  
-  if (!osd_sink_pad)
-    g_print ("Unable to get osd sink pad\n");
-  gst_object_unref (osd_sink_pad);
+  if (appsink) {
+    /* Configure appsink to extract data from DeepStream pipeline. Like the
+     * video sink it does not wait for the clock, so with or without either
+     * branch the pipeline runs at the speed of the data */
+    g_object_set (appsink, "emit-signals", TRUE, "async", FALSE, "sync", FALSE,
+        NULL);
 
-  if (!appsink_sink_pad) {
-    g_printerr ("Unable to get appsink sink pad\n");
+    /* Callback to access buffer and object info. */
+    g_signal_connect (appsink, "new-sample", G_CALLBACK (new_sample), NULL);
   }
-  gst_object_unref (appsink_sink_pad);
-
-  /* Configure appsink to extract data from DeepStream pipeline */
-  g_object_set (appsink, "emit-signals", TRUE, "async", FALSE, NULL);
-  g_object_set (sink, "sync", FALSE, NULL);
-
-  /* Callback to access buffer and object info. */
-  g_signal_connect (appsink, "new-sample", G_CALLBACK (new_sample), NULL);
+  if (sink)
+    g_object_set (sink, "sync", FALSE, NULL);
 
   /* Set the pipeline to "playing" state */
-  g_print ("Now playing: %s\n", argv[1]);
+  /* Every element with an input and an output, in the order of the data */
+  if (stage_trace_enable)
+  {
+    stage_trace = stage_trace_new (stage_trace_chrome[0] ? stage_trace_chrome : NULL);
+    if (!stage_trace)
+      return -1;
+    for (guint i = 0; i < num_sources; i++) {
+      gchar name[32];
+      /* Decoders behind a demuxer are only added once it runs */
+      g_snprintf (name, sizeof (name), "decoder-%u", i);
+      GstElement *decoder = gst_bin_get_by_name (GST_BIN (pipeline), name);
+      if (decoder) {
+        stage_trace_add_element (stage_trace, decoder);
+        gst_object_unref (decoder);
+      }
+      g_snprintf (name, sizeof (name), "nvvideo-converter1-%u", i);
+      GstElement *nvvidconv1 = gst_bin_get_by_name (GST_BIN (pipeline), name);
+      stage_trace_add_element (stage_trace, nvvidconv1);
+      gst_object_unref (nvvidconv1);
+    }
+    GstElement *traced[] = { streammux, pgie, nvtracker, sgie0, sgie1, sgie2,
+        sgie3, sgie4, nvvidconv2, tee, tiler, nvosd, transform };
+    for (guint i = 0; i < G_N_ELEMENTS (traced); i++)
+      if (traced[i])
+        stage_trace_add_element (stage_trace, traced[i]);
+    results_stage = stage_trace_add_stage (stage_trace, "results probe");
+    if (stage_trace_interval > 0)
+      g_timeout_add_seconds (stage_trace_interval, stage_trace_report, NULL);
+  }
+
+  for (guint i = 0; i < num_sources; i++)
+    g_print ("Now playing: %s\n", source_configs[i].path);
+  if (config_reload)
+    config_watch = config_watch_new (CONFIG_PATH, reload_config, NULL);
+  if (hotlist)
+    hotlist_watch = config_watch_new (hotlist_path, reload_hotlist, NULL);
+  gint64 start_time = g_get_monotonic_time ();
   gst_element_set_state (pipeline, GST_STATE_PLAYING);
 
   /* Wait till pipeline encounters an error or EOS */
@@ -1012,8 +2402,147 @@ main (int argc, char *argv[])
   /* Out of the main loop, clean up nicely */
   g_print ("Returned, stopping playback\n");
   gst_element_set_state (pipeline, GST_STATE_NULL);
+  config_watch_free (config_watch);
+  config_watch_free (hotlist_watch);
   g_print ("Deleting pipeline\n");
   gst_object_unref (GST_OBJECT (pipeline));
+  guint64 total_frames = 0, h2d_bytes = 0, disk_bytes = 0;
+  gdouble elapsed = (g_get_monotonic_time () - start_time) / 1e6;
+  for (guint i = 0; i < num_sources; i++) {
+    AppSrcFeederStats feed;
+    if (!sources[i].feeder) {
+      g_print ("source %u: %lu frames decoded, %lu bytes read\n", i,
+          (unsigned long) sources[i].frames,
+          (unsigned long) sources[i].bytes_read);
+      total_frames += sources[i].frames;
+      disk_bytes += sources[i].bytes_read;
+      /* The hardware decoder uploads the stream, avdec the decoded frames */
+      h2d_bytes += g_strcmp0 (source_decoder, "sw") ? sources[i].bytes_read :
+          sources[i].frames * sources[i].frame_size;
+      continue;
+    }
+    appsrc_feeder_get_stats (sources[i].feeder, &feed);
+    g_print ("appsrc %u: %lu frames pushed, %lu underruns\n", i,
+        (unsigned long) feed.pushed, (unsigned long) feed.underruns);
+    if (live_latency_ms > 0)
+      g_print ("appsrc %u: dropped %lu late, %lu on a full ring, %lu skipped "
+          "frames, latency %.1f ms\n", i, (unsigned long) feed.dropped_late,
+          (unsigned long) feed.dropped_full,
+          (unsigned long) feed.dropped_skipped, feed.latency / 1e6);
+    total_frames += feed.pushed;
+    /* Raw frames are uploaded to device memory by nvvideoconvert */
+    h2d_bytes += feed.pushed * sources[i].frame_size;
+    disk_bytes += feed.pushed * sources[i].frame_size;
+    appsrc_feeder_free (sources[i].feeder);
+    appsrc_io_close (sources[i].io);
+  }
+  g_print ("throughput: %u sources, %lu frames in %.2f s, %.1f fps\n",
+      num_sources, (unsigned long) total_frames, elapsed,
+      elapsed > 0 ? total_frames / elapsed : 0.0);
+  g_print ("input: %lu bytes read, %.0f bytes per frame\n",
+      (unsigned long) disk_bytes,
+      total_frames ? (gdouble) disk_bytes / total_frames : 0.0);
+
+  /* Wall time per frame shows what a branch costs on the GPU bound path,
+   * process CPU time per frame what it costs the host */
+  struct rusage usage;
+  getrusage (RUSAGE_SELF, &usage);
+  gdouble cpu = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+      (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+  g_print ("frame time: %s profile, osd %d, appsink %d, sgie2..4 %d%d%d, "
+      "%.3f ms wall, %.3f ms cpu per frame\n", pipeline_profile,
+      pipeline_osd, pipeline_appsink, sgie_enable[2], sgie_enable[3],
+      sgie_enable[4], total_frames ? elapsed * 1e3 / total_frames : 0.0,
+      total_frames ? cpu * 1e3 / total_frames : 0.0);
+
+  if (benchmark) {
+    g_print ("benchmark: %.1f fps, %.1f plates/s, %.0f%% cpu, peak rss %ld MB, "
+        "%.1f MB/s host to device\n", elapsed > 0 ? total_frames / elapsed : 0.0,
+        elapsed > 0 ? plates_read / elapsed : 0.0,
+        elapsed > 0 ? cpu * 100 / elapsed : 0.0, usage.ru_maxrss / 1024,
+        elapsed > 0 ? h2d_bytes / elapsed / 1e6 : 0.0);
+    write_benchmark_summary (num_sources, sgie_batch,
+        total_frames, elapsed, cpu, usage.ru_maxrss, disk_bytes, h2d_bytes);
+  }
+
+  vehicle_join_free (vehicle_join);
+  stage_trace_free (stage_trace);
+
+  if (latency) {
+    latency_print ("streammux to results", latency->pipeline_us);
+    latency_print ("results probe", latency->probe_us);
+    g_array_free (latency->pipeline_us, TRUE);
+    g_array_free (latency->probe_us, TRUE);
+    g_mutex_clear (&latency->lock);
+    g_free (latency);
+  }
+
+  if (lpr_gate) {
+    LprGateStats gate_stats;
+    lpr_gate_get_stats (lpr_gate, &gate_stats);
+    g_print ("lpr gate: %lu plate crops, %lu read, %lu skipped as low quality, "
+        "%lu skipped as repeats\n", (unsigned long) gate_stats.crops,
+        (unsigned long) gate_stats.read,
+        (unsigned long) gate_stats.skipped_low,
+        (unsigned long) gate_stats.skipped_repeat);
+    lpr_gate_free (lpr_gate);
+  }
+  if (lpr_gate_trace_file)
+    fclose (lpr_gate_trace_file);
+
+  /* The pipeline is stopped, so every result is queued by now */
+  if (track_consensus) {
+    guint64 readings, vehicles;
+    guint open_tracks;
+    track_consensus_flush (track_consensus);
+    track_consensus_get_stats (track_consensus, &readings, &vehicles,
+        &open_tracks);
+    g_print ("consensus: %lu readings, %lu vehicles\n",
+        (unsigned long) readings, (unsigned long) vehicles);
+    track_consensus_free (track_consensus);
+  }
+  if (evidence) {
+    EvidenceStats evidence_stats;
+    evidence_export_drain (evidence);
+    evidence_export_get_stats (evidence, &evidence_stats);
+    g_print ("evidence: %lu crops written, %lu dropped, %lu failed, "
+        "latency mean %.1f ms max %.1f ms, encode mean %.1f ms\n",
+        (unsigned long) evidence_stats.written,
+        (unsigned long) evidence_stats.dropped,
+        (unsigned long) evidence_stats.failed,
+        evidence_stats.latency_mean_us / 1000.0,
+        evidence_stats.latency_max_us / 1000.0,
+        evidence_stats.encode_mean_us / 1000.0);
+    evidence_export_free (evidence);
+  }
+  if (hotlist_alerts) {
+    HotlistAlertStats alert_stats;
+    hotlist_alerts_drain (hotlist_alerts);
+    hotlist_alerts_get_stats (hotlist_alerts, &alert_stats);
+    g_print ("hotlist: %lu alerts, %lu dropped\n",
+        (unsigned long) alert_stats.alerts, (unsigned long) alert_stats.dropped);
+    hotlist_alerts_free (hotlist_alerts);
+    hotlist_unref (hotlist);
+  }
+  ResultWriterStats writer_stats;
+  result_writer_flush (result_writer);
+  result_writer_get_stats (result_writer, &writer_stats);
+  g_print ("results: %lu written, %lu dropped, max queue depth %u, "
+      "%lu blocked pushes, %u rotations\n",
+      (unsigned long) writer_stats.written,
+      (unsigned long) writer_stats.dropped, writer_stats.max_depth,
+      (unsigned long) writer_stats.blocked, writer_stats.rotations);
+  result_writer_free (result_writer);
+  if (plate_store) {
+    PlateStoreStats store_stats;
+    plate_store_get_stats (plate_store, &store_stats);
+    g_print ("store: %lu results, %u plates in %u segments, %lu failed\n",
+        (unsigned long) store_stats.records, store_stats.plates,
+        store_stats.segments, (unsigned long) store_stats.failed);
+    plate_store_close (plate_store);
+  }
+  runtime_config_free_all ();
+  g_hash_table_destroy (config_values);
   g_source_remove (bus_watch_id);
   g_main_loop_unref (loop);
   return 0;
@@ -0,0 +1,467 @@
+/*
+ * Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <jpeglib.h>
+#include "evidence_export.h"
+
+#define EVIDENCE_CROPS 2
+
+static const gchar *crop_names[EVIDENCE_CROPS] = { "plate", "vehicle" };
+
+typedef struct _EvidenceCrop
+{
+  EvidenceFormat format;
+  guint width;
+  guint height;
+  guint8 *pixels;               /* NV12: Y rows then UV rows, RGBA: rows */
+} EvidenceCrop;
+
+typedef struct _EvidenceTrack
+{
+  gint64 track_id;
+  gfloat confidence;            /* Of the best reading so far */
+  guint64 pts;                  /* Of the frame of that reading */
+  guint64 last_batch;
+  EvidenceCrop *crops[EVIDENCE_CROPS];  /* NULL once queued */
+} EvidenceTrack;
+
+typedef struct _EvidenceJob
+{
+  gint64 track_id;
+  guint64 pts;
+  gint64 queued_at;
+  EvidenceCrop *crops[EVIDENCE_CROPS];
+} EvidenceJob;
+
+struct _EvidenceExport
+{
+  EvidenceConfig config;
+  gchar *dir;
+
+  GMutex lock;
+  GCond cond;
+  GHashTable *tracks;
+  guint64 batch;
+  GQueue *jobs;
+  guint busy;                   /* Jobs taken by a worker */
+  gboolean stop;
+  GThread **workers;
+
+  EvidenceStats stats;
+  gint64 latency_sum;
+  gint64 encode_sum;
+};
+
+typedef struct _JpegError
+{
+  struct jpeg_error_mgr mgr;
+  jmp_buf jump;
+} JpegError;
+
+static void
+crop_free (EvidenceCrop * crop)
+{
+  if (crop) {
+    g_free (crop->pixels);
+    g_free (crop);
+  }
+}
+
+static void
+track_free (gpointer data)
+{
+  EvidenceTrack *track = data;
+
+  for (guint i = 0; i < EVIDENCE_CROPS; i++)
+    crop_free (track->crops[i]);
+  g_free (track);
+}
+
+/* Copy the pixels under box, clipped to the frame and, for NV12, to even
+ * coordinates. NULL when nothing is left. */
+static EvidenceCrop *
+crop_copy (const EvidenceFrame * frame, const EvidenceBox * box)
+{
+  gint left = CLAMP (box->left, 0, (gint) frame->width);
+  gint top = CLAMP (box->top, 0, (gint) frame->height);
+  gint right = CLAMP (box->left + box->width, 0, (gint) frame->width);
+  gint bottom = CLAMP (box->top + box->height, 0, (gint) frame->height);
+  EvidenceCrop *crop;
+
+  if (frame->format == EVIDENCE_FORMAT_NV12) {
+    left &= ~1;
+    top &= ~1;
+    right &= ~1;
+    bottom &= ~1;
+  }
+  if (right - left < 2 || bottom - top < 2)
+    return NULL;
+
+  crop = g_new0 (EvidenceCrop, 1);
+  crop->format = frame->format;
+  crop->width = right - left;
+  crop->height = bottom - top;
+  if (frame->format == EVIDENCE_FORMAT_NV12) {
+    guint8 *uv;
+
+    crop->pixels = g_malloc (crop->width * crop->height * 3 / 2);
+    uv = crop->pixels + crop->width * crop->height;
+    for (guint y = 0; y < crop->height; y++)
+      memcpy (crop->pixels + y * crop->width,
+          frame->planes[0] + (gsize) (top + y) * frame->pitch[0] + left,
+          crop->width);
+    for (guint y = 0; y < crop->height / 2; y++)
+      memcpy (uv + y * crop->width,
+          frame->planes[1] + (gsize) (top / 2 + y) * frame->pitch[1] + left,
+          crop->width);
+  } else {
+    crop->pixels = g_malloc (crop->width * crop->height * 4);
+    for (guint y = 0; y < crop->height; y++)
+      memcpy (crop->pixels + y * crop->width * 4,
+          frame->planes[0] + (gsize) (top + y) * frame->pitch[0] + left * 4,
+          crop->width * 4);
+  }
+  return crop;
+}
+
+/* Scanline y of crop as YCbCr (NV12) or RGB (RGBA) triplets */
+static void
+crop_row (const EvidenceCrop * crop, guint y, guint8 * row)
+{
+  if (crop->format == EVIDENCE_FORMAT_NV12) {
+    const guint8 *luma = crop->pixels + y * crop->width;
+    const guint8 *uv = crop->pixels + crop->width * crop->height +
+        (y / 2) * crop->width;
+    for (guint x = 0; x < crop->width; x++) {
+      row[3 * x] = luma[x];
+      row[3 * x + 1] = uv[x & ~1];
+      row[3 * x + 2] = uv[(x & ~1) + 1];
+    }
+  } else {
+    const guint8 *rgba = crop->pixels + y * crop->width * 4;
+    for (guint x = 0; x < crop->width; x++) {
+      row[3 * x] = rgba[4 * x];
+      row[3 * x + 1] = rgba[4 * x + 1];
+      row[3 * x + 2] = rgba[4 * x + 2];
+    }
+  }
+}
+
+static void
+jpeg_error_exit (j_common_ptr cinfo)
+{
+  longjmp (((JpegError *) cinfo->err)->jump, 1);
+}
+
+/* Encode crop to path.tmp and rename it to path once complete */
+static gboolean
+crop_write_jpeg (const EvidenceCrop * crop, const gchar * path, gint quality)
+{
+  struct jpeg_compress_struct cinfo;
+  JpegError error;
+  gchar *tmp = g_strconcat (path, ".tmp", NULL);
+  guint8 *row = g_malloc (crop->width * 3);
+  FILE *volatile out = fopen (tmp, "wb");
+  volatile gboolean ok = FALSE;
+
+  if (!out)
+    goto done;
+
+  cinfo.err = jpeg_std_error (&error.mgr);
+  error.mgr.error_exit = jpeg_error_exit;
+  if (setjmp (error.jump)) {
+    jpeg_destroy_compress (&cinfo);
+    goto done;
+  }
+  jpeg_create_compress (&cinfo);
+  jpeg_stdio_dest (&cinfo, out);
+  cinfo.image_width = crop->width;
+  cinfo.image_height = crop->height;
+  cinfo.input_components = 3;
+  cinfo.in_color_space =
+      crop->format == EVIDENCE_FORMAT_NV12 ? JCS_YCbCr : JCS_RGB;
+  jpeg_set_defaults (&cinfo);
+  jpeg_set_quality (&cinfo, quality, TRUE);
+  jpeg_start_compress (&cinfo, TRUE);
+  while (cinfo.next_scanline < cinfo.image_height) {
+    crop_row (crop, cinfo.next_scanline, row);
+    jpeg_write_scanlines (&cinfo, &row, 1);
+  }
+  jpeg_finish_compress (&cinfo);
+  jpeg_destroy_compress (&cinfo);
+  ok = TRUE;
+
+done:
+  if (out && fclose (out) != 0)
+    ok = FALSE;
+  if (ok)
+    ok = rename (tmp, path) == 0;
+  if (!ok)
+    unlink (tmp);
+  g_free (row);
+  g_free (tmp);
+  return ok;
+}
+
+static gpointer
+evidence_worker (gpointer user_data)
+{
+  EvidenceExport *ex = user_data;
+
+  for (;;) {
+    EvidenceJob *job;
+    guint written = 0, failed = 0;
+    gint64 encode = 0;
+
+    g_mutex_lock (&ex->lock);
+    while (g_queue_is_empty (ex->jobs) && !ex->stop)
+      g_cond_wait (&ex->cond, &ex->lock);
+    job = g_queue_pop_head (ex->jobs);
+    if (job)
+      ex->busy++;
+    g_mutex_unlock (&ex->lock);
+    if (!job)
+      break;
+
+    for (guint i = 0; i < EVIDENCE_CROPS; i++) {
+      gint64 start = g_get_monotonic_time ();
+      gchar *path;
+
+      if (!job->crops[i])
+        continue;
+      path = g_strdup_printf ("%s/%ld_%lu_%s.jpg", ex->dir,
+          (long) job->track_id, (unsigned long) job->pts, crop_names[i]);
+      if (crop_write_jpeg (job->crops[i], path, ex->config.quality))
+        written++;
+      else
+        failed++;
+      encode += g_get_monotonic_time () - start;
+      g_free (path);
+      crop_free (job->crops[i]);
+    }
+
+    g_mutex_lock (&ex->lock);
+    gint64 latency = g_get_monotonic_time () - job->queued_at;
+    ex->stats.written += written;
+    ex->stats.failed += failed;
+    ex->encode_sum += encode;
+    ex->latency_sum += latency;
+    ex->stats.latency_max_us = MAX (ex->stats.latency_max_us, latency);
+    ex->busy--;
+    g_cond_broadcast (&ex->cond);
+    g_mutex_unlock (&ex->lock);
+    g_free (job);
+  }
+  return NULL;
+}
+
+EvidenceExport *
+evidence_export_new (const EvidenceConfig * config)
+{
+  EvidenceExport *ex;
+
+  if (g_mkdir_with_parents (config->dir, 0755) != 0) {
+    g_printerr ("evidence: cannot create %s: %s\n", config->dir,
+        g_strerror (errno));
+    return NULL;
+  }
+
+  ex = g_new0 (EvidenceExport, 1);
+  ex->config = *config;
+  ex->config.workers = MAX (config->workers, 1);
+  ex->config.queue_size = MAX (config->queue_size, 1);
+  ex->config.quality = CLAMP (config->quality, 1, 100);
+  ex->dir = g_strdup (config->dir);
+  ex->config.dir = ex->dir;
+  g_mutex_init (&ex->lock);
+  g_cond_init (&ex->cond);
+  ex->tracks = g_hash_table_new_full (g_int64_hash, g_int64_equal, NULL,
+      track_free);
+  ex->jobs = g_queue_new ();
+  ex->workers = g_new0 (GThread *, ex->config.workers);
+  for (guint i = 0; i < ex->config.workers; i++)
+    ex->workers[i] = g_thread_new ("evidence", evidence_worker, ex);
+  return ex;
+}
+
+/* The track of track_id, added on first use. With the lock held. */
+static EvidenceTrack *
+track_get (EvidenceExport * ex, gint64 track_id)
+{
+  EvidenceTrack *track = g_hash_table_lookup (ex->tracks, &track_id);
+
+  if (!track) {
+    track = g_new0 (EvidenceTrack, 1);
+    track->track_id = track_id;
+    track->confidence = -1;
+    g_hash_table_insert (ex->tracks, &track->track_id, track);
+  }
+  track->last_batch = ex->batch;
+  return track;
+}
+
+gboolean
+evidence_export_wants (EvidenceExport * ex, gint64 track_id, gfloat confidence)
+{
+  gboolean wants;
+
+  g_mutex_lock (&ex->lock);
+  wants = confidence > track_get (ex, track_id)->confidence;
+  g_mutex_unlock (&ex->lock);
+  return wants;
+}
+
+void
+evidence_export_offer (EvidenceExport * ex, gint64 track_id, guint64 pts,
+    gfloat confidence, const EvidenceFrame * frame, const EvidenceBox * plate,
+    const EvidenceBox * vehicle)
+{
+  const EvidenceBox *boxes[EVIDENCE_CROPS] = { plate, vehicle };
+  EvidenceCrop *crops[EVIDENCE_CROPS];
+  EvidenceTrack *track;
+
+  /* Copy outside the lock, the workers only need it between jobs */
+  for (guint i = 0; i < EVIDENCE_CROPS; i++)
+    crops[i] = boxes[i] ? crop_copy (frame, boxes[i]) : NULL;
+
+  g_mutex_lock (&ex->lock);
+  track = track_get (ex, track_id);
+  track->confidence = confidence;
+  track->pts = pts;
+  for (guint i = 0; i < EVIDENCE_CROPS; i++) {
+    EvidenceCrop *old = track->crops[i];
+    track->crops[i] = crops[i];
+    crops[i] = old;
+  }
+  g_mutex_unlock (&ex->lock);
+
+  for (guint i = 0; i < EVIDENCE_CROPS; i++)
+    crop_free (crops[i]);
+}
+
+void
+evidence_export_emit (EvidenceExport * ex, gint64 track_id)
+{
+  EvidenceTrack *track;
+  EvidenceJob *job;
+  guint crops = 0;
+
+  g_mutex_lock (&ex->lock);
+  track = g_hash_table_lookup (ex->tracks, &track_id);
+  for (guint i = 0; track && i < EVIDENCE_CROPS; i++)
+    crops += track->crops[i] != NULL;
+  if (!crops) {
+    g_mutex_unlock (&ex->lock);
+    return;
+  }
+
+  /* The best score stays, so a later record of the track only gets crops
+   * of a better frame */
+  if (g_queue_get_length (ex->jobs) >= ex->config.queue_size) {
+    ex->stats.dropped += crops;
+    for (guint i = 0; i < EVIDENCE_CROPS; i++) {
+      crop_free (track->crops[i]);
+      track->crops[i] = NULL;
+    }
+    g_mutex_unlock (&ex->lock);
+    return;
+  }
+
+  job = g_new0 (EvidenceJob, 1);
+  job->track_id = track_id;
+  job->pts = track->pts;
+  job->queued_at = g_get_monotonic_time ();
+  for (guint i = 0; i < EVIDENCE_CROPS; i++) {
+    job->crops[i] = track->crops[i];
+    track->crops[i] = NULL;
+  }
+  g_queue_push_tail (ex->jobs, job);
+  ex->stats.queued++;
+  g_cond_broadcast (&ex->cond);
+  g_mutex_unlock (&ex->lock);
+}
+
+static gboolean
+track_expired (gpointer key, gpointer value, gpointer user_data)
+{
+  EvidenceExport *ex = user_data;
+  EvidenceTrack *track = value;
+
+  return ex->batch - track->last_batch > ex->config.timeout;
+}
+
+void
+evidence_export_tick (EvidenceExport * ex)
+{
+  g_mutex_lock (&ex->lock);
+  ex->batch++;
+  g_hash_table_foreach_remove (ex->tracks, track_expired, ex);
+  g_mutex_unlock (&ex->lock);
+}
+
+void
+evidence_export_drain (EvidenceExport * ex)
+{
+  g_mutex_lock (&ex->lock);
+  while (!g_queue_is_empty (ex->jobs) || ex->busy)
+    g_cond_wait (&ex->cond, &ex->lock);
+  g_mutex_unlock (&ex->lock);
+}
+
+void
+evidence_export_get_stats (EvidenceExport * ex, EvidenceStats * stats)
+{
+  guint64 done;
+
+  g_mutex_lock (&ex->lock);
+  *stats = ex->stats;
+  done = ex->stats.queued - g_queue_get_length (ex->jobs) - ex->busy;
+  stats->latency_mean_us = done ? ex->latency_sum / (gint64) done : 0;
+  done = ex->stats.written + ex->stats.failed;
+  stats->encode_mean_us = done ? ex->encode_sum / (gint64) done : 0;
+  g_mutex_unlock (&ex->lock);
+}
+
+void
+evidence_export_free (EvidenceExport * ex)
+{
+  if (!ex)
+    return;
+  g_mutex_lock (&ex->lock);
+  ex->stop = TRUE;
+  g_cond_broadcast (&ex->cond);
+  g_mutex_unlock (&ex->lock);
+  for (guint i = 0; i < ex->config.workers; i++)
+    g_thread_join (ex->workers[i]);
+  g_free (ex->workers);
+  g_queue_free (ex->jobs);
+  g_hash_table_destroy (ex->tracks);
+  g_cond_clear (&ex->cond);
+  g_mutex_clear (&ex->lock);
+  g_free (ex->dir);
+  g_free (ex);
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* Asynchronous JPEG evidence of emitted results.
+ *
+ * For every vehicle track the results probe offers the plate and vehicle
+ * crops of a frame with a plate reading. Only a reading more confident than
+ * the best one of the track so far is copied out of the frame, so a track
+ * holds the crops of its best frame. When the record of the track is
+ * emitted, its crops are queued for a pool of worker threads that convert
+ * them, encode them with libjpeg and write <track>_<pts>_plate.jpg and
+ * <track>_<pts>_vehicle.jpg. The queue is bounded: when it is full the crops
+ * are dropped and counted, the streaming thread never waits for an encoder.
+ */
+
+#ifndef __EVIDENCE_EXPORT_H__
+#define __EVIDENCE_EXPORT_H__
+
+#include <glib.h>
+
+typedef enum
+{
+  EVIDENCE_FORMAT_NV12,         /* Y plane, interleaved UV plane */
+  EVIDENCE_FORMAT_RGBA
+} EvidenceFormat;
+
+/* A CPU readable frame */
+typedef struct _EvidenceFrame
+{
+  EvidenceFormat format;
+  guint width;
+  guint height;
+  const guint8 *planes[2];
+  guint pitch[2];
+} EvidenceFrame;
+
+typedef struct _EvidenceBox
+{
+  gint left;
+  gint top;
+  gint width;
+  gint height;
+} EvidenceBox;
+
+typedef struct _EvidenceConfig
+{
+  const gchar *dir;             /* Created if missing */
+  guint workers;
+  guint queue_size;             /* Tracks queued for the workers */
+  gint quality;                 /* JPEG quality, 1 to 100 */
+  guint timeout;                /* Batches after which a track not offered
+                                 * again is forgotten */
+} EvidenceConfig;
+
+typedef struct _EvidenceStats
+{
+  guint64 queued;               /* Tracks queued */
+  guint64 written;              /* Crops written */
+  guint64 dropped;              /* Crops dropped on a full queue */
+  guint64 failed;               /* Crops that could not be written */
+  gint64 latency_mean_us;       /* Emit to written, per track */
+  gint64 latency_max_us;
+  gint64 encode_mean_us;        /* Encode and write, per crop */
+} EvidenceStats;
+
+typedef struct _EvidenceExport EvidenceExport;
+
+/* NULL when dir cannot be created */
+EvidenceExport *evidence_export_new (const EvidenceConfig * config);
+
+/* TRUE when a reading of track_id with confidence beats the best frame of
+ * the track, i.e. when its crops should be offered */
+gboolean evidence_export_wants (EvidenceExport * ex, gint64 track_id,
+    gfloat confidence);
+
+/* Keep the crops under plate and vehicle (may be NULL) of frame as the best
+ * frame of track_id */
+void evidence_export_offer (EvidenceExport * ex, gint64 track_id,
+    guint64 pts, gfloat confidence, const EvidenceFrame * frame,
+    const EvidenceBox * plate, const EvidenceBox * vehicle);
+
+/* The record of track_id was emitted: queue the crops of its best frame */
+void evidence_export_emit (EvidenceExport * ex, gint64 track_id);
+
+/* Advance by one batch, forgetting tracks not offered for timeout batches */
+void evidence_export_tick (EvidenceExport * ex);
+
+/* Wait until the queued crops are written */
+void evidence_export_drain (EvidenceExport * ex);
+
+void evidence_export_get_stats (EvidenceExport * ex, EvidenceStats * stats);
+
+void evidence_export_free (EvidenceExport * ex);
+
+#endif
@@ -0,0 +1,696 @@
+/*
+ * Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "hotlist.h"
+
+#define HOTLIST_MAGIC "ALPRHOT1"
+#define HOTLIST_SUFFIX ".idx"
+
+/* 6 bits per character, code 0 ends the plate */
+#define HOTLIST_CODE_BITS 6
+#define HOTLIST_CODE_MASK ((1ull << HOTLIST_CODE_BITS) - 1)
+
+/* The plate and its variants, at most 3 confusions per character */
+#define HOTLIST_MAX_KEYS (1 + HOTLIST_MAX_PLATE * 3)
+
+/* Keys per table line, one cache line */
+#define HOTLIST_LINE_KEYS 8
+
+/* Table lines, a power of two keeping the table at most 3/4 full */
+#define HOTLIST_MIN_LINE_BITS 4
+#define HOTLIST_MAX_LINE_BITS 28
+
+/* Characters an OCR misreads for each other. Every group is a clique, each
+ * member lists all the others, see confusions_symmetric() */
+static const gchar *const confusions[128] = {
+  ['0'] = "ODQ",['O'] = "0DQ",['D'] = "0OQ",['Q'] = "0OD",
+  ['1'] = "I7",['I'] = "17",['7'] = "1I",
+  ['2'] = "Z",['Z'] = "2",
+  ['4'] = "A",['A'] = "4",
+  ['5'] = "S",['S'] = "5",
+  ['6'] = "GC",['G'] = "6C",['C'] = "6G",
+  ['8'] = "B",['B'] = "8",
+  ['E'] = "F",['F'] = "E",
+  ['K'] = "X",['X'] = "K",
+  ['M'] = "N",['N'] = "M",
+  ['P'] = "R",['R'] = "P",
+  ['U'] = "V",['V'] = "U",
+};
+
+/* TRUE when a listed plate read with any confusion of the table matches,
+ * whichever member of a group is on the list and whichever was read */
+static gboolean
+confusions_symmetric (void)
+{
+  for (guint c = 0; c < G_N_ELEMENTS (confusions); c++) {
+    for (const gchar * a = confusions[c]; a && *a; a++) {
+      const gchar *back = confusions[(guchar) * a];
+      if (*a == (gchar) c || !back || !strchr (back, c))
+        return FALSE;
+      for (const gchar * b = confusions[c]; *b; b++)
+        if (*b != *a && !strchr (back, *b))
+          return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+/* Start of <path>.idx, followed by the table of 2^line_bits lines of
+ * HOTLIST_LINE_KEYS keys (0 = empty), and with notes the note offset of
+ * every slot and the notes */
+typedef struct _HotlistHeader
+{
+  gchar magic[8];
+  guint32 line_bits;
+  guint32 reserved;
+  guint64 count;
+  guint64 skipped;
+  guint64 notes_bytes;          /* 0 = no notes */
+  gint64 source_mtime_ns;       /* Of the list it was built from */
+  guint64 source_size;
+  guint64 pad;
+} HotlistHeader;
+
+G_STATIC_ASSERT (sizeof (HotlistHeader) == HOTLIST_LINE_KEYS * sizeof (guint64));
+
+struct _Hotlist
+{
+  gint refs;
+  guint8 *base;
+  gsize size;
+  gboolean mapped;              /* Else base is allocated */
+  const HotlistHeader *header;
+  guint shift;
+  guint64 line_mask;
+  const guint64 *table;
+  const guint32 *note_at;       /* NULL without notes */
+  const gchar *notes;
+};
+
+static inline guint64
+mix_key (guint64 key)
+{
+  key ^= key >> 30;
+  key *= 0xbf58476d1ce4e5b9ull;
+  key ^= key >> 27;
+  key *= 0x94d049bb133111ebull;
+  return key ^ (key >> 31);
+}
+
+static inline guint
+char_code (gchar c)
+{
+  if (c >= '0' && c <= '9')
+    return 1 + c - '0';
+  return 11 + c - 'A';
+}
+
+static inline gchar
+code_char (guint code)
+{
+  return code <= 10 ? '0' + code - 1 : 'A' + code - 11;
+}
+
+/* Upper case letters and digits of plate into chars, other ASCII dropped.
+ * FALSE when there are none, more than HOTLIST_MAX_PLATE or non-ASCII. */
+static inline gboolean
+normalize_plate (const gchar * plate, gsize size, gchar * chars, guint * len)
+{
+  *len = 0;
+  for (gsize i = 0; i < size && plate[i]; i++) {
+    gchar c = plate[i];
+    if ((guchar) c >= 0x80)
+      return FALSE;
+    if (c >= 'a' && c <= 'z')
+      c -= 'a' - 'A';
+    if (!((c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z')))
+      continue;
+    if (*len == HOTLIST_MAX_PLATE)
+      return FALSE;
+    chars[(*len)++] = c;
+  }
+  return *len > 0;
+}
+
+static inline guint
+code_shift (guint position)
+{
+  return HOTLIST_CODE_BITS * (HOTLIST_MAX_PLATE - 1 - position);
+}
+
+static guint64
+pack_plate (const gchar * chars, guint len)
+{
+  guint64 key = 0;
+
+  for (guint i = 0; i < len; i++)
+    key |= (guint64) char_code (chars[i]) << code_shift (i);
+  return key;
+}
+
+static void
+unpack_plate (guint64 key, gchar * plate)
+{
+  guint i;
+
+  for (i = 0; i < HOTLIST_MAX_PLATE; i++) {
+    guint code = (key >> code_shift (i)) & HOTLIST_CODE_MASK;
+    if (!code)
+      break;
+    plate[i] = code_char (code);
+  }
+  plate[i] = '\0';
+}
+
+static gsize
+image_size (guint line_bits, guint64 notes_bytes)
+{
+  gsize slots = ((gsize) HOTLIST_LINE_KEYS) << line_bits;
+  gsize size = sizeof (HotlistHeader) + slots * sizeof (guint64);
+
+  if (notes_bytes)
+    size += slots * sizeof (guint32) + notes_bytes;
+  return size;
+}
+
+/* Point list at the parts of the image at list->base */
+static gboolean
+hotlist_attach (Hotlist * list)
+{
+  const HotlistHeader *header = (const HotlistHeader *) list->base;
+
+  if (list->size < sizeof (*header) ||
+      memcmp (header->magic, HOTLIST_MAGIC, sizeof (header->magic)) ||
+      header->line_bits < HOTLIST_MIN_LINE_BITS ||
+      header->line_bits > HOTLIST_MAX_LINE_BITS ||
+      list->size != image_size (header->line_bits, header->notes_bytes))
+    return FALSE;
+
+  list->header = header;
+  list->shift = 64 - header->line_bits;
+  list->line_mask = (1ull << header->line_bits) - 1;
+  list->table = (const guint64 *) (header + 1);
+  if (header->notes_bytes) {
+    list->note_at = (const guint32 *) (list->table +
+        ((gsize) HOTLIST_LINE_KEYS << header->line_bits));
+    list->notes = (const gchar *) (list->note_at +
+        ((gsize) HOTLIST_LINE_KEYS << header->line_bits));
+  }
+  return TRUE;
+}
+
+/* Slot of key in the table, or of the empty slot it belongs in */
+static inline gsize
+find_slot (const Hotlist * list, guint64 key, gboolean * found)
+{
+  guint64 line = mix_key (key) >> list->shift;
+
+  /* The table is at most 3/4 full, so there is always an empty slot */
+  for (;; line = (line + 1) & list->line_mask) {
+    const guint64 *keys = list->table + line * HOTLIST_LINE_KEYS;
+    for (guint i = 0; i < HOTLIST_LINE_KEYS; i++) {
+      if (keys[i] == key || keys[i] == 0) {
+        *found = keys[i] == key;
+        return line * HOTLIST_LINE_KEYS + i;
+      }
+    }
+  }
+}
+
+/* Read the text list at path into a new image, allocated with
+ * posix_memalign */
+static guint8 *
+build_image (const gchar * path, const struct stat *st, gsize * size)
+{
+  FILE *fp = fopen (path, "r");
+  GArray *entries;
+  GString *notes;
+  gchar *line = NULL;
+  gsize line_size = 0;
+  guint64 skipped = 0;
+  guint line_bits = HOTLIST_MIN_LINE_BITS;
+  guint8 *image;
+
+  if (!fp) {
+    g_printerr ("Hotlist %s could not be opened: %s\n", path,
+        g_strerror (errno));
+    return NULL;
+  }
+  entries = g_array_sized_new (FALSE, FALSE, sizeof (guint64),
+      MAX (st->st_size / 8, 16));
+  /* Offset 0 is the empty note, notes follow the keys they belong to */
+  GArray *note_of = g_array_sized_new (FALSE, FALSE, sizeof (guint32),
+      MAX (st->st_size / 8, 16));
+  notes = g_string_new ("");
+  g_string_append_c (notes, '\0');
+
+  while (getline (&line, &line_size, fp) > 0) {
+    gchar chars[HOTLIST_MAX_PLATE];
+    gchar *note = strchr (line, ',');
+    guint32 note_offset = 0;
+    guint len;
+
+    g_strstrip (line);
+    if (line[0] == '#' || line[0] == '\0')
+      continue;
+    if (note)
+      *note++ = '\0';
+    if (!normalize_plate (line, strlen (line), chars, &len)) {
+      skipped++;
+      continue;
+    }
+    guint64 key = pack_plate (chars, len);
+    if (note && *g_strstrip (note) && notes->len < G_MAXUINT32 - HOTLIST_NOTE_LEN) {
+      note_offset = notes->len;
+      g_string_append_len (notes, note, MIN (strlen (note), HOTLIST_NOTE_LEN - 1));
+      g_string_append_c (notes, '\0');
+    }
+    g_array_append_val (entries, key);
+    g_array_append_val (note_of, note_offset);
+  }
+  free (line);
+  fclose (fp);
+
+  while (line_bits < HOTLIST_MAX_LINE_BITS &&
+      ((guint64) HOTLIST_LINE_KEYS << line_bits) * 3 / 4 < entries->len)
+    line_bits++;
+  if (((guint64) HOTLIST_LINE_KEYS << line_bits) * 3 / 4 < entries->len) {
+    g_printerr ("Hotlist %s has too many entries\n", path);
+    g_array_free (entries, TRUE);
+    g_array_free (note_of, TRUE);
+    g_string_free (notes, TRUE);
+    return NULL;
+  }
+
+  guint64 notes_bytes = notes->len > 1 ? notes->len : 0;
+  *size = image_size (line_bits, notes_bytes);
+  if (posix_memalign ((void **) &image, 4096, *size)) {
+    g_array_free (entries, TRUE);
+    g_array_free (note_of, TRUE);
+    g_string_free (notes, TRUE);
+    return NULL;
+  }
+  memset (image, 0, *size);
+  Hotlist view = { 0, image, *size };
+  HotlistHeader *header = (HotlistHeader *) image;
+
+  memcpy (header->magic, HOTLIST_MAGIC, sizeof (header->magic));
+  header->line_bits = line_bits;
+  header->skipped = skipped;
+  header->notes_bytes = notes_bytes;
+  header->source_mtime_ns = st->st_mtim.tv_sec * 1000000000ll + st->st_mtim.tv_nsec;
+  header->source_size = st->st_size;
+  hotlist_attach (&view);
+
+  /* Duplicates keep the note of the first entry */
+  for (guint i = 0; i < entries->len; i++) {
+    guint64 key = g_array_index (entries, guint64, i);
+    gboolean found;
+    gsize slot = find_slot (&view, key, &found);
+    if (found)
+      continue;
+    ((guint64 *) view.table)[slot] = key;
+    if (notes_bytes)
+      ((guint32 *) view.note_at)[slot] = g_array_index (note_of, guint32, i);
+    header->count++;
+  }
+  if (notes_bytes)
+    memcpy ((gchar *) view.notes, notes->str, notes_bytes);
+
+  g_array_free (entries, TRUE);
+  g_array_free (note_of, TRUE);
+  g_string_free (notes, TRUE);
+  return image;
+}
+
+/* Write image to idx_path through a temporary file */
+static gboolean
+write_image (const gchar * idx_path, const guint8 * image, gsize size)
+{
+  gchar *tmp = g_strconcat (idx_path, ".tmp", NULL);
+  gint fd = open (tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  gboolean ok = fd >= 0;
+
+  for (gsize done = 0; ok && done < size;) {
+    ssize_t n = write (fd, image + done, size - done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    ok = n > 0;
+    done += MAX (n, 0);
+  }
+  if (fd >= 0)
+    close (fd);
+  ok = ok && rename (tmp, idx_path) == 0;
+  if (!ok) {
+    g_printerr ("Hotlist index %s could not be written: %s\n", idx_path,
+        g_strerror (errno));
+    unlink (tmp);
+  }
+  g_free (tmp);
+  return ok;
+}
+
+/* Map idx_path if it was built from the list described by st */
+static gboolean
+map_image (Hotlist * list, const gchar * idx_path, const struct stat *st)
+{
+  gint fd = open (idx_path, O_RDONLY | O_CLOEXEC);
+  struct stat idx_st;
+
+  if (fd < 0)
+    return FALSE;
+  if (fstat (fd, &idx_st) != 0 || idx_st.st_size < (off_t) sizeof (HotlistHeader)) {
+    close (fd);
+    return FALSE;
+  }
+  list->size = idx_st.st_size;
+  /* Populated here, so no lookup in the streaming thread faults a page in */
+  list->base = mmap (NULL, list->size, PROT_READ, MAP_SHARED | MAP_POPULATE,
+      fd, 0);
+  close (fd);
+  if (list->base == MAP_FAILED) {
+    list->base = NULL;
+    return FALSE;
+  }
+  list->mapped = TRUE;
+  if (!hotlist_attach (list) ||
+      list->header->source_mtime_ns !=
+      st->st_mtim.tv_sec * 1000000000ll + st->st_mtim.tv_nsec ||
+      list->header->source_size != (guint64) st->st_size) {
+    munmap (list->base, list->size);
+    list->base = NULL;
+    list->mapped = FALSE;
+    return FALSE;
+  }
+  return TRUE;
+}
+
+Hotlist *
+hotlist_load (const gchar * path)
+{
+  Hotlist *list = g_new0 (Hotlist, 1);
+  gchar *idx_path = g_strconcat (path, HOTLIST_SUFFIX, NULL);
+  struct stat st;
+
+  g_assert (confusions_symmetric ());
+  list->refs = 1;
+  if (stat (path, &st) != 0) {
+    g_printerr ("Hotlist %s could not be read: %s\n", path, g_strerror (errno));
+    goto fail;
+  }
+  if (!map_image (list, idx_path, &st)) {
+    guint8 *image = build_image (path, &st, &list->size);
+    if (!image)
+      goto fail;
+    /* The written index is mapped, so its pages are shared */
+    if (write_image (idx_path, image, list->size) &&
+        map_image (list, idx_path, &st)) {
+      free (image);
+    } else {
+      list->base = image;
+      hotlist_attach (list);
+    }
+  }
+  g_free (idx_path);
+  return list;
+
+fail:
+  g_free (idx_path);
+  g_free (list);
+  return NULL;
+}
+
+Hotlist *
+hotlist_ref (Hotlist * list)
+{
+  if (list)
+    g_atomic_int_inc (&list->refs);
+  return list;
+}
+
+void
+hotlist_unref (Hotlist * list)
+{
+  if (!list || !g_atomic_int_dec_and_test (&list->refs))
+    return;
+  if (list->mapped)
+    munmap (list->base, list->size);
+  else
+    free (list->base);
+  g_free (list);
+}
+
+guint64
+hotlist_size (Hotlist * list)
+{
+  return list->header->count;
+}
+
+guint64
+hotlist_skipped (Hotlist * list)
+{
+  return list->header->skipped;
+}
+
+gboolean
+hotlist_match (Hotlist * list, const gchar * plate, gboolean near_miss,
+    HotlistMatch * match)
+{
+  gchar chars[HOTLIST_MAX_PLATE];
+  guint64 keys[HOTLIST_MAX_KEYS];
+  guint len, count = 1;
+
+  if (!normalize_plate (plate, RESULT_PLATE_LEN, chars, &len))
+    return FALSE;
+  keys[0] = pack_plate (chars, len);
+  for (guint i = 0; near_miss && i < len; i++) {
+    const gchar *other = confusions[(guchar) chars[i]];
+    for (; other && *other; other++)
+      keys[count++] = (keys[0] & ~(HOTLIST_CODE_MASK << code_shift (i))) |
+          (guint64) char_code (*other) << code_shift (i);
+  }
+
+  /* Start the line loads of all keys before waiting for the first */
+  for (guint i = 0; i < count; i++)
+    __builtin_prefetch (list->table +
+        (mix_key (keys[i]) >> list->shift) * HOTLIST_LINE_KEYS);
+
+  for (guint i = 0; i < count; i++) {
+    gboolean found;
+    gsize slot = find_slot (list, keys[i], &found);
+    if (!found)
+      continue;
+    unpack_plate (keys[i], match->plate);
+    match->distance = i > 0;
+    g_strlcpy (match->note, list->note_at ?
+        list->notes + list->note_at[slot] : "", HOTLIST_NOTE_LEN);
+    return TRUE;
+  }
+  return FALSE;
+}
+
+typedef struct _HotlistAlert
+{
+  gint64 time_us;
+  guint64 pts;
+  gint64 track_id;
+  guint source_id;
+  gfloat lpr_confidence;
+  gfloat ocr_confidence;
+  gchar plate[RESULT_PLATE_LEN];
+  HotlistMatch match;
+} HotlistAlert;
+
+struct _HotlistAlerts
+{
+  FILE *out;
+  GMutex lock;
+  GCond cond;
+  GQueue *queue;
+  guint queue_size;
+  gboolean stop;
+  GThread *thread;
+  guint64 alerts;
+  guint64 dropped;
+};
+
+static void
+write_json_string (FILE * out, const gchar * str)
+{
+  fputc ('"', out);
+  for (; *str; str++) {
+    guchar c = *str;
+    if (c == '"' || c == '\\')
+      fprintf (out, "\\%c", c);
+    else if (c < 0x20)
+      fprintf (out, "\\u%04x", c);
+    else
+      fputc (c, out);
+  }
+  fputc ('"', out);
+}
+
+static void
+write_alert (FILE * out, const HotlistAlert * alert)
+{
+  time_t seconds = alert->time_us / G_USEC_PER_SEC;
+  gint64 pts = alert->pts == G_MAXUINT64 ? -1 : (gint64) alert->pts;
+  struct tm tm;
+  gchar time_str[32];
+
+  gmtime_r (&seconds, &tm);
+  strftime (time_str, sizeof (time_str), "%Y-%m-%dT%H:%M:%S", &tm);
+  fprintf (out, "{\"time\":\"%s.%03dZ\",\"track_id\":%" G_GINT64_FORMAT
+      ",\"source_id\":%u,\"pts\":%" G_GINT64_FORMAT ",\"plate\":", time_str,
+      (gint) (alert->time_us % G_USEC_PER_SEC / 1000), alert->track_id,
+      alert->source_id, pts);
+  write_json_string (out, alert->plate);
+  fprintf (out, ",\"lpr_confidence\":%f,\"ocr_confidence\":%f,"
+      "\"hotlist_plate\":", alert->lpr_confidence, alert->ocr_confidence);
+  write_json_string (out, alert->match.plate);
+  fprintf (out, ",\"distance\":%u,\"note\":", alert->match.distance);
+  write_json_string (out, alert->match.note);
+  fputs ("}\n", out);
+}
+
+static gpointer
+alerts_thread (gpointer data)
+{
+  HotlistAlerts *alerts = (HotlistAlerts *) data;
+
+  g_mutex_lock (&alerts->lock);
+  for (;;) {
+    HotlistAlert *alert = g_queue_pop_head (alerts->queue);
+    if (!alert) {
+      if (alerts->stop)
+        break;
+      g_cond_wait (&alerts->cond, &alerts->lock);
+      continue;
+    }
+
+    /* Written without the lock, so pushes never wait for the output */
+    g_mutex_unlock (&alerts->lock);
+    write_alert (alerts->out, alert);
+    fflush (alerts->out);
+    g_free (alert);
+    g_mutex_lock (&alerts->lock);
+    alerts->alerts++;
+  }
+  g_mutex_unlock (&alerts->lock);
+  return NULL;
+}
+
+HotlistAlerts *
+hotlist_alerts_new (const gchar * path, guint queue_size)
+{
+  HotlistAlerts *alerts;
+  FILE *out = g_strcmp0 (path, "-") ? fopen (path, "a") : stderr;
+
+  if (!out) {
+    g_printerr ("Hotlist alert output %s could not be opened: %s\n", path,
+        g_strerror (errno));
+    return NULL;
+  }
+  alerts = g_new0 (HotlistAlerts, 1);
+  alerts->out = out;
+  alerts->queue_size = MAX (queue_size, 1);
+  g_mutex_init (&alerts->lock);
+  g_cond_init (&alerts->cond);
+  alerts->queue = g_queue_new ();
+  alerts->thread = g_thread_new ("hotlist-alerts", alerts_thread, alerts);
+  return alerts;
+}
+
+void
+hotlist_alerts_push (HotlistAlerts * alerts, const ResultRecord * record,
+    const HotlistMatch * match)
+{
+  HotlistAlert *alert = g_new (HotlistAlert, 1);
+
+  alert->time_us = g_get_real_time ();
+  alert->pts = record->pts;
+  alert->track_id = record->track_id;
+  alert->source_id = record->source_id;
+  alert->lpr_confidence = record->lpr_confidence;
+  alert->ocr_confidence = record->ocr_confidence;
+  g_strlcpy (alert->plate, record->plate, RESULT_PLATE_LEN);
+  alert->match = *match;
+
+  g_mutex_lock (&alerts->lock);
+  if (alerts->stop ||
+      g_queue_get_length (alerts->queue) >= alerts->queue_size) {
+    alerts->dropped++;
+    g_free (alert);
+  } else {
+    g_queue_push_tail (alerts->queue, alert);
+    g_cond_signal (&alerts->cond);
+  }
+  g_mutex_unlock (&alerts->lock);
+}
+
+void
+hotlist_alerts_get_stats (HotlistAlerts * alerts, HotlistAlertStats * stats)
+{
+  g_mutex_lock (&alerts->lock);
+  stats->alerts = alerts->alerts;
+  stats->dropped = alerts->dropped;
+  g_mutex_unlock (&alerts->lock);
+}
+
+void
+hotlist_alerts_drain (HotlistAlerts * alerts)
+{
+  if (!alerts->thread)
+    return;
+
+  g_mutex_lock (&alerts->lock);
+  alerts->stop = TRUE;
+  g_cond_signal (&alerts->cond);
+  g_mutex_unlock (&alerts->lock);
+  g_thread_join (alerts->thread);
+  alerts->thread = NULL;
+}
+
+void
+hotlist_alerts_free (HotlistAlerts * alerts)
+{
+  if (!alerts)
+    return;
+
+  hotlist_alerts_drain (alerts);
+
+  if (alerts->out != stderr)
+    fclose (alerts->out);
+  g_queue_free (alerts->queue);
+  g_mutex_clear (&alerts->lock);
+  g_cond_clear (&alerts->cond);
+  g_free (alerts);
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* Watchlist matching of emitted plates.
+ *
+ * A hotlist is a text file with one plate per line, optionally followed by
+ * a comma and a note (a case number, say). Plates are packed into 64-bit
+ * keys of 6 bits per character (A-Z and 0-9, at most 10 characters, other
+ * characters dropped) and stored in an open addressed hash table of
+ * 64-byte lines of eight keys, at most 3/4 full, so a lookup almost always
+ * reads one cache line. The table is built once into <path>.idx next to
+ * the list and mapped from there, so a restart or a second process maps it
+ * in milliseconds and shares its pages.
+ *
+ * A lookup checks the plate itself and every variant that differs by one
+ * OCR confusion (0/O/D/Q, 1/I/7, 8/B, 5/S, ...). The lines of all variants
+ * are prefetched before any is compared, so their cache misses overlap.
+ *
+ * Hotlists are reference counted, so a new list can be swapped in while
+ * matches against the old one are still running. Alerts are written as
+ * JSON lines by a thread of their own.
+ */
+
+#ifndef __HOTLIST_H__
+#define __HOTLIST_H__
+
+#include <glib.h>
+#include "result_writer.h"
+
+#define HOTLIST_MAX_PLATE 10
+#define HOTLIST_NOTE_LEN 64
+
+typedef struct _HotlistMatch
+{
+  gchar plate[HOTLIST_MAX_PLATE + 1];   /* The hotlist entry */
+  guint distance;               /* 0 = exact, 1 = one OCR confusion */
+  gchar note[HOTLIST_NOTE_LEN];
+} HotlistMatch;
+
+typedef struct _Hotlist Hotlist;
+
+/* Map <path>.idx, building it first when it is missing or older than
+ * path. NULL if path can not be read. */
+Hotlist *hotlist_load (const gchar * path);
+
+Hotlist *hotlist_ref (Hotlist * list);
+void hotlist_unref (Hotlist * list);
+
+guint64 hotlist_size (Hotlist * list);
+
+/* Entries skipped when the list was built: too long, or empty */
+guint64 hotlist_skipped (Hotlist * list);
+
+/* TRUE when plate, or with near_miss a plate one OCR confusion away, is on
+ * the list. An exact entry is preferred over a near one. */
+gboolean hotlist_match (Hotlist * list, const gchar * plate,
+    gboolean near_miss, HotlistMatch * match);
+
+typedef struct _HotlistAlertStats
+{
+  guint64 alerts;               /* Written */
+  guint64 dropped;              /* On a full queue */
+} HotlistAlertStats;
+
+typedef struct _HotlistAlerts HotlistAlerts;
+
+/* Open path ("-" for stderr) for alerts queued up to queue_size, NULL if it
+ * can not be opened */
+HotlistAlerts *hotlist_alerts_new (const gchar * path, guint queue_size);
+
+/* Queue an alert for record, never blocks */
+void hotlist_alerts_push (HotlistAlerts * alerts, const ResultRecord * record,
+    const HotlistMatch * match);
+
+void hotlist_alerts_get_stats (HotlistAlerts * alerts,
+    HotlistAlertStats * stats);
+
+/* Write what is queued and stop the thread, later alerts are dropped */
+void hotlist_alerts_drain (HotlistAlerts * alerts);
+
+/* Drain and close the output */
+void hotlist_alerts_free (HotlistAlerts * alerts);
+
+#endif
@@ -0,0 +1,221 @@
+/*
+ * Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* Lookups/sec of the hotlist (hotlist.h).
+ *
+ * Writes a list of random plates, builds its index and maps it again the
+ * way a restart does, then times lookups of plates on the list, plates one
+ * OCR confusion away from it and plates not on it, with and without the
+ * near-miss variants. With -f an existing list is used, and its entries
+ * are read back as the plates on the list.
+ *
+ *   $ make hotlist HOTLIST_ARGS="-n 10000000"
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "hotlist.h"
+
+#define BENCH_ALPHABET "0123456789ABCDEFGHJKLMNPQRSTUVWXYZ"
+#define BENCH_PLATE 8
+
+typedef struct _BenchConfig
+{
+  const gchar *path;
+  gboolean generate;
+  guint64 entries;
+  guint lookups;
+} BenchConfig;
+
+static guint64 rng_state = 0x2545f4914f6cdd1dull;
+
+static guint32
+rng_next (void)
+{
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return rng_state >> 32;
+}
+
+static void
+random_plate (gchar * plate)
+{
+  guint len = 6 + rng_next () % 2;
+
+  for (guint i = 0; i < len; i++)
+    plate[i] = BENCH_ALPHABET[rng_next () % (sizeof (BENCH_ALPHABET) - 1)];
+  plate[len] = '\0';
+}
+
+static gboolean
+write_list (const BenchConfig * cfg, gchar (*plates)[BENCH_PLATE])
+{
+  FILE *fp = fopen (cfg->path, "w");
+
+  if (!fp) {
+    g_printerr ("%s could not be written\n", cfg->path);
+    return FALSE;
+  }
+  for (guint64 i = 0; i < cfg->entries; i++) {
+    random_plate (plates[i]);
+    if (i % 4 == 0)
+      fprintf (fp, "%s,case %lu\n", plates[i], (unsigned long) i);
+    else
+      fprintf (fp, "%s\n", plates[i]);
+  }
+  return fclose (fp) == 0;
+}
+
+/* The first cfg->entries plates of an existing list */
+static guint64
+read_list (const BenchConfig * cfg, gchar (*plates)[BENCH_PLATE])
+{
+  FILE *fp = fopen (cfg->path, "r");
+  gchar line[256];
+  guint64 count = 0;
+
+  if (!fp)
+    return 0;
+  while (count < cfg->entries && fgets (line, sizeof (line), fp)) {
+    line[strcspn (line, ",\r\n")] = '\0';
+    if (line[0] && line[0] != '#' && strlen (line) < BENCH_PLATE)
+      strcpy (plates[count++], line);
+  }
+  fclose (fp);
+  return count;
+}
+
+static void
+time_lookups (Hotlist * list, const gchar * name, gchar (*queries)[BENCH_PLATE],
+    guint count, gboolean near_miss)
+{
+  HotlistMatch match;
+  guint hits = 0;
+  gint64 start = g_get_monotonic_time ();
+
+  for (guint i = 0; i < count; i++)
+    hits += hotlist_match (list, queries[i], near_miss, &match);
+  gint64 elapsed = MAX (g_get_monotonic_time () - start, 1);
+
+  g_print ("%-10s %-6s %10.0f lookups/s %8.1f ns/lookup %6.1f%% hits\n", name,
+      near_miss ? "near" : "exact", count / (elapsed / 1e6),
+      elapsed * 1000.0 / count, 100.0 * hits / count);
+}
+
+static void
+usage (const gchar * prog)
+{
+  g_printerr ("Usage: %s [-n entries] [-l lookups] [-f hotlist | -o new_hotlist]\n"
+      "  -n  entries written, or read from -f, default 10000000\n"
+      "  -l  lookups per kind, default 1000000\n"
+      "  -f  an existing hotlist instead of random plates\n"
+      "  -o  where the random list is written, default hotlist-bench.txt\n",
+      prog);
+}
+
+int
+main (int argc, char *argv[])
+{
+  BenchConfig cfg = { "hotlist-bench.txt", TRUE, 10000000, 1000000 };
+  gint opt;
+
+  while ((opt = getopt (argc, argv, "n:l:f:o:h")) != -1) {
+    switch (opt) {
+      case 'n': cfg.entries = strtoull (optarg, NULL, 10); break;
+      case 'l': cfg.lookups = atoi (optarg); break;
+      case 'f': cfg.path = optarg; cfg.generate = FALSE; break;
+      case 'o': cfg.path = optarg; break;
+      default: usage (argv[0]); return -1;
+    }
+  }
+  if (optind != argc || cfg.entries == 0 || cfg.lookups == 0) {
+    usage (argv[0]);
+    return -1;
+  }
+
+  gchar (*plates)[BENCH_PLATE] = g_malloc (cfg.entries * BENCH_PLATE);
+  gchar (*queries)[BENCH_PLATE] = g_malloc ((gsize) cfg.lookups * BENCH_PLATE);
+  gchar *idx_path = g_strconcat (cfg.path, ".idx", NULL);
+  guint64 entries = cfg.entries;
+
+  if (cfg.generate) {
+    if (!write_list (&cfg, plates))
+      return -1;
+    unlink (idx_path);
+  } else if (!(entries = read_list (&cfg, plates))) {
+    g_printerr ("No plates in %s\n", cfg.path);
+    return -1;
+  }
+
+  gint64 start = g_get_monotonic_time ();
+  Hotlist *list = hotlist_load (cfg.path);
+  if (!list)
+    return -1;
+  g_print ("load: %lu entries, %lu skipped in %.3f s\n",
+      (unsigned long) hotlist_size (list), (unsigned long) hotlist_skipped (list),
+      (g_get_monotonic_time () - start) / 1e6);
+  hotlist_unref (list);
+
+  start = g_get_monotonic_time ();
+  list = hotlist_load (cfg.path);
+  g_print ("reload: mapped %s in %.3f ms\n", idx_path,
+      (g_get_monotonic_time () - start) / 1e3);
+
+  for (guint i = 0; i < cfg.lookups; i++)
+    strcpy (queries[i], plates[rng_next () % entries]);
+  time_lookups (list, "listed", queries, cfg.lookups, FALSE);
+  time_lookups (list, "listed", queries, cfg.lookups, TRUE);
+
+  /* One character, if any, replaced by one an OCR confuses it with */
+  for (guint i = 0; i < cfg.lookups; i++) {
+    static const gchar *const pairs[] = { "0D", "1I", "8B", "5S", "2Z", "6G",
+      "C6", "4A", "MN", "UV", "KX", "EF", "PR" };
+    guint len = strlen (queries[i]), first = rng_next () % len;
+    for (guint j = 0; j < len; j++) {
+      gchar *c = &queries[i][(first + j) % len];
+      const gchar *pair = NULL;
+      for (guint k = 0; k < G_N_ELEMENTS (pairs) && !pair; k++)
+        if (strchr (pairs[k], *c))
+          pair = pairs[k];
+      if (pair) {
+        *c = *c == pair[0] ? pair[1] : pair[0];
+        break;
+      }
+    }
+  }
+  time_lookups (list, "confused", queries, cfg.lookups, FALSE);
+  time_lookups (list, "confused", queries, cfg.lookups, TRUE);
+
+  for (guint i = 0; i < cfg.lookups; i++)
+    random_plate (queries[i]);
+  time_lookups (list, "random", queries, cfg.lookups, FALSE);
+  time_lookups (list, "random", queries, cfg.lookups, TRUE);
+
+  hotlist_unref (list);
+  g_free (idx_path);
+  g_free (plates);
+  g_free (queries);
+  return 0;
+}
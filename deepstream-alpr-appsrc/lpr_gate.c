@@ -0,0 +1,239 @@
+/*
+ * Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "lpr_gate.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define LPR_GATE_HAVE_SSE2 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define LPR_GATE_HAVE_NEON 1
+#endif
+
+/* Ticks between sweeps of the ended tracks */
+#define LPR_GATE_SWEEP_INTERVAL 256
+
+typedef struct _LprGateTrack
+{
+  gint64 key;
+  gfloat best_score;
+  guint64 last_tick;
+} LprGateTrack;
+
+struct _LprGate
+{
+  LprGateConfig config;
+  GHashTable *tracks;           /* &key -> LprGateTrack */
+  guint64 tick;
+  LprGateStats stats;
+};
+
+/* Laplacian sum and sum of squares of columns [x, end) of row y, 1 byte
+ * pixels. Returns the first column not done. */
+static guint
+laplacian_row_simd (const guint8 * row, guint stride, guint x, guint end,
+    gint64 * sum, gint64 * sum_sq)
+{
+#if defined(LPR_GATE_HAVE_SSE2)
+  const __m128i zero = _mm_setzero_si128 ();
+  const __m128i ones = _mm_set1_epi16 (1);
+  __m128i acc = _mm_setzero_si128 ();
+  __m128i acc_sq = _mm_setzero_si128 ();
+
+  /* A row of a plate crop (< 4096 pixels) fits the int32 lanes */
+  for (; x + 8 <= end; x += 8) {
+    __m128i c = _mm_unpacklo_epi8 (_mm_loadl_epi64 ((const __m128i *) (row + x)), zero);
+    __m128i l = _mm_unpacklo_epi8 (_mm_loadl_epi64 ((const __m128i *) (row + x - 1)), zero);
+    __m128i r = _mm_unpacklo_epi8 (_mm_loadl_epi64 ((const __m128i *) (row + x + 1)), zero);
+    __m128i u = _mm_unpacklo_epi8 (_mm_loadl_epi64 ((const __m128i *) (row + x - stride)), zero);
+    __m128i d = _mm_unpacklo_epi8 (_mm_loadl_epi64 ((const __m128i *) (row + x + stride)), zero);
+    __m128i lap = _mm_sub_epi16 (_mm_slli_epi16 (c, 2),
+        _mm_add_epi16 (_mm_add_epi16 (l, r), _mm_add_epi16 (u, d)));
+    acc = _mm_add_epi32 (acc, _mm_madd_epi16 (lap, ones));
+    acc_sq = _mm_add_epi32 (acc_sq, _mm_madd_epi16 (lap, lap));
+  }
+
+  gint32 lanes[4], lanes_sq[4];
+  _mm_storeu_si128 ((__m128i *) lanes, acc);
+  _mm_storeu_si128 ((__m128i *) lanes_sq, acc_sq);
+  for (int i = 0; i < 4; i++) {
+    *sum += lanes[i];
+    *sum_sq += (guint32) lanes_sq[i];
+  }
+#elif defined(LPR_GATE_HAVE_NEON)
+  int32x4_t acc = vdupq_n_s32 (0);
+  uint32x4_t acc_sq = vdupq_n_u32 (0);
+
+  for (; x + 8 <= end; x += 8) {
+    int16x8_t c = vreinterpretq_s16_u16 (vmovl_u8 (vld1_u8 (row + x)));
+    int16x8_t l = vreinterpretq_s16_u16 (vmovl_u8 (vld1_u8 (row + x - 1)));
+    int16x8_t r = vreinterpretq_s16_u16 (vmovl_u8 (vld1_u8 (row + x + 1)));
+    int16x8_t u = vreinterpretq_s16_u16 (vmovl_u8 (vld1_u8 (row + x - stride)));
+    int16x8_t d = vreinterpretq_s16_u16 (vmovl_u8 (vld1_u8 (row + x + stride)));
+    int16x8_t lap = vsubq_s16 (vshlq_n_s16 (c, 2),
+        vaddq_s16 (vaddq_s16 (l, r), vaddq_s16 (u, d)));
+    acc = vpadalq_s16 (acc, lap);
+    acc_sq = vreinterpretq_u32_s32 (vmlal_s16 (vreinterpretq_s32_u32 (acc_sq),
+            vget_low_s16 (lap), vget_low_s16 (lap)));
+    acc_sq = vreinterpretq_u32_s32 (vmlal_s16 (vreinterpretq_s32_u32 (acc_sq),
+            vget_high_s16 (lap), vget_high_s16 (lap)));
+  }
+  *sum += vaddvq_s32 (acc);
+  *sum_sq += vaddvq_u32 (acc_sq);
+#endif
+  return x;
+}
+
+gfloat
+lpr_laplacian_variance (const guint8 * pixels, guint stride,
+    guint pixel_step, guint width, guint height)
+{
+  gint64 sum = 0;
+  gint64 sum_sq = 0;
+  guint64 count;
+
+  if (width < 3 || height < 3)
+    return 0.0f;
+
+  /* Interior pixels only, the neighbours stay inside the crop */
+  for (guint y = 1; y + 1 < height; y++) {
+    const guint8 *row = pixels + (gsize) y * stride;
+    guint x = 1;
+
+    if (pixel_step == 1)
+      x = laplacian_row_simd (row, stride, x, width - 1, &sum, &sum_sq);
+    for (; x + 1 < width; x++) {
+      const guint8 *c = row + x * pixel_step;
+      gint lap = 4 * c[0] - c[-(gint) pixel_step] - c[pixel_step] -
+          c[-(gint) stride] - c[stride];
+      sum += lap;
+      sum_sq += lap * lap;
+    }
+  }
+
+  count = (guint64) (width - 2) * (height - 2);
+  gdouble mean = (gdouble) sum / count;
+  return (gfloat) ((gdouble) sum_sq / count - mean * mean);
+}
+
+gfloat
+lpr_gate_score (const LprGateConfig * config, gfloat width, gfloat height,
+    gfloat sharpness)
+{
+  gfloat size, aspect, ratio, sharp = 1.0f;
+
+  if (width <= 0 || height <= 0)
+    return 0.0f;
+
+  size = MIN (width / config->ideal_width, 1.0f);
+  ratio = width / height;
+  aspect = MIN (MIN (ratio / config->aspect_min, config->aspect_max / ratio), 1.0f);
+  if (sharpness >= 0 && config->sharpness_ref > 0)
+    sharp = MIN (sharpness / config->sharpness_ref, 1.0f);
+  return size * aspect * sharp;
+}
+
+LprGate *
+lpr_gate_new (const LprGateConfig * config)
+{
+  LprGate *gate = g_new0 (LprGate, 1);
+
+  gate->config = *config;
+  gate->tracks = g_hash_table_new_full (g_int64_hash, g_int64_equal, NULL,
+      g_free);
+  return gate;
+}
+
+void
+lpr_gate_set_config (LprGate * gate, const LprGateConfig * config)
+{
+  gate->config = *config;
+}
+
+gboolean
+lpr_gate_decide (LprGate * gate, gint64 track_id, gfloat score,
+    gboolean weak)
+{
+  LprGateTrack *track;
+  gboolean read;
+
+  gate->stats.crops++;
+  if (score < gate->config.min_score) {
+    gate->stats.skipped_low++;
+    return FALSE;
+  }
+  if (track_id < 0) {
+    gate->stats.read++;
+    return TRUE;
+  }
+
+  track = g_hash_table_lookup (gate->tracks, &track_id);
+  if (!track) {
+    track = g_new (LprGateTrack, 1);
+    track->key = track_id;
+    track->best_score = -1.0f;
+    g_hash_table_insert (gate->tracks, &track->key, track);
+  }
+  track->last_tick = gate->tick;
+
+  read = weak || track->best_score < 0 ||
+      score > track->best_score * (1.0f + gate->config.better_margin);
+  track->best_score = MAX (track->best_score, score);
+  if (read)
+    gate->stats.read++;
+  else
+    gate->stats.skipped_repeat++;
+  return read;
+}
+
+static gboolean
+track_ended (gpointer key, gpointer value, gpointer user_data)
+{
+  LprGate *gate = (LprGate *) user_data;
+  LprGateTrack *track = (LprGateTrack *) value;
+
+  return gate->tick - track->last_tick > gate->config.track_timeout;
+}
+
+void
+lpr_gate_tick (LprGate * gate)
+{
+  gate->tick++;
+  if (gate->tick % LPR_GATE_SWEEP_INTERVAL == 0)
+    g_hash_table_foreach_remove (gate->tracks, track_ended, gate);
+}
+
+void
+lpr_gate_get_stats (LprGate * gate, LprGateStats * stats)
+{
+  *stats = gate->stats;
+}
+
+void
+lpr_gate_free (LprGate * gate)
+{
+  if (!gate)
+    return;
+  g_hash_table_destroy (gate->tracks);
+  g_free (gate);
+}
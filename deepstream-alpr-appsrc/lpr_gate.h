@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* Quality gating of the LPR classifier.
+ *
+ * Every plate crop gets a cheap quality score from its size, its aspect ratio
+ * and, when the frame is readable by the CPU, the variance of the Laplacian
+ * of its luma (sharpness). Per vehicle track the gate lets a crop through to
+ * the LPR classifier only when it scores better than the best crop of the
+ * track so far, or when the plate consensus of the track is still weak.
+ */
+
+#ifndef __LPR_GATE_H__
+#define __LPR_GATE_H__
+
+#include <glib.h>
+
+/* unique_component_id given to skipped plate objects, so the LPR nvinfer
+ * (operate-on-gie-id=2) passes over them. Restored after the LPR GIE. */
+#define LPR_GATE_SKIPPED_ID 0x4c5052
+
+typedef struct _LprGateConfig
+{
+  gfloat min_score;             /* Crops below are never read */
+  gfloat better_margin;         /* Relative gain over the best crop to read again */
+  gfloat ideal_width;           /* Plate width in pixels that scores full size */
+  gfloat aspect_min;            /* Width / height range that scores full aspect */
+  gfloat aspect_max;
+  gfloat sharpness_ref;         /* Laplacian variance that scores full sharpness */
+  guint track_timeout;          /* Ticks after which the state of a track is dropped */
+} LprGateConfig;
+
+typedef struct _LprGateStats
+{
+  guint64 crops;
+  guint64 read;                 /* Crops sent to LPR */
+  guint64 skipped_low;          /* Below min_score */
+  guint64 skipped_repeat;       /* Not better than the best crop of a strong track */
+} LprGateStats;
+
+typedef struct _LprGate LprGate;
+
+/* Variance of the 4-neighbour Laplacian over a width x height luma crop.
+ * pixel_step is the byte distance of horizontal neighbours (1 for the Y plane
+ * of NV12 / I420, 4 for RGBA, where the G byte stands in for luma). */
+gfloat lpr_laplacian_variance (const guint8 * pixels, guint stride,
+    guint pixel_step, guint width, guint height);
+
+/* Quality in [0, 1]. sharpness < 0 means not measured. */
+gfloat lpr_gate_score (const LprGateConfig * config, gfloat width,
+    gfloat height, gfloat sharpness);
+
+LprGate *lpr_gate_new (const LprGateConfig * config);
+
+/* TRUE when the crop of track_id with score should be read. weak tells that
+ * the plate consensus of the track still wants readings. Tracks with a
+ * negative id are never gated by history. */
+gboolean lpr_gate_decide (LprGate * gate, gint64 track_id, gfloat score,
+    gboolean weak);
+
+/* Replace the thresholds, from the thread that calls lpr_gate_decide. The
+ * best crop of every track is kept. */
+void lpr_gate_set_config (LprGate * gate, const LprGateConfig * config);
+
+/* Advance by one batch, dropping the state of tracks that ended */
+void lpr_gate_tick (LprGate * gate);
+
+void lpr_gate_get_stats (LprGate * gate, LprGateStats * stats);
+
+void lpr_gate_free (LprGate * gate);
+
+#endif
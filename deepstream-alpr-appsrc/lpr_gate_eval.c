@@ -0,0 +1,289 @@
+/*
+ * Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* Replay of the LPR quality gate on a recorded plate crop trace.
+ *
+ * Record the trace with lpr_gate_enable = 0 and lpr_gate_trace = <file>, so
+ * every crop carries its LPR reading. The replay feeds all readings into one
+ * track consensus and only the readings the gate lets through into another,
+ * then reports the LPR inferences skipped and how often the gated plate of a
+ * vehicle still matches the ungated one (or the ground truth, when given as
+ * "vehicle_id,plate" lines).
+ *
+ *   $ make eval EVAL_ARGS="-g truth.csv lpr_gate_trace.csv"
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "lpr_gate.h"
+#include "track_consensus.h"
+
+#define EVAL_LINE_MAX 2048
+
+typedef struct _EvalRun
+{
+  TrackConsensus *consensus;
+  GHashTable *plates;           /* vehicle id -> emitted plate */
+} EvalRun;
+
+static void
+store_plate (const ResultRecord * record, gpointer user_data)
+{
+  EvalRun *run = (EvalRun *) user_data;
+  gint64 *key = g_new (gint64, 1);
+
+  *key = record->track_id;
+  g_hash_table_replace (run->plates, key, g_strdup (record->plate));
+}
+
+static void
+eval_run_init (EvalRun * run, guint timeout)
+{
+  TrackConsensusConfig config = { timeout, 0 };
+
+  run->plates = g_hash_table_new_full (g_int64_hash, g_int64_equal, g_free,
+      g_free);
+  run->consensus = track_consensus_new (&config, store_plate, run);
+}
+
+static void
+eval_run_clear (EvalRun * run)
+{
+  track_consensus_free (run->consensus);
+  g_hash_table_destroy (run->plates);
+}
+
+/* Fill record and chars from "batch,source,vehicle,width,height,sharpness,
+ * confidence,plate,confs". Returns the batch, or -1 on a malformed line. */
+static gint64
+parse_trace_line (gchar * line, ResultRecord * record, LprCharMeta * chars,
+    gfloat * width, gfloat * height, gfloat * sharpness)
+{
+  gchar **fields = g_strsplit (g_strchomp (line), ",", 9);
+  gint64 batch = -1;
+
+  memset (record, 0, sizeof (*record));
+  memset (chars, 0, sizeof (*chars));
+  if (g_strv_length (fields) != 9)
+    goto done;
+
+  batch = g_ascii_strtoll (fields[0], NULL, 10);
+  record->source_id = atoi (fields[1]);
+  record->track_id = g_ascii_strtoll (fields[2], NULL, 10);
+  *width = atof (fields[3]);
+  *height = atof (fields[4]);
+  *sharpness = atof (fields[5]);
+  record->ocr_confidence = atof (fields[6]);
+  record->color_class = record->make_class = record->type_class = -1;
+  g_strlcpy (record->plate, fields[7], sizeof (record->plate));
+
+  /* Per-character confidences at the UTF-8 character offsets of the plate */
+  gchar **confs = g_strsplit (fields[8], ";", -1);
+  const gchar *glyph = record->plate;
+  for (guint i = 0; confs[i] && confs[i][0] && *glyph &&
+      i < LPR_CHAR_META_MAX_LEN; i++) {
+    chars->offsets[i] = glyph - record->plate;
+    chars->confs[i] = atof (confs[i]);
+    chars->length = i + 1;
+    glyph = g_utf8_next_char (glyph);
+  }
+  g_strfreev (confs);
+
+done:
+  g_strfreev (fields);
+  return batch;
+}
+
+static GHashTable *
+load_truth (const gchar * path)
+{
+  FILE *fp = fopen (path, "r");
+  gchar line[EVAL_LINE_MAX];
+  GHashTable *truth;
+
+  if (!fp)
+    return NULL;
+  truth = g_hash_table_new_full (g_int64_hash, g_int64_equal, g_free, g_free);
+  while (fgets (line, sizeof (line), fp)) {
+    gchar **fields = g_strsplit (g_strchomp (line), ",", 2);
+    if (g_strv_length (fields) == 2) {
+      gint64 *key = g_new (gint64, 1);
+      *key = g_ascii_strtoll (fields[0], NULL, 10);
+      g_hash_table_replace (truth, key, g_strdup (fields[1]));
+    }
+    g_strfreev (fields);
+  }
+  fclose (fp);
+  return truth;
+}
+
+/* Vehicles whose plate in run equals the one in reference */
+static guint
+count_matches (GHashTable * run, GHashTable * reference, guint * total)
+{
+  GHashTableIter iter;
+  gpointer key, value;
+  guint matches = 0;
+
+  *total = 0;
+  g_hash_table_iter_init (&iter, reference);
+  while (g_hash_table_iter_next (&iter, &key, &value)) {
+    const gchar *plate = g_hash_table_lookup (run, key);
+    if (((const gchar *) value)[0] == '\0')
+      continue;
+    (*total)++;
+    if (plate && !strcmp (plate, value))
+      matches++;
+  }
+  return matches;
+}
+
+static void
+usage (const gchar * prog)
+{
+  g_printerr ("Usage: %s [-m min_score] [-b better_margin] [-w ideal_width]\n"
+      "          [-a aspect_min] [-A aspect_max] [-s sharpness_ref]\n"
+      "          [-r min_readings] [-c strong_confidence] [-o timeout]\n"
+      "          [-g ground_truth.csv] trace.csv\n", prog);
+}
+
+int
+main (int argc, char *argv[])
+{
+  LprGateConfig config = { 0.15, 0.1, 100, 1.5, 5.0, 300, 30 };
+  guint min_readings = 3;
+  gfloat strong_confidence = 0.8;
+  const gchar *truth_path = NULL;
+  gchar line[EVAL_LINE_MAX];
+  guint64 crops = 0, readings = 0, gated_readings = 0;
+  gint64 batch = -1;
+  EvalRun all, gated;
+  LprGate *gate;
+  FILE *fp;
+  gint opt;
+
+  while ((opt = getopt (argc, argv, "m:b:w:a:A:s:r:c:o:g:h")) != -1) {
+    switch (opt) {
+      case 'm': config.min_score = atof (optarg); break;
+      case 'b': config.better_margin = atof (optarg); break;
+      case 'w': config.ideal_width = atof (optarg); break;
+      case 'a': config.aspect_min = atof (optarg); break;
+      case 'A': config.aspect_max = atof (optarg); break;
+      case 's': config.sharpness_ref = atof (optarg); break;
+      case 'r': min_readings = atoi (optarg); break;
+      case 'c': strong_confidence = atof (optarg); break;
+      case 'o': config.track_timeout = atoi (optarg); break;
+      case 'g': truth_path = optarg; break;
+      default: usage (argv[0]); return -1;
+    }
+  }
+  if (optind != argc - 1) {
+    usage (argv[0]);
+    return -1;
+  }
+
+  fp = fopen (argv[optind], "r");
+  if (!fp) {
+    g_printerr ("Trace %s could not be opened\n", argv[optind]);
+    return -1;
+  }
+
+  eval_run_init (&all, config.track_timeout);
+  eval_run_init (&gated, config.track_timeout);
+  gate = lpr_gate_new (&config);
+
+  while (fgets (line, sizeof (line), fp)) {
+    ResultRecord record;
+    LprCharMeta chars;
+    gfloat width, height, sharpness;
+    gint64 line_batch = parse_trace_line (line, &record, &chars, &width,
+        &height, &sharpness);
+    guint track_readings = 0;
+    gfloat confidence = 0;
+
+    if (line_batch < 0)
+      continue;
+    /* One tick per batch, as in the app */
+    for (; batch >= 0 && batch < line_batch; batch++) {
+      track_consensus_tick (all.consensus);
+      track_consensus_tick (gated.consensus);
+      lpr_gate_tick (gate);
+    }
+    batch = line_batch;
+
+    crops++;
+    if (record.plate[0] != '\0') {
+      readings++;
+      track_consensus_observe (all.consensus, &record, &chars);
+    }
+
+    gboolean weak = !track_consensus_query (gated.consensus, record.track_id,
+        &track_readings, &confidence) || track_readings < min_readings ||
+        confidence < strong_confidence;
+    if (lpr_gate_decide (gate, record.track_id,
+            lpr_gate_score (&config, width, height, sharpness), weak) &&
+        record.plate[0] != '\0') {
+      gated_readings++;
+      track_consensus_observe (gated.consensus, &record, &chars);
+    }
+  }
+  fclose (fp);
+  track_consensus_flush (all.consensus);
+  track_consensus_flush (gated.consensus);
+
+  LprGateStats stats;
+  guint total, matches;
+  lpr_gate_get_stats (gate, &stats);
+  g_print ("trace: %lu plate crops, %lu with a reading, %u vehicles\n",
+      (unsigned long) crops, (unsigned long) readings,
+      g_hash_table_size (all.plates));
+  g_print ("gate: %lu read, %lu skipped as low quality, %lu skipped as repeats, "
+      "%.1f%% of LPR inferences saved\n", (unsigned long) stats.read,
+      (unsigned long) stats.skipped_low, (unsigned long) stats.skipped_repeat,
+      crops ? 100.0 * (crops - stats.read) / crops : 0.0);
+  matches = count_matches (gated.plates, all.plates, &total);
+  g_print ("gated plate equals ungated plate: %u / %u vehicles (%.1f%%), "
+      "from %lu of %lu readings\n", matches, total,
+      total ? 100.0 * matches / total : 0.0, (unsigned long) gated_readings,
+      (unsigned long) readings);
+
+  if (truth_path) {
+    GHashTable *truth = load_truth (truth_path);
+    if (!truth) {
+      g_printerr ("Ground truth %s could not be opened\n", truth_path);
+    } else {
+      guint all_matches = count_matches (all.plates, truth, &total);
+      matches = count_matches (gated.plates, truth, &total);
+      g_print ("accuracy: ungated %u / %u (%.1f%%), gated %u / %u (%.1f%%)\n",
+          all_matches, total, total ? 100.0 * all_matches / total : 0.0,
+          matches, total, total ? 100.0 * matches / total : 0.0);
+      g_hash_table_destroy (truth);
+    }
+  }
+
+  lpr_gate_free (gate);
+  eval_run_clear (&all);
+  eval_run_clear (&gated);
+  return 0;
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+/* Per-character confidences of a plate, shared by the LPR parser and the app.
+ *
+ * The parser can not reach the object meta, so it adds a second attribute to
+ * the plate classification (label_id LPR_CHAR_ATTR_INDEX) whose label packs
+ * two bytes per character: the quantized confidence and the CTC timestep,
+ * both offset by one so the label stays NUL free. result_class_id holds the
+ * character count and result_prob the summed log confidence.
+ * It costs a second label allocation per plate, so the parser only adds it
+ * when LPR_CHAR_ATTR=1 is set in its environment; the app sets that when
+ * consensus or the LPR gate trace needs it.
+ * The app unpacks it into an LprCharMeta user meta on the plate object. */
+
+#ifndef __LPR_CHAR_META_H__
+#define __LPR_CHAR_META_H__
+
+/* Environment variable that turns the packed character attribute on */
+#define LPR_CHAR_ATTR_ENV "LPR_CHAR_ATTR"
+
+/* label_id of the plate text and of the packed characters */
+#define LPR_PLATE_ATTR_INDEX 0
+#define LPR_CHAR_ATTR_INDEX 1
+
+/* Characters that fit the 128 byte label of NvDsLabelInfo */
+#define LPR_CHAR_META_MAX_LEN 63
+
+/* Packed byte of a confidence in [0, 1] and back */
+#define LPR_CHAR_CONF_PACK(conf) \
+    ((unsigned char)(1 + (int)((conf) < 0.0f ? 0.0f : (conf) > 1.0f ? 254.0f : (conf) * 254.0f + 0.5f)))
+#define LPR_CHAR_CONF_UNPACK(byte) (((unsigned char)(byte) - 1) / 254.0f)
+
+/* Packed byte of a timestep, saturating at 254 */
+#define LPR_CHAR_STEP_PACK(step) ((unsigned char)(1 + ((step) > 253 ? 254 : (step))))
+#define LPR_CHAR_STEP_UNPACK(byte) ((unsigned char)(byte) - 1)
+
+/* User meta type name, see nvds_get_user_meta_type() */
+#define LPR_CHAR_META_TYPE "NVIDIA.LPR.CHAR_META"
+
+typedef struct _LprCharMeta
+{
+    unsigned int length;                          /* Number of characters */
+    float log_conf;                               /* Sum of the log confidences */
+    float confs[LPR_CHAR_META_MAX_LEN];           /* Confidence of each character */
+    unsigned char steps[LPR_CHAR_META_MAX_LEN];   /* Timestep of each character, 254 = later */
+    unsigned char offsets[LPR_CHAR_META_MAX_LEN]; /* Byte offset of each character in the label */
+} LprCharMeta;
+
+#endif
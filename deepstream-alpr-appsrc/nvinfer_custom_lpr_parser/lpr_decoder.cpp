@@ -0,0 +1,733 @@
+/*
+ * Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include "lpr_decoder.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LPR_HAVE_AVX2 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define LPR_HAVE_NEON 1
+#endif
+
+/* Timesteps per argmax pass of the raw layout, any seq_len is decoded in
+ * chunks of this many rows */
+#define LPR_RAW_CHUNK_ROWS 64
+
+bool lpr_dict_load(const char *path, LprDict *dict)
+{
+    char line[64];
+    FILE *fp = fopen(path, "r");
+
+    dict->size = 0;
+    if (fp == NULL)
+        return false;
+
+    while (fgets(line, sizeof(line), fp)) {
+        size_t len = strlen(line);
+        if (len > 0 && line[len - 1] != '\n' && !feof(fp)) {
+            fprintf(stderr, "LPR dictionary %s: line %u too long\n", path, dict->size + 1);
+            fclose(fp);
+            return false;
+        }
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+            len--;
+        if (len > LPR_MAX_GLYPH_LEN || dict->size == LPR_MAX_DICT_SIZE) {
+            fprintf(stderr, "LPR dictionary %s: entry %u exceeds table limits\n", path, dict->size + 1);
+            fclose(fp);
+            return false;
+        }
+        memcpy(dict->glyphs[dict->size], line, len);
+        dict->lengths[dict->size] = (unsigned char)len;
+        dict->size++;
+    }
+    fclose(fp);
+
+    return dict->size > 0;
+}
+
+unsigned int lpr_plate_label(const LprDict *dict, const LprPlate *plate, char *label)
+{
+    unsigned int len = 0;
+
+    for (unsigned int id = 0; id < plate->length; id++) {
+        int c = plate->chars[id];
+        memcpy(label + len, dict->glyphs[c], LPR_MAX_GLYPH_LEN);
+        len += dict->lengths[c];
+    }
+    label[len] = '\0';
+
+    return len;
+}
+
+typedef void (*ArgmaxRowsFunc)(const float *rows, unsigned int num_rows,
+                               unsigned int num_classes, bool logits,
+                               int *indices, float *confs);
+
+typedef float (*SumExpFunc)(const float *row, unsigned int num_classes, float max);
+
+/* log(LPR_BEAM_PRUNE_PROB), for logit rows */
+#define LPR_BEAM_PRUNE_LOGP (-6.9078f)
+#define LPR_BEAM_MAX_CANDIDATES (LPR_MAX_BEAM_WIDTH * (LPR_BEAM_TOP_CLASSES + 1))
+#define LPR_BEAM_HASH_SIZE 1024
+
+/* sum(exp(row[c] - max)) */
+static float sum_exp_scalar(const float *row, unsigned int num_classes, float max)
+{
+    float sum = 0.0f;
+    for (unsigned int c = 0; c < num_classes; c++) {
+        sum += expf(row[c] - max);
+    }
+    return sum;
+}
+
+/* softmax(row)[argmax] = 1 / sum(exp(row[c] - row[argmax])) */
+static inline float softmax_max(const float *row, unsigned int num_classes, float max)
+{
+    return 1.0f / sum_exp_scalar(row, num_classes, max);
+}
+
+#if LPR_HAVE_AVX2
+/* Cephes style exp(), relative error below 2e-7 over the float range */
+__attribute__((target("avx2")))
+static inline __m256 exp256_ps(__m256 x)
+{
+    x = _mm256_min_ps(x, _mm256_set1_ps(88.3762626647949f));
+    x = _mm256_max_ps(x, _mm256_set1_ps(-88.3762626647949f));
+
+    __m256 fx = _mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(1.44269504088896341f)),
+                              _mm256_set1_ps(0.5f));
+    fx = _mm256_floor_ps(fx);
+    x = _mm256_sub_ps(x, _mm256_mul_ps(fx, _mm256_set1_ps(0.693359375f)));
+    x = _mm256_sub_ps(x, _mm256_mul_ps(fx, _mm256_set1_ps(-2.12194440e-4f)));
+
+    __m256 y = _mm256_set1_ps(1.9875691500E-4f);
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(1.3981999507E-3f));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(8.3334519073E-3f));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(4.1665795894E-2f));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(1.6666665459E-1f));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(5.0000001201E-1f));
+    y = _mm256_add_ps(_mm256_mul_ps(y, _mm256_mul_ps(x, x)), x);
+    y = _mm256_add_ps(y, _mm256_set1_ps(1.0f));
+
+    __m256i n = _mm256_add_epi32(_mm256_cvttps_epi32(fx), _mm256_set1_epi32(127));
+    return _mm256_mul_ps(y, _mm256_castsi256_ps(_mm256_slli_epi32(n, 23)));
+}
+
+__attribute__((target("avx2")))
+static float sum_exp_avx2(const float *row, unsigned int num_classes, float max)
+{
+    __m256 vsum = _mm256_setzero_ps();
+    __m256 vmax = _mm256_set1_ps(max);
+    unsigned int c = 0;
+    float sum;
+
+    for (; c + 8 <= num_classes; c += 8) {
+        vsum = _mm256_add_ps(vsum, exp256_ps(_mm256_sub_ps(_mm256_loadu_ps(row + c), vmax)));
+    }
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(vsum), _mm256_extractf128_ps(vsum, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    sum = _mm_cvtss_f32(s);
+
+    for (; c < num_classes; c++) {
+        sum += expf(row[c] - max);
+    }
+    return sum;
+}
+#endif
+
+static void argmax_rows_scalar(const float *rows, unsigned int num_rows,
+                               unsigned int num_classes, bool logits,
+                               int *indices, float *confs)
+{
+    for (unsigned int r = 0; r < num_rows; r++) {
+        const float *row = rows + (size_t)r * num_classes;
+        float best = row[0];
+        int best_id = 0;
+
+        for (unsigned int c = 1; c < num_classes; c++) {
+            if (row[c] > best) {
+                best = row[c];
+                best_id = c;
+            }
+        }
+        indices[r] = best_id;
+        confs[r] = logits ? softmax_max(row, num_classes, best) : best;
+    }
+}
+
+#if LPR_HAVE_AVX2
+__attribute__((target("avx2")))
+static void argmax_rows_avx2(const float *rows, unsigned int num_rows,
+                             unsigned int num_classes, bool logits,
+                             int *indices, float *confs)
+{
+    for (unsigned int r = 0; r < num_rows; r++) {
+        const float *row = rows + (size_t)r * num_classes;
+        unsigned int c = 1;
+        float best = row[0];
+        int best_id = -1;
+
+        if (num_classes >= 8) {
+            __m256 vmax = _mm256_loadu_ps(row);
+            for (c = 8; c + 8 <= num_classes; c += 8) {
+                vmax = _mm256_max_ps(vmax, _mm256_loadu_ps(row + c));
+            }
+            __m128 m = _mm_max_ps(_mm256_castps256_ps128(vmax),
+                                  _mm256_extractf128_ps(vmax, 1));
+            m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+            m = _mm_max_ss(m, _mm_shuffle_ps(m, m, 1));
+            best = _mm_cvtss_f32(m);
+        }
+        for (; c < num_classes; c++) {
+            if (row[c] > best)
+                best = row[c];
+        }
+
+        /* First class holding the maximum, same tie-break as the scalar loop */
+        __m256 vbest = _mm256_set1_ps(best);
+        for (c = 0; c + 8 <= num_classes; c += 8) {
+            int mask = _mm256_movemask_ps(
+                _mm256_cmp_ps(_mm256_loadu_ps(row + c), vbest, _CMP_EQ_OQ));
+            if (mask) {
+                best_id = c + __builtin_ctz(mask);
+                break;
+            }
+        }
+        for (; best_id < 0 && c < num_classes; c++) {
+            if (row[c] == best)
+                best_id = c;
+        }
+        if (best_id < 0)
+            best_id = 0;
+
+        indices[r] = best_id;
+        confs[r] = logits ? 1.0f / sum_exp_avx2(row, num_classes, best) : best;
+    }
+}
+#endif
+
+#if LPR_HAVE_NEON
+static void argmax_rows_neon(const float *rows, unsigned int num_rows,
+                             unsigned int num_classes, bool logits,
+                             int *indices, float *confs)
+{
+    for (unsigned int r = 0; r < num_rows; r++) {
+        const float *row = rows + (size_t)r * num_classes;
+        unsigned int c = 1;
+        float best = row[0];
+        int best_id = 0;
+
+        if (num_classes >= 4) {
+            float32x4_t vmax = vld1q_f32(row);
+            for (c = 4; c + 4 <= num_classes; c += 4) {
+                vmax = vmaxq_f32(vmax, vld1q_f32(row + c));
+            }
+            best = vmaxvq_f32(vmax);
+        }
+        for (; c < num_classes; c++) {
+            if (row[c] > best)
+                best = row[c];
+        }
+        for (c = 0; c < num_classes; c++) {
+            if (row[c] == best) {
+                best_id = c;
+                break;
+            }
+        }
+
+        indices[r] = best_id;
+        confs[r] = logits ? softmax_max(row, num_classes, best) : best;
+    }
+}
+#endif
+
+static ArgmaxRowsFunc select_argmax_rows()
+{
+#if LPR_HAVE_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return argmax_rows_avx2;
+#endif
+#if LPR_HAVE_NEON
+    return argmax_rows_neon;
+#endif
+    return argmax_rows_scalar;
+}
+
+static SumExpFunc select_sum_exp()
+{
+#if LPR_HAVE_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return sum_exp_avx2;
+#endif
+    return sum_exp_scalar;
+}
+
+void lpr_argmax_rows(const float *rows, unsigned int num_rows,
+                     unsigned int num_classes, bool logits,
+                     int *indices, float *confs)
+{
+    static const ArgmaxRowsFunc argmax_rows = select_argmax_rows();
+
+    if (num_classes == 0)
+        return;
+    argmax_rows(rows, num_rows, num_classes, logits, indices, confs);
+}
+
+/* Confidences are summed as logs so long plates do not underflow */
+static inline float conf_log(float conf)
+{
+    return logf(std::max(conf, FLT_MIN));
+}
+
+/* Collapse count timesteps starting at timestep first. prev carries the last
+ * index across chunks of one sequence. */
+static void collapse_rows(const int *indices, const float *confs, unsigned int count,
+                          unsigned int first, int blank, int *prev, LprPlate *plate)
+{
+    for (unsigned int i = 0; i < count; i++) {
+        int curr_data = indices[i];
+        if (curr_data < 0 || curr_data > blank)
+            continue;
+
+        if (curr_data != *prev && curr_data != blank && plate->length < LPR_MAX_PLATE_LEN) {
+            plate->chars[plate->length] = curr_data;
+            plate->confs[plate->length] = confs[i];
+            plate->steps[plate->length] = first + i;
+            plate->log_conf += conf_log(confs[i]);
+            plate->length++;
+        }
+        *prev = curr_data;
+    }
+}
+
+void lpr_greedy_collapse(const int *indices, const float *confs,
+                         unsigned int seq_len, int blank, LprPlate *plate)
+{
+    int prev = -1;
+
+    plate->length = 0;
+    plate->log_conf = 0.0f;
+    collapse_rows(indices, confs, seq_len, 0, blank, &prev, plate);
+}
+
+void lpr_decode_argmax_batch(const int *indices, const float *confs,
+                             unsigned int batch_size, unsigned int seq_len,
+                             int blank, LprPlate *plates)
+{
+    for (unsigned int b = 0; b < batch_size; b++) {
+        lpr_greedy_collapse(indices + (size_t)b * seq_len,
+                            confs + (size_t)b * seq_len, seq_len, blank,
+                            &plates[b]);
+    }
+}
+
+void lpr_decode_raw_batch(const float *rows, unsigned int batch_size,
+                          unsigned int seq_len, unsigned int num_classes,
+                          bool logits, int blank, LprPlate *plates)
+{
+    int indices[LPR_RAW_CHUNK_ROWS];
+    float confs[LPR_RAW_CHUNK_ROWS];
+
+    for (unsigned int b = 0; b < batch_size; b++) {
+        const float *plate_rows = rows + (size_t)b * seq_len * num_classes;
+        LprPlate *plate = &plates[b];
+        int prev = -1;
+
+        plate->length = 0;
+        plate->log_conf = 0.0f;
+        for (unsigned int t = 0; t < seq_len; t += LPR_RAW_CHUNK_ROWS) {
+            unsigned int count = std::min(seq_len - t, (unsigned int)LPR_RAW_CHUNK_ROWS);
+            lpr_argmax_rows(plate_rows + (size_t)t * num_classes, count,
+                            num_classes, logits, indices, confs);
+            collapse_rows(indices, confs, count, t, blank, &prev, plate);
+        }
+    }
+}
+
+bool lpr_grammar_compile(const char *pattern, const LprDict *dict, LprGrammar *grammar)
+{
+    grammar->length = 0;
+    memset(grammar->allowed, 0, sizeof(grammar->allowed));
+
+    for (const char *p = pattern; *p; p++) {
+        if (*p == '-' || *p == ' ')
+            continue;
+        if ((*p != 'A' && *p != '0' && *p != '?') || grammar->length == LPR_MAX_PLATE_LEN)
+            return false;
+
+        unsigned char *allowed = grammar->allowed[grammar->length];
+        for (unsigned int c = 0; c < dict->size; c++) {
+            char glyph = dict->lengths[c] == 1 ? dict->glyphs[c][0] : 0;
+            bool match = *p == '?' ||
+                         (*p == 'A' && glyph >= 'A' && glyph <= 'Z') ||
+                         (*p == '0' && glyph >= '0' && glyph <= '9');
+            if (match)
+                allowed[c >> 3] |= 1 << (c & 7);
+        }
+        grammar->length++;
+    }
+
+    return grammar->length > 0;
+}
+
+/* One prefix of the beam. The prefix string is the chain of nodes ending at
+ * node; a candidate that extends a beam keeps parent / last / conf until it
+ * survives pruning and gets its own node.
+ * Probabilities are kept in the linear domain and rescaled every timestep so
+ * that the best beam is 1, which keeps the inner loop free of exp / log. */
+typedef struct _BeamEntry
+{
+    unsigned long long hash;  /* Hash of the prefix string */
+    int node;                 /* Last prefix node, -1 = empty prefix, -2 = pending */
+    int parent;               /* Node extended by a pending candidate */
+    int last;                 /* Last character, -1 for the empty prefix */
+    unsigned int len;
+    float conf;               /* Probability of last when it was emitted */
+    float p_b;                /* Probability of the prefix ending in blank */
+    float p_nb;               /* Probability of the prefix ending in last */
+} BeamEntry;
+
+typedef struct _BeamNode
+{
+    int parent;
+    int ch;
+    float conf;
+    unsigned int step;
+} BeamNode;
+
+/* Live nodes of the beams never exceed one chain per beam, one more timestep
+ * of new nodes fits after a compaction */
+#define LPR_BEAM_MAX_NODES ((LPR_MAX_PLATE_LEN + 1) * LPR_MAX_BEAM_WIDTH)
+
+typedef struct _BeamArena
+{
+    BeamEntry beams[LPR_MAX_BEAM_WIDTH];
+    BeamEntry cands[LPR_BEAM_MAX_CANDIDATES];
+    int order[LPR_MAX_BEAM_WIDTH];
+    float scores[LPR_BEAM_MAX_CANDIDATES];
+    bool has_child[LPR_MAX_BEAM_WIDTH];
+    BeamNode nodes[LPR_BEAM_MAX_NODES];
+    int remap[LPR_BEAM_MAX_NODES];
+    unsigned int slot_stamp[LPR_BEAM_HASH_SIZE];
+    int slot_cand[LPR_BEAM_HASH_SIZE];
+    unsigned int stamp;
+} BeamArena;
+
+static thread_local BeamArena beam_arena;
+
+static inline unsigned long long hash_extend(unsigned long long hash, int ch)
+{
+    hash ^= (unsigned long long)(ch + 1);
+    hash *= 0x100000001b3ULL;
+    return hash ^ (hash >> 29);
+}
+
+static inline bool grammar_allows(const LprGrammar *grammar, unsigned int pos, int ch)
+{
+    if (!grammar || grammar->length == 0)
+        return true;
+    return pos < grammar->length &&
+           (grammar->allowed[pos][ch >> 3] & (1 << (ch & 7)));
+}
+
+/* Candidate holding prefix hash, NULL if there is none */
+static BeamEntry *lookup_candidate(BeamArena *arena, unsigned long long hash)
+{
+    unsigned int slot = (unsigned int)hash & (LPR_BEAM_HASH_SIZE - 1);
+
+    while (arena->slot_stamp[slot] == arena->stamp) {
+        BeamEntry *cand = &arena->cands[arena->slot_cand[slot]];
+        if (cand->hash == hash)
+            return cand;
+        slot = (slot + 1) & (LPR_BEAM_HASH_SIZE - 1);
+    }
+    return NULL;
+}
+
+/* Candidate holding prefix hash, inserted with zero probability if new */
+static BeamEntry *find_candidate(BeamArena *arena, unsigned int *num_cands,
+                                 unsigned long long hash, bool *inserted)
+{
+    unsigned int slot = (unsigned int)hash & (LPR_BEAM_HASH_SIZE - 1);
+
+    while (arena->slot_stamp[slot] == arena->stamp) {
+        BeamEntry *cand = &arena->cands[arena->slot_cand[slot]];
+        if (cand->hash == hash) {
+            *inserted = false;
+            return cand;
+        }
+        slot = (slot + 1) & (LPR_BEAM_HASH_SIZE - 1);
+    }
+
+    arena->slot_stamp[slot] = arena->stamp;
+    arena->slot_cand[slot] = *num_cands;
+    BeamEntry *cand = &arena->cands[(*num_cands)++];
+    cand->hash = hash;
+    cand->p_b = 0.0f;
+    cand->p_nb = 0.0f;
+    *inserted = true;
+    return cand;
+}
+
+/* Drop the nodes no beam refers to. Parents are always older than their
+ * children, so one forward pass renumbers them. */
+static unsigned int compact_nodes(BeamArena *arena, unsigned int num_beams,
+                                  unsigned int num_nodes)
+{
+    for (unsigned int n = 0; n < num_nodes; n++)
+        arena->remap[n] = -1;
+    for (unsigned int b = 0; b < num_beams; b++) {
+        for (int node = arena->beams[b].node; node >= 0 && arena->remap[node] < 0;
+             node = arena->nodes[node].parent)
+            arena->remap[node] = 0;
+    }
+
+    unsigned int live = 0;
+    for (unsigned int n = 0; n < num_nodes; n++) {
+        if (arena->remap[n] < 0)
+            continue;
+        BeamNode node = arena->nodes[n];
+        if (node.parent >= 0)
+            node.parent = arena->remap[node.parent];
+        arena->nodes[live] = node;
+        arena->remap[n] = live++;
+    }
+    for (unsigned int b = 0; b < num_beams; b++) {
+        if (arena->beams[b].node >= 0)
+            arena->beams[b].node = arena->remap[arena->beams[b].node];
+    }
+    return live;
+}
+
+void lpr_beam_search(const float *rows, unsigned int seq_len,
+                     unsigned int num_classes, bool logits, int blank,
+                     unsigned int beam_width, const LprGrammar *grammar,
+                     LprPlate *plate)
+{
+    static const SumExpFunc sum_exp = select_sum_exp();
+    BeamArena *arena = &beam_arena;
+    unsigned int num_beams = 1;
+    unsigned int num_nodes = 0;
+    int top_ids[LPR_BEAM_TOP_CLASSES];
+    float top_prob[LPR_BEAM_TOP_CLASSES];
+
+    plate->length = 0;
+    plate->log_conf = 0.0f;
+    if (beam_width > LPR_MAX_BEAM_WIDTH)
+        beam_width = LPR_MAX_BEAM_WIDTH;
+    if (beam_width == 0 || blank < 0 || static_cast<unsigned int>(blank) >= num_classes)
+        return;
+
+    arena->beams[0].hash = 0xcbf29ce484222325ULL;
+    arena->beams[0].node = -1;
+    arena->beams[0].last = -1;
+    arena->beams[0].len = 0;
+    arena->beams[0].conf = 0.0f;
+    arena->beams[0].p_b = 1.0f;
+    arena->beams[0].p_nb = 0.0f;
+
+    for (unsigned int t = 0; t < seq_len; t++) {
+        const float *row = rows + (size_t)t * num_classes;
+        unsigned int num_top = 0;
+        if (num_nodes + beam_width > LPR_BEAM_MAX_NODES)
+            num_nodes = compact_nodes(arena, num_beams, num_nodes);
+        unsigned int num_cands = 0;
+        float max = row[0];
+        float norm = 1.0f;
+
+        /* Logits are normalized with a vectorized log-sum-exp of the row */
+        if (logits) {
+            for (unsigned int c = 1; c < num_classes; c++)
+                max = std::max(max, row[c]);
+            norm = 1.0f / sum_exp(row, num_classes, max);
+        }
+#define ROW_PROB(c) (logits ? expf(row[c] - max) * norm : row[c])
+
+        /* Keep the most likely characters of this timestep, sorted. Scores
+         * that can not reach LPR_BEAM_PRUNE_PROB are skipped up front. */
+        float min_score = logits ? max + LPR_BEAM_PRUNE_LOGP : LPR_BEAM_PRUNE_PROB;
+        for (int c = 0; c < blank; c++) {
+            if (row[c] < min_score)
+                continue;
+            if (num_top == LPR_BEAM_TOP_CLASSES && row[c] <= row[top_ids[num_top - 1]])
+                continue;
+            unsigned int pos = num_top < LPR_BEAM_TOP_CLASSES ? num_top++ : num_top - 1;
+            while (pos > 0 && row[top_ids[pos - 1]] < row[c]) {
+                top_ids[pos] = top_ids[pos - 1];
+                pos--;
+            }
+            top_ids[pos] = c;
+        }
+        for (unsigned int k = 0; k < num_top; k++) {
+            top_prob[k] = ROW_PROB(top_ids[k]);
+            if (top_prob[k] < LPR_BEAM_PRUNE_PROB) {
+                num_top = k;
+                break;
+            }
+        }
+
+        float p_blank = ROW_PROB(blank);
+        if (++arena->stamp == 0) {
+            memset(arena->slot_stamp, 0, sizeof(arena->slot_stamp));
+            arena->stamp = 1;
+        }
+
+        /* Same prefix: blank, or the last character repeated */
+        for (unsigned int b = 0; b < num_beams; b++) {
+            const BeamEntry *beam = &arena->beams[b];
+            bool inserted;
+            BeamEntry *cand = find_candidate(arena, &num_cands, beam->hash, &inserted);
+            if (inserted) {
+                cand->node = beam->node;
+                cand->last = beam->last;
+                cand->len = beam->len;
+                cand->conf = beam->conf;
+            }
+            cand->p_b += (beam->p_b + beam->p_nb) * p_blank;
+            if (beam->last >= 0)
+                cand->p_nb += beam->p_nb * ROW_PROB(beam->last);
+        }
+
+        /* With a full beam, a new prefix has to beat the weakest candidate
+         * so far to survive: candidates only gain probability, and a new
+         * prefix only gets it from the beam it extends. Extensions below
+         * that are skipped, unless they extend into another beam. */
+        float floor = 0.0f;
+        if (num_beams == beam_width) {
+            floor = FLT_MAX;
+            for (unsigned int b = 0; b < num_beams; b++) {
+                floor = std::min(floor, arena->cands[b].p_b + arena->cands[b].p_nb);
+                arena->has_child[b] = false;
+            }
+            for (unsigned int b = 0; b < num_beams; b++) {
+                const BeamEntry *child = &arena->beams[b];
+                if (child->len == 0)
+                    continue;
+                for (unsigned int a = 0; a < num_beams; a++) {
+                    if (arena->beams[a].len + 1 == child->len &&
+                        hash_extend(arena->beams[a].hash, child->last) == child->hash)
+                        arena->has_child[a] = true;
+                }
+            }
+        }
+
+        /* New prefixes: one more character */
+        for (unsigned int b = 0; b < num_beams; b++) {
+            const BeamEntry *beam = &arena->beams[b];
+            float p_total = beam->p_b + beam->p_nb;
+            if (beam->len == LPR_MAX_PLATE_LEN)
+                continue;
+            for (unsigned int k = 0; k < num_top; k++) {
+                int c = top_ids[k];
+                float p_new = (c == beam->last ? beam->p_b : p_total) * top_prob[k];
+                /* Beams are rescaled to best == 1, so this is relative to the best */
+                if (p_total * top_prob[k] < LPR_BEAM_PRUNE_PROB)
+                    break;
+                if (p_total * top_prob[k] < floor && !arena->has_child[b])
+                    break;
+                if (!grammar_allows(grammar, beam->len, c))
+                    continue;
+                unsigned long long hash = hash_extend(beam->hash, c);
+                if (p_new < floor) {
+                    BeamEntry *cand = lookup_candidate(arena, hash);
+                    if (cand)
+                        cand->p_nb += p_new;
+                    continue;
+                }
+                bool inserted;
+                BeamEntry *cand = find_candidate(arena, &num_cands, hash, &inserted);
+                if (inserted) {
+                    cand->node = -2;
+                    cand->parent = beam->node;
+                    cand->last = c;
+                    cand->len = beam->len + 1;
+                    cand->conf = top_prob[k];
+                }
+                /* A repeated character only starts a new one after a blank */
+                cand->p_nb += p_new;
+            }
+        }
+#undef ROW_PROB
+
+        /* Prune to the beam width, keeping the best ones sorted. Most
+         * candidates lose against the weakest kept one right away. */
+        const float *scores = arena->scores;
+        num_beams = 0;
+        for (unsigned int i = 0; i < num_cands; i++) {
+            float score = arena->cands[i].p_b + arena->cands[i].p_nb;
+            arena->scores[i] = score;
+            if (num_beams == beam_width && score <= scores[arena->order[num_beams - 1]])
+                continue;
+            unsigned int pos = num_beams < beam_width ? num_beams++ : num_beams - 1;
+            while (pos > 0 && scores[arena->order[pos - 1]] < score) {
+                arena->order[pos] = arena->order[pos - 1];
+                pos--;
+            }
+            arena->order[pos] = i;
+        }
+
+        float best = scores[arena->order[0]];
+        float rescale = best > 0.0f ? 1.0f / best : 1.0f;
+        for (unsigned int b = 0; b < num_beams; b++) {
+            BeamEntry *beam = &arena->beams[b];
+            *beam = arena->cands[arena->order[b]];
+            beam->p_b *= rescale;
+            beam->p_nb *= rescale;
+            if (beam->node == -2) {
+                arena->nodes[num_nodes].parent = beam->parent;
+                arena->nodes[num_nodes].ch = beam->last;
+                arena->nodes[num_nodes].conf = beam->conf;
+                arena->nodes[num_nodes].step = t;
+                beam->node = num_nodes++;
+            }
+        }
+    }
+
+    /* Beams are sorted, take the first one the grammar accepts */
+    for (unsigned int b = 0; b < num_beams; b++) {
+        const BeamEntry *beam = &arena->beams[b];
+        if (grammar && grammar->length && beam->len != grammar->length)
+            continue;
+
+        plate->length = beam->len;
+        unsigned int pos = beam->len;
+        for (int node = beam->node; node >= 0; node = arena->nodes[node].parent) {
+            pos--;
+            plate->chars[pos] = arena->nodes[node].ch;
+            plate->confs[pos] = arena->nodes[node].conf;
+            plate->steps[pos] = arena->nodes[node].step;
+            plate->log_conf += conf_log(arena->nodes[node].conf);
+        }
+        break;
+    }
+}
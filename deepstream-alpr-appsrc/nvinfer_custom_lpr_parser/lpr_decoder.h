@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* CTC decode engine for the LPR classifier output.
+ *
+ * The engine does not depend on any DeepStream type, so it can decode either
+ * one object inside the nvinfer parse callback or a whole batch of plates
+ * laid out contiguously in memory ([batch x seq_len x num_classes]).
+ *
+ * Two output layouts of the LPR network are supported:
+ *  - argmax layout: an int32 [seq_len] class index layer plus a float
+ *    [seq_len] max-confidence layer (the TAO deployable model).
+ *  - raw layout: the float [seq_len x num_classes] per-timestep probability
+ *    (or logit) tensor. Argmax and max-softmax are computed here with
+ *    AVX2 / NEON when available.
+ */
+
+#ifndef __LPR_DECODER_H__
+#define __LPR_DECODER_H__
+
+/* Upper bound of characters per plate. The number of timesteps is not
+ * bounded, longer sequences are decoded in chunks on the stack. */
+#define LPR_MAX_PLATE_LEN 64
+
+/* Beam search limits, see lpr_beam_search() */
+#define LPR_MAX_BEAM_WIDTH 32
+/* Classes kept per timestep when extending a beam */
+#define LPR_BEAM_TOP_CLASSES 8
+/* Classes below this probability never extend a beam */
+#define LPR_BEAM_PRUNE_PROB 1e-3f
+
+/* Dictionary capacity, enough for the CN/US/EU LPR character sets */
+#define LPR_MAX_DICT_SIZE 256
+#define LPR_MAX_GLYPH_LEN 8
+
+/* Largest plate label in bytes, without the terminating NUL */
+#define LPR_MAX_LABEL_LEN (LPR_MAX_PLATE_LEN * LPR_MAX_GLYPH_LEN)
+
+/* Flat glyph table loaded from dict.txt, one UTF-8 glyph per line */
+typedef struct _LprDict
+{
+    unsigned int size;                                  /* Glyph count, also the CTC blank index */
+    unsigned char lengths[LPR_MAX_DICT_SIZE];           /* Byte length of each glyph */
+    char glyphs[LPR_MAX_DICT_SIZE][LPR_MAX_GLYPH_LEN];  /* Glyph bytes, not NUL terminated */
+} LprDict;
+
+/* Per-position character classes of a plate format, compiled from a pattern
+ * against the dictionary by lpr_grammar_compile() */
+typedef struct _LprGrammar
+{
+    unsigned int length;                                          /* Plate length, 0 = unconstrained */
+    unsigned char allowed[LPR_MAX_PLATE_LEN][LPR_MAX_DICT_SIZE / 8]; /* Bitset of glyphs per position */
+} LprGrammar;
+
+typedef struct _LprPlate
+{
+    unsigned int length;                /* Number of non-blank characters */
+    int chars[LPR_MAX_PLATE_LEN];       /* Dictionary index of each character */
+    float confs[LPR_MAX_PLATE_LEN];     /* Max softmax of each character */
+    unsigned int steps[LPR_MAX_PLATE_LEN]; /* Timestep that emitted each character */
+    float log_conf;                     /* Sum of the log confidences */
+} LprPlate;
+
+/* Load the dictionary file into dict. Returns false when the file can not be
+ * read, is empty, or has more / longer entries than the table holds. */
+bool lpr_dict_load(const char *path, LprDict *dict);
+
+/* Compile a plate pattern into grammar. Each pattern character is one plate
+ * position: 'A' any letter, '0' any digit, '?' any glyph. '-' and ' ' are
+ * separators and are skipped. */
+bool lpr_grammar_compile(const char *pattern, const LprDict *dict, LprGrammar *grammar);
+
+/* Write the glyphs of plate into label, NUL terminated. label must hold
+ * LPR_MAX_LABEL_LEN + 1 bytes. Returns the label length in bytes. */
+unsigned int lpr_plate_label(const LprDict *dict, const LprPlate *plate, char *label);
+
+/* Per-timestep argmax and max-softmax over rows of a float tensor.
+ * When logits is true the rows are unnormalized scores and the returned
+ * confidence is softmax(row)[argmax], otherwise the rows are probabilities
+ * and the confidence is the row maximum. */
+void lpr_argmax_rows(const float *rows, unsigned int num_rows,
+                     unsigned int num_classes, bool logits,
+                     int *indices, float *confs);
+
+/* Greedy CTC collapse of one plate. Index blank (== dictionary size) is the
+ * CTC blank, indices outside [0, blank] are skipped. Characters beyond
+ * LPR_MAX_PLATE_LEN are dropped. */
+void lpr_greedy_collapse(const int *indices, const float *confs,
+                         unsigned int seq_len, int blank, LprPlate *plate);
+
+/* Decode a batch of plates from the argmax layout. indices and confs hold
+ * batch_size * seq_len contiguous entries. */
+void lpr_decode_argmax_batch(const int *indices, const float *confs,
+                             unsigned int batch_size, unsigned int seq_len,
+                             int blank, LprPlate *plates);
+
+/* Decode a batch of plates from the raw layout. rows holds
+ * batch_size * seq_len * num_classes contiguous entries. */
+void lpr_decode_raw_batch(const float *rows, unsigned int batch_size,
+                          unsigned int seq_len, unsigned int num_classes,
+                          bool logits, int blank, LprPlate *plates);
+
+/* CTC prefix beam search of one plate over the raw layout. Per-character
+ * confidences are the probabilities of the timestep that emitted them.
+ * When grammar is not NULL only prefixes accepted by it are extended and the
+ * result is empty unless a full-length plate survives. Beam state lives in a
+ * per-thread arena, nothing is allocated. */
+void lpr_beam_search(const float *rows, unsigned int seq_len,
+                     unsigned int num_classes, bool logits, int blank,
+                     unsigned int beam_width, const LprGrammar *grammar,
+                     LprPlate *plate);
+
+#endif
@@ -0,0 +1,342 @@
+/*
+ * Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* CPU-only microbenchmark of the LPR decode path (decode + label build, the
+ * work NvDsInferParseCustomNVPlate does per object), and of the parser entry
+ * point itself fed argmax output layers. Builds without DeepStream /
+ * TensorRT, against stub/nvdsinfer.h: make bench
+ *
+ * Plates are synthesized on a CTC path: each character spans 1..N timesteps,
+ * repeated characters are separated by blanks, the rest is blank. The raw
+ * layout puts a configurable softmax peak on the path class; the argmax
+ * layout can carry invalid class indices. */
+
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "nvdsinfer.h"
+#include "lpr_decoder.h"
+#include "lpr_plate_format.h"
+
+extern "C" void *__libc_malloc(size_t size);
+
+static unsigned long alloc_count = 0;
+
+extern "C" bool NvDsInferParseCustomNVPlate(std::vector<NvDsInferLayerInfo> const &outputLayersInfo,
+                                            NvDsInferNetworkInfo const &networkInfo,
+                                            float classifierThreshold,
+                                            std::vector<NvDsInferAttribute> &attrList,
+                                            std::string &attrString);
+
+/* Count every heap allocation made while timing */
+extern "C" void *malloc(size_t size)
+{
+    alloc_count++;
+    return __libc_malloc(size);
+}
+
+typedef struct _BenchConfig
+{
+    const char *dict_path;
+    const char *pattern;
+    const char *region;
+    unsigned int seq_len;
+    unsigned int plate_len;
+    unsigned int max_span;       /* Timesteps a character may span */
+    float repeat_prob;           /* Probability of the previous character again */
+    float invalid_prob;          /* Probability of an out-of-range argmax index */
+    float peak;                  /* Logit margin of the path class over noise */
+    unsigned int beam_width;
+    unsigned int num_plates;
+    unsigned int rounds;
+} BenchConfig;
+
+typedef struct _SyntheticSet
+{
+    unsigned int num_classes;
+    std::vector<float> rows;     /* [plates x seq_len x num_classes] probabilities */
+    std::vector<int> indices;    /* [plates x seq_len] argmax layout */
+    std::vector<float> confs;
+    std::vector<std::vector<int> > truth;
+} SyntheticSet;
+
+static void
+make_synthetic_set(const BenchConfig &cfg, const LprDict &dict,
+                   const LprGrammar *grammar, SyntheticSet &set)
+{
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    int blank = dict.size;
+    unsigned int num_classes = dict.size + 1;
+
+    set.num_classes = num_classes;
+    set.rows.assign((size_t)cfg.num_plates * cfg.seq_len * num_classes, 0.0f);
+    set.indices.assign((size_t)cfg.num_plates * cfg.seq_len, blank);
+    set.confs.assign((size_t)cfg.num_plates * cfg.seq_len, 0.0f);
+    set.truth.resize(cfg.num_plates);
+
+    for (unsigned int p = 0; p < cfg.num_plates; p++) {
+        std::vector<int> path(cfg.seq_len, blank);
+        std::vector<int> &label = set.truth[p];
+        unsigned int t = unit(rng) < 0.5f ? 1 : 0;
+
+        label.clear();
+        unsigned int plate_len = grammar ? std::min(cfg.plate_len, grammar->length) : cfg.plate_len;
+        for (unsigned int i = 0; i < plate_len; i++) {
+            int c = (!label.empty() && unit(rng) < cfg.repeat_prob) ? label.back() : rng() % dict.size;
+            /* Plates follow the pattern when one is given */
+            while (grammar && (i >= grammar->length ||
+                               !(grammar->allowed[i][c >> 3] & (1 << (c & 7)))))
+                c = rng() % dict.size;
+            unsigned int span = 1 + rng() % cfg.max_span;
+            /* CTC needs a blank between equal characters */
+            if (!label.empty() && c == label.back())
+                t++;
+            if (t + span > cfg.seq_len)
+                break;
+            for (unsigned int s = 0; s < span; s++)
+                path[t++] = c;
+            label.push_back(c);
+            if (unit(rng) < 0.5f)
+                t++;
+        }
+
+        for (t = 0; t < cfg.seq_len; t++) {
+            float *row = &set.rows[((size_t)p * cfg.seq_len + t) * num_classes];
+            float sum = 0.0f;
+            for (unsigned int c = 0; c < num_classes; c++) {
+                row[c] = expf(unit(rng) * 2.0f + (c == (unsigned int)path[t] ? cfg.peak : 0.0f));
+                sum += row[c];
+            }
+            for (unsigned int c = 0; c < num_classes; c++)
+                row[c] /= sum;
+
+            size_t i = (size_t)p * cfg.seq_len + t;
+            lpr_argmax_rows(row, 1, num_classes, false, &set.indices[i], &set.confs[i]);
+            if (unit(rng) < cfg.invalid_prob)
+                set.indices[i] = unit(rng) < 0.5f ? -1 : blank + 1 + rng() % 16;
+        }
+    }
+}
+
+enum BenchMode { BENCH_ARGMAX, BENCH_RAW_GREEDY, BENCH_RAW_BEAM, BENCH_PARSE };
+
+static const char *mode_names[] = { "argmax-greedy", "raw-greedy", "raw-beam", "parse-argmax" };
+
+static LprGlyphTable glyph_table;
+
+static void
+run_mode(BenchMode mode, const BenchConfig &cfg, const LprDict &dict,
+         const LprGrammar *grammar, const LprFormatDfa *dfa,
+         const SyntheticSet &set, unsigned int batch_size)
+{
+    std::vector<LprPlate> plates(batch_size);
+    std::vector<double> samples;
+    unsigned int num_batches = cfg.num_plates / batch_size;
+    unsigned long allocs = 0;
+    unsigned long correct = 0, emitted = 0;
+    char label[LPR_MAX_LABEL_LEN + 1];
+    int blank = dict.size;
+    size_t raw_stride = (size_t)cfg.seq_len * set.num_classes;
+
+    /* The parser gets the layers of the TAO model, one plate per call as
+     * nvinfer makes them */
+    NvDsInferNetworkInfo network = { cfg.seq_len * 4, 48, 3 };
+    std::vector<NvDsInferLayerInfo> layers(2);
+    std::vector<NvDsInferAttribute> attrs;
+    std::string attr_string;
+    memset(&layers[0], 0, sizeof(NvDsInferLayerInfo) * 2);
+    layers[0].dataType = INT32;
+    layers[0].layerName = "tf_op_layer_ArgMax";
+    layers[1].dataType = FLOAT;
+    layers[1].layerName = "tf_op_layer_Max";
+    for (NvDsInferLayerInfo &layer : layers) {
+        layer.inferDims.numDims = 1;
+        layer.inferDims.d[0] = layer.inferDims.numElements = cfg.seq_len;
+    }
+    std::vector<std::string> parse_labels(batch_size);
+    std::vector<bool> parse_emitted(batch_size);
+    attrs.reserve(2);
+    attr_string.reserve(LPR_MAX_LABEL_LEN);
+    for (std::string &s : parse_labels)
+        s.reserve(LPR_MAX_LABEL_LEN);
+
+    if (num_batches == 0)
+        return;
+    samples.reserve((size_t)num_batches * cfg.rounds);
+
+    for (unsigned int round = 0; round < cfg.rounds; round++) {
+        for (unsigned int b = 0; b < num_batches; b++) {
+            size_t first = (size_t)b * batch_size;
+            unsigned long alloc_start = alloc_count;
+            auto start = std::chrono::steady_clock::now();
+
+            if (mode == BENCH_ARGMAX) {
+                lpr_decode_argmax_batch(&set.indices[first * cfg.seq_len],
+                                        &set.confs[first * cfg.seq_len],
+                                        batch_size, cfg.seq_len, blank, &plates[0]);
+            }
+            else if (mode == BENCH_RAW_GREEDY) {
+                lpr_decode_raw_batch(&set.rows[first * raw_stride], batch_size,
+                                     cfg.seq_len, set.num_classes, false, blank, &plates[0]);
+            }
+            else if (mode == BENCH_PARSE) {
+                for (unsigned int i = 0; i < batch_size; i++) {
+                    layers[0].buffer = (void *)&set.indices[(first + i) * cfg.seq_len];
+                    layers[1].buffer = (void *)&set.confs[(first + i) * cfg.seq_len];
+                    attrs.clear();
+                    NvDsInferParseCustomNVPlate(layers, network, 0.0f, attrs, attr_string);
+                    /* nvinfer frees the labels it takes over */
+                    for (NvDsInferAttribute &attr : attrs)
+                        free(attr.attributeLabel);
+                    parse_labels[i] = attr_string;
+                    parse_emitted[i] = !attrs.empty();
+                }
+            }
+            else {
+                for (unsigned int i = 0; i < batch_size; i++)
+                    lpr_beam_search(&set.rows[(first + i) * raw_stride], cfg.seq_len,
+                                    set.num_classes, false, blank, cfg.beam_width,
+                                    grammar, &plates[i]);
+            }
+            for (unsigned int i = 0; mode != BENCH_PARSE && i < batch_size; i++) {
+                if (dfa && !lpr_format_match(dfa, &glyph_table, &plates[i]))
+                    plates[i].length = 0;
+                lpr_plate_label(&dict, &plates[i], label);
+            }
+
+            auto end = std::chrono::steady_clock::now();
+            allocs += alloc_count - alloc_start;
+            samples.push_back(std::chrono::duration<double, std::nano>(end - start).count() / batch_size);
+
+            if (round == 0) {
+                for (unsigned int i = 0; i < batch_size && mode == BENCH_PARSE; i++) {
+                    std::string truth;
+                    for (int c : set.truth[first + i])
+                        truth.append(dict.glyphs[c], dict.lengths[c]);
+                    emitted += parse_emitted[i];
+                    correct += parse_labels[i] == truth;
+                }
+                for (unsigned int i = 0; i < batch_size && mode != BENCH_PARSE; i++) {
+                    const std::vector<int> &truth = set.truth[first + i];
+                    emitted += plates[i].length >= 3;
+                    correct += plates[i].length == truth.size() &&
+                               std::equal(truth.begin(), truth.end(), plates[i].chars);
+                }
+            }
+        }
+    }
+
+    std::sort(samples.begin(), samples.end());
+    double sum = 0.0;
+    for (double s : samples)
+        sum += s;
+
+    printf("%-14s batch %4u  ns/plate mean %8.1f p50 %8.1f p99 %8.1f  allocs/plate %.3f"
+           "  exact %5.1f%%  emitted %5.1f%%\n",
+           mode_names[mode], batch_size, sum / samples.size(),
+           samples[samples.size() / 2], samples[std::min(samples.size() - 1, samples.size() * 99 / 100)],
+           (double)allocs / ((double)num_batches * batch_size * cfg.rounds),
+           100.0 * correct / (num_batches * batch_size),
+           100.0 * emitted / (num_batches * batch_size));
+}
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-d dict.txt] [-s seq_len] [-l plate_len] [-m max_span]\n"
+            "          [-r repeat_prob] [-i invalid_prob] [-k peak] [-w beam_width]\n"
+            "          [-p pattern] [-f region] [-n plates] [-R rounds]\n", prog);
+}
+
+int
+main(int argc, char *argv[])
+{
+    BenchConfig cfg = { "../dict.txt", NULL, NULL, 24, 7, 2, 0.1f, 0.0f, 10.0f, 8, 4096, 20 };
+    static const unsigned int batch_sizes[] = { 1, 8, 32, 128 };
+    LprDict dict;
+    LprGrammar grammar;
+    SyntheticSet set;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:s:l:m:r:i:k:w:p:f:n:R:h")) != -1) {
+        switch (opt) {
+        case 'd': cfg.dict_path = optarg; break;
+        case 's': cfg.seq_len = atoi(optarg); break;
+        case 'l': cfg.plate_len = atoi(optarg); break;
+        case 'm': cfg.max_span = std::max(1, atoi(optarg)); break;
+        case 'r': cfg.repeat_prob = atof(optarg); break;
+        case 'i': cfg.invalid_prob = atof(optarg); break;
+        case 'k': cfg.peak = atof(optarg); break;
+        case 'w': cfg.beam_width = atoi(optarg); break;
+        case 'p': cfg.pattern = optarg; break;
+        case 'f': cfg.region = optarg; break;
+        case 'n': cfg.num_plates = atoi(optarg); break;
+        case 'R': cfg.rounds = std::max(1, atoi(optarg)); break;
+        default: usage(argv[0]); return opt == 'h' ? 0 : -1;
+        }
+    }
+
+    if (cfg.seq_len == 0 || cfg.plate_len > LPR_MAX_PLATE_LEN || cfg.num_plates == 0) {
+        fprintf(stderr, "seq_len must be > 0, plate_len <= %d and plates > 0\n", LPR_MAX_PLATE_LEN);
+        return -1;
+    }
+    if (!lpr_dict_load(cfg.dict_path, &dict)) {
+        fprintf(stderr, "open dictionary file %s failed.\n", cfg.dict_path);
+        return -1;
+    }
+    if (cfg.pattern && !lpr_grammar_compile(cfg.pattern, &dict, &grammar)) {
+        fprintf(stderr, "invalid plate pattern %s\n", cfg.pattern);
+        return -1;
+    }
+
+    const LprFormatDfa *dfa = cfg.region ? lpr_format_region(cfg.region) : NULL;
+    if (cfg.region && !dfa) {
+        fprintf(stderr, "unknown plate region %s\n", cfg.region);
+        return -1;
+    }
+    lpr_glyph_table_init(&dict, &glyph_table);
+
+    make_synthetic_set(cfg, dict, cfg.pattern ? &grammar : NULL, set);
+
+    printf("seq_len %u, %u classes, plate_len %u, max_span %u, repeat %.2f, invalid %.2f,"
+           " peak %.1f, beam %u%s%s%s%s\n",
+           cfg.seq_len, set.num_classes, cfg.plate_len, cfg.max_span, cfg.repeat_prob,
+           cfg.invalid_prob, cfg.peak, cfg.beam_width, cfg.pattern ? ", pattern " : "",
+           cfg.pattern ? cfg.pattern : "", cfg.region ? ", region " : "",
+           cfg.region ? cfg.region : "");
+
+    for (BenchMode mode : { BENCH_ARGMAX, BENCH_RAW_GREEDY, BENCH_RAW_BEAM, BENCH_PARSE }) {
+        for (unsigned int batch_size : batch_sizes)
+            run_mode(mode, cfg, dict, cfg.pattern ? &grammar : NULL, dfa, set, batch_size);
+    }
+
+    return 0;
+}
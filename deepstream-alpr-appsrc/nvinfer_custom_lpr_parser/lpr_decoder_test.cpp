@@ -0,0 +1,851 @@
+/*
+ * Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* Equivalence test of the LPR decode path: make test
+ *
+ * Random tensors are decoded by the greedy loop the parser shipped with
+ * (scalar argmax, collapse, invalid indices skipped) and by
+ * lpr_decode_argmax_batch / lpr_decode_raw_batch, for every batch size up to
+ * 128. Tensors mix long runs of one class, blanks, ties and out-of-range
+ * indices. Any difference in characters, timesteps or confidences fails.
+ *
+ * lpr_beam_search is checked against a plain prefix beam search on
+ * std::vector prefixes that applies the same pruning rules, for widths 1
+ * to 32 with and without a plate pattern; against the greedy loop at width
+ * 1 on peaked rows; and on hand-built tensors where merging the paths of a
+ * prefix, or a plate pattern, must change the greedy reading.
+ *
+ * The tw and us plate formats of lpr_plate_format.h must accept their
+ * plates, repair confusable glyphs up to LPR_FORMAT_MAX_REPAIRS swaps and
+ * reject the rest; a small format set is also compiled and checked at
+ * build time. With LPR_PLATE_REGION=tw set, only the region checks of the
+ * parser entry point run, as the parser reads its environment once.
+ *
+ * NvDsInferParseCustomNVPlate is built in against stub/nvdsinfer.h and fed
+ * the same tensors through named, unnamed and raw output layers; its label,
+ * plate attribute and packed character attribute are checked against the
+ * greedy loop too, and every heap allocation made by a call must be one of
+ * the attribute labels nvinfer takes over: the plate label alone, plus the
+ * packed character label in a second run with LPR_CHAR_ATTR=1. */
+
+#include <algorithm>
+#include <math.h>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "nvdsinfer.h"
+#include "lpr_decoder.h"
+#include "lpr_char_meta.h"
+#include "lpr_plate_format.h"
+
+#define TEST_MAX_BATCH 128
+
+static const unsigned int seq_lens[] = { 1, 2, 24, 63, 64, 65, 200 };
+
+static unsigned long failures = 0;
+
+/* LPR_CHAR_ATTR is set, the parser adds the packed character attribute */
+static bool char_attr = false;
+
+extern "C" void *__libc_malloc(size_t size);
+
+static unsigned long alloc_count = 0;
+
+/* Count every heap allocation, the parser may only allocate labels */
+extern "C" void *malloc(size_t size)
+{
+    alloc_count++;
+    return __libc_malloc(size);
+}
+
+extern "C" bool NvDsInferParseCustomNVPlate(std::vector<NvDsInferLayerInfo> const &outputLayersInfo,
+                                            NvDsInferNetworkInfo const &networkInfo,
+                                            float classifierThreshold,
+                                            std::vector<NvDsInferAttribute> &attrList,
+                                            std::string &attrString);
+
+static void
+fail(const char *fmt, const char *what, unsigned int seq_len)
+{
+    if (failures++ < 10)
+        fprintf(stderr, fmt, what, seq_len);
+}
+
+typedef struct _RefPlate
+{
+    std::vector<int> chars;
+    std::vector<unsigned int> steps;
+    std::vector<float> confs;
+} RefPlate;
+
+/* The original NvDsInferParseCustomNVPlate loop, characters beyond
+ * LPR_MAX_PLATE_LEN dropped like the decoder does */
+static void
+ref_collapse(const int *indices, const float *confs, unsigned int seq_len,
+             int blank, RefPlate &plate)
+{
+    int prev = 100;
+
+    plate.chars.clear();
+    plate.steps.clear();
+    plate.confs.clear();
+    for (unsigned int seq_id = 0; seq_id < seq_len; seq_id++) {
+        bool do_softmax = false;
+        int curr_data = indices[seq_id];
+        if (curr_data < 0 || curr_data > blank)
+            continue;
+        if (seq_id == 0) {
+            prev = curr_data;
+            if (curr_data != blank)
+                do_softmax = true;
+        }
+        else {
+            if (curr_data != prev && curr_data != blank)
+                do_softmax = true;
+            prev = curr_data;
+        }
+        if (do_softmax && plate.chars.size() < LPR_MAX_PLATE_LEN) {
+            plate.chars.push_back(curr_data);
+            plate.steps.push_back(seq_id);
+            plate.confs.push_back(confs[seq_id]);
+        }
+    }
+}
+
+/* First class holding the row maximum, softmax of it for logits */
+static void
+ref_argmax(const float *row, unsigned int num_classes, bool logits, int *index, float *conf)
+{
+    int best = 0;
+
+    for (unsigned int c = 1; c < num_classes; c++) {
+        if (row[c] > row[best])
+            best = c;
+    }
+    *index = best;
+    if (!logits) {
+        *conf = row[best];
+        return;
+    }
+    double sum = 0.0;
+    for (unsigned int c = 0; c < num_classes; c++)
+        sum += exp((double)row[c] - row[best]);
+    *conf = (float)(1.0 / sum);
+}
+
+static bool
+conf_equal(float a, float b, bool exact)
+{
+    return exact ? a == b : fabsf(a - b) <= 1e-5f * std::max(1.0f, fabsf(b));
+}
+
+static void
+check_plate(const char *what, unsigned int batch_size, unsigned int seq_len,
+            unsigned int b, const RefPlate &ref, const LprPlate &plate, bool exact)
+{
+    bool same = plate.length == ref.chars.size();
+    double log_conf = 0.0;
+
+    for (unsigned int i = 0; same && i < plate.length; i++) {
+        same = plate.chars[i] == ref.chars[i] && plate.steps[i] == ref.steps[i] &&
+               conf_equal(plate.confs[i], ref.confs[i], exact);
+        log_conf += log(std::max(ref.confs[i], 1e-38f));
+    }
+    if (same && fabs(plate.log_conf - log_conf) > 1e-4 * std::max(1.0, fabs(log_conf)))
+        same = false;
+    if (!same) {
+        if (failures++ < 10)
+            fprintf(stderr, "%s: batch %u seq_len %u plate %u: %u characters, expected %zu\n",
+                    what, batch_size, seq_len, b, plate.length, ref.chars.size());
+    }
+}
+
+/* Runs of one class with blanks in between, like a CTC path, and noise */
+static int
+random_class(std::mt19937 &rng, int blank, int prev)
+{
+    unsigned int roll = rng() % 100;
+
+    if (roll < 40 && prev >= 0)
+        return prev;
+    if (roll < 65)
+        return blank;
+    return rng() % blank;
+}
+
+static void
+test_argmax(std::mt19937 &rng, int blank, unsigned int batch_size, unsigned int seq_len)
+{
+    std::vector<int> indices((size_t)batch_size * seq_len);
+    std::vector<float> confs(indices.size());
+    std::vector<LprPlate> plates(batch_size);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    int prev = -1;
+
+    for (size_t i = 0; i < indices.size(); i++) {
+        prev = random_class(rng, blank, prev);
+        indices[i] = prev;
+        /* Out of range indices are skipped, they must not break a run */
+        if (unit(rng) < 0.05f)
+            indices[i] = unit(rng) < 0.5f ? -1 - (int)(rng() % 4) : blank + 1 + rng() % 16;
+        confs[i] = unit(rng);
+    }
+
+    lpr_decode_argmax_batch(&indices[0], &confs[0], batch_size, seq_len, blank, &plates[0]);
+    for (unsigned int b = 0; b < batch_size; b++) {
+        RefPlate ref;
+        ref_collapse(&indices[(size_t)b * seq_len], &confs[(size_t)b * seq_len], seq_len, blank, ref);
+        check_plate("argmax", batch_size, seq_len, b, ref, plates[b], true);
+    }
+}
+
+static void
+test_raw(std::mt19937 &rng, int blank, unsigned int batch_size, unsigned int seq_len, bool logits)
+{
+    unsigned int num_classes = blank + 1;
+    std::vector<float> rows((size_t)batch_size * seq_len * num_classes);
+    std::vector<LprPlate> plates(batch_size);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    int prev = -1;
+
+    for (size_t r = 0; r < (size_t)batch_size * seq_len; r++) {
+        float *row = &rows[r * num_classes];
+        prev = random_class(rng, blank, prev);
+        for (unsigned int c = 0; c < num_classes; c++)
+            row[c] = logits ? unit(rng) * 8.0f - 4.0f : unit(rng) * 0.1f;
+        row[prev] += logits ? 4.0f : 0.5f;
+        /* Ties go to the first class */
+        if (unit(rng) < 0.1f)
+            row[rng() % num_classes] = row[prev];
+    }
+
+    lpr_decode_raw_batch(&rows[0], batch_size, seq_len, num_classes, logits, blank, &plates[0]);
+    for (unsigned int b = 0; b < batch_size; b++) {
+        std::vector<int> indices(seq_len);
+        std::vector<float> confs(seq_len);
+        RefPlate ref;
+        for (unsigned int t = 0; t < seq_len; t++)
+            ref_argmax(&rows[((size_t)b * seq_len + t) * num_classes], num_classes, logits,
+                       &indices[t], &confs[t]);
+        ref_collapse(&indices[0], &confs[0], seq_len, blank, ref);
+        check_plate(logits ? "raw-logits" : "raw-probs", batch_size, seq_len, b, ref,
+                    plates[b], !logits);
+    }
+}
+
+/* One prefix of ref_beam_search */
+typedef struct _RefBeam
+{
+    RefPlate plate;
+    float p_b;
+    float p_nb;
+} RefBeam;
+
+static RefBeam *
+ref_find_beam(std::vector<RefBeam> &beams, const std::vector<int> &chars)
+{
+    for (RefBeam &beam : beams) {
+        if (beam.plate.chars == chars)
+            return &beam;
+    }
+    return NULL;
+}
+
+/* CTC prefix beam search over probability rows the way lpr_beam_search
+ * defines it: the LPR_BEAM_TOP_CLASSES most likely characters of a
+ * timestep at or above LPR_BEAM_PRUNE_PROB extend a beam while that
+ * extension is not below LPR_BEAM_PRUNE_PROB of the best beam, the best
+ * beam_width prefixes survive in the order they were first reached when
+ * they tie, and beams are rescaled to best == 1. Nothing else is pruned. */
+static void
+ref_beam_search(const float *rows, unsigned int seq_len, unsigned int num_classes,
+                int blank, unsigned int beam_width, const LprGrammar *grammar,
+                RefPlate &plate)
+{
+    std::vector<RefBeam> beams(1);
+    std::vector<RefBeam> cands;
+
+    beams[0].p_b = 1.0f;
+    beams[0].p_nb = 0.0f;
+    for (unsigned int t = 0; t < seq_len; t++) {
+        const float *row = rows + (size_t)t * num_classes;
+        std::vector<int> top;
+        for (int c = 0; c < blank; c++) {
+            if (row[c] >= LPR_BEAM_PRUNE_PROB)
+                top.push_back(c);
+        }
+        std::stable_sort(top.begin(), top.end(), [row](int a, int b) { return row[a] > row[b]; });
+        if (top.size() > LPR_BEAM_TOP_CLASSES)
+            top.resize(LPR_BEAM_TOP_CLASSES);
+
+        cands.clear();
+        for (const RefBeam &beam : beams) {
+            RefBeam *cand = ref_find_beam(cands, beam.plate.chars);
+            if (!cand) {
+                cands.push_back(beam);
+                cand = &cands.back();
+                cand->p_b = cand->p_nb = 0.0f;
+            }
+            cand->p_b += (beam.p_b + beam.p_nb) * row[blank];
+            if (!beam.plate.chars.empty())
+                cand->p_nb += beam.p_nb * row[beam.plate.chars.back()];
+        }
+        for (size_t b = 0; b < beams.size(); b++) {
+            const RefBeam beam = beams[b];
+            float p_total = beam.p_b + beam.p_nb;
+            unsigned int pos = beam.plate.chars.size();
+            if (pos == LPR_MAX_PLATE_LEN)
+                continue;
+            for (int c : top) {
+                if (p_total * row[c] < LPR_BEAM_PRUNE_PROB)
+                    break;
+                if (grammar && grammar->length &&
+                    (pos >= grammar->length || !(grammar->allowed[pos][c >> 3] & (1 << (c & 7)))))
+                    continue;
+                bool repeat = !beam.plate.chars.empty() && beam.plate.chars.back() == c;
+                std::vector<int> chars = beam.plate.chars;
+                chars.push_back(c);
+                RefBeam *cand = ref_find_beam(cands, chars);
+                if (!cand) {
+                    cands.push_back(beam);
+                    cand = &cands.back();
+                    cand->plate.chars = chars;
+                    cand->plate.steps.push_back(t);
+                    cand->plate.confs.push_back(row[c]);
+                    cand->p_b = cand->p_nb = 0.0f;
+                }
+                cand->p_nb += (repeat ? beam.p_b : p_total) * row[c];
+            }
+        }
+
+        std::stable_sort(cands.begin(), cands.end(), [](const RefBeam &a, const RefBeam &b) {
+            return a.p_b + a.p_nb > b.p_b + b.p_nb;
+        });
+        if (cands.size() > beam_width)
+            cands.resize(beam_width);
+        float best = cands[0].p_b + cands[0].p_nb;
+        float rescale = best > 0.0f ? 1.0f / best : 1.0f;
+        for (RefBeam &cand : cands) {
+            cand.p_b *= rescale;
+            cand.p_nb *= rescale;
+        }
+        beams.swap(cands);
+    }
+
+    plate = RefPlate();
+    for (const RefBeam &beam : beams) {
+        if (grammar && grammar->length && beam.plate.chars.size() != grammar->length)
+            continue;
+        plate = beam.plate;
+        break;
+    }
+}
+
+/* Row of probabilities peaking at class peak, the rest spread at random */
+static void
+peaked_row(std::mt19937 &rng, float *row, unsigned int num_classes, int peak, float peak_prob)
+{
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    float sum = 0.0f;
+
+    for (unsigned int c = 0; c < num_classes; c++) {
+        row[c] = (int)c == peak ? 0.0f : unit(rng) * unit(rng);
+        sum += row[c];
+    }
+    for (unsigned int c = 0; c < num_classes; c++)
+        row[c] = (int)c == peak ? peak_prob : row[c] / sum * (1.0f - peak_prob);
+}
+
+/* lpr_beam_search against ref_beam_search, on rows whose peak ranges from
+ * a clear reading to near noise */
+static void
+test_beam(std::mt19937 &rng, int blank, const LprGrammar *grammar)
+{
+    unsigned int num_classes = blank + 1;
+    unsigned int seq_len = 1 + rng() % 40;
+    unsigned int beam_width = 1 + rng() % LPR_MAX_BEAM_WIDTH;
+    std::vector<float> rows((size_t)seq_len * num_classes);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    int prev = -1;
+    LprPlate plate;
+    RefPlate ref;
+
+    for (unsigned int t = 0; t < seq_len; t++) {
+        prev = random_class(rng, blank, prev);
+        peaked_row(rng, &rows[(size_t)t * num_classes], num_classes, prev, 0.05f + unit(rng) * 0.95f);
+    }
+
+    lpr_beam_search(&rows[0], seq_len, num_classes, false, blank, beam_width, grammar, &plate);
+    ref_beam_search(&rows[0], seq_len, num_classes, blank, beam_width, grammar, ref);
+    check_plate(grammar ? "beam-pattern" : "beam", beam_width, seq_len, 0, ref, plate, true);
+}
+
+/* At width 1 on rows peaking above 0.9 the best prefix is the greedy path */
+static void
+test_beam_greedy(std::mt19937 &rng, int blank, bool logits)
+{
+    unsigned int num_classes = blank + 1;
+    unsigned int seq_len = 1 + rng() % 40;
+    std::vector<float> rows((size_t)seq_len * num_classes);
+    std::vector<int> indices(seq_len);
+    std::vector<float> confs(seq_len);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    int prev = -1;
+    LprPlate plate;
+    RefPlate ref;
+
+    for (unsigned int t = 0; t < seq_len; t++) {
+        float *row = &rows[(size_t)t * num_classes];
+        prev = random_class(rng, blank, prev);
+        peaked_row(rng, row, num_classes, prev, 0.9f + unit(rng) * 0.1f);
+        if (logits) {
+            for (unsigned int c = 0; c < num_classes; c++)
+                row[c] = logf(std::max(row[c], 1e-30f)) + 3.0f;
+        }
+        ref_argmax(row, num_classes, logits, &indices[t], &confs[t]);
+    }
+    ref_collapse(&indices[0], &confs[0], seq_len, blank, ref);
+
+    lpr_beam_search(&rows[0], seq_len, num_classes, logits, blank, 1, NULL, &plate);
+    check_plate(logits ? "beam-greedy-logits" : "beam-greedy", 1, seq_len, 0, ref, plate, !logits);
+}
+
+/* Dictionary index of glyph, the blank for '-' */
+static int
+glyph_class(const LprDict &dict, char glyph)
+{
+    for (unsigned int c = 0; c < dict.size; c++) {
+        if (dict.lengths[c] == 1 && dict.glyphs[c][0] == glyph)
+            return c;
+    }
+    return dict.size;
+}
+
+/* Decode rows given per timestep as up to two "<glyph><percent>" choices,
+ * the rest of the row shared evenly, and compare the label with expected */
+static void
+check_beam_case(const char *what, const LprDict &dict, const std::vector<const char *> &steps,
+                unsigned int beam_width, const char *pattern, const char *expected)
+{
+    unsigned int num_classes = dict.size + 1;
+    std::vector<float> rows(steps.size() * num_classes);
+    LprGrammar grammar;
+    LprPlate plate;
+    char label[LPR_MAX_LABEL_LEN + 1];
+
+    for (size_t t = 0; t < steps.size(); t++) {
+        float *row = &rows[t * num_classes];
+        float rest = 1.0f;
+        int chosen[2] = { -1, -1 };
+        const char *p = steps[t];
+        for (unsigned int i = 0; i < 2 && *p; i++) {
+            chosen[i] = glyph_class(dict, *p);
+            row[chosen[i]] = strtol(p + 1, (char **)&p, 10) / 100.0f;
+            rest -= row[chosen[i]];
+            while (*p == ' ')
+                p++;
+        }
+        for (unsigned int c = 0; c < num_classes; c++) {
+            if ((int)c != chosen[0] && (int)c != chosen[1])
+                row[c] = rest / (num_classes - (chosen[1] >= 0 ? 2 : 1));
+        }
+    }
+    if (pattern && !lpr_grammar_compile(pattern, &dict, &grammar)) {
+        fail("%s: seq_len %u: pattern does not compile\n", what, steps.size());
+        return;
+    }
+
+    lpr_beam_search(&rows[0], steps.size(), num_classes, false, dict.size, beam_width,
+                    pattern ? &grammar : NULL, &plate);
+    lpr_plate_label(&dict, &plate, label);
+    if (strcmp(label, expected)) {
+        if (failures++ < 10)
+            fprintf(stderr, "%s: width %u: read \"%s\", expected \"%s\"\n", what, beam_width,
+                    label, expected);
+    }
+}
+
+static unsigned int
+test_beam_cases(const LprDict &dict)
+{
+    /* Greedy takes the blank twice and reads nothing. "A" is reached through
+     * A-, -A and AA, 0.64 against 0.36 for the empty prefix. */
+    std::vector<const char *> merged = { "A40 -60", "A40 -60" };
+    check_beam_case("beam-merge", dict, merged, 1, NULL, "");
+    check_beam_case("beam-merge", dict, merged, 2, NULL, "A");
+
+    /* The argmax path reads A81, which the pattern rejects for AB1 */
+    std::vector<const char *> plate = { "A95", "-95", "855 B45", "-95", "195" };
+    check_beam_case("beam-pattern", dict, plate, 4, NULL, "A81");
+    check_beam_case("beam-pattern", dict, plate, 4, "AA0", "AB1");
+
+    /* No full-length plate survives, nothing is read */
+    std::vector<const char *> short_plate = { "A95", "-95", "195" };
+    check_beam_case("beam-pattern", dict, short_plate, 4, "AA0", "");
+    return 5;
+}
+
+/* Two formats sharing their first position: AA00 and A0 */
+static constexpr const char *test_formats[] = { "AA-00", "A0" };
+static constexpr LprFormatDfa test_dfa = lpr_format_compile(test_formats);
+static_assert(test_dfa.num_states == 7, "AA00 and A0 share one state after the start");
+static_assert(test_dfa.next[1][LPR_GLYPH_LETTER] == 2 && test_dfa.next[1][LPR_GLYPH_DIGIT] == 0,
+              "both formats start with a letter");
+static_assert(test_dfa.accept[test_dfa.next[2][LPR_GLYPH_DIGIT]], "A0 is accepted");
+static_assert(!test_dfa.accept[2], "A alone is not accepted");
+
+/* Plate of ASCII glyphs, false when one is not in the dictionary */
+static bool
+ascii_plate(const LprDict &dict, const char *text, LprPlate *plate)
+{
+    memset(plate, 0, sizeof(*plate));
+    for (const char *p = text; *p; p++) {
+        int c = glyph_class(dict, *p);
+        if (c == (int)dict.size)
+            return false;
+        plate->chars[plate->length] = c;
+        plate->confs[plate->length] = 0.9f;
+        plate->steps[plate->length] = plate->length * 2;
+        plate->length++;
+    }
+    return true;
+}
+
+/* lpr_format_match of text against dfa must give expected, NULL = rejected */
+static void
+check_format(const char *what, const LprDict &dict, const LprGlyphTable &table,
+             const LprFormatDfa *dfa, const char *text, const char *expected)
+{
+    LprPlate plate;
+    char label[LPR_MAX_LABEL_LEN + 1];
+
+    if (!dfa || !ascii_plate(dict, text, &plate)) {
+        if (failures++ < 10)
+            fprintf(stderr, "%s: %s: not in the dictionary\n", what, text);
+        return;
+    }
+    bool matched = lpr_format_match(dfa, &table, &plate);
+    lpr_plate_label(&dict, &plate, label);
+    if (matched != (expected != NULL) || (expected && strcmp(label, expected))) {
+        if (failures++ < 10)
+            fprintf(stderr, "%s: %s: %s \"%s\", expected %s\n", what, text,
+                    matched ? "read" : "rejected", label, expected ? expected : "a rejection");
+    }
+}
+
+static unsigned int
+test_formats_match(const LprDict &dict)
+{
+    const LprFormatDfa *tw = lpr_format_region("tw");
+    const LprFormatDfa *us = lpr_format_region("us");
+    LprGlyphTable table;
+    unsigned int cases = 0;
+
+    lpr_glyph_table_init(&dict, &table);
+    if (lpr_format_region("xx"))
+        fail("%s: seq_len %u: unknown region has formats\n", "format", 0);
+
+    static const char *const tw_valid[] = { "ABC1234", "AB1234", "1234AB", "A11234", "ABC123", "123ABC" };
+    static const char *const us_valid[] = { "1ABC234", "ABC1234", "ABC123", "12A345", "AB12345", "A12ABC" };
+    for (const char *plate : tw_valid)
+        check_format("format-tw", dict, table, tw, plate, plate);
+    for (const char *plate : us_valid)
+        check_format("format-us", dict, table, us, plate, plate);
+    cases += 12;
+
+    /* Confusables are swapped where the position class needs it */
+    check_format("format-tw", dict, table, tw, "A8C1234", "ABC1234");
+    check_format("format-us", dict, table, us, "A8C1234", "ABC1234");
+    check_format("format-tw", dict, table, tw, "ABC12S4", "ABC1254");
+    check_format("format-tw", dict, table, tw, "88C1234", "BBC1234");
+    /* Three swaps are over LPR_FORMAT_MAX_REPAIRS */
+    check_format("format-tw", dict, table, tw, "88C12S4", NULL);
+    /* No format of that length, or a glyph without a look-alike */
+    check_format("format-tw", dict, table, tw, "ABC12345", NULL);
+    check_format("format-tw", dict, table, tw, "AB12", NULL);
+    check_format("format-us", dict, table, us, "ABCD12345", NULL);
+    check_format("format-tw", dict, table, tw, "ABCK123", NULL);
+    cases += 9;
+
+    check_format("format-test", dict, table, &test_dfa, "AB12", "AB12");
+    check_format("format-test", dict, table, &test_dfa, "A1", "A1");
+    check_format("format-test", dict, table, &test_dfa, "AB1", NULL);
+    check_format("format-test", dict, table, &test_dfa, "8B12", "BB12");
+    return cases + 4;
+}
+
+static NvDsInferLayerInfo
+make_layer(const char *name, NvDsInferDataType type, void *buffer,
+           unsigned int rows, unsigned int cols)
+{
+    NvDsInferLayerInfo layer;
+
+    memset(&layer, 0, sizeof(layer));
+    layer.dataType = type;
+    layer.inferDims.numDims = cols ? 2 : 1;
+    layer.inferDims.d[0] = rows;
+    layer.inferDims.d[1] = cols;
+    layer.inferDims.numElements = rows * (cols ? cols : 1);
+    layer.layerName = name;
+    layer.buffer = buffer;
+    return layer;
+}
+
+/* Run the parser entry point and compare what it returns with ref */
+static void
+check_parse(const char *what, const std::vector<NvDsInferLayerInfo> &layers,
+            unsigned int seq_len, const LprDict &dict, const RefPlate &ref)
+{
+    NvDsInferNetworkInfo network = { seq_len * 4, 48, 3 };
+    std::vector<NvDsInferAttribute> attrs;
+    std::string label;
+    std::string expected;
+    double conf = 1.0;
+
+    /* nvinfer hands in reused containers, growing them is not the parser's */
+    attrs.reserve(2);
+    label.reserve(LPR_MAX_LABEL_LEN);
+
+    for (size_t i = 0; i < ref.chars.size(); i++) {
+        expected.append(dict.glyphs[ref.chars[i]], dict.lengths[ref.chars[i]]);
+        conf *= ref.confs[i];
+    }
+
+    unsigned long alloc_start = alloc_count;
+    bool parsed = NvDsInferParseCustomNVPlate(layers, network, 0.0f, attrs, label);
+    unsigned long allocs = alloc_count - alloc_start;
+    if (!parsed) {
+        fail("%s: seq_len %u: parser failed\n", what, seq_len);
+        return;
+    }
+    if (allocs != attrs.size())
+        fail("%s: seq_len %u: allocations besides the attribute labels\n", what, seq_len);
+    if (label != expected)
+        fail("%s: seq_len %u: label differs\n", what, seq_len);
+
+    /* Plates shorter than 3 characters are not reported */
+    if (ref.chars.size() < 3) {
+        if (!attrs.empty())
+            fail("%s: seq_len %u: attributes for a short plate\n", what, seq_len);
+        return;
+    }
+    /* One label per plate, and the packed characters only when asked for */
+    if (attrs.size() != (char_attr ? 2u : 1u) || allocs != (char_attr ? 2u : 1u)) {
+        fail(char_attr ? "%s: seq_len %u: expected a plate and a character attribute\n" :
+                         "%s: seq_len %u: expected only the plate attribute\n", what, seq_len);
+        for (NvDsInferAttribute &attr : attrs)
+            free(attr.attributeLabel);
+        return;
+    }
+
+    const NvDsInferAttribute &plate = attrs[0];
+    if (plate.attributeIndex != LPR_PLATE_ATTR_INDEX || plate.attributeValue != 1 ||
+        expected != plate.attributeLabel ||
+        fabs(plate.attributeConfidence - conf) > 1e-4 * std::max(conf, 1e-30))
+        fail("%s: seq_len %u: plate attribute differs\n", what, seq_len);
+    if (!char_attr) {
+        free(attrs[0].attributeLabel);
+        return;
+    }
+
+    const NvDsInferAttribute &chars = attrs[1];
+    unsigned int num_chars = std::min(ref.chars.size(), (size_t)LPR_CHAR_META_MAX_LEN);
+    bool same = chars.attributeIndex == LPR_CHAR_ATTR_INDEX &&
+                chars.attributeValue == num_chars &&
+                strlen(chars.attributeLabel) == num_chars * 2;
+    for (unsigned int i = 0; same && i < num_chars; i++) {
+        same = (unsigned char)chars.attributeLabel[i * 2] == LPR_CHAR_CONF_PACK(ref.confs[i]) &&
+               (unsigned char)chars.attributeLabel[i * 2 + 1] == LPR_CHAR_STEP_PACK(ref.steps[i]);
+    }
+    if (!same)
+        fail("%s: seq_len %u: character attribute differs\n", what, seq_len);
+
+    for (NvDsInferAttribute &attr : attrs)
+        free(attr.attributeLabel);
+}
+
+static void
+test_parser(std::mt19937 &rng, const LprDict &dict, unsigned int seq_len)
+{
+    int blank = dict.size;
+    unsigned int num_classes = blank + 1;
+    std::vector<int> indices(seq_len);
+    std::vector<float> confs(seq_len);
+    std::vector<float> rows((size_t)seq_len * num_classes);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    RefPlate ref;
+    int prev = -1;
+
+    for (unsigned int t = 0; t < seq_len; t++) {
+        prev = random_class(rng, blank, prev);
+        indices[t] = unit(rng) < 0.05f ? blank + 1 : prev;
+        confs[t] = 0.5f + unit(rng) * 0.5f;
+        for (unsigned int c = 0; c < num_classes; c++)
+            rows[(size_t)t * num_classes + c] = unit(rng) * 0.1f;
+        rows[(size_t)t * num_classes + prev] += 0.5f;
+    }
+    ref_collapse(&indices[0], &confs[0], seq_len, blank, ref);
+
+    /* The TAO layer names, in either order */
+    std::vector<NvDsInferLayerInfo> named = {
+        make_layer("tf_op_layer_ArgMax", INT32, &indices[0], seq_len, 0),
+        make_layer("tf_op_layer_Max", FLOAT, &confs[0], seq_len, 0),
+    };
+    check_parse("parse-named", named, seq_len, dict, ref);
+    std::swap(named[0], named[1]);
+    check_parse("parse-named", named, seq_len, dict, ref);
+
+    /* Other names are bound by type and shape */
+    std::vector<NvDsInferLayerInfo> typed = {
+        make_layer("scores", FLOAT, &confs[0], seq_len, 0),
+        make_layer("classes", INT32, &indices[0], seq_len, 0),
+    };
+    check_parse("parse-typed", typed, seq_len, dict, ref);
+
+    std::vector<int> raw_indices(seq_len);
+    std::vector<float> raw_confs(seq_len);
+    for (unsigned int t = 0; t < seq_len; t++)
+        ref_argmax(&rows[(size_t)t * num_classes], num_classes, false, &raw_indices[t], &raw_confs[t]);
+    ref_collapse(&raw_indices[0], &raw_confs[0], seq_len, blank, ref);
+    std::vector<NvDsInferLayerInfo> raw = {
+        make_layer("raw_scores", FLOAT, &rows[0], seq_len, num_classes),
+    };
+    check_parse("parse-raw", raw, seq_len, dict, ref);
+}
+
+/* The parser with LPR_PLATE_REGION=tw: text read through the argmax layers,
+ * one blank after each character, must give label expected */
+static void
+check_region_parse(const LprDict &dict, const char *text, const char *expected)
+{
+    size_t len = strlen(text);
+    unsigned int seq_len = len * 2;
+    std::vector<int> indices(seq_len, dict.size);
+    std::vector<float> confs(seq_len, 0.9f);
+    NvDsInferNetworkInfo network = { seq_len * 4, 48, 3 };
+    std::vector<NvDsInferAttribute> attrs;
+    std::string label;
+
+    for (size_t i = 0; i < len; i++)
+        indices[i * 2] = glyph_class(dict, text[i]);
+    std::vector<NvDsInferLayerInfo> layers = {
+        make_layer("tf_op_layer_ArgMax", INT32, &indices[0], seq_len, 0),
+        make_layer("tf_op_layer_Max", FLOAT, &confs[0], seq_len, 0),
+    };
+    bool parsed = NvDsInferParseCustomNVPlate(layers, network, 0.0f, attrs, label);
+    bool same = parsed && label == expected && attrs.empty() == !*expected &&
+                (attrs.empty() || !strcmp(attrs[0].attributeLabel, expected));
+    if (!same && failures++ < 10)
+        fprintf(stderr, "parse-region: %s: read \"%s\" with %zu attributes, expected \"%s\"\n",
+                text, label.c_str(), attrs.size(), expected);
+    for (NvDsInferAttribute &attr : attrs)
+        free(attr.attributeLabel);
+}
+
+static int
+test_region_parse(const LprDict &dict)
+{
+    check_region_parse(dict, "ABC1234", "ABC1234");
+    check_region_parse(dict, "A8C1234", "ABC1234");
+    /* A US-only format, and a plate no swap repairs, read nothing */
+    check_region_parse(dict, "1ABC234", "");
+    check_region_parse(dict, "ABCK123", "");
+    printf("parser, region tw: 4 cases, %lu mismatches\n", failures);
+    return failures ? 1 : 0;
+}
+
+/* The parser entry point on random tensors of every layout */
+static int
+test_parser_all(std::mt19937 &rng, const LprDict &dict)
+{
+    unsigned long start_failures = failures;
+    std::vector<NvDsInferLayerInfo> none;
+    std::vector<NvDsInferAttribute> attrs;
+    std::string label;
+    NvDsInferNetworkInfo network = { 96, 48, 3 };
+
+    if (NvDsInferParseCustomNVPlate(none, network, 0.0f, attrs, label))
+        fail("%s: seq_len %u: parsed without output layers\n", "parse-empty", 0);
+    for (unsigned int round = 0; round < 200; round++) {
+        for (unsigned int seq_len : seq_lens)
+            test_parser(rng, dict, seq_len);
+    }
+    printf("parser%s: %u cases, %lu mismatches\n", char_attr ? ", character attribute" : "",
+           200 * (unsigned int)(sizeof(seq_lens) / sizeof(seq_lens[0])) * 4 + 1,
+           failures - start_failures);
+    return failures ? 1 : 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *dict_path = argc > 1 ? argv[1] : "../dict.txt";
+    LprDict dict;
+    std::mt19937 rng(42);
+    unsigned long cases = 0;
+
+    if (!lpr_dict_load(dict_path, &dict)) {
+        fprintf(stderr, "open dictionary file %s failed.\n", dict_path);
+        return 1;
+    }
+    int blank = dict.size;
+
+    if (getenv("LPR_PLATE_REGION"))
+        return test_region_parse(dict);
+    char_attr = getenv(LPR_CHAR_ATTR_ENV) && atoi(getenv(LPR_CHAR_ATTR_ENV));
+    if (char_attr)
+        return test_parser_all(rng, dict);
+
+    for (unsigned int batch_size = 1; batch_size <= TEST_MAX_BATCH; batch_size++) {
+        for (unsigned int seq_len : seq_lens) {
+            test_argmax(rng, blank, batch_size, seq_len);
+            test_raw(rng, blank, batch_size, seq_len, false);
+            test_raw(rng, blank, batch_size, seq_len, true);
+            cases += 3;
+        }
+    }
+
+    printf("decoder: %lu cases, %lu mismatches\n", cases, failures);
+
+    unsigned long decoder_failures = failures;
+    LprGrammar grammar;
+    if (!lpr_grammar_compile("AA000", &dict, &grammar)) {
+        fprintf(stderr, "pattern AA000 does not compile against %s\n", dict_path);
+        return 1;
+    }
+    cases = test_beam_cases(dict);
+    for (unsigned int round = 0; round < 20000; round++) {
+        test_beam(rng, blank, round % 3 ? NULL : &grammar);
+        test_beam_greedy(rng, blank, round % 2);
+        cases += 2;
+    }
+    printf("beam: %lu cases, %lu mismatches\n", cases, failures - decoder_failures);
+
+    decoder_failures = failures;
+    cases = test_formats_match(dict);
+    printf("formats: %lu cases, %lu mismatches\n", cases, failures - decoder_failures);
+
+    return test_parser_all(rng, dict);
+}
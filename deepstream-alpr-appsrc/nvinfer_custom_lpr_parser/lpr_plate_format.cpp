@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <string.h>
+#include "lpr_plate_format.h"
+
+/* Taiwan: cars since 2012, older cars, motorcycles */
+static constexpr const char *lpr_formats_tw[] = {
+    "AAA-0000", "AA-0000", "0000-AA", "A0-0000", "0A-0000", "AAA-000", "000-AAA"
+};
+
+/* US: the common passenger formats */
+static constexpr const char *lpr_formats_us[] = {
+    "0AAA000", "AAA-0000", "AAA-000", "000-AAA", "00A-000", "AA0-0000", "A00-AAA"
+};
+
+static constexpr LprFormatDfa lpr_dfa_tw = lpr_format_compile(lpr_formats_tw);
+static constexpr LprFormatDfa lpr_dfa_us = lpr_format_compile(lpr_formats_us);
+
+/* OCR look-alikes between the digit and letter classes */
+static const char lpr_confusions[][2] = {
+    { '0', 'D' }, { '0', 'O' }, { '0', 'Q' }, { '1', 'I' }, { '2', 'Z' },
+    { '5', 'S' }, { '6', 'G' }, { '8', 'B' }
+};
+
+static int
+dict_find_ascii(const LprDict *dict, char glyph)
+{
+    for (unsigned int c = 0; c < dict->size; c++) {
+        if (dict->lengths[c] == 1 && dict->glyphs[c][0] == glyph)
+            return c;
+    }
+    return -1;
+}
+
+void lpr_glyph_table_init(const LprDict *dict, LprGlyphTable *table)
+{
+    for (unsigned int c = 0; c < LPR_MAX_DICT_SIZE; c++) {
+        char glyph = (c < dict->size && dict->lengths[c] == 1) ? dict->glyphs[c][0] : 0;
+        if (glyph >= '0' && glyph <= '9')
+            table->cls[c] = LPR_GLYPH_DIGIT;
+        else if ((glyph >= 'A' && glyph <= 'Z') || (glyph >= 'a' && glyph <= 'z'))
+            table->cls[c] = LPR_GLYPH_LETTER;
+        else
+            table->cls[c] = LPR_GLYPH_OTHER;
+        table->alt[c] = -1;
+    }
+
+    /* First look-alike present in the dictionary wins */
+    for (size_t i = 0; i < sizeof(lpr_confusions) / sizeof(lpr_confusions[0]); i++) {
+        int digit = dict_find_ascii(dict, lpr_confusions[i][0]);
+        int letter = dict_find_ascii(dict, lpr_confusions[i][1]);
+        if (digit < 0 || letter < 0)
+            continue;
+        if (table->alt[digit] < 0)
+            table->alt[digit] = letter;
+        if (table->alt[letter] < 0)
+            table->alt[letter] = digit;
+    }
+}
+
+const LprFormatDfa *lpr_format_region(const char *region)
+{
+    if (!strcmp(region, "tw"))
+        return &lpr_dfa_tw;
+    if (!strcmp(region, "us"))
+        return &lpr_dfa_us;
+    return NULL;
+}
+
+bool lpr_format_match(const LprFormatDfa *dfa, const LprGlyphTable *table,
+                      LprPlate *plate)
+{
+    const unsigned char none = 0xff;
+    unsigned char cost[LPR_FORMAT_MAX_STATES];
+    unsigned char next_cost[LPR_FORMAT_MAX_STATES];
+    unsigned char from[LPR_MAX_PLATE_LEN][LPR_FORMAT_MAX_STATES];
+    bool swapped[LPR_MAX_PLATE_LEN][LPR_FORMAT_MAX_STATES];
+    unsigned int num_states = dfa->num_states;
+
+    memset(cost, none, num_states);
+    cost[1] = 0;
+
+    /* Fewest-swaps path through the DFA, one step per character */
+    for (unsigned int i = 0; i < plate->length; i++) {
+        int c = plate->chars[i];
+        int alt = table->alt[c];
+        bool alive = false;
+
+        memset(next_cost, none, num_states);
+        for (unsigned int s = 1; s < num_states; s++) {
+            if (cost[s] == none)
+                continue;
+
+            unsigned int ns = dfa->next[s][table->cls[c]];
+            if (ns && cost[s] < next_cost[ns]) {
+                next_cost[ns] = cost[s];
+                from[i][ns] = s;
+                swapped[i][ns] = false;
+                alive = true;
+            }
+            if (alt < 0 || cost[s] >= LPR_FORMAT_MAX_REPAIRS)
+                continue;
+            ns = dfa->next[s][table->cls[alt]];
+            if (ns && cost[s] + 1 < next_cost[ns]) {
+                next_cost[ns] = cost[s] + 1;
+                from[i][ns] = s;
+                swapped[i][ns] = true;
+                alive = true;
+            }
+        }
+        if (!alive)
+            return false;
+        memcpy(cost, next_cost, num_states);
+    }
+
+    unsigned int best = 0;
+    for (unsigned int s = 1; s < num_states; s++) {
+        if (dfa->accept[s] && cost[s] != none && (best == 0 || cost[s] < cost[best]))
+            best = s;
+    }
+    if (best == 0)
+        return false;
+
+    for (unsigned int i = plate->length; i-- > 0; ) {
+        if (swapped[i][best])
+            plate->chars[i] = table->alt[plate->chars[i]];
+        best = from[i][best];
+    }
+
+    return true;
+}
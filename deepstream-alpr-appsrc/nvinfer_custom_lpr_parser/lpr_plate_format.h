@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* Per-region plate formats compiled into DFAs at build time.
+ *
+ * A format is written with one character per plate position:
+ *   'A' letter, '0' digit, '@' non-ASCII glyph (e.g. a province character),
+ *   '?' any glyph, '-' and ' ' are separators and take no position.
+ * All formats of a region are merged into one DFA over the glyph classes,
+ * so validating a plate is one table lookup per character.
+ * Plates that do not match are repaired by swapping OCR-confusable glyphs
+ * (0/D, 8/B, 5/S, ...) where the position class requires it, choosing the
+ * path with the fewest swaps. */
+
+#ifndef __LPR_PLATE_FORMAT_H__
+#define __LPR_PLATE_FORMAT_H__
+
+#include <stddef.h>
+#include "lpr_decoder.h"
+
+#define LPR_FORMAT_MAX_STATES 64
+
+/* Upper bound of glyph swaps when repairing a plate */
+#define LPR_FORMAT_MAX_REPAIRS 2
+
+enum LprGlyphClass
+{
+    LPR_GLYPH_LETTER = 0,
+    LPR_GLYPH_DIGIT = 1,
+    LPR_GLYPH_OTHER = 2,
+    LPR_GLYPH_NUM_CLASSES = 3
+};
+
+/* State 0 rejects, state 1 is the start state */
+typedef struct _LprFormatDfa
+{
+    unsigned char next[LPR_FORMAT_MAX_STATES][LPR_GLYPH_NUM_CLASSES];
+    bool accept[LPR_FORMAT_MAX_STATES];
+    unsigned int num_states;
+} LprFormatDfa;
+
+/* Class and OCR-confusable alternative of every dictionary glyph */
+typedef struct _LprGlyphTable
+{
+    unsigned char cls[LPR_MAX_DICT_SIZE];
+    int alt[LPR_MAX_DICT_SIZE];      /* Dictionary index of the look-alike, -1 if none */
+} LprGlyphTable;
+
+constexpr bool
+lpr_format_class_match(char pattern, unsigned int cls)
+{
+    return pattern == '?' ||
+           (pattern == 'A' && cls == LPR_GLYPH_LETTER) ||
+           (pattern == '0' && cls == LPR_GLYPH_DIGIT) ||
+           (pattern == '@' && cls == LPR_GLYPH_OTHER);
+}
+
+constexpr void
+lpr_format_insert(LprFormatDfa &dfa, const char *pattern, unsigned int state)
+{
+    while (*pattern == '-' || *pattern == ' ')
+        pattern++;
+
+    if (*pattern == '\0') {
+        dfa.accept[state] = true;
+        return;
+    }
+    if (*pattern != 'A' && *pattern != '0' && *pattern != '@' && *pattern != '?')
+        throw "unknown plate format character";
+
+    for (unsigned int cls = 0; cls < LPR_GLYPH_NUM_CLASSES; cls++) {
+        if (!lpr_format_class_match(*pattern, cls))
+            continue;
+        if (dfa.next[state][cls] == 0) {
+            if (dfa.num_states == LPR_FORMAT_MAX_STATES)
+                throw "too many plate format states";
+            dfa.next[state][cls] = dfa.num_states++;
+        }
+        lpr_format_insert(dfa, pattern + 1, dfa.next[state][cls]);
+    }
+}
+
+/* Merge the formats into one DFA. Formats are linear, so inserting them into a
+ * trie over the glyph classes already gives a deterministic automaton. */
+template <size_t N>
+constexpr LprFormatDfa
+lpr_format_compile(const char *const (&formats)[N])
+{
+    LprFormatDfa dfa = {};
+    dfa.num_states = 2;
+    for (size_t i = 0; i < N; i++)
+        lpr_format_insert(dfa, formats[i], 1);
+    return dfa;
+}
+
+/* Build the glyph classes and look-alikes of dict */
+void lpr_glyph_table_init(const LprDict *dict, LprGlyphTable *table);
+
+/* DFA of a region name ("tw", "us"), NULL if unknown */
+const LprFormatDfa *lpr_format_region(const char *region);
+
+/* Validate plate against dfa, repairing up to LPR_FORMAT_MAX_REPAIRS
+ * confusable glyphs in place. Returns false when no repair makes the plate
+ * match. O(length * states), no allocation. */
+bool lpr_format_match(const LprFormatDfa *dfa, const LprGlyphTable *table,
+                      LprPlate *plate);
+
+#endif
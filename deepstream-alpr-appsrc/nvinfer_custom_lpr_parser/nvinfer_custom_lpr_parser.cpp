@@ -1,151 +1,283 @@
-/*
- * Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
- *
- * Permission is hereby granted, free of charge, to any person obtaining a
- * copy of this software and associated documentation files (the "Software"),
- * to deal in the Software without restriction, including without limitation
- * the rights to use, copy, modify, merge, publish, distribute, sublicense,
- * and/or sell copies of the Software, and to permit persons to whom the
- * Software is furnished to do so, subject to the following conditions:
- *
- * The above copyright notice and this permission notice shall be included in
- * all copies or substantial portions of the Software.
- *
- * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
- * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
- * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
- * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
- * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
- * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
- * DEALINGS IN THE SOFTWARE.
- */
-
-#include <string>
-#include <string.h>
-#include <stdio.h>
-#include <iostream>
-#include <vector>
-#include <assert.h>
-#include <locale>
-#include <codecvt>
-#include "nvdsinfer.h"
-#include <fstream>
-
-using namespace std;
-using std::string;
-using std::vector;
-
-static bool dict_ready=false;
-std::vector<string> dict_table;
-
-extern "C"
-{
-
-bool NvDsInferParseCustomNVPlate(std::vector<NvDsInferLayerInfo> const &outputLayersInfo,
-                                 NvDsInferNetworkInfo const &networkInfo, float classifierThreshold,
-                                 std::vector<NvDsInferAttribute> &attrList, std::string &attrString)
-{   
-    int *outputStrBuffer = NULL;
-    float *outputConfBuffer = NULL;
-    NvDsInferAttribute LPR_attr;
-   
-    int seq_len = 0; 
-
-    // Get list
-    vector<int> str_idxes;
-    int prev = 100;
-
-    // For confidence
-    double bank_softmax_max[16] = {0.0};
-    unsigned int valid_bank_count = 0;
-    bool do_softmax = false;
-    ifstream fdict;
-
-    setlocale(LC_CTYPE, "");
-
-    if(!dict_ready) {
-        fdict.open("dict.txt");
-        if(!fdict.is_open())
-        {
-            cout << "open dictionary file failed." << endl;
-	        return false;
-        }
-	    while(!fdict.eof()) {
-	        string strLineAnsi;
-	        if ( getline(fdict, strLineAnsi) ) {
-	            dict_table.push_back(strLineAnsi);
-	        }
-        }
-        dict_ready=true;
-        fdict.close();
-    }
-
-    int layer_size = outputLayersInfo.size();
-
-    LPR_attr.attributeConfidence = 1.0;
-
-    seq_len = networkInfo.width/4;
-
-    for( int li=0; li<layer_size; li++) {
-        if(!outputLayersInfo[li].isInput) {
-            if (outputLayersInfo[li].dataType == 0) {
-                if (!outputConfBuffer)
-                    outputConfBuffer = static_cast<float *>(outputLayersInfo[li].buffer);
-            }
-            else if (outputLayersInfo[li].dataType == 3) {
-                if(!outputStrBuffer)
-                    outputStrBuffer = static_cast<int *>(outputLayersInfo[li].buffer);
-            }
-        }
-    }
- 
-    for(int seq_id = 0; seq_id < seq_len; seq_id++) {
-       do_softmax = false;
-
-       int curr_data = outputStrBuffer[seq_id];
-           if(curr_data < 0 || curr_data > static_cast<int>(dict_table.size())){
-                   continue;
-           }
-       if (seq_id == 0) {
-           prev = curr_data;
-           str_idxes.push_back(curr_data);
-           if ( curr_data != static_cast<int>(dict_table.size()) ) do_softmax = true;
-       } else {
-           if (curr_data != prev) {
-               str_idxes.push_back(curr_data);
-               if (static_cast<unsigned long>(curr_data) != dict_table.size()) do_softmax = true;
-           }
-           prev = curr_data;
-       }
-
-       // Do softmax
-       if (do_softmax) {
-           do_softmax = false;
-           bank_softmax_max[valid_bank_count] = outputConfBuffer[seq_id];
-           valid_bank_count++;
-       }
-    }
-
-    attrString = "";
-    for(unsigned int id = 0; id < str_idxes.size(); id++) {
-        if (static_cast<unsigned int>(str_idxes[id]) != dict_table.size()) {
-            attrString += dict_table[str_idxes[id]];
-        }
-    }
-
-    //Ignore the short string, it may be wrong plate string
-    if (valid_bank_count >=  3) {
-
-        LPR_attr.attributeIndex = 0;
-        LPR_attr.attributeValue = 1;
-        LPR_attr.attributeLabel = strdup(attrString.c_str());
-        for (unsigned int count = 0; count < valid_bank_count; count++) {
-            LPR_attr.attributeConfidence *= bank_softmax_max[count];
-        }
-        attrList.push_back(LPR_attr);
-    }
-
-    return true;
-}
-
-}//end of extern "C"
+/*
+ * Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <string>
+#include <string.h>
+#include <math.h>
+#include <stdio.h>
+#include <iostream>
+#include <vector>
+#include <assert.h>
+#include <locale>
+#include <mutex>
+#include <dlfcn.h>
+#include <libgen.h>
+#include <limits.h>
+#include <stdlib.h>
+#include "nvdsinfer.h"
+#include "lpr_decoder.h"
+#include "lpr_plate_format.h"
+#include "lpr_char_meta.h"
+
+using namespace std;
+using std::string;
+using std::vector;
+
+/* Output layer names of the TAO LPRNet deployable model */
+#define LPR_INDEX_LAYER_NAME "tf_op_layer_ArgMax"
+#define LPR_CONF_LAYER_NAME "tf_op_layer_Max"
+
+/* Environment variables overriding the parser defaults */
+#define LPR_DICT_PATH_ENV "LPR_DICT_PATH"
+#define LPR_OUTPUT_LOGITS_ENV "LPR_OUTPUT_LOGITS"
+#define LPR_BEAM_WIDTH_ENV "LPR_BEAM_WIDTH"
+#define LPR_PLATE_PATTERN_ENV "LPR_PLATE_PATTERN"
+#define LPR_PLATE_REGION_ENV "LPR_PLATE_REGION"
+
+/* Output layers of one network, resolved on the first call for it */
+typedef struct _LprLayerBinding
+{
+    const char *key;         /* Name of the first output layer, identifies the network */
+    size_t num_layers;
+    int str_layer;           /* int32 [seq_len] argmax layer */
+    int conf_layer;          /* float [seq_len] max-confidence layer */
+    int raw_layer;           /* float [seq_len x num_classes] score layer */
+} LprLayerBinding;
+
+static LprDict lpr_dict;
+static bool lpr_dict_ready = false;
+static bool lpr_raw_logits = false;
+static unsigned int lpr_beam_width = 0;
+static bool lpr_char_attr = false;
+static LprGrammar lpr_grammar;
+static const LprGrammar *lpr_plate_grammar = NULL;
+static LprGlyphTable lpr_glyph_table;
+static const LprFormatDfa *lpr_plate_dfa = NULL;
+static std::once_flag lpr_init_once;
+
+/* Each nvinfer instance parses on its own output thread */
+static thread_local LprLayerBinding lpr_binding = { NULL, 0, -1, -1, -1 };
+
+static void
+lpr_parser_load()
+{
+    const char *env_path = getenv(LPR_DICT_PATH_ENV);
+    const char *env_logits = getenv(LPR_OUTPUT_LOGITS_ENV);
+    const char *env_char_attr = getenv(LPR_CHAR_ATTR_ENV);
+    char lib_dict_path[PATH_MAX] = {0};
+    Dl_info lib_info;
+
+    setlocale(LC_CTYPE, "");
+    lpr_raw_logits = env_logits && atoi(env_logits);
+    lpr_char_attr = env_char_attr && atoi(env_char_attr);
+
+    if (env_path) {
+        lpr_dict_ready = lpr_dict_load(env_path, &lpr_dict);
+        if (!lpr_dict_ready)
+            fprintf(stderr, "open dictionary file %s failed.\n", env_path);
+    }
+    else {
+        // dict.txt in the working directory, then next to the parser library's parent directory
+        lpr_dict_ready = lpr_dict_load("dict.txt", &lpr_dict);
+    }
+    if (!env_path && !lpr_dict_ready && dladdr((void *)&lpr_parser_load, &lib_info) && lib_info.dli_fname) {
+        char lib_path[PATH_MAX];
+        strncpy(lib_path, lib_info.dli_fname, sizeof(lib_path) - 1);
+        lib_path[sizeof(lib_path) - 1] = '\0';
+        snprintf(lib_dict_path, sizeof(lib_dict_path), "%s/../dict.txt", dirname(lib_path));
+        lpr_dict_ready = lpr_dict_load(lib_dict_path, &lpr_dict);
+    }
+    if (!lpr_dict_ready) {
+        fprintf(stderr, "open dictionary file failed, set " LPR_DICT_PATH_ENV
+                " to the absolute path of dict.txt.\n");
+        return;
+    }
+
+    // Beam search needs the raw score layer, the argmax layout is always greedy.
+    // It costs several times the greedy decode, so only an explicit width enables it.
+    const char *env_beam = getenv(LPR_BEAM_WIDTH_ENV);
+    const char *env_pattern = getenv(LPR_PLATE_PATTERN_ENV);
+    if (env_beam)
+        lpr_beam_width = atoi(env_beam);
+    if (env_pattern && *env_pattern) {
+        if (lpr_beam_width < 2)
+            fprintf(stderr, "plate pattern %s needs " LPR_BEAM_WIDTH_ENV
+                    " >= 2, decoding unconstrained.\n", env_pattern);
+        else if (lpr_grammar_compile(env_pattern, &lpr_dict, &lpr_grammar))
+            lpr_plate_grammar = &lpr_grammar;
+        else
+            fprintf(stderr, "invalid plate pattern %s, decoding unconstrained.\n", env_pattern);
+    }
+
+    // Plates outside the region formats are repaired or dropped before any label exists
+    const char *env_region = getenv(LPR_PLATE_REGION_ENV);
+    if (env_region && *env_region) {
+        lpr_plate_dfa = lpr_format_region(env_region);
+        if (lpr_plate_dfa)
+            lpr_glyph_table_init(&lpr_dict, &lpr_glyph_table);
+        else
+            fprintf(stderr, "unknown plate region %s, plates are not validated.\n", env_region);
+    }
+}
+
+/* Load the dictionary when nvinfer opens the library, so a missing file is
+ * reported at startup rather than on the first plate. */
+__attribute__((constructor)) static void
+lpr_parser_init()
+{
+    std::call_once(lpr_init_once, lpr_parser_load);
+}
+
+static void
+lpr_bind_layers(std::vector<NvDsInferLayerInfo> const &outputLayersInfo)
+{
+    LprLayerBinding binding = { outputLayersInfo[0].layerName, outputLayersInfo.size(), -1, -1, -1 };
+    int layer_size = outputLayersInfo.size();
+
+    for (int li = 0; li < layer_size; li++) {
+        const NvDsInferLayerInfo &layer = outputLayersInfo[li];
+        if (layer.isInput || !layer.layerName)
+            continue;
+        if (!strcmp(layer.layerName, LPR_INDEX_LAYER_NAME))
+            binding.str_layer = li;
+        else if (!strcmp(layer.layerName, LPR_CONF_LAYER_NAME))
+            binding.conf_layer = li;
+    }
+
+    // Models with other layer names are bound by type and shape
+    for (int li = 0; li < layer_size; li++) {
+        const NvDsInferLayerInfo &layer = outputLayersInfo[li];
+        if (layer.isInput || li == binding.str_layer || li == binding.conf_layer)
+            continue;
+        if (layer.dataType == FLOAT) {
+            if (layer.inferDims.numDims >= 2) {
+                if (binding.raw_layer < 0)
+                    binding.raw_layer = li;
+            }
+            else if (binding.conf_layer < 0)
+                binding.conf_layer = li;
+        }
+        else if (layer.dataType == INT32) {
+            if (binding.str_layer < 0)
+                binding.str_layer = li;
+        }
+    }
+
+    lpr_binding = binding;
+}
+
+extern "C"
+{
+
+bool NvDsInferParseCustomNVPlate(std::vector<NvDsInferLayerInfo> const &outputLayersInfo,
+                                 NvDsInferNetworkInfo const &networkInfo, float classifierThreshold,
+                                 std::vector<NvDsInferAttribute> &attrList, std::string &attrString)
+{   
+    NvDsInferAttribute LPR_attr;
+    LprPlate plate;
+    unsigned int seq_len = 0; 
+
+    std::call_once(lpr_init_once, lpr_parser_load);
+    if (!lpr_dict_ready || outputLayersInfo.empty())
+        return false;
+
+    if (lpr_binding.key != outputLayersInfo[0].layerName ||
+        lpr_binding.num_layers != outputLayersInfo.size())
+        lpr_bind_layers(outputLayersInfo);
+
+    int blank = static_cast<int>(lpr_dict.size);
+
+    if (lpr_binding.str_layer >= 0 && lpr_binding.conf_layer >= 0) {
+        // Wider models are read up to the layer size, not past it
+        seq_len = outputLayersInfo[lpr_binding.str_layer].inferDims.numElements;
+        if (seq_len == 0)
+            seq_len = networkInfo.width/4;
+
+        lpr_decode_argmax_batch(
+            static_cast<const int *>(outputLayersInfo[lpr_binding.str_layer].buffer),
+            static_cast<const float *>(outputLayersInfo[lpr_binding.conf_layer].buffer),
+            1, seq_len, blank, &plate);
+    }
+    else if (lpr_binding.raw_layer >= 0) {
+        // [seq_len x num_classes] scores, one row per timestep
+        const NvDsInferLayerInfo &rawLayer = outputLayersInfo[lpr_binding.raw_layer];
+        seq_len = rawLayer.inferDims.d[0];
+        if (seq_len == 0)
+            return false;
+        unsigned int num_classes = rawLayer.inferDims.numElements / seq_len;
+        if (lpr_beam_width > 1)
+            lpr_beam_search(static_cast<const float *>(rawLayer.buffer), seq_len,
+                            num_classes, lpr_raw_logits, blank, lpr_beam_width,
+                            lpr_plate_grammar, &plate);
+        else
+            lpr_decode_raw_batch(static_cast<const float *>(rawLayer.buffer), 1,
+                                 seq_len, num_classes, lpr_raw_logits, blank, &plate);
+    }
+    else {
+        return false;
+    }
+
+    if (lpr_plate_dfa && !lpr_format_match(lpr_plate_dfa, &lpr_glyph_table, &plate))
+        plate.length = 0;
+
+    // One sized copy into the label nvinfer takes ownership of, nothing else allocates
+    char label[LPR_MAX_LABEL_LEN + 1];
+    unsigned int label_len = lpr_plate_label(&lpr_dict, &plate, label);
+    attrString.assign(label, label_len);
+
+    //Ignore the short string, it may be wrong plate string
+    if (plate.length >=  3) {
+
+        LPR_attr.attributeIndex = LPR_PLATE_ATTR_INDEX;
+        LPR_attr.attributeValue = 1;
+        LPR_attr.attributeLabel = static_cast<char *>(malloc(label_len + 1));
+        if (!LPR_attr.attributeLabel)
+            return false;
+        memcpy(LPR_attr.attributeLabel, label, label_len + 1);
+        // Summed in the log domain, the product underflows on long plates
+        LPR_attr.attributeConfidence = expf(plate.log_conf);
+        attrList.push_back(LPR_attr);
+
+        // Per-character confidences and timesteps for voting downstream, when asked for
+        if (!lpr_char_attr)
+            return true;
+        unsigned int num_chars = std::min(plate.length, (unsigned int)LPR_CHAR_META_MAX_LEN);
+        NvDsInferAttribute char_attr;
+        char_attr.attributeIndex = LPR_CHAR_ATTR_INDEX;
+        char_attr.attributeValue = num_chars;
+        char_attr.attributeConfidence = plate.log_conf;
+        char_attr.attributeLabel = static_cast<char *>(malloc(num_chars * 2 + 1));
+        if (!char_attr.attributeLabel)
+            return true;
+        for (unsigned int i = 0; i < num_chars; i++) {
+            char_attr.attributeLabel[i * 2] = LPR_CHAR_CONF_PACK(plate.confs[i]);
+            char_attr.attributeLabel[i * 2 + 1] = LPR_CHAR_STEP_PACK(plate.steps[i]);
+        }
+        char_attr.attributeLabel[num_chars * 2] = '\0';
+        attrList.push_back(char_attr);
+    }
+
+    return true;
+}
+
+}//end of extern "C"
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* The subset of the DeepStream nvdsinfer.h types the LPR parser uses, with
+ * the same layout, so the parser builds into the CPU-only bench and test.
+ * The library itself is built against the DeepStream header. */
+
+#ifndef __NVDSINFER_H__
+#define __NVDSINFER_H__
+
+#define NVDSINFER_MAX_DIMS 8
+
+typedef enum
+{
+    FLOAT = 0,
+    HALF = 1,
+    INT8 = 2,
+    INT32 = 3
+} NvDsInferDataType;
+
+typedef struct
+{
+    unsigned int numDims;
+    unsigned int d[NVDSINFER_MAX_DIMS];
+    unsigned int numElements;
+} NvDsInferDims;
+
+typedef struct
+{
+    NvDsInferDataType dataType;
+    NvDsInferDims inferDims;
+    int bindingIndex;
+    const char *layerName;
+    void *buffer;
+    int isInput;
+} NvDsInferLayerInfo;
+
+typedef struct
+{
+    unsigned int width;
+    unsigned int height;
+    unsigned int channels;
+} NvDsInferNetworkInfo;
+
+typedef struct
+{
+    unsigned int attributeIndex;
+    unsigned int attributeValue;
+    float attributeConfidence;
+    char *attributeLabel;
+} NvDsInferAttribute;
+
+#endif
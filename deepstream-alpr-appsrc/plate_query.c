@@ -0,0 +1,339 @@
+/*
+ * Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* Search the plate store of the app, and measure how fast it answers.
+ *
+ * With -d the store directory is indexed by this process, with -S the
+ * queries go to the socket of a running app (result_store_socket). Hits are
+ * printed as CSV, the newest first:
+ *
+ *   time, distance, plate, track id, source, pts, confidence,
+ *   color class, prob, make class, prob, type class, prob
+ *
+ *   $ ./plate-query -d plates -k 1 -t 86400 ABC1234
+ *
+ * With -B a new store of synthetic reads is written to the directory and
+ * indexed again, then random queries at distance 0, 1 and 2 are timed:
+ *
+ *   $ make query QUERY_ARGS="-B 20000000 -d /tmp/plate-bench"
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "plate_store.h"
+
+#define QUERY_ALPHABET "0123456789ABCDEFGHJKLMNPQRSTUVWXYZ"
+
+typedef struct _QueryConfig
+{
+  const gchar *dir;
+  const gchar *socket_path;
+  guint distance;
+  gint64 seconds;               /* 0 = all */
+  guint limit;
+  guint64 bench_reads;          /* 0 = no benchmark */
+  guint bench_plates;
+  guint bench_queries;
+} QueryConfig;
+
+static guint64 rng_state = 0x9e3779b97f4a7c15ull;
+
+static guint32
+rng_next (void)
+{
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return rng_state >> 32;
+}
+
+static void
+random_plate (gchar * plate)
+{
+  guint len = 6 + rng_next () % 2;
+
+  for (guint i = 0; i < len; i++)
+    plate[i] = QUERY_ALPHABET[rng_next () % (sizeof (QUERY_ALPHABET) - 1)];
+  plate[len] = '\0';
+}
+
+static gint
+compare_latency (gconstpointer a, gconstpointer b)
+{
+  gint64 la = *(const gint64 *) a, lb = *(const gint64 *) b;
+  return la < lb ? -1 : la > lb;
+}
+
+static gboolean
+bench_write (const QueryConfig * cfg, gchar (*plates)[RESULT_PLATE_LEN])
+{
+  PlateStoreConfig store_config = { cfg->dir, 64 << 20, FALSE };
+  ResultRecord batch[256];
+  PlateStoreStats stats;
+  PlateStore *store = plate_store_open (&store_config);
+
+  if (!store)
+    return FALSE;
+  plate_store_get_stats (store, &stats);
+  if (stats.records) {
+    g_printerr ("%s already holds %lu results, use an empty directory\n",
+        cfg->dir, (unsigned long) stats.records);
+    plate_store_close (store);
+    return FALSE;
+  }
+
+  memset (batch, 0, sizeof (batch));
+  gint64 start = g_get_monotonic_time ();
+  for (guint64 i = 0; i < cfg->bench_reads; i += G_N_ELEMENTS (batch)) {
+    guint count = MIN (G_N_ELEMENTS (batch), cfg->bench_reads - i);
+    for (guint j = 0; j < count; j++) {
+      ResultRecord *r = &batch[j];
+      r->pts = (i + j) * 33333333ull;
+      r->track_id = (i + j) / 8;
+      r->source_id = (i + j) % 4;
+      r->lpr_confidence = 0.5f + (rng_next () % 50) / 100.0f;
+      r->ocr_confidence = 0.5f + (rng_next () % 50) / 100.0f;
+      r->color_class = r->make_class = r->type_class = -1;
+      strcpy (r->plate, plates[rng_next () % cfg->bench_plates]);
+    }
+    plate_store_append (store, batch, count);
+  }
+  gint64 elapsed = g_get_monotonic_time () - start;
+  plate_store_get_stats (store, &stats);
+  plate_store_close (store);
+
+  g_print ("append: %lu reads in %.2f s, %.0f reads/s, %u segments\n",
+      (unsigned long) stats.records, elapsed / 1e6,
+      stats.records / (elapsed / 1e6), stats.segments);
+  return stats.failed == 0;
+}
+
+static int
+bench (const QueryConfig * cfg)
+{
+  PlateStoreConfig store_config = { cfg->dir, 0, TRUE };
+  gchar (*plates)[RESULT_PLATE_LEN] = g_malloc ((gsize) RESULT_PLATE_LEN *
+      cfg->bench_plates);
+  gint64 *latency = g_new (gint64, cfg->bench_queries);
+  PlateStoreHit *hits = g_new (PlateStoreHit, cfg->limit);
+  PlateStoreStats stats;
+  int ret = -1;
+
+  for (guint i = 0; i < cfg->bench_plates; i++)
+    random_plate (plates[i]);
+  if (!bench_write (cfg, plates))
+    goto done;
+
+  gint64 start = g_get_monotonic_time ();
+  PlateStore *store = plate_store_open (&store_config);
+  if (!store)
+    goto done;
+  plate_store_get_stats (store, &stats);
+  g_print ("index: %lu reads, %u plates rebuilt in %.2f s\n",
+      (unsigned long) stats.records, stats.plates,
+      (g_get_monotonic_time () - start) / 1e6);
+
+  for (guint distance = 0; distance <= PLATE_STORE_MAX_DISTANCE; distance++) {
+    guint64 matched = 0;
+    gint64 sum = 0;
+    for (guint i = 0; i < cfg->bench_queries; i++) {
+      gchar plate[RESULT_PLATE_LEN];
+      PlateStoreQuery query = { plate, distance, 0, cfg->limit };
+      guint total;
+      /* A stored plate misread in distance places */
+      strcpy (plate, plates[rng_next () % cfg->bench_plates]);
+      for (guint d = 0; d < distance; d++)
+        plate[rng_next () % strlen (plate)] =
+            QUERY_ALPHABET[rng_next () % (sizeof (QUERY_ALPHABET) - 1)];
+      start = g_get_monotonic_time ();
+      plate_store_query (store, &query, hits, &total);
+      latency[i] = g_get_monotonic_time () - start;
+      sum += latency[i];
+      matched += total;
+    }
+    qsort (latency, cfg->bench_queries, sizeof (gint64), compare_latency);
+    g_print ("distance %u: %u queries, mean %.3f ms, p50 %.3f ms, p99 %.3f ms, "
+        "max %.3f ms, %.1f hits\n", distance, cfg->bench_queries,
+        sum / 1000.0 / cfg->bench_queries,
+        latency[cfg->bench_queries / 2] / 1000.0,
+        latency[cfg->bench_queries * 99 / 100] / 1000.0,
+        latency[cfg->bench_queries - 1] / 1000.0,
+        (gdouble) matched / cfg->bench_queries);
+  }
+  plate_store_close (store);
+  ret = 0;
+
+done:
+  g_free (plates);
+  g_free (latency);
+  g_free (hits);
+  return ret;
+}
+
+static int
+query_dir (const QueryConfig * cfg, gchar ** plates, guint count)
+{
+  PlateStoreConfig store_config = { cfg->dir, 0, TRUE };
+  PlateStoreHit *hits = g_new (PlateStoreHit, MAX (cfg->limit, 1));
+  GString *out = g_string_new (NULL);
+  PlateStoreStats stats;
+  gint64 start = g_get_monotonic_time ();
+  PlateStore *store = plate_store_open (&store_config);
+
+  if (!store) {
+    g_free (hits);
+    g_string_free (out, TRUE);
+    return -1;
+  }
+  plate_store_get_stats (store, &stats);
+  g_printerr ("%s: %lu results, %u plates, %u segments, %lu corrupt, "
+      "indexed in %.0f ms\n", cfg->dir, (unsigned long) stats.records,
+      stats.plates, stats.segments, (unsigned long) stats.corrupt,
+      (g_get_monotonic_time () - start) / 1000.0);
+
+  for (guint i = 0; i < count; i++) {
+    PlateStoreQuery query = { plates[i], cfg->distance,
+      cfg->seconds ? g_get_real_time () - cfg->seconds * G_USEC_PER_SEC : 0,
+      cfg->limit
+    };
+    guint total, filled;
+    start = g_get_monotonic_time ();
+    filled = plate_store_query (store, &query, hits, &total);
+    gint64 elapsed = g_get_monotonic_time () - start;
+    g_string_truncate (out, 0);
+    for (guint j = 0; j < filled; j++)
+      plate_store_format_hit (&hits[j], out);
+    g_string_append_printf (out, "# %u of %u hits in %.3f ms\n", filled, total,
+        elapsed / 1000.0);
+    fputs (out->str, stdout);
+  }
+  plate_store_close (store);
+  g_free (hits);
+  g_string_free (out, TRUE);
+  return 0;
+}
+
+static int
+query_socket (const QueryConfig * cfg, gchar ** plates, guint count)
+{
+  struct sockaddr_un addr = {.sun_family = AF_UNIX };
+  gint sock;
+  FILE *in;
+  gchar line[4096];
+
+  if (strlen (cfg->socket_path) >= sizeof (addr.sun_path))
+    return -1;
+  strcpy (addr.sun_path, cfg->socket_path);
+  sock = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock < 0 || connect (sock, (struct sockaddr *) &addr, sizeof (addr)) != 0) {
+    g_printerr ("Failed to connect to %s: %s\n", cfg->socket_path,
+        strerror (errno));
+    if (sock >= 0)
+      close (sock);
+    return -1;
+  }
+  in = fdopen (dup (sock), "r");
+
+  for (guint i = 0; i < count && in; i++) {
+    gchar *request = g_strdup_printf ("%s %u %" G_GINT64_FORMAT " %u\n",
+        plates[i], cfg->distance, cfg->seconds, cfg->limit);
+    gboolean sent = write (sock, request, strlen (request)) ==
+        (ssize_t) strlen (request);
+    g_free (request);
+    if (!sent)
+      break;
+    /* The answer ends with its summary line */
+    while (fgets (line, sizeof (line), in)) {
+      fputs (line, stdout);
+      if (line[0] == '#')
+        break;
+    }
+  }
+  if (in)
+    fclose (in);
+  close (sock);
+  return 0;
+}
+
+static void
+usage (const gchar * prog)
+{
+  g_printerr ("Usage: %s (-d store_dir | -S socket) [-k distance] [-t seconds]\n"
+      "          [-n limit] plate...\n"
+      "       %s -B reads [-P plates] [-q queries] [-n limit] -d new_store_dir\n"
+      "  -k  edit distance, 0 to %d, default 0\n"
+      "  -t  only results of the last seconds, default all\n"
+      "  -n  hits per plate, the newest first, default 100\n"
+      "  -B  benchmark: write reads of -P distinct plates (default reads / 10),\n"
+      "      index them and time -q queries (default 1000) per distance\n",
+      prog, prog, PLATE_STORE_MAX_DISTANCE);
+}
+
+int
+main (int argc, char *argv[])
+{
+  QueryConfig cfg = { NULL, NULL, 0, 0, 100, 0, 0, 1000 };
+  gint opt;
+
+  while ((opt = getopt (argc, argv, "d:S:k:t:n:B:P:q:h")) != -1) {
+    switch (opt) {
+      case 'd': cfg.dir = optarg; break;
+      case 'S': cfg.socket_path = optarg; break;
+      case 'k': cfg.distance = atoi (optarg); break;
+      case 't': cfg.seconds = strtoll (optarg, NULL, 10); break;
+      case 'n': cfg.limit = atoi (optarg); break;
+      case 'B': cfg.bench_reads = strtoull (optarg, NULL, 10); break;
+      case 'P': cfg.bench_plates = atoi (optarg); break;
+      case 'q': cfg.bench_queries = atoi (optarg); break;
+      default: usage (argv[0]); return -1;
+    }
+  }
+  if (cfg.distance > PLATE_STORE_MAX_DISTANCE || cfg.limit == 0) {
+    usage (argv[0]);
+    return -1;
+  }
+
+  if (cfg.bench_reads) {
+    if (!cfg.dir || cfg.bench_queries == 0) {
+      usage (argv[0]);
+      return -1;
+    }
+    if (cfg.bench_plates == 0)
+      cfg.bench_plates = MAX (cfg.bench_reads / 10, 1);
+    return bench (&cfg);
+  }
+
+  if (optind == argc || !cfg.dir == !cfg.socket_path) {
+    usage (argv[0]);
+    return -1;
+  }
+  if (cfg.dir)
+    return query_dir (&cfg, argv + optind, argc - optind);
+  return query_socket (&cfg, argv + optind, argc - optind);
+}
@@ -0,0 +1,849 @@
+/*
+ * Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "plate_store.h"
+
+#define STORE_MAGIC "ALPRPLT1"
+#define STORE_SUFFIX ".plates"
+
+/* Records read per read() when a segment is indexed */
+#define STORE_READ_BATCH 4096
+
+/* Records converted per write() when appending */
+#define STORE_APPEND_BATCH 256
+
+/* Bigrams are taken over the plate between these two bytes */
+#define STORE_PAD_START 0x02
+#define STORE_PAD_END 0x03
+#define STORE_MAX_GRAMS (RESULT_PLATE_LEN + 1)
+
+/* Hits answered on the socket at most, and without a limit */
+#define STORE_SERVE_MAX_HITS 10000
+#define STORE_SERVE_DEFAULT_HITS 100
+#define STORE_SERVE_LINE_MAX 1024
+
+/* How often the server threads check for the store closing */
+#define STORE_POLL_MS 200
+
+/* One result on disk. The header of a segment takes the first slot. */
+typedef struct _StoreRecord
+{
+  gint64 time_us;
+  guint64 pts;
+  gint64 track_id;
+  guint32 source_id;
+  gfloat lpr_confidence;
+  gint32 color_class;
+  gint32 make_class;
+  gint32 type_class;
+  gfloat color_prob;
+  gfloat make_prob;
+  gfloat type_prob;
+  gchar plate[RESULT_PLATE_LEN];
+  gfloat ocr_confidence;        /* 0 in segments written before it existed */
+  guint32 checksum;             /* FNV-1a of everything before it */
+} StoreRecord;
+
+typedef struct _StoreHeader
+{
+  gchar magic[8];
+  guint32 record_size;
+  guint32 reserved;
+  gint64 created_us;
+  guint8 pad[sizeof (StoreRecord) - 24];
+} StoreHeader;
+
+G_STATIC_ASSERT (sizeof (StoreRecord) == 128);
+G_STATIC_ASSERT (sizeof (StoreHeader) == sizeof (StoreRecord));
+
+/* Slot n of a segment is record first + n of the store */
+typedef struct _StoreSegment
+{
+  guint number;
+  gint fd;
+  guint32 first;
+  guint32 slots;
+} StoreSegment;
+
+typedef struct _IdList
+{
+  guint32 *ids;
+  guint32 count;
+  guint32 size;
+} IdList;
+
+typedef struct _PlateEntry
+{
+  IdList records;               /* Ascending, so oldest first */
+  guint len;
+  gchar plate[];
+} PlateEntry;
+
+typedef struct _StoreMatch
+{
+  guint32 id;
+  guint distance;
+} StoreMatch;
+
+struct _PlateStore
+{
+  gchar *dir;
+  guint64 segment_bytes;
+  gboolean read_only;
+
+  /* Held for reading by queries, for writing while the index changes */
+  GRWLock lock;
+  GArray *segments;             /* StoreSegment, the last one is appended to */
+  GPtrArray *plates;            /* PlateEntry by plate id */
+  GHashTable *by_plate;         /* Plate -> PlateEntry */
+  IdList *grams;                /* Plate ids by bigram, 65536 lists */
+  guint32 *times;               /* Stored second of every record */
+  guint32 times_size;
+  guint64 records;
+  guint64 corrupt;
+  guint64 failed;
+
+  StoreRecord *out;
+
+  gchar *socket_path;
+  gint listener;
+  GThread *server;
+  atomic_bool stop;
+};
+
+static guint32
+record_checksum (const StoreRecord * record)
+{
+  const guint8 *p = (const guint8 *) record;
+  guint32 hash = 2166136261u;
+
+  for (gsize i = 0; i < G_STRUCT_OFFSET (StoreRecord, checksum); i++)
+    hash = (hash ^ p[i]) * 16777619u;
+  return hash;
+}
+
+static void
+id_list_push (IdList * list, guint32 id)
+{
+  if (list->count == list->size) {
+    list->size = list->size ? list->size * 2 : 2;
+    list->ids = g_renew (guint32, list->ids, list->size);
+  }
+  list->ids[list->count++] = id;
+}
+
+/* The distinct bigrams of plate padded at both ends */
+static guint
+plate_grams (const gchar * plate, guint len, guint16 * grams)
+{
+  guint count = 0;
+
+  for (guint i = 0; i <= len; i++) {
+    guint8 a = i == 0 ? STORE_PAD_START : (guint8) plate[i - 1];
+    guint8 b = i == len ? STORE_PAD_END : (guint8) plate[i];
+    guint16 gram = (a << 8) | b;
+    guint j;
+    for (j = 0; j < count && grams[j] != gram; j++);
+    if (j == count)
+      grams[count++] = gram;
+  }
+  return count;
+}
+
+/* Levenshtein distance of a and b, or max + 1 once it exceeds max */
+static guint
+edit_distance (const gchar * a, guint la, const gchar * b, guint lb, guint max)
+{
+  guint row[RESULT_PLATE_LEN + 1];
+
+  if ((la > lb ? la - lb : lb - la) > max)
+    return max + 1;
+  for (guint j = 0; j <= lb; j++)
+    row[j] = j;
+  for (guint i = 1; i <= la; i++) {
+    guint diag = row[0];
+    guint best = row[0] = i;
+    for (guint j = 1; j <= lb; j++) {
+      guint up = row[j];
+      guint cost = MIN (MIN (up, row[j - 1]) + 1, diag + (a[i - 1] != b[j - 1]));
+      diag = up;
+      row[j] = cost;
+      best = MIN (best, cost);
+    }
+    if (best > max)
+      return max + 1;
+  }
+  return MIN (row[lb], max + 1);
+}
+
+/* Add record id to the index. Called with the lock held for writing. */
+static void
+index_record (PlateStore * store, guint32 id, const StoreRecord * record)
+{
+  PlateEntry *entry = g_hash_table_lookup (store->by_plate, record->plate);
+
+  if (!entry) {
+    guint16 grams[STORE_MAX_GRAMS];
+    guint len = strlen (record->plate);
+    guint count = plate_grams (record->plate, len, grams);
+
+    entry = g_malloc0 (sizeof (PlateEntry) + len + 1);
+    entry->len = len;
+    memcpy (entry->plate, record->plate, len + 1);
+    for (guint i = 0; i < count; i++)
+      id_list_push (&store->grams[grams[i]], store->plates->len);
+    g_ptr_array_add (store->plates, entry);
+    g_hash_table_insert (store->by_plate, entry->plate, entry);
+  }
+  id_list_push (&entry->records, id);
+  store->times[id] = record->time_us / G_USEC_PER_SEC;
+  store->records++;
+}
+
+/* Make room for the times of records up to id end */
+static void
+reserve_times (PlateStore * store, guint32 end)
+{
+  if (end <= store->times_size)
+    return;
+  guint32 size = MAX (store->times_size, 1024);
+  while (size < end)
+    size *= 2;
+  store->times = g_renew (guint32, store->times, size);
+  memset (store->times + store->times_size, 0,
+      (size - store->times_size) * sizeof (guint32));
+  store->times_size = size;
+}
+
+static gchar *
+segment_path (PlateStore * store, guint number)
+{
+  return g_strdup_printf ("%s/%08u" STORE_SUFFIX, store->dir, number);
+}
+
+static gint
+compare_segments (gconstpointer a, gconstpointer b)
+{
+  guint na = ((const StoreSegment *) a)->number;
+  guint nb = ((const StoreSegment *) b)->number;
+  return na < nb ? -1 : na > nb;
+}
+
+/* Read segment into the index, from slot 1 on */
+static gboolean
+load_segment (PlateStore * store, StoreSegment * segment)
+{
+  StoreHeader header;
+  StoreRecord *batch;
+  ssize_t n;
+
+  if (pread (segment->fd, &header, sizeof (header), 0) != sizeof (header) ||
+      memcmp (header.magic, STORE_MAGIC, sizeof (header.magic)) ||
+      header.record_size != sizeof (StoreRecord)) {
+    g_printerr ("Plate store segment %08u is not a plate store segment\n",
+        segment->number);
+    return FALSE;
+  }
+
+  segment->slots = 0;
+  batch = g_new (StoreRecord, STORE_READ_BATCH);
+  while ((n = pread (segment->fd, batch, STORE_READ_BATCH * sizeof (StoreRecord),
+              (segment->slots + 1) * (off_t) sizeof (StoreRecord))) > 0) {
+    guint count = n / sizeof (StoreRecord);
+    /* A torn record at the end of the segment is not counted as a slot */
+    if (count == 0) {
+      store->corrupt++;
+      break;
+    }
+    reserve_times (store, segment->first + segment->slots + count);
+    for (guint i = 0; i < count; i++) {
+      StoreRecord *record = &batch[i];
+      if (record->checksum != record_checksum (record) ||
+          record->plate[RESULT_PLATE_LEN - 1] != '\0' || !record->plate[0])
+        store->corrupt++;
+      else
+        index_record (store, segment->first + segment->slots + i, record);
+    }
+    segment->slots += count;
+  }
+  g_free (batch);
+  return TRUE;
+}
+
+/* Open the segments of the directory, oldest first, and index them */
+static gboolean
+load_segments (PlateStore * store)
+{
+  GError *error = NULL;
+  GDir *dir = g_dir_open (store->dir, 0, &error);
+  const gchar *name;
+  guint32 first = 0;
+
+  if (!dir) {
+    g_printerr ("Plate store %s could not be opened: %s\n", store->dir,
+        error->message);
+    g_error_free (error);
+    return FALSE;
+  }
+  while ((name = g_dir_read_name (dir))) {
+    StoreSegment segment = { 0 };
+    gchar *end;
+    segment.number = strtoul (name, &end, 10);
+    if (end == name || strcmp (end, STORE_SUFFIX))
+      continue;
+    gchar *path = segment_path (store, segment.number);
+    segment.fd = open (path, O_RDONLY | O_CLOEXEC);
+    g_free (path);
+    if (segment.fd < 0) {
+      g_printerr ("Plate store segment %s could not be opened: %s\n", name,
+          g_strerror (errno));
+      continue;
+    }
+    g_array_append_val (store->segments, segment);
+  }
+  g_dir_close (dir);
+  g_array_sort (store->segments, compare_segments);
+
+  for (guint i = 0; i < store->segments->len; i++) {
+    StoreSegment *segment = &g_array_index (store->segments, StoreSegment, i);
+    segment->first = first;
+    if (!load_segment (store, segment)) {
+      close (segment->fd);
+      g_array_remove_index (store->segments, i--);
+      continue;
+    }
+    first += segment->slots;
+  }
+  return TRUE;
+}
+
+/* Start the segment after the last one. Called with the lock held for
+ * writing, or before the store is shared. */
+static gboolean
+start_segment (PlateStore * store)
+{
+  StoreSegment segment = { 0 };
+  StoreHeader header = { STORE_MAGIC };
+  gchar *path;
+
+  if (store->segments->len) {
+    StoreSegment *last = &g_array_index (store->segments, StoreSegment,
+        store->segments->len - 1);
+    segment.number = last->number + 1;
+    segment.first = last->first + last->slots;
+  }
+  header.record_size = sizeof (StoreRecord);
+  header.created_us = g_get_real_time ();
+
+  path = segment_path (store, segment.number);
+  segment.fd = open (path, O_RDWR | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC,
+      0644);
+  if (segment.fd < 0 || write (segment.fd, &header, sizeof (header)) !=
+      sizeof (header)) {
+    g_printerr ("Plate store segment %s could not be created: %s\n", path,
+        g_strerror (errno));
+    if (segment.fd >= 0) {
+      close (segment.fd);
+      unlink (path);
+    }
+    g_free (path);
+    return FALSE;
+  }
+  g_free (path);
+  g_array_append_val (store->segments, segment);
+  return TRUE;
+}
+
+PlateStore *
+plate_store_open (const PlateStoreConfig * config)
+{
+  PlateStore *store;
+
+  if (!config->read_only && g_mkdir_with_parents (config->dir, 0755) != 0) {
+    g_printerr ("Plate store %s could not be created: %s\n", config->dir,
+        g_strerror (errno));
+    return NULL;
+  }
+
+  store = g_new0 (PlateStore, 1);
+  store->dir = g_strdup (config->dir);
+  store->segment_bytes = MAX (config->segment_bytes, 2 * sizeof (StoreRecord));
+  store->read_only = config->read_only;
+  store->listener = -1;
+  g_rw_lock_init (&store->lock);
+  store->segments = g_array_new (FALSE, FALSE, sizeof (StoreSegment));
+  store->plates = g_ptr_array_new_with_free_func (g_free);
+  store->by_plate = g_hash_table_new (g_str_hash, g_str_equal);
+  store->grams = g_new0 (IdList, 1 << 16);
+  store->out = g_new (StoreRecord, STORE_APPEND_BATCH);
+
+  if (!load_segments (store) || (!store->read_only && !start_segment (store))) {
+    plate_store_close (store);
+    return NULL;
+  }
+  return store;
+}
+
+static gboolean
+write_all (gint fd, const void *data, gsize size)
+{
+  const gchar *p = data;
+
+  while (size > 0) {
+    ssize_t n = write (fd, p, size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return FALSE;
+    p += n;
+    size -= n;
+  }
+  return TRUE;
+}
+
+static void
+append_batch (PlateStore * store, guint count)
+{
+  StoreSegment *segment = &g_array_index (store->segments, StoreSegment,
+      store->segments->len - 1);
+  off_t end = (segment->slots + 1) * (off_t) sizeof (StoreRecord);
+
+  /* Only this thread changes the segment list, so it is read unlocked */
+  if (!write_all (segment->fd, store->out, count * sizeof (StoreRecord))) {
+    g_printerr ("Plate store write failed: %s\n", g_strerror (errno));
+    if (ftruncate (segment->fd, end) != 0)
+      g_printerr ("Plate store segment %08u could not be truncated: %s\n",
+          segment->number, g_strerror (errno));
+    g_rw_lock_writer_lock (&store->lock);
+    store->failed += count;
+    g_rw_lock_writer_unlock (&store->lock);
+    return;
+  }
+
+  g_rw_lock_writer_lock (&store->lock);
+  reserve_times (store, segment->first + segment->slots + count);
+  for (guint i = 0; i < count; i++)
+    index_record (store, segment->first + segment->slots + i, &store->out[i]);
+  segment->slots += count;
+  if ((segment->slots + 1) * (guint64) sizeof (StoreRecord) >=
+      store->segment_bytes) {
+    /* Kept open for the queries */
+    fdatasync (segment->fd);
+    start_segment (store);
+  }
+  g_rw_lock_writer_unlock (&store->lock);
+}
+
+void
+plate_store_append (PlateStore * store, const ResultRecord * records,
+    guint count)
+{
+  gint64 now = g_get_real_time ();
+  guint n = 0;
+
+  if (store->read_only)
+    return;
+
+  for (guint i = 0; i < count; i++) {
+    const ResultRecord *r = &records[i];
+    StoreRecord *out = &store->out[n];
+    if (!r->plate[0])
+      continue;
+    memset (out, 0, sizeof (*out));
+    out->time_us = now;
+    out->pts = r->pts;
+    out->track_id = r->track_id;
+    out->source_id = r->source_id;
+    out->lpr_confidence = r->lpr_confidence;
+    out->ocr_confidence = r->ocr_confidence;
+    out->color_class = r->color_class;
+    out->make_class = r->make_class;
+    out->type_class = r->type_class;
+    out->color_prob = r->color_prob;
+    out->make_prob = r->make_prob;
+    out->type_prob = r->type_prob;
+    g_strlcpy (out->plate, r->plate, RESULT_PLATE_LEN);
+    out->checksum = record_checksum (out);
+    if (++n == STORE_APPEND_BATCH) {
+      append_batch (store, n);
+      n = 0;
+    }
+  }
+  if (n)
+    append_batch (store, n);
+}
+
+/* Add the records of entry stored since since_s to matches */
+static void
+match_entry (PlateStore * store, const PlateEntry * entry, guint distance,
+    guint32 since_s, GArray * matches)
+{
+  guint32 lo = 0, hi = entry->records.count;
+
+  /* Records are stored in time order */
+  while (lo < hi) {
+    guint32 mid = (lo + hi) / 2;
+    if (store->times[entry->records.ids[mid]] < since_s)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  for (guint32 i = lo; i < entry->records.count; i++) {
+    StoreMatch match = { entry->records.ids[i], distance };
+    g_array_append_val (matches, match);
+  }
+}
+
+static void
+match_plate (PlateStore * store, guint32 plate_id, const gchar * plate,
+    guint len, guint max_distance, guint32 since_s, GArray * matches)
+{
+  const PlateEntry *entry = g_ptr_array_index (store->plates, plate_id);
+  guint distance = edit_distance (plate, len, entry->plate, entry->len,
+      max_distance);
+
+  if (distance <= max_distance)
+    match_entry (store, entry, distance, since_s, matches);
+}
+
+static void
+match_fuzzy (PlateStore * store, const gchar * plate, guint len,
+    guint max_distance, guint32 since_s, GArray * matches)
+{
+  guint16 grams[STORE_MAX_GRAMS];
+  guint count = plate_grams (plate, len, grams);
+  gint needed = (gint) count - 2 * (gint) max_distance;
+
+  /* Too short to filter, every plate of a close length is checked */
+  if (needed <= 0) {
+    for (guint32 id = 0; id < store->plates->len; id++)
+      match_plate (store, id, plate, len, max_distance, since_s, matches);
+    return;
+  }
+
+  guint8 *shared = g_malloc0 (store->plates->len);
+  for (guint i = 0; i < count; i++) {
+    const IdList *list = &store->grams[grams[i]];
+    for (guint32 j = 0; j < list->count; j++) {
+      guint32 id = list->ids[j];
+      if (++shared[id] == needed)
+        match_plate (store, id, plate, len, max_distance, since_s, matches);
+    }
+  }
+  g_free (shared);
+}
+
+static gint
+compare_matches (gconstpointer a, gconstpointer b)
+{
+  guint32 ia = ((const StoreMatch *) a)->id;
+  guint32 ib = ((const StoreMatch *) b)->id;
+  return ia > ib ? -1 : ia < ib;
+}
+
+static gboolean
+read_hit (PlateStore * store, const StoreMatch * match, PlateStoreHit * hit)
+{
+  guint lo = 0, hi = store->segments->len;
+  StoreRecord record;
+
+  /* The last segment starting at or before the id */
+  while (hi - lo > 1) {
+    guint mid = (lo + hi) / 2;
+    if (g_array_index (store->segments, StoreSegment, mid).first <= match->id)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  const StoreSegment *segment = &g_array_index (store->segments,
+      StoreSegment, lo);
+  if (pread (segment->fd, &record, sizeof (record),
+          (match->id - segment->first + 1) * (off_t) sizeof (record)) !=
+      sizeof (record))
+    return FALSE;
+
+  memset (hit, 0, sizeof (*hit));
+  hit->time_us = record.time_us;
+  hit->distance = match->distance;
+  hit->record.pts = record.pts;
+  hit->record.track_id = record.track_id;
+  hit->record.source_id = record.source_id;
+  hit->record.lpr_confidence = record.lpr_confidence;
+  hit->record.ocr_confidence = record.ocr_confidence;
+  hit->record.color_class = record.color_class;
+  hit->record.make_class = record.make_class;
+  hit->record.type_class = record.type_class;
+  hit->record.color_prob = record.color_prob;
+  hit->record.make_prob = record.make_prob;
+  hit->record.type_prob = record.type_prob;
+  memcpy (hit->record.plate, record.plate, RESULT_PLATE_LEN);
+  return TRUE;
+}
+
+guint
+plate_store_query (PlateStore * store, const PlateStoreQuery * query,
+    PlateStoreHit * hits, guint * total)
+{
+  guint len = strnlen (query->plate, RESULT_PLATE_LEN);
+  guint max_distance = MIN (query->max_distance, PLATE_STORE_MAX_DISTANCE);
+  guint32 since_s = MAX (query->since_us, 0) / G_USEC_PER_SEC;
+  GArray *matches = g_array_new (FALSE, FALSE, sizeof (StoreMatch));
+  guint filled = 0;
+
+  if (len == RESULT_PLATE_LEN)
+    len--;
+
+  g_rw_lock_reader_lock (&store->lock);
+  if (max_distance == 0) {
+    gchar plate[RESULT_PLATE_LEN];
+    memcpy (plate, query->plate, len);
+    plate[len] = '\0';
+    const PlateEntry *entry = g_hash_table_lookup (store->by_plate, plate);
+    if (entry)
+      match_entry (store, entry, 0, since_s, matches);
+  } else {
+    match_fuzzy (store, query->plate, len, max_distance, since_s, matches);
+  }
+
+  g_array_sort (matches, compare_matches);
+  for (guint i = 0; i < matches->len && filled < query->limit; i++) {
+    if (read_hit (store, &g_array_index (matches, StoreMatch, i),
+            &hits[filled]))
+      filled++;
+  }
+  g_rw_lock_reader_unlock (&store->lock);
+
+  if (total)
+    *total = matches->len;
+  g_array_free (matches, TRUE);
+  return filled;
+}
+
+void
+plate_store_format_hit (const PlateStoreHit * hit, GString * out)
+{
+  const ResultRecord *r = &hit->record;
+  time_t seconds = hit->time_us / G_USEC_PER_SEC;
+  struct tm tm;
+  gchar time_str[32];
+  gint64 pts = r->pts == G_MAXUINT64 ? -1 : (gint64) r->pts;
+
+  gmtime_r (&seconds, &tm);
+  strftime (time_str, sizeof (time_str), "%Y-%m-%dT%H:%M:%S", &tm);
+  g_string_append_printf (out, "%s.%03dZ,%u,%s,%" G_GINT64_FORMAT ",%u,%"
+      G_GINT64_FORMAT ",%f,%d,%f,%d,%f,%d,%f,%f\n", time_str,
+      (gint) (hit->time_us % G_USEC_PER_SEC / 1000), hit->distance, r->plate,
+      r->track_id, r->source_id, pts, r->lpr_confidence, r->color_class,
+      r->color_prob, r->make_class, r->make_prob, r->type_class, r->type_prob,
+      r->ocr_confidence);
+}
+
+/* Answer one request line on fd */
+static void
+serve_request (PlateStore * store, const gchar * line, gint fd, GString * out)
+{
+  gchar plate[RESULT_PLATE_LEN];
+  guint distance = 0, limit = STORE_SERVE_DEFAULT_HITS;
+  gint64 seconds = 0;
+  PlateStoreQuery query = { plate };
+  guint total;
+
+  g_string_truncate (out, 0);
+  if (sscanf (line, "%63s %u %" G_GINT64_FORMAT " %u", plate, &distance,
+          &seconds, &limit) < 1 || distance > PLATE_STORE_MAX_DISTANCE) {
+    g_string_append_printf (out, "# error: expected <plate> [distance 0-%d] "
+        "[seconds back] [limit]\n", PLATE_STORE_MAX_DISTANCE);
+    write_all (fd, out->str, out->len);
+    return;
+  }
+
+  gint64 start = g_get_monotonic_time ();
+  query.max_distance = distance;
+  query.since_us = seconds > 0 ? g_get_real_time () - seconds * G_USEC_PER_SEC : 0;
+  query.limit = MIN (limit, STORE_SERVE_MAX_HITS);
+  PlateStoreHit *hits = g_new (PlateStoreHit, MAX (query.limit, 1));
+  guint filled = plate_store_query (store, &query, hits, &total);
+  gint64 elapsed = g_get_monotonic_time () - start;
+
+  for (guint i = 0; i < filled; i++)
+    plate_store_format_hit (&hits[i], out);
+  g_string_append_printf (out, "# %u of %u hits in %.3f ms\n", filled, total,
+      elapsed / 1000.0);
+  write_all (fd, out->str, out->len);
+  g_free (hits);
+}
+
+static gboolean
+wait_readable (PlateStore * store, gint fd)
+{
+  struct pollfd pfd = {.fd = fd,.events = POLLIN };
+
+  while (!atomic_load (&store->stop)) {
+    if (poll (&pfd, 1, STORE_POLL_MS) > 0)
+      return TRUE;
+  }
+  return FALSE;
+}
+
+static void
+serve_client (PlateStore * store, gint fd)
+{
+  gchar in[STORE_SERVE_LINE_MAX];
+  gsize used = 0;
+  GString *out = g_string_sized_new (4096);
+
+  while (wait_readable (store, fd)) {
+    ssize_t n = read (fd, in + used, sizeof (in) - 1 - used);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    used += n;
+    in[used] = '\0';
+
+    gchar *line = in, *newline;
+    while ((newline = strchr (line, '\n'))) {
+      *newline = '\0';
+      if (*line)
+        serve_request (store, line, fd, out);
+      line = newline + 1;
+    }
+    used -= line - in;
+    memmove (in, line, used);
+    /* A line longer than any request is dropped */
+    if (used == sizeof (in) - 1)
+      used = 0;
+  }
+  g_string_free (out, TRUE);
+}
+
+static gpointer
+serve_thread (gpointer data)
+{
+  PlateStore *store = (PlateStore *) data;
+
+  while (wait_readable (store, store->listener)) {
+    gint fd = accept4 (store->listener, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0)
+      continue;
+    serve_client (store, fd);
+    close (fd);
+  }
+  return NULL;
+}
+
+gboolean
+plate_store_serve (PlateStore * store, const gchar * socket_path)
+{
+  struct sockaddr_un addr = {.sun_family = AF_UNIX };
+
+  if (strlen (socket_path) >= sizeof (addr.sun_path)) {
+    g_printerr ("Plate store socket path %s is too long\n", socket_path);
+    return FALSE;
+  }
+  strcpy (addr.sun_path, socket_path);
+  unlink (socket_path);
+  store->listener = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (store->listener < 0 ||
+      bind (store->listener, (struct sockaddr *) &addr, sizeof (addr)) != 0 ||
+      listen (store->listener, 4) != 0) {
+    g_printerr ("Plate store could not listen on %s: %s\n", socket_path,
+        g_strerror (errno));
+    if (store->listener >= 0)
+      close (store->listener);
+    store->listener = -1;
+    return FALSE;
+  }
+  store->socket_path = g_strdup (socket_path);
+  store->server = g_thread_new ("plate-store", serve_thread, store);
+  return TRUE;
+}
+
+void
+plate_store_get_stats (PlateStore * store, PlateStoreStats * stats)
+{
+  g_rw_lock_reader_lock (&store->lock);
+  stats->records = store->records;
+  stats->plates = store->plates->len;
+  stats->segments = store->segments->len;
+  stats->corrupt = store->corrupt;
+  stats->failed = store->failed;
+  g_rw_lock_reader_unlock (&store->lock);
+}
+
+void
+plate_store_close (PlateStore * store)
+{
+  if (!store)
+    return;
+
+  if (store->server) {
+    atomic_store (&store->stop, TRUE);
+    g_thread_join (store->server);
+  }
+  if (store->listener >= 0) {
+    close (store->listener);
+    unlink (store->socket_path);
+  }
+
+  for (guint i = 0; i < store->segments->len; i++) {
+    StoreSegment *segment = &g_array_index (store->segments, StoreSegment, i);
+    /* A segment this run appended nothing to is not kept */
+    if (!store->read_only && i == store->segments->len - 1) {
+      fdatasync (segment->fd);
+      if (segment->slots == 0) {
+        gchar *path = segment_path (store, segment->number);
+        unlink (path);
+        g_free (path);
+      }
+    }
+    close (segment->fd);
+  }
+  for (guint i = 0; i < 1 << 16; i++)
+    g_free (store->grams[i].ids);
+  for (guint i = 0; i < store->plates->len; i++)
+    g_free (((PlateEntry *) g_ptr_array_index (store->plates, i))->records.ids);
+
+  g_hash_table_destroy (store->by_plate);
+  g_ptr_array_free (store->plates, TRUE);
+  g_array_free (store->segments, TRUE);
+  g_rw_lock_clear (&store->lock);
+  g_free (store->grams);
+  g_free (store->times);
+  g_free (store->out);
+  g_free (store->socket_path);
+  g_free (store->dir);
+  g_free (store);
+}
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* Persistent, searchable plate results.
+ *
+ * Every result with a plate is appended as a fixed-size, checksummed record
+ * to the newest segment file of a directory. A segment grows to
+ * segment_bytes, then a new one is started; records are never rewritten.
+ * In memory the store keeps the records of every distinct plate, in the
+ * order they were stored, and an inverted index of the plates by bigram
+ * (the plate padded at both ends). A query for the plates within edit
+ * distance k of a string counts the bigrams each plate shares with it: a
+ * plate k edits away shares all but at most 2k of its distinct bigrams, so
+ * only plates above that count are checked with a bounded Levenshtein
+ * distance. Opening a store reads all segments back into the index,
+ * skipping torn or corrupt records, so searches survive restarts.
+ *
+ * Plates are compared byte by byte. Records are in host byte order.
+ */
+
+#ifndef __PLATE_STORE_H__
+#define __PLATE_STORE_H__
+
+#include <glib.h>
+#include "result_writer.h"
+
+#define PLATE_STORE_MAX_DISTANCE 2
+
+typedef struct _PlateStoreConfig
+{
+  const gchar *dir;             /* Created if missing */
+  guint64 segment_bytes;        /* Size at which a new segment is started */
+  gboolean read_only;           /* Index the segments, never append */
+} PlateStoreConfig;
+
+typedef struct _PlateStoreQuery
+{
+  const gchar *plate;
+  guint max_distance;           /* 0 = exact, up to PLATE_STORE_MAX_DISTANCE */
+  gint64 since_us;              /* Only results stored from this wall clock
+                                 * time on, 0 = all */
+  guint limit;                  /* Hits returned, the newest first */
+} PlateStoreQuery;
+
+typedef struct _PlateStoreHit
+{
+  gint64 time_us;               /* Wall clock time the result was stored */
+  guint distance;               /* Edit distance of the plate to the query */
+  ResultRecord record;          /* Without the color, make and type labels */
+} PlateStoreHit;
+
+typedef struct _PlateStoreStats
+{
+  guint64 records;              /* Results indexed */
+  guint plates;                 /* Distinct plates */
+  guint segments;
+  guint64 corrupt;              /* Records skipped when the store was opened */
+  guint64 failed;               /* Results that could not be appended */
+} PlateStoreStats;
+
+typedef struct _PlateStore PlateStore;
+
+/* Index the segments in config->dir and, unless read only, start a new
+ * segment to append to. NULL if the directory or segment can not be opened. */
+PlateStore *plate_store_open (const PlateStoreConfig * config);
+
+/* Append the records that have a plate. Only one thread may append at a
+ * time, queries may run meanwhile. */
+void plate_store_append (PlateStore * store, const ResultRecord * records,
+    guint count);
+
+/* Fill hits with up to query->limit results, the newest first. Returns the
+ * number filled; total, if not NULL, is set to the number that matched. */
+guint plate_store_query (PlateStore * store, const PlateStoreQuery * query,
+    PlateStoreHit * hits, guint * total);
+
+/* One CSV line: time (UTC), distance, plate, track id, source, pts,
+ * confidence, color class, prob, make class, prob, type class, prob */
+void plate_store_format_hit (const PlateStoreHit * hit, GString * out);
+
+/* Answer queries on a UNIX stream socket from a thread, one client at a
+ * time. A request is one line, "<plate> [distance] [seconds back] [limit]";
+ * the answer is a line per hit, ended by "# <hits> of <total> hits in <ms> ms". */
+gboolean plate_store_serve (PlateStore * store, const gchar * socket_path);
+
+void plate_store_get_stats (PlateStore * store, PlateStoreStats * stats);
+
+/* Stop serving, sync the open segment and free the index */
+void plate_store_close (PlateStore * store);
+
+#endif
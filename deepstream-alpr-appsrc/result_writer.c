@@ -0,0 +1,490 @@
+/*
+ * Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "result_writer.h"
+#include "plate_store.h"
+
+#define RESULT_CACHE_LINE 64
+
+/* Records formatted per write(), and the output bytes reserved for each */
+#define RESULT_BATCH 256
+#define RESULT_LINE_MAX 2048
+
+/* The writer sleeps this long when the ring is empty, so a trickle of results
+ * still goes out in batches. The producer only wakes it early at half full. */
+#define RESULT_WRITE_INTERVAL_US 10000
+
+/* Wait of a blocked producer before it checks the ring again */
+#define RESULT_BLOCK_WAIT_US 1000
+
+struct _ResultWriter
+{
+  /* Producer side. head is the next slot to fill. */
+  _Alignas (RESULT_CACHE_LINE) atomic_uint_fast64_t head;
+  atomic_uint max_depth;
+  atomic_uint_fast64_t blocked;
+
+  /* Consumer side. tail is the oldest queued record, the producer also
+   * advances it when it drops that record. */
+  _Alignas (RESULT_CACHE_LINE) atomic_uint_fast64_t tail;
+  atomic_uint_fast64_t written;
+  atomic_uint_fast64_t dropped;
+  atomic_uint rotations;
+
+  _Alignas (RESULT_CACHE_LINE) ResultRecord *ring;
+  guint64 mask;
+  ResultFormat format;
+  ResultOverflow overflow;
+  ResultFsync fsync;
+  guint64 rotate_bytes;
+  guint rotate_keep;
+  gchar *path;                  /* NULL for stdout */
+  PlateStore *store;
+  ResultClassLabels color_labels;
+  ResultClassLabels make_labels;
+  ResultClassLabels type_labels;
+
+  /* Only for sleeping and flushing, pushing never takes the lock */
+  GMutex lock;
+  GCond cond;
+  atomic_bool writer_sleeping;
+  atomic_bool producer_waiting;
+  gboolean stop;
+  guint64 flush_requested;
+  guint64 flush_done;
+
+  /* Writer thread state */
+  GThread *thread;
+  int fd;
+  guint64 file_bytes;
+  gchar *out;
+  ResultRecord *batch;
+};
+
+gboolean
+result_format_from_string (const gchar * name, ResultFormat * format)
+{
+  if (!g_strcmp0 (name, "csv"))
+    *format = RESULT_FORMAT_CSV;
+  else if (!g_strcmp0 (name, "jsonl"))
+    *format = RESULT_FORMAT_JSONL;
+  else
+    return FALSE;
+  return TRUE;
+}
+
+gboolean
+result_overflow_from_string (const gchar * name, ResultOverflow * overflow)
+{
+  if (!g_strcmp0 (name, "block"))
+    *overflow = RESULT_OVERFLOW_BLOCK;
+  else if (!g_strcmp0 (name, "drop-oldest"))
+    *overflow = RESULT_OVERFLOW_DROP_OLDEST;
+  else
+    return FALSE;
+  return TRUE;
+}
+
+gboolean
+result_fsync_from_string (const gchar * name, ResultFsync * fsync)
+{
+  if (!g_strcmp0 (name, "none"))
+    *fsync = RESULT_FSYNC_NONE;
+  else if (!g_strcmp0 (name, "rotate"))
+    *fsync = RESULT_FSYNC_ROTATE;
+  else if (!g_strcmp0 (name, "batch"))
+    *fsync = RESULT_FSYNC_BATCH;
+  else
+    return FALSE;
+  return TRUE;
+}
+
+static void
+writer_wake (ResultWriter * writer)
+{
+  g_mutex_lock (&writer->lock);
+  g_cond_broadcast (&writer->cond);
+  g_mutex_unlock (&writer->lock);
+}
+
+void
+result_writer_push (ResultWriter * writer, const ResultRecord * record)
+{
+  guint64 head = atomic_load_explicit (&writer->head, memory_order_relaxed);
+  guint64 tail = atomic_load_explicit (&writer->tail, memory_order_acquire);
+  gboolean waited = FALSE;
+
+  while (head - tail > writer->mask) {
+    if (writer->overflow == RESULT_OVERFLOW_DROP_OLDEST) {
+      /* Fails when the writer took the record meanwhile, tail is reloaded */
+      if (atomic_compare_exchange_weak_explicit (&writer->tail, &tail,
+              tail + 1, memory_order_acq_rel, memory_order_acquire)) {
+        atomic_fetch_add_explicit (&writer->dropped, 1, memory_order_relaxed);
+        tail++;
+      }
+      continue;
+    }
+
+    if (!waited) {
+      atomic_fetch_add_explicit (&writer->blocked, 1, memory_order_relaxed);
+      waited = TRUE;
+    }
+    g_mutex_lock (&writer->lock);
+    atomic_store (&writer->producer_waiting, TRUE);
+    g_cond_broadcast (&writer->cond);
+    g_cond_wait_until (&writer->cond, &writer->lock,
+        g_get_monotonic_time () + RESULT_BLOCK_WAIT_US);
+    atomic_store (&writer->producer_waiting, FALSE);
+    g_mutex_unlock (&writer->lock);
+    tail = atomic_load_explicit (&writer->tail, memory_order_acquire);
+  }
+
+  writer->ring[head & writer->mask] = *record;
+  atomic_store_explicit (&writer->head, head + 1, memory_order_release);
+
+  guint depth = head + 1 - tail;
+  if (depth > atomic_load_explicit (&writer->max_depth, memory_order_relaxed))
+    atomic_store_explicit (&writer->max_depth, depth, memory_order_relaxed);
+  if (depth > writer->mask / 2 && atomic_load (&writer->writer_sleeping))
+    writer_wake (writer);
+}
+
+/* Copy up to RESULT_BATCH records out of the ring. Returns the number of
+ * valid records, which start at batch[*first]. */
+static guint
+writer_take (ResultWriter * writer, guint * first)
+{
+  guint64 tail = atomic_load_explicit (&writer->tail, memory_order_acquire);
+  guint64 head = atomic_load_explicit (&writer->head, memory_order_acquire);
+  guint64 start = tail;
+  guint64 end = MIN (head, tail + RESULT_BATCH);
+
+  for (guint64 i = start; i < end; i++)
+    writer->batch[i - start] = writer->ring[i & writer->mask];
+
+  /* With drop-oldest the producer may have dropped and refilled the first
+   * slots while they were copied. Those copies are torn, only the records at
+   * or after the tail that the exchange succeeds against are kept. */
+  while (tail < end) {
+    if (atomic_compare_exchange_weak_explicit (&writer->tail, &tail, end,
+            memory_order_acq_rel, memory_order_acquire)) {
+      *first = tail - start;
+      return end - tail;
+    }
+  }
+  return 0;
+}
+
+static gchar *
+append_json_string (gchar * out, const gchar * str)
+{
+  *out++ = '"';
+  for (; *str; str++) {
+    guchar c = *str;
+    if (c == '"' || c == '\\') {
+      *out++ = '\\';
+      *out++ = c;
+    } else if (c < 0x20) {
+      out += sprintf (out, "\\u%04x", c);
+    } else {
+      *out++ = c;
+    }
+  }
+  *out++ = '"';
+  return out;
+}
+
+/* Label of class, "" when there is none */
+static const gchar *
+class_label (const ResultClassLabels * labels, gint class)
+{
+  return class >= 0 && (guint) class < labels->count ? labels->names[class] : "";
+}
+
+/* Format one record at out, at most RESULT_LINE_MAX bytes. Returns the end. */
+static gchar *
+format_record (const ResultWriter * writer, const ResultRecord * r,
+    gchar * out)
+{
+  gint64 pts = r->pts == G_MAXUINT64 ? -1 : (gint64) r->pts;
+  const gchar *color = class_label (&writer->color_labels, r->color_class);
+  const gchar *make = class_label (&writer->make_labels, r->make_class);
+  const gchar *type = class_label (&writer->type_labels, r->type_class);
+
+  if (writer->format == RESULT_FORMAT_CSV) {
+    /* The first nine columns are the historical stdout format */
+    return out + sprintf (out,
+        "%" G_GINT64_FORMAT ",%s,%f,%s,%f,%s,%f,%s,%f,%u,%" G_GINT64_FORMAT
+        ",%d,%d,%d,%f\n", r->track_id, r->plate, r->lpr_confidence, color,
+        r->color_prob, make, r->make_prob, type, r->type_prob,
+        r->source_id, pts, r->color_class, r->make_class, r->type_class,
+        r->ocr_confidence);
+  }
+
+  out += sprintf (out, "{\"track_id\":%" G_GINT64_FORMAT ",\"source_id\":%u,"
+      "\"pts\":%" G_GINT64_FORMAT ",\"plate\":", r->track_id, r->source_id,
+      pts);
+  out = append_json_string (out, r->plate);
+  out += sprintf (out, ",\"lpr_confidence\":%f,\"ocr_confidence\":%f,"
+      "\"color\":", r->lpr_confidence, r->ocr_confidence);
+  out = append_json_string (out, color);
+  out += sprintf (out, ",\"color_class\":%d,\"color_prob\":%f,\"make\":",
+      r->color_class, r->color_prob);
+  out = append_json_string (out, make);
+  out += sprintf (out, ",\"make_class\":%d,\"make_prob\":%f,\"type\":",
+      r->make_class, r->make_prob);
+  out = append_json_string (out, type);
+  out += sprintf (out, ",\"type_class\":%d,\"type_prob\":%f}\n",
+      r->type_class, r->type_prob);
+  return out;
+}
+
+static gboolean
+writer_open (ResultWriter * writer)
+{
+  struct stat st;
+
+  if (!writer->path) {
+    writer->fd = STDOUT_FILENO;
+    writer->file_bytes = 0;
+    return TRUE;
+  }
+
+  writer->fd = open (writer->path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+      0644);
+  if (writer->fd < 0) {
+    g_printerr ("Result file %s could not be opened: %s\n", writer->path,
+        g_strerror (errno));
+    return FALSE;
+  }
+  writer->file_bytes = fstat (writer->fd, &st) == 0 ? st.st_size : 0;
+  return TRUE;
+}
+
+static void
+writer_close (ResultWriter * writer)
+{
+  if (writer->fd < 0)
+    return;
+  if (writer->fsync != RESULT_FSYNC_NONE)
+    fdatasync (writer->fd);
+  if (writer->path)
+    close (writer->fd);
+  writer->fd = -1;
+}
+
+/* path.<keep-1> -> path.<keep>, ..., path -> path.1, then a new path */
+static void
+writer_rotate (ResultWriter * writer)
+{
+  writer_close (writer);
+  for (guint i = writer->rotate_keep; i > 0; i--) {
+    gchar *from = i > 1 ? g_strdup_printf ("%s.%u", writer->path, i - 1) :
+        g_strdup (writer->path);
+    gchar *to = g_strdup_printf ("%s.%u", writer->path, i);
+    rename (from, to);
+    g_free (from);
+    g_free (to);
+  }
+  if (writer->rotate_keep == 0)
+    unlink (writer->path);
+  atomic_fetch_add_explicit (&writer->rotations, 1, memory_order_relaxed);
+  writer_open (writer);
+}
+
+static void
+writer_write (ResultWriter * writer, const ResultRecord * records, guint count)
+{
+  gchar *end = writer->out;
+  gsize left;
+  const gchar *p = writer->out;
+
+  for (guint i = 0; i < count; i++)
+    end = format_record (writer, &records[i], end);
+
+  left = end - writer->out;
+  while (left > 0 && writer->fd >= 0) {
+    ssize_t n = write (writer->fd, p, left);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0) {
+      g_printerr ("Result write failed: %s\n", g_strerror (errno));
+      atomic_fetch_add_explicit (&writer->dropped, count, memory_order_relaxed);
+      return;
+    }
+    p += n;
+    left -= n;
+  }
+  if (writer->fd < 0) {
+    atomic_fetch_add_explicit (&writer->dropped, count, memory_order_relaxed);
+    return;
+  }
+
+  writer->file_bytes += end - writer->out;
+  atomic_fetch_add_explicit (&writer->written, count, memory_order_relaxed);
+  if (writer->fsync == RESULT_FSYNC_BATCH)
+    fdatasync (writer->fd);
+  if (writer->path && writer->rotate_bytes &&
+      writer->file_bytes >= writer->rotate_bytes)
+    writer_rotate (writer);
+}
+
+static gboolean
+writer_empty (ResultWriter * writer)
+{
+  return atomic_load (&writer->head) == atomic_load (&writer->tail);
+}
+
+static gpointer
+writer_thread (gpointer data)
+{
+  ResultWriter *writer = (ResultWriter *) data;
+
+  for (;;) {
+    guint64 flush;
+    gboolean stop;
+    guint count, first;
+
+    g_mutex_lock (&writer->lock);
+    flush = writer->flush_requested;
+    stop = writer->stop;
+    g_mutex_unlock (&writer->lock);
+
+    while ((count = writer_take (writer, &first)) > 0) {
+      writer_write (writer, writer->batch + first, count);
+      if (writer->store)
+        plate_store_append (writer->store, writer->batch + first, count);
+      if (atomic_load (&writer->producer_waiting))
+        writer_wake (writer);
+    }
+
+    g_mutex_lock (&writer->lock);
+    if (writer->flush_done != flush) {
+      writer->flush_done = flush;
+      g_cond_broadcast (&writer->cond);
+    }
+    if (stop && writer_empty (writer)) {
+      g_mutex_unlock (&writer->lock);
+      break;
+    }
+    if (!writer->stop && writer->flush_requested == flush
+        && writer_empty (writer)) {
+      atomic_store (&writer->writer_sleeping, TRUE);
+      g_cond_wait_until (&writer->cond, &writer->lock,
+          g_get_monotonic_time () + RESULT_WRITE_INTERVAL_US);
+      atomic_store (&writer->writer_sleeping, FALSE);
+    }
+    g_mutex_unlock (&writer->lock);
+  }
+  return NULL;
+}
+
+ResultWriter *
+result_writer_new (const ResultWriterConfig * config)
+{
+  ResultWriter *writer;
+  guint size = 2;
+
+  while (size < config->queue_size && size < (1u << 24))
+    size <<= 1;
+
+  if (posix_memalign ((void **) &writer, RESULT_CACHE_LINE, sizeof (*writer)))
+    return NULL;
+  memset (writer, 0, sizeof (*writer));
+  writer->format = config->format;
+  writer->overflow = config->overflow;
+  writer->fsync = config->fsync;
+  writer->rotate_bytes = config->rotate_bytes;
+  writer->rotate_keep = config->rotate_keep;
+  writer->store = config->store;
+  writer->color_labels = config->color_labels;
+  writer->make_labels = config->make_labels;
+  writer->type_labels = config->type_labels;
+  writer->path = g_strcmp0 (config->path, "-") && config->path ?
+      g_strdup (config->path) : NULL;
+  if (!writer_open (writer)) {
+    g_free (writer->path);
+    free (writer);
+    return NULL;
+  }
+
+  writer->ring = g_new (ResultRecord, size);
+  writer->mask = size - 1;
+  writer->batch = g_new (ResultRecord, RESULT_BATCH);
+  writer->out = g_malloc (RESULT_BATCH * RESULT_LINE_MAX);
+  g_mutex_init (&writer->lock);
+  g_cond_init (&writer->cond);
+  writer->thread = g_thread_new ("result-writer", writer_thread, writer);
+  return writer;
+}
+
+void
+result_writer_get_stats (ResultWriter * writer, ResultWriterStats * stats)
+{
+  stats->written = atomic_load (&writer->written);
+  stats->dropped = atomic_load (&writer->dropped);
+  stats->depth = atomic_load (&writer->head) - atomic_load (&writer->tail);
+  stats->max_depth = atomic_load (&writer->max_depth);
+  stats->blocked = atomic_load (&writer->blocked);
+  stats->rotations = atomic_load (&writer->rotations);
+}
+
+void
+result_writer_flush (ResultWriter * writer)
+{
+  g_mutex_lock (&writer->lock);
+  guint64 flush = ++writer->flush_requested;
+  g_cond_broadcast (&writer->cond);
+  while (writer->flush_done < flush && !writer->stop)
+    g_cond_wait (&writer->cond, &writer->lock);
+  g_mutex_unlock (&writer->lock);
+}
+
+void
+result_writer_free (ResultWriter * writer)
+{
+  if (!writer)
+    return;
+
+  g_mutex_lock (&writer->lock);
+  writer->stop = TRUE;
+  g_cond_broadcast (&writer->cond);
+  g_mutex_unlock (&writer->lock);
+  g_thread_join (writer->thread);
+
+  writer_close (writer);
+  g_mutex_clear (&writer->lock);
+  g_cond_clear (&writer->cond);
+  g_free (writer->ring);
+  g_free (writer->batch);
+  g_free (writer->out);
+  g_free (writer->path);
+  free (writer);
+}
@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* Asynchronous result output.
+ *
+ * The sgie4 probe fills fixed-size ResultRecords and pushes them into a
+ * lock-free single producer / single consumer ring. A writer thread drains
+ * the ring in batches, formats them as CSV or JSON lines and writes every
+ * batch with one write(), rotating and fsyncing the file as configured. A
+ * slow reader of the output therefore never stalls the streaming thread,
+ * unless the overflow policy asks for that. The same batches can also be
+ * appended to a plate store (plate_store.h).
+ */
+
+#ifndef __RESULT_WRITER_H__
+#define __RESULT_WRITER_H__
+
+#include <glib.h>
+
+#define RESULT_PLATE_LEN 64
+#define RESULT_LABEL_LEN 32
+
+typedef struct _ResultRecord
+{
+  guint64 pts;                  /* Buffer PTS in ns, GST_CLOCK_TIME_NONE if unset */
+  gint64 track_id;              /* Vehicle object_id */
+  guint source_id;
+  gfloat lpr_confidence;        /* Plate detector score */
+  gfloat ocr_confidence;        /* Probability of the LPR reading, or of the
+                                 * consensus vote */
+  gint color_class;             /* Classifier result_class_id, -1 if none,
+                                 * labelled by the writer thread */
+  gint make_class;
+  gint type_class;
+  gfloat color_prob;
+  gfloat make_prob;
+  gfloat type_prob;
+  gchar plate[RESULT_PLATE_LEN];  /* NUL terminated, empty if no plate */
+} ResultRecord;
+
+/* Labels of the classes of one classifier, in class order */
+typedef struct _ResultClassLabels
+{
+  gchar (*names)[RESULT_LABEL_LEN];
+  guint count;
+} ResultClassLabels;
+
+typedef enum
+{
+  RESULT_FORMAT_CSV,
+  RESULT_FORMAT_JSONL
+} ResultFormat;
+
+typedef enum
+{
+  RESULT_OVERFLOW_BLOCK,        /* The producer waits for the writer */
+  RESULT_OVERFLOW_DROP_OLDEST   /* The oldest queued record is dropped */
+} ResultOverflow;
+
+typedef enum
+{
+  RESULT_FSYNC_NONE,
+  RESULT_FSYNC_ROTATE,          /* On rotation and close */
+  RESULT_FSYNC_BATCH            /* After every batch */
+} ResultFsync;
+
+typedef struct _ResultWriterConfig
+{
+  const gchar *path;            /* "-" for stdout */
+  ResultFormat format;
+  guint queue_size;             /* Rounded up to a power of two */
+  ResultOverflow overflow;
+  ResultFsync fsync;
+  guint64 rotate_bytes;         /* 0 = never rotate */
+  guint rotate_keep;            /* path.1 .. path.<keep> are kept */
+  struct _PlateStore *store;    /* Also appended to by the writer thread,
+                                 * NULL = none */
+  ResultClassLabels color_labels; /* A class without a label is "" */
+  ResultClassLabels make_labels;
+  ResultClassLabels type_labels;
+} ResultWriterConfig;
+
+typedef struct _ResultWriterStats
+{
+  guint64 written;
+  guint64 dropped;
+  guint depth;                  /* Records queued now */
+  guint max_depth;
+  guint64 blocked;              /* Pushes that had to wait, block policy */
+  guint rotations;
+} ResultWriterStats;
+
+typedef struct _ResultWriter ResultWriter;
+
+gboolean result_format_from_string (const gchar * name, ResultFormat * format);
+gboolean result_overflow_from_string (const gchar * name,
+    ResultOverflow * overflow);
+gboolean result_fsync_from_string (const gchar * name, ResultFsync * fsync);
+
+/* Open the output and start the writer thread, NULL if the file can not be
+ * opened */
+ResultWriter *result_writer_new (const ResultWriterConfig * config);
+
+/* Queue one record. Only one thread may push at a time. Never allocates. */
+void result_writer_push (ResultWriter * writer, const ResultRecord * record);
+
+void result_writer_get_stats (ResultWriter * writer, ResultWriterStats * stats);
+
+/* Write everything queued so far and wait until it is written */
+void result_writer_flush (ResultWriter * writer);
+
+/* Drain the queue, stop the thread and close the output */
+void result_writer_free (ResultWriter * writer);
+
+#endif
@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include "runtime_config.h"
+
+static RuntimeConfig *current;
+
+/* Replaced snapshots, freed at exit. Only touched by the publishing thread. */
+static GSList *retired;
+static GMutex publish_lock;
+
+gboolean
+runtime_config_parse (RuntimeConfig * config, const gchar * name,
+    const gchar * value)
+{
+  if (!strcmp (name, "open_everyobject_output"))
+    config->open_everyobject_output = atoi (value);
+  else if (!strcmp (name, "open_everycar_classification"))
+    config->open_everycar_classification = atoi (value);
+  else if (!strcmp (name, "lpr_word_limit"))
+    config->lpr_word_limit = atoi (value);
+  else if (!strcmp (name, "lpr_word_count"))
+    config->lpr_word_count = atoi (value);
+  else if (!strcmp (name, "lpr_gate_min_readings"))
+    config->lpr_gate_min_readings = atoi (value);
+  else if (!strcmp (name, "lpr_gate_strong_confidence"))
+    config->lpr_gate_strong_confidence = atof (value);
+  else if (!strcmp (name, "lpr_gate_min_score"))
+    config->lpr_gate.min_score = atof (value);
+  else if (!strcmp (name, "lpr_gate_better_margin"))
+    config->lpr_gate.better_margin = atof (value);
+  else if (!strcmp (name, "lpr_gate_ideal_width"))
+    config->lpr_gate.ideal_width = atof (value);
+  else if (!strcmp (name, "lpr_gate_aspect_min"))
+    config->lpr_gate.aspect_min = atof (value);
+  else if (!strcmp (name, "lpr_gate_aspect_max"))
+    config->lpr_gate.aspect_max = atof (value);
+  else if (!strcmp (name, "lpr_gate_sharpness_ref"))
+    config->lpr_gate.sharpness_ref = atof (value);
+  else
+    return FALSE;
+  return TRUE;
+}
+
+void
+runtime_config_publish (const RuntimeConfig * config)
+{
+  RuntimeConfig *snapshot = g_new (RuntimeConfig, 1);
+
+  *snapshot = *config;
+
+  g_mutex_lock (&publish_lock);
+  if (current)
+    retired = g_slist_prepend (retired, current);
+  g_atomic_pointer_set (&current, snapshot);
+  g_mutex_unlock (&publish_lock);
+}
+
+const RuntimeConfig *
+runtime_config_get (void)
+{
+  return (const RuntimeConfig *) g_atomic_pointer_get (&current);
+}
+
+void
+runtime_config_free_all (void)
+{
+  g_mutex_lock (&publish_lock);
+  g_slist_free_full (retired, g_free);
+  retired = NULL;
+  g_free (current);
+  current = NULL;
+  g_mutex_unlock (&publish_lock);
+}
+
+struct _ConfigWatch
+{
+  gchar *dir;
+  gchar *name;
+  ConfigWatchCallback changed;
+  gpointer user_data;
+  gint fd;
+  gint stop_pipe[2];
+  GThread *thread;
+};
+
+static gpointer
+config_watch_thread (gpointer data)
+{
+  ConfigWatch *watch = (ConfigWatch *) data;
+  gchar events[4096] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+  struct pollfd fds[2] = {
+    {.fd = watch->fd,.events = POLLIN},
+    {.fd = watch->stop_pipe[0],.events = POLLIN},
+  };
+
+  for (;;) {
+    if (poll (fds, 2, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    if (fds[1].revents)
+      break;
+
+    ssize_t size = read (watch->fd, events, sizeof (events));
+    gboolean changed = FALSE;
+    if (size <= 0)
+      continue;
+    for (gchar *p = events; p < events + size;) {
+      struct inotify_event *event = (struct inotify_event *) p;
+      /* Editors write in place or replace the file by a rename */
+      if (event->len && !strcmp (event->name, watch->name))
+        changed = TRUE;
+      p += sizeof (struct inotify_event) + event->len;
+    }
+    if (changed)
+      watch->changed (watch->user_data);
+  }
+  return NULL;
+}
+
+ConfigWatch *
+config_watch_new (const gchar * path, ConfigWatchCallback changed,
+    gpointer user_data)
+{
+  ConfigWatch *watch = g_new0 (ConfigWatch, 1);
+
+  watch->dir = g_path_get_dirname (path);
+  watch->name = g_path_get_basename (path);
+  watch->changed = changed;
+  watch->user_data = user_data;
+  watch->stop_pipe[0] = watch->stop_pipe[1] = -1;
+
+  /* The directory is watched, as a rename replaces the watched inode */
+  watch->fd = inotify_init1 (IN_CLOEXEC);
+  if (watch->fd < 0 ||
+      inotify_add_watch (watch->fd, watch->dir,
+          IN_CLOSE_WRITE | IN_MOVED_TO) < 0 || pipe (watch->stop_pipe) < 0) {
+    g_printerr ("Cannot watch %s: %s\n", path, g_strerror (errno));
+    config_watch_free (watch);
+    return NULL;
+  }
+  watch->thread = g_thread_new ("config-watch", config_watch_thread, watch);
+  return watch;
+}
+
+void
+config_watch_free (ConfigWatch * watch)
+{
+  if (!watch)
+    return;
+  if (watch->thread) {
+    if (write (watch->stop_pipe[1], "", 1) < 0)
+      g_printerr ("Cannot stop the config watch\n");
+    g_thread_join (watch->thread);
+  }
+  if (watch->fd >= 0)
+    close (watch->fd);
+  if (watch->stop_pipe[0] >= 0) {
+    close (watch->stop_pipe[0]);
+    close (watch->stop_pipe[1]);
+  }
+  g_free (watch->dir);
+  g_free (watch->name);
+  g_free (watch);
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* Settings that can change while the pipeline runs.
+ *
+ * The live settings are kept in an immutable snapshot. A reload parses the
+ * config file into a new snapshot and publishes it with one atomic pointer
+ * store, RCU style: probes load the pointer once per batch and read it
+ * without locks. Reloads are rare and a snapshot is small, so replaced
+ * snapshots are only freed at exit, which makes every read safe without a
+ * grace period.
+ *
+ * A ConfigWatch thread watches the config file with inotify and calls back
+ * after every write or replace of the file.
+ */
+
+#ifndef __RUNTIME_CONFIG_H__
+#define __RUNTIME_CONFIG_H__
+
+#include <glib.h>
+#include "lpr_gate.h"
+
+typedef struct _RuntimeConfig
+{
+  guint version;                /* 0 at startup, +1 per reload */
+  gint open_everyobject_output;
+  gint open_everycar_classification;
+  gint lpr_word_limit;
+  gint lpr_word_count;
+  gint lpr_gate_min_readings;
+  gfloat lpr_gate_strong_confidence;
+  LprGateConfig lpr_gate;
+} RuntimeConfig;
+
+/* Set name = value in config. FALSE when name is not a live setting. */
+gboolean runtime_config_parse (RuntimeConfig * config, const gchar * name,
+    const gchar * value);
+
+/* Publish a copy of config as the current snapshot */
+void runtime_config_publish (const RuntimeConfig * config);
+
+/* The current snapshot, valid until runtime_config_free_all */
+const RuntimeConfig *runtime_config_get (void);
+
+/* Free every snapshot, once no probe runs anymore */
+void runtime_config_free_all (void);
+
+typedef void (*ConfigWatchCallback) (gpointer user_data);
+
+typedef struct _ConfigWatch ConfigWatch;
+
+/* Watch path, NULL when inotify is not available */
+ConfigWatch *config_watch_new (const gchar * path, ConfigWatchCallback changed,
+    gpointer user_data);
+
+void config_watch_free (ConfigWatch * watch);
+
+#endif
@@ -0,0 +1,350 @@
+/*
+ * Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include "stage_trace.h"
+
+/* 2^HIST_SUB_BITS buckets per power of two, values up to 2^32 us */
+#define HIST_SUB_BITS 5
+#define HIST_MAX_BITS 32
+#define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+
+/* Buffers in flight inside one element */
+#define STAGE_IN_FLIGHT 32
+
+typedef struct _StageHistogram
+{
+  guint64 counts[HIST_BUCKETS];
+  guint64 count;
+  guint64 sum;
+  guint64 max;
+} StageHistogram;
+
+/* One entry per PTS: the sources of a batch all stamp n / fps from 0, so
+ * their frames reach streammux with the same PTS and count from the first */
+typedef struct _StageEntry
+{
+  GstClockTime pts;             /* NONE = free */
+  gint64 time;
+} StageEntry;
+
+typedef struct _Stage
+{
+  StageTrace *trace;
+  gchar *name;
+  guint index;
+
+  GMutex lock;
+  StageEntry in_flight[STAGE_IN_FLIGHT];
+  guint next;
+  StageHistogram total;
+  StageHistogram interval;
+} Stage;
+
+struct _StageTrace
+{
+  GPtrArray *stages;
+  gint64 start;
+  gint64 interval_start;
+
+  GMutex chrome_lock;
+  FILE *chrome;
+  gboolean chrome_first;
+};
+
+static guint
+hist_index (guint64 value)
+{
+  guint msb, shift;
+
+  if (value < (1 << HIST_SUB_BITS))
+    return value;
+  value = MIN (value, (G_GUINT64_CONSTANT (1) << HIST_MAX_BITS) - 1);
+  msb = 63 - __builtin_clzll (value);
+  shift = msb - HIST_SUB_BITS;
+  return ((shift + 1) << HIST_SUB_BITS) +
+      (guint) (value >> shift) - (1 << HIST_SUB_BITS);
+}
+
+/* Highest value counted in bucket index */
+static guint64
+hist_value (guint index)
+{
+  guint shift;
+  guint64 mantissa;
+
+  if (index < (1 << HIST_SUB_BITS))
+    return index;
+  shift = (index >> HIST_SUB_BITS) - 1;
+  mantissa = (index & ((1 << HIST_SUB_BITS) - 1)) + (1 << HIST_SUB_BITS);
+  return (mantissa << shift) + (G_GUINT64_CONSTANT (1) << shift) - 1;
+}
+
+static void
+hist_add (StageHistogram * hist, guint64 value)
+{
+  hist->counts[hist_index (value)]++;
+  hist->count++;
+  hist->sum += value;
+  hist->max = MAX (hist->max, value);
+}
+
+static guint64
+hist_percentile (const StageHistogram * hist, gdouble percentile)
+{
+  guint64 rank = (guint64) (hist->count * percentile / 100.0 + 0.5);
+  guint64 seen = 0;
+
+  rank = CLAMP (rank, 1, hist->count);
+  for (guint i = 0; i < HIST_BUCKETS; i++) {
+    seen += hist->counts[i];
+    if (seen >= rank)
+      return MIN (hist_value (i), hist->max);
+  }
+  return hist->max;
+}
+
+static void
+chrome_event (StageTrace * trace, const Stage * stage, GstClockTime pts,
+    gint64 start_us, gint64 end_us)
+{
+  g_mutex_lock (&trace->chrome_lock);
+  fprintf (trace->chrome, "%s{\"name\":\"%s\",\"cat\":\"stage\",\"ph\":\"X\","
+      "\"ts\":%ld,\"dur\":%ld,\"pid\":1,\"tid\":%u,\"args\":{\"pts\":%ld}}",
+      trace->chrome_first ? "" : ",\n", stage->name,
+      (long) (start_us - trace->start), (long) (end_us - start_us),
+      stage->index + 1, GST_CLOCK_TIME_IS_VALID (pts) ? (long) pts : -1L);
+  trace->chrome_first = FALSE;
+  g_mutex_unlock (&trace->chrome_lock);
+}
+
+StageTrace *
+stage_trace_new (const gchar * chrome_path)
+{
+  StageTrace *trace = g_new0 (StageTrace, 1);
+
+  trace->stages = g_ptr_array_new ();
+  trace->start = trace->interval_start = g_get_monotonic_time ();
+  g_mutex_init (&trace->chrome_lock);
+  if (chrome_path) {
+    trace->chrome = fopen (chrome_path, "w");
+    if (!trace->chrome) {
+      g_printerr ("stage trace: cannot write %s: %s\n", chrome_path,
+          g_strerror (errno));
+      stage_trace_free (trace);
+      return NULL;
+    }
+    fprintf (trace->chrome, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    trace->chrome_first = TRUE;
+  }
+  return trace;
+}
+
+guint
+stage_trace_add_stage (StageTrace * trace, const gchar * name)
+{
+  Stage *stage = g_new0 (Stage, 1);
+
+  stage->trace = trace;
+  stage->name = g_strdup (name);
+  stage->index = trace->stages->len;
+  g_mutex_init (&stage->lock);
+  for (guint i = 0; i < STAGE_IN_FLIGHT; i++)
+    stage->in_flight[i].pts = GST_CLOCK_TIME_NONE;
+  g_ptr_array_add (trace->stages, stage);
+
+  /* Name the track of the stage in the trace viewer */
+  if (trace->chrome) {
+    g_mutex_lock (&trace->chrome_lock);
+    fprintf (trace->chrome, "%s{\"name\":\"thread_name\",\"ph\":\"M\","
+        "\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+        trace->chrome_first ? "" : ",\n", stage->index + 1, name);
+    trace->chrome_first = FALSE;
+    g_mutex_unlock (&trace->chrome_lock);
+  }
+  return stage->index;
+}
+
+void
+stage_trace_record (StageTrace * trace, guint index, GstClockTime pts,
+    gint64 start_us, gint64 end_us)
+{
+  Stage *stage = g_ptr_array_index (trace->stages, index);
+
+  g_mutex_lock (&stage->lock);
+  hist_add (&stage->total, end_us - start_us);
+  hist_add (&stage->interval, end_us - start_us);
+  g_mutex_unlock (&stage->lock);
+  if (trace->chrome)
+    chrome_event (trace, stage, pts, start_us, end_us);
+}
+
+static GstPadProbeReturn
+stage_entry_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  Stage *stage = user_data;
+  GstClockTime pts = GST_BUFFER_PTS (GST_PAD_PROBE_INFO_BUFFER (info));
+
+  if (!GST_CLOCK_TIME_IS_VALID (pts))
+    return GST_PAD_PROBE_OK;
+  g_mutex_lock (&stage->lock);
+  for (guint i = 0; i < STAGE_IN_FLIGHT; i++) {
+    if (stage->in_flight[i].pts == pts) {
+      g_mutex_unlock (&stage->lock);
+      return GST_PAD_PROBE_OK;
+    }
+  }
+  stage->in_flight[stage->next].pts = pts;
+  stage->in_flight[stage->next].time = g_get_monotonic_time ();
+  stage->next = (stage->next + 1) % STAGE_IN_FLIGHT;
+  g_mutex_unlock (&stage->lock);
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn
+stage_exit_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  Stage *stage = user_data;
+  GstClockTime pts = GST_BUFFER_PTS (GST_PAD_PROBE_INFO_BUFFER (info));
+  gint64 now = g_get_monotonic_time ();
+  gint64 entry = -1;
+
+  if (!GST_CLOCK_TIME_IS_VALID (pts))
+    return GST_PAD_PROBE_OK;
+  /* A batch leaves with the PTS of the frame that opened it */
+  g_mutex_lock (&stage->lock);
+  for (guint i = 0; i < STAGE_IN_FLIGHT; i++) {
+    StageEntry *in = &stage->in_flight[i];
+    if (in->pts == pts) {
+      entry = in->time;
+      in->pts = GST_CLOCK_TIME_NONE;
+      break;
+    }
+  }
+  g_mutex_unlock (&stage->lock);
+
+  if (entry >= 0)
+    stage_trace_record (stage->trace, stage->index, pts, entry, now);
+  return GST_PAD_PROBE_OK;
+}
+
+static gboolean
+add_pad_probe (GstElement * element, GstPad * pad, gpointer user_data)
+{
+  Stage *stage = user_data;
+
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+      GST_PAD_DIRECTION (pad) == GST_PAD_SINK ? stage_entry_probe :
+      stage_exit_probe, stage, NULL);
+  return TRUE;
+}
+
+gboolean
+stage_trace_add_element (StageTrace * trace, GstElement * element)
+{
+  Stage *stage;
+
+  if (!element->numsinkpads || !element->numsrcpads)
+    return FALSE;
+  stage = g_ptr_array_index (trace->stages,
+      stage_trace_add_stage (trace, GST_ELEMENT_NAME (element)));
+  gst_element_foreach_sink_pad (element, add_pad_probe, stage);
+  gst_element_foreach_src_pad (element, add_pad_probe, stage);
+  return TRUE;
+}
+
+guint
+stage_trace_num_stages (StageTrace * trace)
+{
+  return trace->stages->len;
+}
+
+void
+stage_trace_get_stats (StageTrace * trace, guint index,
+    StageTraceStats * stats)
+{
+  Stage *stage = g_ptr_array_index (trace->stages, index);
+  StageHistogram *hist = &stage->total;
+
+  memset (stats, 0, sizeof (*stats));
+  stats->name = stage->name;
+  g_mutex_lock (&stage->lock);
+  if (hist->count) {
+    stats->count = hist->count;
+    stats->mean_us = hist->sum / hist->count;
+    stats->p50_us = hist_percentile (hist, 50);
+    stats->p99_us = hist_percentile (hist, 99);
+    stats->max_us = hist->max;
+  }
+  g_mutex_unlock (&stage->lock);
+}
+
+void
+stage_trace_print (StageTrace * trace, gboolean interval)
+{
+  gint64 now = g_get_monotonic_time ();
+
+  g_print ("stage latency %s %.1f s (ms): count, mean, p50, p90, p99, p99.9, "
+      "max\n", interval ? "over the last" : "over all",
+      (now - (interval ? trace->interval_start : trace->start)) / 1e6);
+  for (guint i = 0; i < trace->stages->len; i++) {
+    Stage *stage = g_ptr_array_index (trace->stages, i);
+    StageHistogram *hist = interval ? &stage->interval : &stage->total;
+
+    g_mutex_lock (&stage->lock);
+    if (hist->count)
+      g_print ("  %-30s %8lu %8.3f %8.3f %8.3f %8.3f %8.3f %8.3f\n",
+          stage->name, (unsigned long) hist->count,
+          hist->sum / 1e3 / hist->count, hist_percentile (hist, 50) / 1e3,
+          hist_percentile (hist, 90) / 1e3, hist_percentile (hist, 99) / 1e3,
+          hist_percentile (hist, 99.9) / 1e3, hist->max / 1e3);
+    else
+      g_print ("  %-30s %8d\n", stage->name, 0);
+    if (interval)
+      memset (&stage->interval, 0, sizeof (stage->interval));
+    g_mutex_unlock (&stage->lock);
+  }
+  if (interval)
+    trace->interval_start = now;
+}
+
+void
+stage_trace_free (StageTrace * trace)
+{
+  if (!trace)
+    return;
+  for (guint i = 0; i < trace->stages->len; i++) {
+    Stage *stage = g_ptr_array_index (trace->stages, i);
+    g_mutex_clear (&stage->lock);
+    g_free (stage->name);
+    g_free (stage);
+  }
+  g_ptr_array_free (trace->stages, TRUE);
+  if (trace->chrome) {
+    fprintf (trace->chrome, "\n]}\n");
+    fclose (trace->chrome);
+  }
+  g_mutex_clear (&trace->chrome_lock);
+  g_free (trace);
+}
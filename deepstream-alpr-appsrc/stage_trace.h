@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* Per-stage latency tracing.
+ *
+ * A probe on the sink pads of an element stamps the entry time of every
+ * buffer and a probe on its src pads the exit time. Entries are matched to
+ * exits by PTS, which survives elements that output a new buffer, through a
+ * small ring of buffers in flight per stage; buffers of several sources
+ * that share a PTS hold one entry, stamped by the first. Each stage keeps
+ * log-linear, HDR style histograms of its latency, one since start and one
+ * since the last report, within 3% from 1 us to over an hour. With a chrome path every
+ * span is also written as a trace event, for chrome://tracing or Perfetto.
+ *
+ * Without a StageTrace no probe is installed, so tracing costs nothing when
+ * disabled.
+ */
+
+#ifndef __STAGE_TRACE_H__
+#define __STAGE_TRACE_H__
+
+#include <gst/gst.h>
+
+typedef struct _StageTrace StageTrace;
+
+/* NULL when chrome_path is set and cannot be written */
+StageTrace *stage_trace_new (const gchar * chrome_path);
+
+/* Trace element as a stage named after it, FALSE when it has no sink or no
+ * src pad. Request pads must exist already. */
+gboolean stage_trace_add_element (StageTrace * trace, GstElement * element);
+
+/* A stage timed by the caller, such as a probe, returns its index */
+guint stage_trace_add_stage (StageTrace * trace, const gchar * name);
+void stage_trace_record (StageTrace * trace, guint stage, GstClockTime pts,
+    gint64 start_us, gint64 end_us);
+
+typedef struct _StageTraceStats
+{
+  const gchar *name;
+  guint64 count;
+  guint64 mean_us;
+  guint64 p50_us;
+  guint64 p99_us;
+  guint64 max_us;
+} StageTraceStats;
+
+/* Stages in the order they were added, with their figures since start */
+guint stage_trace_num_stages (StageTrace * trace);
+void stage_trace_get_stats (StageTrace * trace, guint stage,
+    StageTraceStats * stats);
+
+/* Print the histograms of every stage, since the last report when interval
+ * is TRUE and since start otherwise */
+void stage_trace_print (StageTrace * trace, gboolean interval);
+
+/* Call once the pipeline is stopped, the probes are not removed. Completes
+ * the chrome trace file. */
+void stage_trace_free (StageTrace * trace);
+
+#endif
@@ -0,0 +1,417 @@
+/*
+ * Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <string.h>
+#include "track_consensus.h"
+
+typedef struct _PlateReading
+{
+  gchar label[RESULT_PLATE_LEN];
+  guint length;                             /* Characters */
+  guint8 offsets[CONSENSUS_MAX_LEN + 1];    /* Character i is label[offsets[i], offsets[i + 1]) */
+  gfloat confs[CONSENSUS_MAX_LEN];
+  gfloat confidence;
+} PlateReading;
+
+typedef struct _Track Track;
+struct _Track
+{
+  gint64 key;                   /* object_id */
+  ResultRecord record;          /* First PTS, the best detector score and the
+                                 * most probable attributes */
+  PlateReading readings[CONSENSUS_MAX_READINGS];
+  guint num_readings;
+  guint64 first_tick;
+  guint64 deadline;             /* Tick at which the track ends */
+  gboolean emitted;
+  Track *prev;                  /* Timing wheel slot list */
+  Track *next;
+};
+
+struct _TrackConsensus
+{
+  TrackConsensusConfig config;
+  TrackConsensusEmit emit;
+  gpointer user_data;
+  GMutex lock;
+
+  GHashTable *tracks;           /* &key -> Track */
+  Track *free_tracks;
+
+  /* Slot deadline & mask holds the tracks that end at that tick. The wheel
+   * is larger than the timeout, so a slot never holds a later lap. */
+  Track **wheel;
+  guint64 mask;
+  guint64 tick;
+
+  guint64 observed;
+  guint64 emitted;
+};
+
+static void
+wheel_unlink (TrackConsensus * consensus, Track * track)
+{
+  if (track->prev)
+    track->prev->next = track->next;
+  else
+    consensus->wheel[track->deadline & consensus->mask] = track->next;
+  if (track->next)
+    track->next->prev = track->prev;
+  track->prev = track->next = NULL;
+}
+
+static void
+wheel_link (TrackConsensus * consensus, Track * track, guint64 deadline)
+{
+  Track **slot = &consensus->wheel[deadline & consensus->mask];
+
+  track->deadline = deadline;
+  track->prev = NULL;
+  track->next = *slot;
+  if (*slot)
+    (*slot)->prev = track;
+  *slot = track;
+}
+
+/* Split record->plate into characters, NULL chars weights them all with the
+ * OCR confidence of the plate */
+static gboolean
+reading_init (PlateReading * reading, const ResultRecord * record,
+    const LprCharMeta * chars)
+{
+  gsize size = strlen (record->plate);
+  const gchar *glyph = record->plate;
+  guint length = 0;
+
+  /* Count first, a reading that is not kept leaves the slot untouched */
+  if (size == 0 || g_utf8_strlen (record->plate, size) > CONSENSUS_MAX_LEN)
+    return FALSE;
+
+  memcpy (reading->label, record->plate, size + 1);
+  reading->confidence = record->ocr_confidence;
+
+  while (*glyph) {
+    reading->offsets[length] = glyph - record->plate;
+    reading->confs[length] = record->ocr_confidence;
+    length++;
+    glyph = g_utf8_next_char (glyph);
+  }
+  reading->offsets[length] = size;
+  reading->length = length;
+
+  /* Per-character confidences only when they describe the same characters */
+  if (chars && chars->length == length) {
+    guint i;
+    for (i = 0; i < length && chars->offsets[i] == reading->offsets[i]; i++)
+      reading->confs[i] = chars->confs[i];
+    if (i < length) {
+      for (i = 0; i < length; i++)
+        reading->confs[i] = record->ocr_confidence;
+    }
+  }
+  return TRUE;
+}
+
+static gboolean
+glyph_equal (const PlateReading * a, const PlateReading * b, guint pos)
+{
+  guint size = a->offsets[pos + 1] - a->offsets[pos];
+
+  return size == (guint) (b->offsets[pos + 1] - b->offsets[pos]) &&
+      !memcmp (a->label + a->offsets[pos], b->label + b->offsets[pos], size);
+}
+
+/* Vote the plate of track into record. The confidence is the mean confidence
+ * of the readings of the voted length times the weakest per-position share
+ * of the winning character. */
+static void
+track_vote (const Track * track, ResultRecord * record)
+{
+  gfloat length_weights[CONSENSUS_MAX_LEN + 1] = { 0 };
+  guint length = 0;
+  gfloat agreement = 1.0f;
+  gfloat conf_sum = 0.0f;
+  guint voters = 0;
+  gchar *out = record->plate;
+
+  record->plate[0] = '\0';
+  record->ocr_confidence = 0;
+  if (track->num_readings == 0)
+    return;
+
+  for (guint r = 0; r < track->num_readings; r++)
+    length_weights[track->readings[r].length] +=
+        MAX (track->readings[r].confidence, 1e-6f);
+  for (guint l = 1; l <= CONSENSUS_MAX_LEN; l++) {
+    if (length_weights[l] > length_weights[length])
+      length = l;
+  }
+
+  for (guint r = 0; r < track->num_readings; r++) {
+    if (track->readings[r].length == length) {
+      conf_sum += track->readings[r].confidence;
+      voters++;
+    }
+  }
+
+  for (guint pos = 0; pos < length; pos++) {
+    const PlateReading *candidates[CONSENSUS_MAX_READINGS];
+    gfloat weights[CONSENSUS_MAX_READINGS];
+    guint num_candidates = 0;
+    guint winner = 0;
+    gfloat total = 0.0f;
+
+    for (guint r = 0; r < track->num_readings; r++) {
+      const PlateReading *reading = &track->readings[r];
+      gfloat weight = MAX (reading->confs[pos], 1e-6f);
+      guint c;
+
+      if (reading->length != length)
+        continue;
+      for (c = 0; c < num_candidates; c++) {
+        if (glyph_equal (candidates[c], reading, pos))
+          break;
+      }
+      if (c == num_candidates) {
+        candidates[c] = reading;
+        weights[c] = 0.0f;
+        num_candidates++;
+      }
+      weights[c] += weight;
+      total += weight;
+    }
+
+    for (guint c = 1; c < num_candidates; c++) {
+      if (weights[c] > weights[winner])
+        winner = c;
+    }
+    agreement = MIN (agreement, weights[winner] / total);
+
+    guint size = candidates[winner]->offsets[pos + 1] -
+        candidates[winner]->offsets[pos];
+    memcpy (out, candidates[winner]->label + candidates[winner]->offsets[pos],
+        size);
+    out += size;
+  }
+  *out = '\0';
+  record->ocr_confidence = conf_sum / voters * agreement;
+}
+
+static void
+track_emit (TrackConsensus * consensus, Track * track)
+{
+  ResultRecord record = track->record;
+
+  track_vote (track, &record);
+  track->emitted = TRUE;
+  consensus->emitted++;
+  consensus->emit (&record, consensus->user_data);
+}
+
+static void
+track_remove (TrackConsensus * consensus, Track * track)
+{
+  wheel_unlink (consensus, track);
+  g_hash_table_remove (consensus->tracks, &track->key);
+  track->next = consensus->free_tracks;
+  consensus->free_tracks = track;
+}
+
+static void
+merge_attribute (gint * cls, gfloat * prob, gint new_cls, gfloat new_prob)
+{
+  if (new_cls < 0 || (*cls >= 0 && new_prob <= *prob))
+    return;
+  *cls = new_cls;
+  *prob = new_prob;
+}
+
+void
+track_consensus_observe (TrackConsensus * consensus,
+    const ResultRecord * record, const LprCharMeta * chars)
+{
+  Track *track;
+  ResultRecord *best;
+
+  g_mutex_lock (&consensus->lock);
+  consensus->observed++;
+
+  track = g_hash_table_lookup (consensus->tracks, &record->track_id);
+  if (track) {
+    wheel_unlink (consensus, track);
+  } else {
+    track = consensus->free_tracks;
+    if (track)
+      consensus->free_tracks = track->next;
+    else
+      track = g_new (Track, 1);
+    track->key = record->track_id;
+    track->record = *record;
+    track->record.color_class = track->record.make_class =
+        track->record.type_class = -1;
+    track->record.color_prob = track->record.make_prob =
+        track->record.type_prob = 0.0f;
+    track->record.lpr_confidence = 0.0f;
+    track->num_readings = 0;
+    track->first_tick = consensus->tick;
+    track->emitted = FALSE;
+    g_hash_table_insert (consensus->tracks, &track->key, track);
+  }
+  wheel_link (consensus, track, consensus->tick + consensus->config.timeout);
+
+  best = &track->record;
+  merge_attribute (&best->color_class, &best->color_prob,
+      record->color_class, record->color_prob);
+  merge_attribute (&best->make_class, &best->make_prob,
+      record->make_class, record->make_prob);
+  merge_attribute (&best->type_class, &best->type_prob,
+      record->type_class, record->type_prob);
+
+  if (record->plate[0] != '\0') {
+    PlateReading *slot = &track->readings[track->num_readings];
+
+    best->lpr_confidence = MAX (best->lpr_confidence, record->lpr_confidence);
+
+    /* When full, the new reading replaces the least confident one */
+    if (track->num_readings == CONSENSUS_MAX_READINGS) {
+      slot = &track->readings[0];
+      for (guint r = 1; r < CONSENSUS_MAX_READINGS; r++) {
+        if (track->readings[r].confidence < slot->confidence)
+          slot = &track->readings[r];
+      }
+      if (record->ocr_confidence <= slot->confidence)
+        slot = NULL;
+    }
+    if (slot && reading_init (slot, record, chars) &&
+        track->num_readings < CONSENSUS_MAX_READINGS)
+      track->num_readings++;
+  }
+
+  if (consensus->config.dwell && !track->emitted &&
+      consensus->tick - track->first_tick >= consensus->config.dwell)
+    track_emit (consensus, track);
+  g_mutex_unlock (&consensus->lock);
+}
+
+void
+track_consensus_tick (TrackConsensus * consensus)
+{
+  Track *track;
+
+  g_mutex_lock (&consensus->lock);
+  consensus->tick++;
+  while ((track = consensus->wheel[consensus->tick & consensus->mask])) {
+    if (!track->emitted)
+      track_emit (consensus, track);
+    track_remove (consensus, track);
+  }
+  g_mutex_unlock (&consensus->lock);
+}
+
+void
+track_consensus_flush (TrackConsensus * consensus)
+{
+  g_mutex_lock (&consensus->lock);
+  for (guint64 slot = 0; slot <= consensus->mask; slot++) {
+    Track *track;
+    while ((track = consensus->wheel[slot])) {
+      if (!track->emitted)
+        track_emit (consensus, track);
+      track_remove (consensus, track);
+    }
+  }
+  g_mutex_unlock (&consensus->lock);
+}
+
+gboolean
+track_consensus_query (TrackConsensus * consensus, gint64 track_id,
+    guint * readings, gfloat * confidence)
+{
+  Track *track;
+  ResultRecord vote;
+
+  g_mutex_lock (&consensus->lock);
+  track = g_hash_table_lookup (consensus->tracks, &track_id);
+  if (track) {
+    track_vote (track, &vote);
+    *readings = track->num_readings;
+    *confidence = vote.ocr_confidence;
+  }
+  g_mutex_unlock (&consensus->lock);
+  return track != NULL;
+}
+
+TrackConsensus *
+track_consensus_new (const TrackConsensusConfig * config,
+    TrackConsensusEmit emit, gpointer user_data)
+{
+  TrackConsensus *consensus = g_new0 (TrackConsensus, 1);
+  guint64 size = 2;
+
+  consensus->config = *config;
+  consensus->config.timeout = MAX (config->timeout, 1);
+  while (size <= consensus->config.timeout)
+    size <<= 1;
+
+  consensus->emit = emit;
+  consensus->user_data = user_data;
+  g_mutex_init (&consensus->lock);
+  consensus->tracks = g_hash_table_new (g_int64_hash, g_int64_equal);
+  consensus->wheel = g_new0 (Track *, size);
+  consensus->mask = size - 1;
+  return consensus;
+}
+
+void
+track_consensus_get_stats (TrackConsensus * consensus, guint64 * observed,
+    guint64 * emitted, guint * active)
+{
+  g_mutex_lock (&consensus->lock);
+  *observed = consensus->observed;
+  *emitted = consensus->emitted;
+  *active = g_hash_table_size (consensus->tracks);
+  g_mutex_unlock (&consensus->lock);
+}
+
+void
+track_consensus_free (TrackConsensus * consensus)
+{
+  if (!consensus)
+    return;
+
+  for (guint64 slot = 0; slot <= consensus->mask; slot++) {
+    while (consensus->wheel[slot]) {
+      Track *track = consensus->wheel[slot];
+      consensus->wheel[slot] = track->next;
+      g_free (track);
+    }
+  }
+  while (consensus->free_tracks) {
+    Track *track = consensus->free_tracks;
+    consensus->free_tracks = track->next;
+    g_free (track);
+  }
+  g_hash_table_destroy (consensus->tracks);
+  g_free (consensus->wheel);
+  g_mutex_clear (&consensus->lock);
+  g_free (consensus);
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* Per-track plate consensus.
+ *
+ * Readings of a vehicle are collected in a track keyed by its tracker
+ * object_id. When the track ends (no reading for timeout batches) or has
+ * been seen for dwell batches, one record is emitted: the plate length is
+ * voted by the OCR confidence of the readings, then every character position
+ * is voted by the confidence of that character, and the vehicle attributes
+ * are the most probable ones seen. Track expiry runs on a timing wheel, so a batch costs
+ * O(1) plus the tracks that end in it.
+ */
+
+#ifndef __TRACK_CONSENSUS_H__
+#define __TRACK_CONSENSUS_H__
+
+#include <glib.h>
+#include "result_writer.h"
+#include "nvinfer_custom_lpr_parser/lpr_char_meta.h"
+
+/* Readings kept per track, the least confident one is replaced when full */
+#define CONSENSUS_MAX_READINGS 16
+
+/* Characters voted per plate: every plate that fits a ResultRecord */
+#define CONSENSUS_MAX_LEN (RESULT_PLATE_LEN - 1)
+
+typedef struct _TrackConsensusConfig
+{
+  guint timeout;                /* Batches without a reading that end a track */
+  guint dwell;                  /* Batches after the first reading that emit a
+                                 * still visible track, 0 = only at track end */
+} TrackConsensusConfig;
+
+/* Called with the consensus record of a track, under the consensus lock */
+typedef void (*TrackConsensusEmit) (const ResultRecord * record,
+    gpointer user_data);
+
+typedef struct _TrackConsensus TrackConsensus;
+
+TrackConsensus *track_consensus_new (const TrackConsensusConfig * config,
+    TrackConsensusEmit emit, gpointer user_data);
+
+/* Add one reading of track record->track_id. chars holds the per-character
+ * confidences of record->plate and may be NULL. */
+void track_consensus_observe (TrackConsensus * consensus,
+    const ResultRecord * record, const LprCharMeta * chars);
+
+/* Advance by one batch, emitting the tracks that ended */
+void track_consensus_tick (TrackConsensus * consensus);
+
+/* Emit every open track, e.g. at EOS */
+void track_consensus_flush (TrackConsensus * consensus);
+
+/* Plate readings of open track track_id and the OCR confidence of their
+ * current vote. FALSE when the track is not open. */
+gboolean track_consensus_query (TrackConsensus * consensus, gint64 track_id,
+    guint * readings, gfloat * confidence);
+
+/* Readings added, records emitted and tracks open */
+void track_consensus_get_stats (TrackConsensus * consensus, guint64 * observed,
+    guint64 * emitted, guint * active);
+
+void track_consensus_free (TrackConsensus * consensus);
+
+#endif
@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <string.h>
+#include "vehicle_join.h"
+
+typedef struct _JoinSlot
+{
+  guint64 object_id;
+  guint generation;             /* Slot is used in this frame when equal */
+  guint entry;
+} JoinSlot;
+
+struct _VehicleJoin
+{
+  JoinSlot *slots;
+  guint mask;
+  guint generation;
+
+  JoinedVehicle *entries;
+  guint num_entries;
+  guint max_entries;
+};
+
+static guint
+join_hash (const VehicleJoin * join, guint64 object_id)
+{
+  return (guint) ((object_id * G_GUINT64_CONSTANT (0x9e3779b97f4a7c15)) >> 32)
+      & join->mask;
+}
+
+/* Reallocate for size slots, keeping the entries of this frame */
+static void
+join_resize (VehicleJoin * join, guint size)
+{
+  g_free (join->slots);
+  join->slots = g_new0 (JoinSlot, size);
+  join->mask = size - 1;
+  join->generation = 1;
+  join->max_entries = size / 2;
+  join->entries = g_renew (JoinedVehicle, join->entries, join->max_entries);
+
+  for (guint e = 0; e < join->num_entries; e++) {
+    guint i = join_hash (join, join->entries[e].object_id);
+    while (join->slots[i].generation == join->generation)
+      i = (i + 1) & join->mask;
+    join->slots[i].object_id = join->entries[e].object_id;
+    join->slots[i].generation = join->generation;
+    join->slots[i].entry = e;
+  }
+}
+
+VehicleJoin *
+vehicle_join_new (void)
+{
+  VehicleJoin *join = g_new0 (VehicleJoin, 1);
+
+  join_resize (join, 64);
+  return join;
+}
+
+void
+vehicle_join_reset (VehicleJoin * join, guint max_objects)
+{
+  join->num_entries = 0;
+
+  /* At most half full, so probe chains stay short */
+  if (max_objects > join->max_entries) {
+    guint size = join->mask + 1;
+    while (size / 2 < max_objects)
+      size <<= 1;
+    join_resize (join, size);
+    return;
+  }
+
+  /* A new generation empties every slot, on wrap they are cleared for real */
+  if (++join->generation == 0) {
+    memset (join->slots, 0, (join->mask + 1) * sizeof (JoinSlot));
+    join->generation = 1;
+  }
+}
+
+JoinedVehicle *
+vehicle_join_get (VehicleJoin * join, guint64 object_id)
+{
+  JoinedVehicle *vehicle;
+  guint i = join_hash (join, object_id);
+
+  while (join->slots[i].generation == join->generation) {
+    if (join->slots[i].object_id == object_id)
+      return &join->entries[join->slots[i].entry];
+    i = (i + 1) & join->mask;
+  }
+
+  /* More objects than announced by vehicle_join_reset */
+  if (join->num_entries == join->max_entries) {
+    join_resize (join, (join->mask + 1) * 2);
+    i = join_hash (join, object_id);
+    while (join->slots[i].generation == join->generation)
+      i = (i + 1) & join->mask;
+  }
+
+  join->slots[i].object_id = object_id;
+  join->slots[i].generation = join->generation;
+  join->slots[i].entry = join->num_entries;
+
+  vehicle = &join->entries[join->num_entries++];
+  vehicle->object_id = object_id;
+  for (guint a = 0; a < VEHICLE_JOIN_ATTRS; a++) {
+    vehicle->attr_class[a] = -1;
+    vehicle->attr_prob[a] = 0;
+  }
+  vehicle->plate = NULL;
+  vehicle->plate_chars = NULL;
+  vehicle->plate_confidence = 0;
+  vehicle->plate_ocr_confidence = 0;
+  vehicle->plate_object = NULL;
+  vehicle->vehicle_object = NULL;
+  return vehicle;
+}
+
+guint
+vehicle_join_count (const VehicleJoin * join)
+{
+  return join->num_entries;
+}
+
+const JoinedVehicle *
+vehicle_join_nth (const VehicleJoin * join, guint i)
+{
+  return &join->entries[i];
+}
+
+void
+vehicle_join_free (VehicleJoin * join)
+{
+  if (!join)
+    return;
+  g_free (join->slots);
+  g_free (join->entries);
+  g_free (join);
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2020, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* Per-frame join of vehicle attributes and plate readings.
+ *
+ * The classifiers of a vehicle are attached to its object meta, its plate
+ * reading to a child object whose parent is the vehicle. One pass over the
+ * objects of a frame fills one entry per vehicle object_id, whatever the
+ * order of the objects, through an open-addressing table that is cleared in
+ * O(1) per frame. Attributes are kept as class indices and the plate as a
+ * pointer to the label of its classifier meta, so nothing is copied.
+ */
+
+#ifndef __VEHICLE_JOIN_H__
+#define __VEHICLE_JOIN_H__
+
+#include <glib.h>
+
+#define VEHICLE_JOIN_COLOR 0
+#define VEHICLE_JOIN_MAKE 1
+#define VEHICLE_JOIN_TYPE 2
+#define VEHICLE_JOIN_ATTRS 3
+
+typedef struct _JoinedVehicle
+{
+  guint64 object_id;
+  gint attr_class[VEHICLE_JOIN_ATTRS];  /* -1 = no label */
+  gfloat attr_prob[VEHICLE_JOIN_ATTRS];
+  const gchar *plate;           /* NULL = no plate read in this frame */
+  gconstpointer plate_chars;    /* LprCharMeta of the plate, may be NULL */
+  gfloat plate_confidence;      /* Plate detector score */
+  gfloat plate_ocr_confidence;  /* Probability of the LPR reading */
+  gconstpointer plate_object;   /* NvDsObjectMeta of the plate, may be NULL */
+  gconstpointer vehicle_object; /* NvDsObjectMeta of the vehicle */
+} JoinedVehicle;
+
+typedef struct _VehicleJoin VehicleJoin;
+
+VehicleJoin *vehicle_join_new (void);
+
+/* Start a frame of at most max_objects objects */
+void vehicle_join_reset (VehicleJoin * join, guint max_objects);
+
+/* The entry of object_id in this frame, added on first use */
+JoinedVehicle *vehicle_join_get (VehicleJoin * join, guint64 object_id);
+
+/* Entries of this frame in the order they were added */
+guint vehicle_join_count (const VehicleJoin * join);
+const JoinedVehicle *vehicle_join_nth (const VehicleJoin * join, guint i);
+
+void vehicle_join_free (VehicleJoin * join);
+
+#endif